@@ -78,6 +78,8 @@ class static_rand_generator {
       eth->ether_type = rte_cpu_to_be_16(0x0800);
 
       struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
+      ip->version_ihl = 0x45;
+      ip->fragment_offset = 0;
       ip->src_addr = 0;
       ip->dst_addr = 0;
       ip->next_proto_id = IPPROTO_TCP;
@@ -118,9 +120,11 @@ class filter_benchmark {
   typedef packet_generator<pktstore_vport, static_rand_generator> pktgen_t;
   typedef unsigned long long int timestamp_t;
   typedef aggregate::count<attribute::packet_header> packet_counter;
+  typedef group_by<attribute::ipv4_src_addr, group::count<>> src_counter;
 
   static const uint64_t CHAR_COUNT = 100000;
   static const uint64_t CAST_COUNT = 100;
+  static const uint64_t MAX_BATCH = 64;
 
   filter_benchmark(const uint64_t load_rate, const std::string& query_path)
     : query_path_(query_path) {
@@ -198,6 +202,28 @@ class filter_benchmark {
     out.close();
   }
 
+  void bench_group_by_latency(uint32_t num_threads,
+                              size_t repeat_max = CAST_COUNT) {
+    std::ofstream out("latency_group_by_" + std::to_string(num_threads)
+                      + output_suffix_);
+    for (size_t i = 0; i < casts_.size(); i++) {
+      double avg = 0.0;
+      size_t groups = 0;
+      for (size_t repeat = 0; repeat < repeat_max; repeat++) {
+        timestamp_t start = get_timestamp();
+        auto res = casts_[i].execute_group_by<src_counter>(num_threads);
+        timestamp_t end = get_timestamp();
+        avg += (end - start);
+        groups += res.size();
+      }
+      avg /= repeat_max;
+      groups /= repeat_max;
+      out << (i + 1) << "\t" << groups << "\t" << avg << "\n";
+      fprintf(stderr, "q%zu: Groups=%zu, Latency=%lf\n", (i + 1), groups, avg);
+    }
+    out.close();
+  }
+
   template<typename container_type>
   uint64_t count_container(container_type& container) {
     typedef typename container_type::iterator iterator_t;
@@ -300,6 +326,44 @@ class filter_benchmark {
     }
   }
 
+  // Throughput of batches of N casts executed with shared scans (see
+  // packet_store::execute_casts), against executing the same N casts one at
+  // a time; batches cycle through the loaded casts.
+  void bench_batch_throughput(size_t max_batch = MAX_BATCH) {
+    std::ofstream ofs("throughput_batch" + output_suffix_);
+    for (size_t n = 1; n <= max_batch; n *= 2) {
+      std::vector<cast> batch;
+      for (size_t i = 0; i < n; i++)
+        batch.push_back(casts_[i % casts_.size()]);
+
+      size_t num_pkts = 0;
+      timestamp_t start = get_timestamp();
+      for (size_t repeat = 0; repeat < CAST_COUNT; repeat++) {
+        for (size_t cnt : cast::execute_batch<packet_counter>(batch))
+          num_pkts += cnt;
+      }
+      timestamp_t end = get_timestamp();
+      double batch_secs = (double) (end - start) / (1000.0 * 1000.0);
+
+      start = get_timestamp();
+      for (size_t repeat = 0; repeat < CAST_COUNT; repeat++) {
+        for (cast& c : batch)
+          c.execute<packet_counter>();
+      }
+      end = get_timestamp();
+      double single_secs = (double) (end - start) / (1000.0 * 1000.0);
+
+      double batch_thput = (double) (n * CAST_COUNT) / batch_secs;
+      double single_thput = (double) (n * CAST_COUNT) / single_secs;
+      double pkt_thput = (double) num_pkts / batch_secs;
+      ofs << n << "\t" << batch_thput << "\t" << single_thput << "\t"
+          << pkt_thput << "\n";
+      fprintf(stderr, "N=%zu: Batch=%lf queries/s (%lf packets/s), Single=%lf queries/s\n",
+              n, batch_thput, pkt_thput, single_thput);
+    }
+    ofs.close();
+  }
+
   void bench_char_throughput(size_t batch_size, uint64_t batch_ms, uint32_t num_threads, bool measure_cpu) {
     fprintf(stderr, "Running for batch_size=%zu, batch_ms=%" PRIu64 ",num_threads=%" PRIu32 "\n",
             batch_size, batch_ms, num_threads);
@@ -443,7 +507,7 @@ class filter_benchmark {
 };
 
 const char* usage =
-  "Usage: %s [-b bench-type] [-q query-rate] [-l load-rate] [-p num-packets] [-n num-threads] [-c measure-cpu] query-path\n";
+  "Usage: %s [-b bench-type] [-q query-rate] [-l load-rate] [-p num-packets] [-n num-threads] [-c measure-cpu] [-H heap|2M|1G] query-path\n";
 
 void print_usage(char *exec) {
   fprintf(stderr, usage, exec);
@@ -470,7 +534,8 @@ int main(int argc, char** argv) {
   uint64_t batch_ms = 0;
   uint32_t num_threads = 1;
   bool measure_cpu = false;
-  while ((c = getopt(argc, argv, "b:p:s:m:l:n:c")) != -1) {
+  slog::allocator::mode alloc_mode = slog::allocator::HEAP;
+  while ((c = getopt(argc, argv, "b:p:s:m:l:n:cH:")) != -1) {
     switch (c) {
     case 'b':
       bench_type = std::string(optarg);
@@ -493,6 +558,13 @@ int main(int argc, char** argv) {
     case 'c':
       measure_cpu = true;
       break;
+    case 'H':
+      if (!slog::allocator::parse(optarg, alloc_mode)) {
+        fprintf(stderr, "Invalid page mode: %s\n", optarg);
+        print_usage(argv[0]);
+        return -1;
+      }
+      break;
     default:
       fprintf(stderr, "Could not parse command line arguments.\n");
     }
@@ -504,6 +576,7 @@ int main(int argc, char** argv) {
   }
 
   std::string query_path = std::string(argv[optind]);
+  slog::allocator::configure(alloc_mode);
   filter_benchmark ls_bench(load_rate, query_path);
   if (bench_type == "latency-cast") {
     fprintf(stderr, "Latency cast benchmark\n");
@@ -513,6 +586,10 @@ int main(int argc, char** argv) {
     fprintf(stderr, "Latency char benchmark\n");
     ls_bench.load_data(num_pkts);
     ls_bench.bench_char_latency();
+  } else if (bench_type == "latency-group-by") {
+    fprintf(stderr, "Latency group-by benchmark\n");
+    ls_bench.load_data(num_pkts);
+    ls_bench.bench_group_by_latency(num_threads);
   } else if (bench_type == "latency-trend") {
     fprintf(stderr, "Latency trend benchmark\n");
     const uint64_t packet_batch = 10000000;
@@ -534,6 +611,10 @@ int main(int argc, char** argv) {
     fprintf(stderr, "Throughput cast benchmark\n");
     ls_bench.load_data(num_pkts);
     ls_bench.bench_cast_throughput(num_threads, measure_cpu);
+  } else if (bench_type == "throughput-batch") {
+    fprintf(stderr, "Throughput batch benchmark\n");
+    ls_bench.load_data(num_pkts);
+    ls_bench.bench_batch_throughput();
   } else if (bench_type == "throughput") {
     fprintf(stderr, "Throughput benchmark\n");
     ls_bench.load_data(num_pkts);
@@ -0,0 +1,154 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "monolog.h"
+
+#define RECORD_LEN     64
+#define NUM_LOOKUPS    (1UL << 22)
+
+using namespace ::slog;
+using namespace ::std::chrono;
+
+const char* usage = "Usage: %s [-n num-entries] [-H heap|2M|1G]\n";
+
+/**
+ * Microbenchmark for the storage of monologs: compares the bucketed bases
+ * (a bucket lookup per access) against the reserved-range base (a pointer add
+ * per access) on the access patterns of entry lists (appends, scans and
+ * random reads of record ids), the offset log and the data log.
+ */
+class monolog_bench {
+ public:
+  monolog_bench(size_t num_entries)
+    : num_entries_(num_entries) {
+    std::mt19937_64 gen(0);
+    std::uniform_int_distribution<size_t> dist(0, num_entries - 1);
+    for (size_t i = 0; i < NUM_LOOKUPS; i++)
+      lookups_.push_back(dist(gen));
+  }
+
+  template<typename log_type>
+  void bench_entries(const char* name) {
+    log_type* log = new log_type;
+
+    auto t0 = steady_clock::now();
+    for (size_t i = 0; i < num_entries_; i++)
+      log->set(i, i);
+    auto t1 = steady_clock::now();
+
+    uint64_t sum = 0;
+    for (size_t i = 0; i < num_entries_; i++)
+      sum += log->get(i);
+    auto t2 = steady_clock::now();
+
+    for (size_t idx : lookups_)
+      sum += log->get(idx);
+    auto t3 = steady_clock::now();
+
+    fprintf(stderr, "%s: set=%lf ns/entry, scan=%lf ns/entry, "
+            "random get=%lf ns/entry (checksum %" PRIu64 ")\n", name,
+            per_op(t0, t1, num_entries_), per_op(t1, t2, num_entries_),
+            per_op(t2, t3, lookups_.size()), sum);
+    delete log;
+  }
+
+  template<typename log_type>
+  void bench_records(const char* name) {
+    log_type* log = new log_type;
+    uint8_t record[RECORD_LEN];
+    for (size_t i = 0; i < RECORD_LEN; i++)
+      record[i] = (uint8_t) i;
+
+    size_t num_records = num_entries_ / 4;
+    auto t0 = steady_clock::now();
+    for (size_t i = 0; i < num_records; i++) {
+      log->ensure_alloc(i * RECORD_LEN, (i + 1) * RECORD_LEN);
+      log->write_unsafe(i * RECORD_LEN, record, RECORD_LEN);
+    }
+    auto t1 = steady_clock::now();
+
+    uint64_t sum = 0;
+    for (size_t idx : lookups_) {
+      idx %= num_records;
+      log->read(idx * RECORD_LEN, record, RECORD_LEN);
+      sum += record[idx % RECORD_LEN];
+    }
+    auto t2 = steady_clock::now();
+
+    fprintf(stderr, "%s: write=%lf ns/record, random read=%lf ns/record "
+            "(checksum %" PRIu64 ")\n", name, per_op(t0, t1, num_records),
+            per_op(t1, t2, lookups_.size()), sum);
+    delete log;
+  }
+
+ private:
+  static double per_op(steady_clock::time_point start,
+                       steady_clock::time_point end, size_t ops) {
+    return (double) duration_cast<nanoseconds>(end - start).count()
+           / (double) ops;
+  }
+
+  size_t num_entries_;
+  std::vector<size_t> lookups_;
+};
+
+void print_usage(char *exec) {
+  fprintf(stderr, usage, exec);
+}
+
+int main(int argc, char** argv) {
+  int c;
+  size_t num_entries = 1UL << 24;
+  allocator::mode alloc_mode = allocator::HEAP;
+  while ((c = getopt(argc, argv, "n:H:")) != -1) {
+    switch (c) {
+    case 'n':
+      num_entries = atoll(optarg);
+      break;
+    case 'H':
+      if (!allocator::parse(optarg, alloc_mode)) {
+        fprintf(stderr, "Invalid page mode: %s\n", optarg);
+        print_usage(argv[0]);
+        return -1;
+      }
+      break;
+    default:
+      fprintf(stderr, "Could not parse command line arguments.\n");
+      print_usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (num_entries < 4 || num_entries > (1UL << 27)) {
+    fprintf(stderr, "Number of entries must be in [4, 2^27]\n");
+    return -1;
+  }
+
+  allocator::configure(alloc_mode);
+  monolog_bench bench(num_entries);
+
+  // Entry lists
+  bench.bench_entries<__monolog_base<uint64_t, 24>>("entry list (bucketed)");
+  bench.bench_entries<__monolog_reserved_base<uint64_t, (1UL << 28)>>(
+      "entry list (reserved)");
+
+  // Offset log
+  bench.bench_entries<__monolog_linear_base<uint64_t, 1024, 16777216>>(
+      "offset log (bucketed)");
+  bench.bench_entries<__monolog_reserved_base<uint64_t, (1UL << 34)>>(
+      "offset log (reserved)");
+
+  // Data log
+  bench.bench_records<__monolog_linear_base<uint8_t>>("data log (bucketed)");
+  bench.bench_records<__monolog_reserved_base<uint8_t, (1UL << 40)>>(
+      "data log (reserved)");
+
+  return 0;
+}
@@ -43,6 +43,8 @@
 #include "critical_error_handler.h"
 #include "packetstore.h"
 #include "character_builder.h"
+#include "cast_builder.h"
+#include "sharded_packet_store.h"
 #include "bench_vport.h"
 #include "dpdk_utils.h"
 #include "pkt_attrs.h"
@@ -55,7 +57,7 @@ using namespace ::slog;
 using namespace ::std::chrono;
 
 const char* usage =
-  "Usage: %s [-n num-threads] [-r rate-limit] [-c]\n";
+  "Usage: %s [-n num-threads] [-r rate-limit] [-c] [-s] [-H heap|2M|1G] [-p]\n";
 
 typedef uint64_t timestamp_t;
 
@@ -90,6 +92,8 @@ class static_rand_generator {
       eth->ether_type = rte_cpu_to_be_16(0x0800);
 
       struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
+      ip->version_ihl = 0x45;
+      ip->fragment_offset = 0;
       ip->src_addr = 0;
       ip->dst_addr = 0;
       ip->next_proto_id = IPPROTO_TCP;
@@ -129,8 +133,18 @@ class packet_loader {
  public:
   static const uint64_t kMaxPktsPerThread = 60 * 1e6;
 
-  packet_loader(bool add_filters, std::string& filters_file) {
-    store_ = new packet_store();
+  packet_loader(bool add_filters, std::string& filters_file,
+                const uint32_t num_threads, const bool sharded) {
+    store_ = NULL;
+    sharded_store_ = NULL;
+    if (sharded) {
+      std::vector<int> cores;
+      for (uint32_t i = 0; i < num_threads; i++)
+        cores.push_back(i);
+      sharded_store_ = new sharded_packet_store(cores);
+    } else {
+      store_ = new packet_store();
+    }
     if (add_filters) {
       load_filters(filters_file);
     }
@@ -147,7 +161,8 @@ class packet_loader {
     uint64_t num_pkts = PKTS_PER_THREAD;
     if (worker_rate != 0)
       num_pkts = std::min(max_worker_rate, worker_rate) * 10;
-    size_t num_filters = characters_.size();
+    size_t num_filters = sharded_store_ ? sharded_characters_.size() :
+                         characters_.size();
 
     // Generate packets
     zipf_generator gen1(1, 256);
@@ -169,7 +184,9 @@ class packet_loader {
     for (uint32_t i = 0; i < num_threads; i++) {
       workers.push_back(std::thread([i, worker_rate, num_pkts, &thputs, &done, &mempool, this] {
         pkt_attrs* buf = &pkt_data_[i * num_pkts];
-        packet_store::handle* handle = store_->get_handle();
+        packet_store::handle* handle = sharded_store_ ?
+                                       sharded_store_->get_handle(i) :
+                                       store_->get_handle();
         pktstore_vport* vport = new pktstore_vport(handle);
         static_rand_generator* gen = new static_rand_generator(mempool, buf);
         pktgen_type pktgen(vport, gen, worker_rate, num_pkts);
@@ -182,6 +199,16 @@ class packet_loader {
         double totsecs = (double) (end - start) / (1000.0 * 1000.0);
         thputs[i] = ((double) pktgen.total_sent() / totsecs);
         fprintf(stderr, "Thread #%u(%lfs): Throughput: %lf.\n", i, totsecs, thputs[i]);
+#ifdef MEASURE_INGEST_STAGES
+        const packet_store::ingest_stats& st = handle->stage_stats();
+        if (st.num_pkts > 0) {
+          double n = (double) st.num_pkts;
+          fprintf(stderr, "Thread #%u: Cycles/pkt: prefetch=%lf, parse=%lf, "
+                  "insert=%lf, total=%lf.\n", i, st.prefetch_cycles / n,
+                  st.parse_cycles / n, st.insert_cycles / n,
+                  (st.prefetch_cycles + st.parse_cycles + st.insert_cycles) / n);
+        }
+#endif
 
         delete vport;
         delete gen;
@@ -236,9 +263,42 @@ class packet_loader {
     ofs.close();
 
     fprintf(stderr, "Completed loading packets\n");
+
+    const slog::allocator::alloc_stats& astats = slog::allocator::stats();
+    fprintf(stderr, "Allocator (%s): heap=%" PRIu64 "B, huge=%" PRIu64 "B, "
+            "fallback=%" PRIu64 "B, arena=%" PRIu64 "B, reserved=%" PRIu64 "B\n",
+            slog::allocator::name(slog::allocator::current_mode()),
+            astats.heap_bytes.load(), astats.huge_bytes.load(),
+            astats.fallback_bytes.load(), astats.arena_bytes.load(),
+            astats.reserved_bytes.load());
+
+    const slog::preallocator::prealloc_stats& pstats = slog::preallocator::stats();
+    fprintf(stderr, "Preallocator (%s): requests=%" PRIu64 ", preallocated=%"
+            PRIu64 "B, inline allocations=%" PRIu64 " (%" PRIu64 "B)\n",
+            slog::preallocator::running() ? "on" : "off",
+            pstats.requests.load(), pstats.prealloc_bytes.load(),
+            pstats.stalls.load(), pstats.stall_bytes.load());
+
+    if (sharded_store_)
+      measure_merge_cost();
   }
 
  private:
+  // Query-side cost of sharding: fan-out vs. merge time for a count cast
+  void measure_merge_cost() {
+    const int num_queries = 10;
+    auto c = sharded_cast_builder(sharded_store_, "dst_port == 1").build();
+    size_t cnt = 0;
+    for (int i = 0; i < num_queries; i++)
+      cnt = c.execute<packet_store::packet_counter>();
+
+    const sharded_packet_store::query_stats& stats = sharded_store_->stats();
+    double n = (double) stats.num_queries.load();
+    fprintf(stderr, "Sharded cast over %zu shards (%zu pkts): shard cycles/query=%lf, "
+            "merge cycles/query=%lf.\n", sharded_store_->num_shards(), cnt,
+            stats.shard_cycles.load() / n, stats.merge_cycles.load() / n);
+  }
+
   void load_filters(std::string& filters_file) {
     std::vector<std::string> filters;
     fprintf(stderr, "Loading filters...\n");
@@ -250,14 +310,22 @@ class packet_loader {
 
     std::string exp;
     while (std::getline(in, exp)) {
-      auto c = character_builder(store_, exp).build();
-      characters_.push_back(c);
+      if (sharded_store_) {
+        auto c = sharded_character_builder(sharded_store_, exp).build();
+        sharded_characters_.push_back(c);
+      } else {
+        auto c = character_builder(store_, exp).build();
+        characters_.push_back(c);
+      }
     }
-    fprintf(stderr, "Loaded %zu filters.\n", characters_.size());
+    fprintf(stderr, "Loaded %zu filters.\n", sharded_store_ ?
+            sharded_characters_.size() : characters_.size());
   }
 
   packet_store *store_;
+  sharded_packet_store *sharded_store_;
   std::vector<complex_character> characters_;
+  std::vector<sharded_complex_character> sharded_characters_;
   std::vector<pkt_attrs> pkt_data_;
 };
 
@@ -284,7 +352,10 @@ int main(int argc, char** argv) {
   bool add_filters = false;
   std::string filters_file = "";
   bool measure_cpu = false;
-  while ((c = getopt(argc, argv, "n:r:f:c")) != -1) {
+  bool sharded = false;
+  bool prealloc = false;
+  slog::allocator::mode alloc_mode = slog::allocator::HEAP;
+  while ((c = getopt(argc, argv, "n:r:f:csH:p")) != -1) {
     switch (c) {
     case 'n':
       num_threads = atoi(optarg);
@@ -299,13 +370,29 @@ int main(int argc, char** argv) {
     case 'c':
       measure_cpu = true;
       break;
+    case 's':
+      sharded = true;
+      break;
+    case 'p':
+      prealloc = true;
+      break;
+    case 'H':
+      if (!slog::allocator::parse(optarg, alloc_mode)) {
+        fprintf(stderr, "Invalid page mode: %s\n", optarg);
+        print_usage(argv[0]);
+        return -1;
+      }
+      break;
     default:
       fprintf(stderr, "Could not parse command line arguments.\n");
       print_usage(argv[0]);
     }
   }
 
-  packet_loader loader(add_filters, filters_file);
+  slog::allocator::configure(alloc_mode);
+  if (prealloc)
+    slog::preallocator::start();
+  packet_loader loader(add_filters, filters_file, num_threads, sharded);
   loader.load_packets(num_threads, rate_limit, measure_cpu);
 
   return 0;
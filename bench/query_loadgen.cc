@@ -0,0 +1,335 @@
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "query_protocol.h"
+
+#define SPIN_NS        100000   // Spin instead of sleeping this close to a send
+#define START_DELAY_NS 100000000
+#define DRAIN_SECS     5        // How long to wait for responses after the last send
+
+using namespace ::netplay;
+using namespace ::std::chrono;
+
+const char* usage =
+  "Usage: %s [-h host] [-p port] [-r target-qps] [-d duration-secs]\n"
+  "          [-w warmup-secs] [-c connections] [-t ping|cast|character]\n"
+  "          [-e expression] [-a count|bytes|ids|packets] [-i char-id] [-C]\n";
+
+void print_usage(char *exec) {
+  fprintf(stderr, usage, exec);
+}
+
+/**
+ * Open-loop load generator for the query server (see query_server.h).
+ *
+ * Each connection has a sender thread that sends requests on a fixed
+ * schedule, which together add up to the target rate, and a receiver
+ * thread that reads the responses. Senders never wait for responses:
+ * requests that fall due while a sender is behind are pipelined in a single
+ * write. Latency is measured from the time a request was scheduled to be
+ * sent, rather than from when it was actually sent, so that a slow server
+ * cannot hide queueing delays by slowing down the senders (coordinated
+ * omission).
+ */
+class query_loadgen {
+ public:
+  typedef steady_clock::time_point time_point;
+
+  query_loadgen(const std::string& host, int port, uint64_t qps,
+                uint64_t duration_secs, uint64_t warmup_secs,
+                size_t num_conns, const std::string& request)
+    : host_(host), port_(port), qps_(qps), num_conns_(num_conns),
+      request_(request) {
+    num_requests_ = qps * duration_secs / num_conns;
+    interval_ns_ = num_conns * 1000000000ULL / qps;
+    warmup_ns_ = warmup_secs * 1000000000ULL;
+  }
+
+  void run() {
+    std::vector<int> fds;
+    for (size_t i = 0; i < num_conns_; i++)
+      fds.push_back(connect_server());
+
+    start_ = steady_clock::now() + nanoseconds(START_DELAY_NS);
+    latencies_.resize(num_conns_);
+    errors_.assign(num_conns_, 0);
+    lost_.assign(num_conns_, 0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_conns_; i++) {
+      threads.push_back(std::thread(&query_loadgen::send_requests, this, i, fds[i]));
+      threads.push_back(std::thread(&query_loadgen::receive_responses, this, i, fds[i]));
+    }
+    for (auto& t : threads)
+      t.join();
+    end_ = steady_clock::now();
+    for (int fd : fds)
+      close(fd);
+  }
+
+  void report() {
+    std::vector<uint64_t> all;
+    uint64_t errors = 0, lost = 0;
+    for (size_t i = 0; i < num_conns_; i++) {
+      all.insert(all.end(), latencies_[i].begin(), latencies_[i].end());
+      errors += errors_[i];
+      lost += lost_[i];
+    }
+    std::sort(all.begin(), all.end());
+
+    double secs = (double) duration_cast<nanoseconds>(end_ - start_).count() / 1e9;
+    double achieved = (double) (num_requests_ * num_conns_ - lost) / secs;
+    double p50 = percentile(all, 0.5), p99 = percentile(all, 0.99);
+    double p999 = percentile(all, 0.999);
+    double max = all.empty() ? 0.0 : (double) all.back() / 1000.0;
+    fprintf(stderr, "Target=%" PRIu64 " queries/s, Achieved=%lf queries/s, "
+            "p50=%lf us, p99=%lf us, p99.9=%lf us, max=%lf us, errors=%" PRIu64
+            ", lost=%" PRIu64 "\n", qps_, achieved, p50, p99, p999, max, errors,
+            lost);
+
+    std::ofstream out("query_latency_" + std::to_string(num_conns_) + ".txt",
+                      std::ios_base::app);
+    out << qps_ << "\t" << achieved << "\t" << p50 << "\t" << p99 << "\t"
+        << p999 << "\t" << max << "\t" << errors << "\t" << lost << "\n";
+    out.close();
+  }
+
+ private:
+  int connect_server() {
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port_);
+    if (inet_pton(AF_INET, host_.c_str(), &sa.sin_addr) != 1) {
+      fprintf(stderr, "Invalid host: %s\n", host_.c_str());
+      exit(-1);
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &sa, sizeof(sa)) != 0) {
+      fprintf(stderr, "Could not connect to %s:%d: %s\n", host_.c_str(), port_,
+              strerror(errno));
+      exit(-1);
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval tv = { DRAIN_SECS, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+  }
+
+  /* Requests of connection i are spread evenly between those of the others */
+  time_point scheduled(size_t i, uint64_t id) const {
+    return start_ + nanoseconds(id * interval_ns_ + i * interval_ns_ / num_conns_);
+  }
+
+  void send_requests(size_t i, int fd) {
+    std::string buf;
+    uint64_t id = 0;
+    while (id < num_requests_) {
+      time_point due = scheduled(i, id);
+      time_point now = steady_clock::now();
+      if (due > now + nanoseconds(SPIN_NS))
+        std::this_thread::sleep_until(due - nanoseconds(SPIN_NS));
+      while (steady_clock::now() < due);
+
+      buf.clear();
+      now = steady_clock::now();
+      do {
+        size_t pos = buf.size();
+        buf.append(request_);
+        uint32_t rid = (uint32_t) id;
+        memcpy(&buf[pos] + offsetof(query_protocol::request_header, id), &rid,
+               sizeof(rid));
+        id++;
+      } while (id < num_requests_ && scheduled(i, id) <= now);
+
+      size_t off = 0;
+      while (off < buf.size()) {
+        ssize_t n = send(fd, buf.data() + off, buf.size() - off, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0) {
+          fprintf(stderr, "Connection %zu: send failed: %s\n", i, strerror(errno));
+          shutdown(fd, SHUT_RDWR);
+          return;
+        }
+        off += n;
+      }
+    }
+  }
+
+  void receive_responses(size_t i, int fd) {
+    using namespace query_protocol;
+    std::vector<uint64_t>& lat = latencies_[i];
+    lat.reserve(num_requests_);
+    std::string buf;
+    size_t pos = 0;
+    uint64_t done = 0;
+    char tmp[65536];
+    while (done < num_requests_) {
+      ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      time_point now = steady_clock::now();
+      buf.append(tmp, n);
+
+      size_t size;
+      while ((size = frame_size<response_header>(buf.data(), buf.size(), pos)) != 0) {
+        response_header hdr;
+        memcpy(&hdr, buf.data() + pos, sizeof(hdr));
+        pos += size;
+        if (hdr.flags & RESPONSE_MORE)
+          continue;
+        done++;
+        if (hdr.status != STATUS_OK)
+          errors_[i]++;
+        uint64_t ns = duration_cast<nanoseconds>(scheduled(i, hdr.id) - start_).count();
+        if (ns >= warmup_ns_)
+          lat.push_back(duration_cast<nanoseconds>(now - scheduled(i, hdr.id)).count());
+      }
+      if (pos >= buf.size() / 2) {
+        buf.erase(0, pos);
+        pos = 0;
+      }
+    }
+    lost_[i] = num_requests_ - done;
+  }
+
+  static double percentile(const std::vector<uint64_t>& sorted, double q) {
+    if (sorted.empty())
+      return 0.0;
+    size_t idx = std::min(sorted.size() - 1, (size_t) (q * (double) sorted.size()));
+    return (double) sorted[idx] / 1000.0;
+  }
+
+  std::string host_;
+  int port_;
+  uint64_t qps_;
+  size_t num_conns_;
+  std::string request_;  // Encoded request, sent with increasing ids
+  uint64_t num_requests_;  // Per connection
+  uint64_t interval_ns_;   // Between requests of a connection
+  uint64_t warmup_ns_;
+  time_point start_;
+  time_point end_;
+  std::vector<std::vector<uint64_t>> latencies_;  // In ns, per connection
+  std::vector<uint64_t> errors_;
+  std::vector<uint64_t> lost_;
+};
+
+int main(int argc, char** argv) {
+  using namespace query_protocol;
+  int c;
+  std::string host = "127.0.0.1";
+  int port = 11001;
+  uint64_t qps = 1000;
+  uint64_t duration = 10;
+  uint64_t warmup = 1;
+  size_t num_conns = 4;
+  std::string type = "ping";
+  std::string exp = "src_port == 80";
+  std::string agg = "count";
+  uint32_t char_id = 0;
+  uint16_t flags = 0;
+  while ((c = getopt(argc, argv, "h:p:r:d:w:c:t:e:a:i:C")) != -1) {
+    switch (c) {
+    case 'h':
+      host = std::string(optarg);
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'r':
+      qps = atoll(optarg);
+      break;
+    case 'd':
+      duration = atoll(optarg);
+      break;
+    case 'w':
+      warmup = atoll(optarg);
+      break;
+    case 'c':
+      num_conns = atoi(optarg);
+      break;
+    case 't':
+      type = std::string(optarg);
+      break;
+    case 'e':
+      exp = std::string(optarg);
+      break;
+    case 'a':
+      agg = std::string(optarg);
+      break;
+    case 'i':
+      char_id = atoi(optarg);
+      break;
+    case 'C':
+      flags |= REQUEST_CACHED;
+      break;
+    default:
+      fprintf(stderr, "Could not parse command line arguments.\n");
+      print_usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (qps == 0 || num_conns == 0 || num_conns > qps || warmup >= duration) {
+    fprintf(stderr, "Need 0 < connections <= target-qps and warmup < duration\n");
+    return -1;
+  }
+
+  uint8_t aggregate;
+  if (agg == "count") {
+    aggregate = AGGREGATE_COUNT;
+  } else if (agg == "bytes") {
+    aggregate = AGGREGATE_BYTES;
+  } else if (agg == "ids") {
+    aggregate = AGGREGATE_IDS;
+  } else if (agg == "packets") {
+    aggregate = AGGREGATE_PACKETS;
+  } else {
+    fprintf(stderr, "Invalid aggregate: %s\n", agg.c_str());
+    print_usage(argv[0]);
+    return -1;
+  }
+
+  std::string request;
+  if (type == "ping") {
+    append_request(request, 0, REQUEST_PING, 0, 0, NULL, 0);
+  } else if (type == "cast") {
+    append_request(request, 0, REQUEST_CAST, aggregate, flags, exp.data(),
+                   exp.size());
+  } else if (type == "character") {
+    character_request req = { char_id, 0, UINT32_MAX };
+    append_request(request, 0, REQUEST_CHARACTER, aggregate, flags, &req,
+                   sizeof(req));
+  } else {
+    fprintf(stderr, "Invalid request type: %s\n", type.c_str());
+    print_usage(argv[0]);
+    return -1;
+  }
+
+  query_loadgen loadgen(host, port, qps, duration, warmup, num_conns, request);
+  loadgen.run();
+  loadgen.report();
+
+  return 0;
+}
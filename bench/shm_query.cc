@@ -0,0 +1,171 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "cast_builder.h"
+#include "shm_store.h"
+
+using namespace ::netplay;
+using namespace ::std::chrono;
+
+typedef aggregate::record_ids<attribute::packet_header> id_list;
+
+const char* usage =
+  "Usage: %s [-n shm-name] [-e expression] [-a count|bytes|ids|packets]\n"
+  "          [-r repetitions] [-C]\n";
+
+void print_usage(char *exec) {
+  fprintf(stderr, usage, exec);
+}
+
+/**
+ * Runs casts against a packet store shared by netplayd (--shm), from another
+ * process: the store is mapped read-only and queried in place (see
+ * shm_store.h), with no socket or copy in between. Each repetition plans and
+ * executes the cast, like the query server does per request; for packets,
+ * every matching packet is viewed in the mapped data log and read.
+ *
+ * Reports the result and the latency distribution, and appends it to
+ * shm_query_latency.txt, for comparison with qloadgen.
+ */
+class shm_query {
+ public:
+  shm_query(const std::string& name, const std::string& exp,
+            const std::string& agg, size_t reps, bool cached)
+    : reader_(name), exp_(exp), agg_(agg), reps_(reps), cached_(cached),
+      result_(0), sink_(0) {
+  }
+
+  void run() {
+    fprintf(stderr, "Attached to %s: %zu shard(s), %" PRIu64 " packets, %"
+            PRIu64 " MB mapped\n", reader_.region().name().c_str(),
+            reader_.store()->num_shards(), reader_.num_pkts(),
+            (uint64_t) reader_.region().used() >> 20);
+    for (size_t i = 0; i < reps_; i++) {
+      auto start = steady_clock::now();
+      result_ = execute();
+      auto end = steady_clock::now();
+      latencies_.push_back(duration_cast<nanoseconds>(end - start).count());
+    }
+  }
+
+  void report() {
+    std::sort(latencies_.begin(), latencies_.end());
+    double p50 = percentile(0.5), p99 = percentile(0.99);
+    double max = (double) latencies_.back() / 1000.0;
+    fprintf(stderr, "Aggregate=%s, Result=%" PRIu64 ", p50=%lf us, p99=%lf us, "
+            "max=%lf us\n", agg_.c_str(), result_, p50, p99, max);
+
+    std::ofstream out("shm_query_latency.txt", std::ios_base::app);
+    out << agg_ << "\t" << result_ << "\t" << p50 << "\t" << p99 << "\t"
+        << max << "\n";
+    out.close();
+  }
+
+ private:
+  uint64_t execute() {
+    sharded_cast_builder builder(reader_.store(), exp_);
+    sharded_cast c = builder.build();
+    if (agg_ == "count")
+      return cached_ ? c.execute_cached<packet_store::packet_counter>()
+                     : c.execute<packet_store::packet_counter>();
+    if (agg_ == "bytes")
+      return cached_ ? c.execute_cached<packet_store::byte_counter>()
+                     : c.execute<packet_store::byte_counter>();
+
+    id_list::result_type ids = c.execute<id_list>();
+    if (agg_ == "ids")
+      return ids.size();
+
+    // Read every packet in place; returns the number of bytes read
+    uint64_t bytes = 0;
+    uint8_t sum = 0;
+    for (uint64_t id : ids) {
+      packet_view pkt;
+      if (!reader_.view_pkt(pkt, id))
+        continue;
+      for (uint16_t i = 0; i < pkt.length; i++)
+        sum += pkt.data[i];
+      bytes += pkt.length;
+    }
+    sink_ += sum;
+    return bytes;
+  }
+
+  double percentile(double q) const {
+    size_t idx = std::min(latencies_.size() - 1,
+                          (size_t) (q * (double) latencies_.size()));
+    return (double) latencies_[idx] / 1000.0;
+  }
+
+  shm_store_reader reader_;
+  std::string exp_;
+  std::string agg_;
+  size_t reps_;
+  bool cached_;
+  uint64_t result_;
+  uint64_t sink_;  // Keeps packet reads from being optimized away
+  std::vector<uint64_t> latencies_;  // In ns
+};
+
+int main(int argc, char** argv) {
+  int c;
+  std::string name = "/netplay";
+  std::string exp = "src_port == 80";
+  std::string agg = "count";
+  size_t reps = 100;
+  bool cached = false;
+  while ((c = getopt(argc, argv, "n:e:a:r:C")) != -1) {
+    switch (c) {
+    case 'n':
+      name = std::string(optarg);
+      break;
+    case 'e':
+      exp = std::string(optarg);
+      break;
+    case 'a':
+      agg = std::string(optarg);
+      break;
+    case 'r':
+      reps = atoi(optarg);
+      break;
+    case 'C':
+      cached = true;
+      break;
+    default:
+      fprintf(stderr, "Could not parse command line arguments.\n");
+      print_usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (agg != "count" && agg != "bytes" && agg != "ids" && agg != "packets") {
+    fprintf(stderr, "Invalid aggregate: %s\n", agg.c_str());
+    print_usage(argv[0]);
+    return -1;
+  }
+  if (reps == 0) {
+    fprintf(stderr, "Need at least one repetition\n");
+    return -1;
+  }
+
+  try {
+    shm_query query(name, exp, agg, reps, cached);
+    query.run();
+    query.report();
+  } catch (std::exception& e) {
+    fprintf(stderr, "%s\n", e.what());
+    return -1;
+  }
+
+  return 0;
+}
@@ -2,6 +2,8 @@
 #include <pthread.h>
 #include <sys/time.h>
 
+#include <algorithm>
+#include <array>
 #include <ctime>
 #include <chrono>
 #include <random>
@@ -53,7 +55,7 @@ using namespace ::netplay;
 using namespace ::slog;
 using namespace ::std::chrono;
 
-const char* usage = "Usage: %s [-n num-pkts] [-i interval]\n";
+const char* usage = "Usage: %s [-n num-pkts] [-i interval] [-r num-addrs]\n";
 
 typedef uint64_t timestamp_t;
 
@@ -88,6 +90,8 @@ class static_rand_generator {
       eth->ether_type = rte_cpu_to_be_16(0x0800);
 
       struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
+      ip->version_ihl = 0x45;
+      ip->fragment_offset = 0;
       ip->src_addr = 0;
       ip->dst_addr = 0;
       ip->next_proto_id = IPPROTO_TCP;
@@ -173,6 +177,7 @@ class storage_bench {
 
       fprintf(stderr, "Interval %" PRIu64 " in %lf seconds, storage = %zuB.\n",
         batch_id, totsecs, storage.total());
+      print_slab_stats();
 
       delete vport;
       delete gen;
@@ -182,7 +187,52 @@ class storage_bench {
     ofs.close();
   }
 
+  // Footprint of the IPv6 address (radix) index: random addresses, spread
+  // over as many /64 networks, i.e., sparse in both key words
+  void radix_footprint(const uint64_t num_addrs) {
+    std::mt19937_64 rng(0);
+    std::vector<std::array<uint8_t, 16>> addrs(num_addrs);
+    for (auto& addr : addrs) {
+      uint64_t net = rng(), host = rng();
+      for (int i = 0; i < 8; i++) {
+        addr[i] = net >> (56 - 8 * i);
+        addr[8 + i] = host >> (56 - 8 * i);
+      }
+      addr[0] = 0x20;
+    }
+
+    __index16* idx = new __index16();
+    timestamp_t start = get_timestamp();
+    for (uint64_t i = 0; i < num_addrs; i++)
+      idx->add_entry(addrs[i].data(), i);
+    timestamp_t end = get_timestamp();
+
+    std::sort(addrs.begin(), addrs.end());
+    size_t distinct = std::unique(addrs.begin(), addrs.end()) - addrs.begin();
+    size_t storage = idx->storage_size();
+    fprintf(stderr, "Radix index: %zu distinct addresses in %lf seconds, "
+            "storage = %zuB, %lf bytes/address.\n", distinct,
+            (double) (end - start) / (1000.0 * 1000.0), storage,
+            distinct ? (double) storage / (double) distinct : 0.0);
+    print_slab_stats();
+    delete idx;
+  }
+
  private:
+  // Allocation cost and fragmentation of lazily created index objects
+  void print_slab_stats() {
+    const slog::slab::slab_stats& st = slog::slab::stats();
+    uint64_t allocs = st.num_allocs.load();
+    uint64_t chunk = st.chunk_bytes.load();
+    uint64_t live = st.live_bytes.load();
+    fprintf(stderr, "Slab: %" PRIu64 " objects, %lf cycles/alloc, chunks = %"
+            PRIu64 "B, live = %" PRIu64 "B, free = %" PRIu64 "B, "
+            "fragmentation = %lf%%.\n", allocs,
+            allocs ? (double) st.alloc_cycles.load() / (double) allocs : 0.0,
+            chunk, live, st.free_bytes.load(),
+            chunk ? (double) (chunk - live) * 100.0 / (double) chunk : 0.0);
+  }
+
   packet_store *store_;
 };
 
@@ -206,7 +256,8 @@ int main(int argc, char** argv) {
   int c;
   uint64_t num_pkts = 300000000;
   uint64_t interval = 1000000;
-  while ((c = getopt(argc, argv, "n:i:")) != -1) {
+  uint64_t num_addrs = 0;
+  while ((c = getopt(argc, argv, "n:i:r:")) != -1) {
     switch (c) {
     case 'n':
       num_pkts = atoll(optarg);
@@ -214,6 +265,9 @@ int main(int argc, char** argv) {
     case 'i':
       interval = atoll(optarg);
       break;
+    case 'r':
+      num_addrs = atoll(optarg);
+      break;
     default:
       fprintf(stderr, "Could not parse command line arguments.\n");
       print_usage(argv[0]);
@@ -221,7 +275,10 @@ int main(int argc, char** argv) {
   }
 
   storage_bench bench;
-  bench.load_packets(num_pkts, interval);
+  if (num_addrs > 0)
+    bench.radix_footprint(num_addrs);
+  else
+    bench.load_packets(num_pkts, interval);
 
   return 0;
 }
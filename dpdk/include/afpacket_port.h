@@ -0,0 +1,242 @@
+#ifndef AFPACKET_PORT_H_
+#define AFPACKET_PORT_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include <atomic>
+
+#include "dpdk_exception.h"
+
+struct rte_mempool;
+
+#define AFPACKET_BLOCK_SIZE     (1 << 22)  // 4MB blocks
+#define AFPACKET_FRAME_SIZE     (1 << 11)  // 2KB frames
+#define AFPACKET_NUM_BLOCKS     64
+#define AFPACKET_BLOCK_TIMEOUT  10         // Block retire timeout (ms)
+
+namespace netplay {
+namespace dpdk {
+
+/**
+ * A TPACKET_V3 memory-mapped receive ring on a Linux AF_PACKET socket.
+ *
+ * The kernel fills fixed-size blocks with variable-length frames and hands a
+ * whole block to user-space at a time, so packets can be consumed in large
+ * batches without any per-packet system calls. Each ring belongs to exactly
+ * one (writer) thread.
+ */
+class afpacket_ring {
+ public:
+  /**
+   * Constructor to initialize the ring.
+   *
+   * @param iface The interface to capture on.
+   * @param fanout_id The id of the PACKET_FANOUT group the ring should join.
+   */
+  afpacket_ring(const char* iface, uint16_t fanout_id) {
+    cur_block_ = 0;
+
+    fd_ = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (fd_ < 0)
+      throw dpdk_exception("Could not create AF_PACKET socket");
+
+    int version = TPACKET_V3;
+    if (setsockopt(fd_, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+      throw dpdk_exception("Could not set TPACKET_V3");
+
+    memset(&req_, 0, sizeof(req_));
+    req_.tp_block_size = AFPACKET_BLOCK_SIZE;
+    req_.tp_frame_size = AFPACKET_FRAME_SIZE;
+    req_.tp_block_nr = AFPACKET_NUM_BLOCKS;
+    req_.tp_frame_nr = (AFPACKET_BLOCK_SIZE * AFPACKET_NUM_BLOCKS) / AFPACKET_FRAME_SIZE;
+    req_.tp_retire_blk_tov = AFPACKET_BLOCK_TIMEOUT;
+    req_.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+    if (setsockopt(fd_, SOL_PACKET, PACKET_RX_RING, &req_, sizeof(req_)) < 0)
+      throw dpdk_exception("Could not set up PACKET_RX_RING");
+
+    ring_size_ = (size_t) req_.tp_block_size * req_.tp_block_nr;
+    ring_ = (uint8_t*) mmap(NULL, ring_size_, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_LOCKED | MAP_POPULATE, fd_, 0);
+    if (ring_ == MAP_FAILED)
+      throw dpdk_exception("Could not mmap AF_PACKET ring");
+
+    int ifindex = if_nametoindex(iface);
+    if (ifindex == 0)
+      throw dpdk_exception("Could not find interface");
+
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifindex;
+    if (bind(fd_, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+      throw dpdk_exception("Could not bind AF_PACKET socket");
+
+    struct packet_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = ifindex;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(fd_, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+      throw dpdk_exception("Could not enable promiscuous mode");
+
+    int fanout = fanout_id | (PACKET_FANOUT_HASH << 16);
+    if (setsockopt(fd_, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0)
+      throw dpdk_exception("Could not join PACKET_FANOUT group");
+  }
+
+  ~afpacket_ring() {
+    munmap(ring_, ring_size_);
+    close(fd_);
+  }
+
+  /**
+   * Get the next block handed over by the kernel, if any.
+   *
+   * @return The next block, or NULL if the kernel has not retired one yet.
+   */
+  struct tpacket_block_desc* next_block() {
+    struct tpacket_block_desc* block = block_at(cur_block_);
+    if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE)
+         & TP_STATUS_USER) == 0)
+      return NULL;
+    return block;
+  }
+
+  /**
+   * Return the current block to the kernel and advance to the next block.
+   *
+   * @param block The block to release.
+   */
+  void release_block(struct tpacket_block_desc* block) {
+    __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                     __ATOMIC_RELEASE);
+    cur_block_ = (cur_block_ + 1) % req_.tp_block_nr;
+  }
+
+  /**
+   * Block until the kernel retires a block, or until the timeout expires.
+   *
+   * @param timeout_ms The timeout in milliseconds.
+   */
+  void wait(int timeout_ms) {
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN | POLLERR;
+    pfd.revents = 0;
+    poll(&pfd, 1, timeout_ms);
+  }
+
+  /**
+   * Get the socket file descriptor for the ring.
+   *
+   * @return The socket file descriptor.
+   */
+  int fd() const {
+    return fd_;
+  }
+
+  /**
+   * Iterate over the packets in a block in batches of at most max_pkts
+   * packets, invoking fn(pkts, lens, arrival_ns, cnt) for each batch.
+   *
+   * @param block The block to iterate over.
+   * @param pkts Buffer for packet data pointers (at least max_pkts entries).
+   * @param lens Buffer for packet lengths (at least max_pkts entries).
+   * @param arrival_ns Buffer for the kernel's arrival timestamps of the
+   * packets, in ns (at least max_pkts entries).
+   * @param max_pkts The maximum number of packets per batch.
+   * @param fn The function to invoke for each batch.
+   * @return The number of packets in the block.
+   */
+  template<typename batch_fn>
+  static uint32_t for_each_batch(struct tpacket_block_desc* block,
+                                 unsigned char** pkts, uint16_t* lens,
+                                 uint64_t* arrival_ns, uint16_t max_pkts,
+                                 batch_fn fn) {
+    uint32_t num_pkts = block->hdr.bh1.num_pkts;
+    struct tpacket3_hdr* hdr = (struct tpacket3_hdr*) ((uint8_t*) block +
+                               block->hdr.bh1.offset_to_first_pkt);
+    uint16_t cnt = 0;
+    for (uint32_t i = 0; i < num_pkts; i++) {
+      pkts[cnt] = (unsigned char*) hdr + hdr->tp_mac;
+      lens[cnt] = hdr->tp_snaplen;
+      arrival_ns[cnt] = hdr->tp_sec * 1000000000ULL + hdr->tp_nsec;
+      if (++cnt == max_pkts) {
+        fn(pkts, lens, arrival_ns, cnt);
+        cnt = 0;
+      }
+      hdr = (struct tpacket3_hdr*) ((uint8_t*) hdr + hdr->tp_next_offset);
+    }
+    if (cnt > 0)
+      fn(pkts, lens, arrival_ns, cnt);
+    return num_pkts;
+  }
+
+ private:
+  inline struct tpacket_block_desc* block_at(uint32_t i) {
+    return (struct tpacket_block_desc*) (ring_ + (size_t) i * req_.tp_block_size);
+  }
+
+  int fd_;
+  uint8_t* ring_;
+  size_t ring_size_;
+  uint32_t cur_block_;
+  struct tpacket_req3 req_;
+};
+
+/**
+ * Capture port on a Linux AF_PACKET interface; does not require DPDK rings,
+ * hugepages or dedicated NICs (e.g., works on a veth pair).
+ *
+ * Every writer polling the port opens its own TPACKET_V3 ring; all rings of a
+ * port join the same PACKET_FANOUT group, so the kernel distributes flows
+ * across writers by hash.
+ */
+class afpacket_port {
+ public:
+  afpacket_port(const char* iface, struct rte_mempool* mempool) {
+    (void) mempool;
+    strncpy(iface_, iface, IF_NAMESIZE);
+    iface_[IF_NAMESIZE - 1] = '\0';
+    fanout_id_ = (getpid() ^ next_port_id()) & 0xFFFF;
+  }
+
+  ~afpacket_port() {
+  }
+
+  /**
+   * Open a new receive ring for the port; should be called on the thread
+   * that polls the ring.
+   *
+   * @return A new receive ring.
+   */
+  afpacket_ring* open_ring() {
+    return new afpacket_ring(iface_, fanout_id_);
+  }
+
+ private:
+  static uint32_t next_port_id() {
+    static std::atomic<uint32_t> port_id(0);
+    return port_id.fetch_add(1U) << 8;
+  }
+
+  char iface_[IF_NAMESIZE];
+  uint16_t fanout_id_;
+};
+
+}
+}
+
+#endif  // AFPACKET_PORT_H_
@@ -92,6 +92,34 @@ struct bess_ring_init {
   }
 };
 
+struct bess_ring_lookup {
+  inline void operator()(const char* port_name, struct rte_ring** rxq,
+                         struct rte_ring** txq) {
+    char port_file[PORT_FNAME_LEN];
+    snprintf(port_file, PORT_FNAME_LEN, "%s/%s/%s", P_tmpdir, PORT_DIR_PREFIX, port_name);
+
+    FILE* fd = fopen(port_file, "r");
+    if (!fd) {
+      throw dpdk_exception("Could not open port file");
+    }
+
+    struct bess_ring_init::rte_ring_bar *bar;
+    int i = fread(&bar, 8, 1, fd);
+    fclose(fd);
+
+    if (i != 1)
+      throw dpdk_exception("Invalid number of bytes read");
+    if (bar == NULL)
+      throw dpdk_exception("Could not find bar");
+    if (bar->num_inc_q < 1 || bar->num_out_q < 1)
+      throw dpdk_exception("Port has no queues");
+
+    /* Only the first queue in each direction is polled */
+    *rxq = bar->inc_qs[0];
+    *txq = bar->out_qs[0];
+  }
+};
+
 }
 }
 
@@ -67,6 +67,24 @@ struct ovs_ring_init {
   }
 };
 
+struct ovs_ring_lookup {
+  inline void operator()(const char* iface, struct rte_ring** rxq,
+                         struct rte_ring** txq) {
+    char rxq_name[Q_NAME];
+    char txq_name[Q_NAME];
+    snprintf(rxq_name, Q_NAME, MP_CLIENT_RXQ_NAME, iface);
+    snprintf(txq_name, Q_NAME, MP_CLIENT_TXQ_NAME, iface);
+
+    *rxq = rte_ring_lookup(rxq_name);
+    if (*rxq == NULL)
+      throw dpdk_exception("could not find rx rte_ring");
+
+    *txq = rte_ring_lookup(txq_name);
+    if (*txq == NULL)
+      throw dpdk_exception("could not find tx rte_ring");
+  }
+};
+
 }
 }
 
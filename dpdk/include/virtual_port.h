@@ -9,9 +9,12 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include <atomic>
+
 #include <rte_config.h>
 #include <rte_malloc.h>
 #include <rte_ring.h>
@@ -23,6 +26,7 @@
 #include <rte_eal.h>
 #include <rte_ether.h>
 #include <rte_mbuf.h>
+#include <rte_interrupts.h>
 
 #include "dpdk_utils.h"
 
@@ -34,6 +38,7 @@ class virtual_port {
  public:
   virtual_port(const char* iface, struct rte_mempool* mempool) {
     port_ = init_(iface, mempool);
+    intr_state_ = INTR_UNINITIALIZED;
   }
 
   ~virtual_port() {
@@ -47,9 +52,49 @@ class virtual_port {
     return rte_eth_rx_burst(port_, static_cast<uint16_t>(0), pkts, n_pkts);
   }
 
+  /**
+   * Block until the port raises a receive interrupt, or until the timeout
+   * expires. The interrupt is registered with the epoll instance of the first
+   * thread that waits on it, and only that thread can block on it; other
+   * threads polling the same port get false, and back off instead.
+   *
+   * @param timeout_ms The timeout in milliseconds.
+   * @return False if the port's PMD does not support receive interrupts, or
+   * if they belong to another thread.
+   */
+  bool wait_rx(int timeout_ms) {
+    int state = intr_state_.load(std::memory_order_acquire);
+    if (state == INTR_UNINITIALIZED
+        && intr_state_.compare_exchange_strong(state, INTR_REGISTERING)) {
+      int ret = rte_eth_dev_rx_intr_ctl_q(port_, 0, RTE_EPOLL_PER_THREAD,
+                                          RTE_INTR_EVENT_ADD, NULL);
+      intr_owner_ = pthread_self();
+      state = (ret == 0) ? INTR_SUPPORTED : INTR_UNSUPPORTED;
+      intr_state_.store(state, std::memory_order_release);
+    }
+    if (state != INTR_SUPPORTED || !pthread_equal(intr_owner_, pthread_self()))
+      return false;
+
+    if (rte_eth_dev_rx_intr_enable(port_, 0) != 0)
+      return false;
+    struct rte_epoll_event event;
+    rte_epoll_wait(RTE_EPOLL_PER_THREAD, &event, 1, timeout_ms);
+    rte_eth_dev_rx_intr_disable(port_, 0);
+    return true;
+  }
+
  private:
+  enum intr_state {
+    INTR_UNINITIALIZED,
+    INTR_REGISTERING,
+    INTR_SUPPORTED,
+    INTR_UNSUPPORTED
+  };
+
   initializer init_;
   int port_;
+  std::atomic<int> intr_state_;
+  pthread_t intr_owner_;  // Set before intr_state_ becomes INTR_SUPPORTED
 };
 
 }
@@ -0,0 +1,460 @@
+#ifndef SLOG_ALLOCATOR_H_
+#define SLOG_ALLOCATOR_H_
+
+#include <unistd.h>
+#include <string.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+#include "shmregion.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define SLOG_MPOL_PREFERRED     1           // MPOL_PREFERRED from <numaif.h>
+#define SLOG_HUGE_2MB           (1UL << 21)
+#define SLOG_HUGE_1GB           (1UL << 30)
+#define SLOG_ARENA_CHUNK_SIZE   (16 * SLOG_HUGE_2MB)  // Also the chunk alignment
+#define SLOG_ARENA_MAX_ALLOC    (1UL << 20)  // Larger allocations are mapped directly
+#define SLOG_ARENA_ALIGN        64
+
+namespace slog {
+
+/**
+ * Allocator for the buckets of logs and index structures (monologs, entry
+ * lists and indexlets).
+ *
+ * In HEAP mode (the default) memory comes from the regular heap, i.e., 4KB
+ * pages on whichever NUMA node first touches them. In the huge page modes:
+ *  - large allocations (log buckets) are mapped directly with MAP_HUGETLB,
+ *    and fall back to transparent huge pages if no huge pages are reserved;
+ *  - small allocations (entry list buckets, indexlets) are carved out of
+ *    per-thread chunks of 2MB huge pages, so that neighbouring index nodes
+ *    share TLB entries, and indexlets do not each round up to a huge page.
+ *    The most recent allocation of a thread (e.g., a bucket that lost an
+ *    allocation race) is reused right away; other freed blocks are not
+ *    reused, but a chunk is unmapped once all of its blocks are freed (by any
+ *    thread) and its thread has moved on to a new chunk or exited;
+ *  - mappings are bound (preferred) to the NUMA node of the allocating
+ *    thread, i.e., the writer's node for data written on ingest.
+ *
+ * Independently of the mode, all memory can be drawn from a shared memory
+ * region instead (see share()), so that other processes can map the logs and
+ * indexes and query them in place. Allocations are then carved out of the
+ * region with a bump pointer and never reclaimed; in the huge page modes the
+ * region is backed by transparent huge pages where the kernel allows it for
+ * shared memory, and pages are placed on the node of the thread that first
+ * touches them (i.e., the writer's).
+ *
+ * The mode and the region are process-wide, and must be configured before
+ * any store is created.
+ */
+class allocator {
+ public:
+  enum mode {
+    HEAP = 0,
+    HUGE_2MB = 1,
+    HUGE_1GB = 2
+  };
+
+  // Sources of memory: private memory of each mode, or the shared region.
+  // Memory obtained from one source must never be reused for another (e.g.,
+  // heap memory in the shared region, where readers cannot map it).
+  static const size_t SHARED_SOURCE = HUGE_1GB + 1;
+  static const size_t NUM_SOURCES = SHARED_SOURCE + 1;
+
+  struct alloc_stats {
+    std::atomic<uint64_t> heap_bytes;
+    std::atomic<uint64_t> huge_bytes;
+    std::atomic<uint64_t> fallback_bytes;  // Huge page mapping failed
+    std::atomic<uint64_t> arena_bytes;
+    std::atomic<uint64_t> reserved_bytes;  // Reserved (not committed) ranges
+    std::atomic<uint64_t> shared_bytes;    // Allocated from the shared region
+  };
+
+  static void configure(mode m, bool bind_numa = true) {
+    config().m = m;
+    config().bind_numa = bind_numa;
+  }
+
+  static mode current_mode() {
+    return config().m;
+  }
+
+  /**
+   * Draw all subsequent allocations from a shared memory region.
+   *
+   * @param region The region (created, i.e., writable, by this process), or
+   * NULL to allocate private memory again.
+   */
+  static void share(shm_region* region) {
+    config().region = region;
+    if (region != NULL && config().m != HEAP)
+      madvise(region->base(), region->capacity(), MADV_HUGEPAGE);
+  }
+
+  /* The shared memory region allocations come from, or NULL */
+  static shm_region* shared_region() {
+    return config().region;
+  }
+
+  static const alloc_stats& stats() {
+    return stats_ref();
+  }
+
+  /* The source that allocations currently come from */
+  static size_t source() {
+    return config().region != NULL ? SHARED_SOURCE : (size_t) config().m;
+  }
+
+  /* The source that memory returned to the allocator came from */
+  static size_t source_of(const void* ptr) {
+    shm_region* region = config().region;
+    if (region != NULL && region->contains(ptr))
+      return SHARED_SOURCE;
+    return config().m;
+  }
+
+  /**
+   * Get the NUMA node of the calling thread.
+   *
+   * @return The NUMA node the calling thread is running on, or -1 if unknown.
+   */
+  static int current_node() {
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 || node >= 64)
+      return -1;
+    return (int) node;
+  }
+
+  /**
+   * Get the NUMA node of a CPU.
+   *
+   * @param cpu The CPU.
+   * @return The NUMA node of the CPU, or -1 if unknown.
+   */
+  static int cpu_node(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR* dir = opendir(path);
+    if (dir == NULL)
+      return -1;
+    int node = -1;
+    struct dirent* ent;
+    while (node < 0 && (ent = readdir(dir)) != NULL) {
+      if (!strncmp(ent->d_name, "node", 4) && ent->d_name[4] >= '0'
+          && ent->d_name[4] <= '9')
+        node = atoi(ent->d_name + 4);
+    }
+    closedir(dir);
+    return node < 64 ? node : -1;
+  }
+
+  /**
+   * Bind subsequent allocations of the calling thread to a NUMA node, rather
+   * than to the node the thread runs on; used by threads that allocate on
+   * behalf of others (e.g., the preallocator on behalf of writers).
+   *
+   * @param node The NUMA node, or -1 to use the calling thread's node.
+   */
+  static void set_thread_node(int node) {
+    thread_node() = node;
+  }
+
+  /* The NUMA node allocations of the calling thread are bound to, or -1 */
+  static int get_thread_node() {
+    return thread_node();
+  }
+
+  static const char* name(mode m) {
+    switch (m) {
+    case HEAP:
+      return "heap";
+    case HUGE_2MB:
+      return "2M";
+    case HUGE_1GB:
+      return "1G";
+    }
+    return "unknown";
+  }
+
+  /**
+   * Parse an allocator mode name.
+   *
+   * @param str The mode name (heap, 2M or 1G).
+   * @param m Set to the parsed mode.
+   * @return True if the name is valid, false otherwise.
+   */
+  static bool parse(const char* str, mode& m) {
+    if (!strcmp(str, "heap")) {
+      m = HEAP;
+    } else if (!strcmp(str, "2M")) {
+      m = HUGE_2MB;
+    } else if (!strcmp(str, "1G")) {
+      m = HUGE_1GB;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  static void* allocate(size_t bytes) {
+    if (config().region != NULL)
+      return shared_allocate(bytes);
+    if (config().m == HEAP) {
+      stats_ref().heap_bytes.fetch_add(bytes, std::memory_order_relaxed);
+      return ::operator new(bytes);
+    }
+    if (bytes <= SLOG_ARENA_MAX_ALLOC)
+      return arena_allocate(bytes);
+    return map_pages(bytes);
+  }
+
+  static void deallocate(void* ptr, size_t bytes) {
+    if (ptr == NULL || source_of(ptr) == SHARED_SOURCE)
+      return;
+    if (config().m == HEAP) {
+      stats_ref().heap_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+      ::operator delete(ptr);
+    } else if (bytes <= SLOG_ARENA_MAX_ALLOC) {
+      arena_deallocate(ptr, bytes);
+    } else {
+      munmap(ptr, round_up(bytes, page_size(bytes)));
+    }
+  }
+
+  /**
+   * Reserve a range of virtual address space; pages are only backed by
+   * memory as they are first touched. In the huge page modes, the range is
+   * backed by transparent huge pages, bound to the calling thread's node.
+   *
+   * @param bytes The size of the range.
+   * @return The start of the range.
+   */
+  static void* reserve(size_t bytes) {
+    size_t len = round_up(bytes, SLOG_HUGE_2MB);
+    if (config().region != NULL) {
+      stats_ref().reserved_bytes.fetch_add(len, std::memory_order_relaxed);
+      return shared_allocate(len);
+    }
+    void* ptr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED)
+      throw std::bad_alloc();
+    if (config().m != HEAP) {
+      madvise(ptr, len, MADV_HUGEPAGE);
+      bind_local(ptr, len);
+    }
+    stats_ref().reserved_bytes.fetch_add(len, std::memory_order_relaxed);
+    return ptr;
+  }
+
+  static void release(void* ptr, size_t bytes) {
+    size_t len = round_up(bytes, SLOG_HUGE_2MB);
+    if (config().region == NULL)
+      munmap(ptr, len);
+    stats_ref().reserved_bytes.fetch_sub(len, std::memory_order_relaxed);
+  }
+
+  template<typename T>
+  static T* new_array(size_t n) {
+    T* arr = (T*) allocate(n * sizeof(T));
+    if (!std::is_trivial<T>::value)
+      for (size_t i = 0; i < n; i++)
+        new (arr + i) T;
+    return arr;
+  }
+
+  template<typename T>
+  static void delete_array(T* arr, size_t n) {
+    if (arr == NULL)
+      return;
+    if (!std::is_trivial<T>::value)
+      for (size_t i = 0; i < n; i++)
+        arr[i].~T();
+    deallocate(arr, n * sizeof(T));
+  }
+
+  template<typename T>
+  static T* new_object() {
+    return new (allocate(sizeof(T))) T();
+  }
+
+  template<typename T>
+  static void delete_object(T* obj) {
+    if (obj == NULL)
+      return;
+    obj->~T();
+    deallocate(obj, sizeof(T));
+  }
+
+ private:
+  struct settings {
+    mode m;
+    bool bind_numa;
+    shm_region* region;
+  };
+
+  /* The chunk a thread allocates from; the thread holds a reference to it */
+  struct arena {
+    ~arena() {
+      if (base != NULL)
+        release_chunk(base, 1);
+    }
+
+    char* base;
+    size_t off;
+  };
+
+  /* At the start of each (aligned) chunk: the bytes of its blocks in use,
+   * plus one while a thread allocates from it */
+  struct chunk_header {
+    std::atomic<size_t> live;
+  };
+
+  static settings& config() {
+    static settings s = { HEAP, true, NULL };
+    return s;
+  }
+
+  static alloc_stats& stats_ref() {
+    static alloc_stats s;
+    return s;
+  }
+
+  static inline size_t round_up(size_t x, size_t align) {
+    return (x + align - 1) & ~(align - 1);
+  }
+
+  /* 1GB pages are only used if they do not waste more than 1/8th of the
+   * allocation, e.g., 1GB log blocks plus their buffer use 2MB pages. */
+  static size_t page_size(size_t bytes) {
+    if (config().m == HUGE_1GB
+        && round_up(bytes, SLOG_HUGE_1GB) - bytes <= bytes / 8)
+      return SLOG_HUGE_1GB;
+    return SLOG_HUGE_2MB;
+  }
+
+  /* Large allocations are aligned to 2MB, so they can be backed by huge pages */
+  static void* shared_allocate(size_t bytes) {
+    size_t align = bytes > SLOG_ARENA_MAX_ALLOC ? SLOG_HUGE_2MB : SLOG_ARENA_ALIGN;
+    bytes = round_up(bytes, SLOG_ARENA_ALIGN);
+    void* ptr = config().region->allocate(bytes, align);
+    stats_ref().shared_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    return ptr;
+  }
+
+  /* Mappings aligned beyond their page size are over-mapped, then trimmed */
+  static void* map_pages(size_t bytes, size_t align = 0) {
+    size_t pgsz = page_size(bytes);
+    size_t len = round_up(bytes, pgsz);
+    size_t map_len = len + align;
+    int huge_flag = (pgsz == SLOG_HUGE_1GB) ? MAP_HUGE_1GB : MAP_HUGE_2MB;
+    char* ptr = (char*) mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | huge_flag, -1, 0);
+    bool huge = (ptr != MAP_FAILED);
+    if (!huge) {
+      ptr = (char*) mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (ptr == MAP_FAILED)
+        throw std::bad_alloc();
+    }
+    if (align != 0) {
+      char* start = (char*) round_up((uintptr_t) ptr, align);
+      if (start != ptr)
+        munmap(ptr, start - ptr);
+      if (start + len != ptr + map_len)
+        munmap(start + len, ptr + map_len - (start + len));
+      ptr = start;
+    }
+    if (huge) {
+      stats_ref().huge_bytes.fetch_add(len, std::memory_order_relaxed);
+    } else {
+      madvise(ptr, len, MADV_HUGEPAGE);
+      stats_ref().fallback_bytes.fetch_add(len, std::memory_order_relaxed);
+    }
+    bind_local(ptr, len);
+    return ptr;
+  }
+
+  static void bind_local(void* ptr, size_t len) {
+    if (!config().bind_numa)
+      return;
+    int node = thread_node() >= 0 ? thread_node() : current_node();
+    if (node < 0)
+      return;
+    unsigned long nodemask = 1UL << node;
+    syscall(SYS_mbind, ptr, len, SLOG_MPOL_PREFERRED, &nodemask,
+            sizeof(nodemask) * 8 + 1, 0);
+  }
+
+  static int& thread_node() {
+    static thread_local int node = -1;
+    return node;
+  }
+
+  static arena& local_arena() {
+    static thread_local arena a = { NULL, SLOG_ARENA_CHUNK_SIZE };
+    return a;
+  }
+
+  static chunk_header* header(char* chunk) {
+    return (chunk_header*) chunk;
+  }
+
+  static void release_chunk(char* chunk, size_t bytes) {
+    if (header(chunk)->live.fetch_sub(bytes, std::memory_order_acq_rel) == bytes)
+      munmap(chunk, SLOG_ARENA_CHUNK_SIZE);
+  }
+
+  static void* arena_allocate(size_t bytes) {
+    arena& a = local_arena();
+    bytes = round_up(bytes, SLOG_ARENA_ALIGN);
+    if (a.off + bytes > SLOG_ARENA_CHUNK_SIZE) {
+      char* chunk = (char*) map_pages(SLOG_ARENA_CHUNK_SIZE,
+                                      SLOG_ARENA_CHUNK_SIZE);
+      new (header(chunk)) chunk_header();
+      header(chunk)->live.store(1, std::memory_order_relaxed);
+      if (a.base != NULL)
+        release_chunk(a.base, 1);
+      a.base = chunk;
+      a.off = round_up(sizeof(chunk_header), SLOG_ARENA_ALIGN);
+    }
+    void* ptr = a.base + a.off;
+    a.off += bytes;
+    header(a.base)->live.fetch_add(bytes, std::memory_order_relaxed);
+    stats_ref().arena_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    return ptr;
+  }
+
+  static void arena_deallocate(void* ptr, size_t bytes) {
+    arena& a = local_arena();
+    bytes = round_up(bytes, SLOG_ARENA_ALIGN);
+    char* chunk = (char*) ((uintptr_t) ptr & ~(SLOG_ARENA_CHUNK_SIZE - 1));
+    if (chunk == a.base && (char*) ptr + bytes == a.base + a.off)
+      a.off -= bytes;
+    stats_ref().arena_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    release_chunk(chunk, bytes);
+  }
+};
+
+}
+
+#endif /* SLOG_ALLOCATOR_H_ */
@@ -1,10 +1,20 @@
 #ifndef SLOG_DATALOG_H_
 #define SLOG_DATALOG_H_
 
+#include "monolog.h"
+
+#ifndef SLOG_DATALOG_RESERVE
+#define SLOG_DATALOG_RESERVE (1UL << 40)  // Max bytes in a reserved data log
+#endif
+
 namespace slog {
 
+#ifdef SLOG_RESERVED_DATALOG
+  typedef __monolog_reserved_base<uint8_t, SLOG_DATALOG_RESERVE> datalog;
+#else
   typedef __monolog_linear_base<uint8_t> datalog;
+#endif
   
 }
 
-#endif  // SLOG_DATALOG_H_
\ No newline at end of file
+#endif  // SLOG_DATALOG_H_
@@ -1,11 +1,150 @@
 #ifndef SLOG_ENTRYLIST_H_
 #define SLOG_ENTRYLIST_H_
 
+#include <atomic>
+#include <cstdint>
+
 #include "monolog.h"
+#include "slab.h"
+
+#ifndef SLOG_ENTRYLIST_RESERVE
+#define SLOG_ENTRYLIST_RESERVE (1UL << 24)  // Max entries per reserved entry log
+#endif
+
+#define SLOG_ENTRYLIST_INLINE  7  // Inline entries; fills a cache line with the header
 
 namespace slog {
 
-typedef monolog_relaxed<uint64_t, 24> entry_list;
+/**
+ * Unbounded log of index entries, which holds the entries of entry lists that
+ * outgrow their inline entries.
+ */
+#ifdef SLOG_RESERVED_ENTRYLIST
+typedef monolog_relaxed<uint64_t, 24,
+    __monolog_reserved_base<uint64_t, SLOG_ENTRYLIST_RESERVE>> entry_log;
+#else
+typedef monolog_relaxed<uint64_t, 24> entry_log;
+#endif
+
+/**
+ * List of index entries (record ids) for a single key, with a small-list
+ * optimization.
+ *
+ * Most keys of wide indexes (e.g., rarely seen addresses) only have a handful
+ * of entries. The first SLOG_ENTRYLIST_INLINE entries are therefore stored
+ * inline, in the same cache line as the pointer to the overflow log, so that a
+ * small list costs 64 bytes instead of a full entry_log (bucket pointers and a
+ * first bucket, ~330 bytes), and reading it does not chase a bucket pointer.
+ *
+ * Inline entries are claimed with a CAS on empty slots, so they become visible
+ * in order of their slots. Once all of them are taken, the list is promoted:
+ * the first writer that finds no overflow log creates one from its slab (see
+ * lazy_ref; the others wait for it), and all further entries are appended to
+ * the installed log. Entries
+ * are never moved, so entry i is inline entry i for i < SLOG_ENTRYLIST_INLINE,
+ * and overflow entry i - SLOG_ENTRYLIST_INLINE otherwise.
+ */
+class entry_list {
+ public:
+  typedef size_t size_type;
+  typedef uint64_t value_type;
+
+  static const size_t INLINE_ENTRIES = SLOG_ENTRYLIST_INLINE;
+  static const uint64_t EMPTY = UINT64_MAX;
+
+  entry_list() {
+    for (size_t i = 0; i < INLINE_ENTRIES; i++)
+      inline_[i].store(EMPTY, std::memory_order_relaxed);
+  }
+
+  ~entry_list() {
+    overflow_.reset();
+  }
+
+  // Append an entry to the list; returns its position.
+  size_t push_back(const uint64_t val) {
+    if (overflow_.load() == NULL) {
+      for (size_t i = 0; i < INLINE_ENTRIES; i++) {
+        uint64_t expected = EMPTY;
+        if (inline_[i].load(std::memory_order_relaxed) == EMPTY
+            && inline_[i].compare_exchange_strong(expected, val,
+                std::memory_order_release, std::memory_order_relaxed))
+          return i;
+      }
+    }
+    return INLINE_ENTRIES + overflow()->push_back(val);
+  }
+
+  // Append the entries start..end (inclusive); returns the position of the
+  // first one. Inline slots are claimed one at a time, so entries of
+  // concurrent ranges may interleave there; the rest of the range is claimed
+  // at once in the overflow log, where it is contiguous.
+  size_t push_back_range(const uint64_t start, const uint64_t end) {
+    size_t first = SIZE_MAX;
+    uint64_t val = start;
+    if (overflow_.load() == NULL) {
+      for (size_t i = 0; i < INLINE_ENTRIES && val <= end; i++) {
+        uint64_t expected = EMPTY;
+        if (inline_[i].load(std::memory_order_relaxed) == EMPTY
+            && inline_[i].compare_exchange_strong(expected, val,
+                std::memory_order_release, std::memory_order_relaxed)) {
+          if (first == SIZE_MAX)
+            first = i;
+          val++;
+        }
+      }
+    }
+    if (val <= end) {
+      size_t idx = INLINE_ENTRIES + overflow()->push_back_range(val, end);
+      if (first == SIZE_MAX)
+        first = idx;
+    }
+    return first;
+  }
+
+  // Entries at positions < size() are valid.
+  uint64_t get(const size_t idx) const {
+    if (idx < INLINE_ENTRIES)
+      return inline_[idx].load(std::memory_order_acquire);
+    return overflow_.load()->get(idx - INLINE_ENTRIES);
+  }
+
+  uint64_t at(const size_t idx) const {
+    return get(idx);
+  }
+
+  // Number of entries that have been written (inline), or claimed (overflow).
+  size_t size() const {
+    entry_log* log = overflow_.load();
+    if (log != NULL)
+      return INLINE_ENTRIES + log->size();
+    size_t n = 0;
+    while (n < INLINE_ENTRIES
+           && inline_[n].load(std::memory_order_acquire) != EMPTY)
+      n++;
+    return n;
+  }
+
+  bool is_inline() const {
+    return overflow_.load() == NULL;
+  }
+
+  size_t storage_size() const {
+    entry_log* log = overflow_.load();
+    if (log == NULL)
+      return sizeof(entry_list);
+    return sizeof(entry_list) + log->storage_size();
+  }
+
+ private:
+  // Get the overflow log, promoting the list if necessary.
+  entry_log* overflow() {
+    return overflow_.get();
+  }
+
+  std::atomic<uint64_t> inline_[INLINE_ENTRIES];
+  lazy_ref<entry_log> overflow_;
+};
 
 }
 
@@ -3,11 +3,47 @@
 
 #include <cstdint>
 #include <iterator>
+#include <memory>
+#include <vector>
+
+#include "tieredindex.h"
 
 namespace slog {
 
 typedef std::iterator<std::input_iterator_tag, uint64_t, uint64_t, const uint64_t*, uint64_t> __input_iterator;
 
+/**
+ * A set of entry lists (e.g., those matched by a radix index prefix scan),
+ * exposed through the tiered index interface with keys 0 ... size() - 1, so
+ * that it can be iterated over by a filter_result.
+ */
+class entry_list_set : public tiered_index_base {
+ public:
+  void add(entry_list* list) {
+    lists_.push_back(list);
+  }
+
+  entry_list* at(const uint64_t key) const final {
+    return key < lists_.size() ? lists_[key] : NULL;
+  }
+
+  size_t size() const {
+    return lists_.size();
+  }
+
+ private:
+  std::vector<entry_list*> lists_;
+};
+
+/**
+ * The record ids of the entry lists of an index for a range of tokens, within a
+ * range of record ids (e.g., below the maximum record id when the filter was
+ * issued, and, to extend an earlier result, at or above its maximum).
+ *
+ * The index is looked up through a function instantiated for its concrete
+ * type rather than through the tiered index vtable, so that indexes mapped
+ * from another process's shared memory can be filtered (see tieredindex.h).
+ */
 class filter_result {
  public:
   class filter_iterator : public __input_iterator {
@@ -31,10 +67,13 @@ class filter_result {
       cur_tok_ = res_->tok_min_;
       cur_entry_list_ = NULL;
       if (res_->index_ != NULL)
-        cur_entry_list_ = res_->index_->at(cur_tok_);
+        cur_entry_list_ = res_->list_at(cur_tok_);
       cur_idx_ = -1;
 
-      advance();
+      do {
+        advance();
+      } while (cur_tok_ != res_->tok_max_ + 1 &&
+               !res_->in_range(cur_entry_list_->get(cur_idx_)));
     }
 
     filter_iterator(uint64_t tok, int64_t idx) {
@@ -61,7 +100,7 @@ class filter_result {
       do {
         advance();
       } while (cur_tok_ != res_->tok_max_ + 1 &&
-               cur_entry_list_->get(cur_idx_) >= res_->max_rid_);
+               !res_->in_range(cur_entry_list_->get(cur_idx_)));
       return *this;
     }
 
@@ -83,6 +122,11 @@ class filter_result {
       return cur_tok_ == res_->tok_max_ + 1;
     }
 
+    /* The token of the current entry */
+    uint64_t token() const {
+      return cur_tok_;
+    }
+
    private:
     void advance() {
       if (cur_tok_ == res_->tok_max_ + 1)
@@ -90,7 +134,7 @@ class filter_result {
       cur_idx_++;
       if (cur_entry_list_ == NULL || static_cast<uint64_t>(cur_idx_) == cur_entry_list_->size()) {
         cur_idx_ = 0;
-        while ((cur_entry_list_ = res_->index_->at(++cur_tok_)) == NULL
+        while ((cur_entry_list_ = res_->list_at(++cur_tok_)) == NULL
                && cur_tok_ <= res_->tok_max_);
       }
     }
@@ -103,16 +147,33 @@ class filter_result {
 
   filter_result() {
     index_ = NULL;
+    lookup_ = NULL;
     tok_min_ = 1;
     tok_max_ = 0;
+    min_rid_ = 0;
     max_rid_ = 0;
   }
 
-  filter_result(const tiered_index_base* index, const uint64_t tok_min,
-                const uint64_t tok_max, const uint64_t max_rid) {
+  template<typename index_type>
+  filter_result(const index_type* index, const uint64_t tok_min,
+                const uint64_t tok_max, const uint64_t max_rid,
+                const uint64_t min_rid = 0) {
     index_ = index;
+    lookup_ = &lookup<index_type>;
     tok_min_ = tok_min;
     tok_max_ = tok_max;
+    min_rid_ = min_rid;
+    max_rid_ = max_rid;
+  }
+
+  filter_result(std::shared_ptr<const entry_list_set> lists,
+                const uint64_t max_rid, const uint64_t min_rid = 0) {
+    lists_ = lists;
+    index_ = lists_.get();
+    lookup_ = &lookup<entry_list_set>;
+    tok_min_ = 0;
+    tok_max_ = lists_->size() > 0 ? lists_->size() - 1 : 0;
+    min_rid_ = min_rid;
     max_rid_ = max_rid;
   }
 
@@ -125,9 +186,27 @@ class filter_result {
   }
 
  private:
-  const tiered_index_base* index_;
+  typedef entry_list* (*lookup_fn)(const void* index, const uint64_t key);
+
+  template<typename index_type>
+  static entry_list* lookup(const void* index, const uint64_t key) {
+    return static_cast<const index_type*>(index)->at(key);
+  }
+
+  inline entry_list* list_at(const uint64_t key) const {
+    return lookup_(index_, key);
+  }
+
+  inline bool in_range(const uint64_t record_id) const {
+    return record_id >= min_rid_ && record_id < max_rid_;
+  }
+
+  std::shared_ptr<const entry_list_set> lists_;
+  const void* index_;
+  lookup_fn lookup_;
   uint64_t tok_min_;
   uint64_t tok_max_;
+  uint64_t min_rid_;
   uint64_t max_rid_;
 };
 
@@ -22,6 +22,7 @@
 
 #include "tokens.h"
 #include "tieredindex.h"
+#include "radixindex.h"
 #include "streamlog.h"
 #include "offsetlog.h"
 #include "datalog.h"
@@ -37,6 +38,9 @@
 #define OFFSET6 32768
 #define OFFSET7 65536
 #define OFFSET8 131072
+#define OFFSET16 262144
+
+#define SLOG_MULTI_GET_PREFETCH 8  // Records prefetched ahead in multi_get
 
 namespace slog {
 
@@ -56,6 +60,34 @@ struct logstore_storage {
   }
 };
 
+/**
+ * The data log, offset log and index logs of a log-store; everything needed
+ * to query it. A log-store whose logs are allocated from a shared memory
+ * region can be queried by other processes through a log-store built from its
+ * layout (see log_store::layout()).
+ */
+struct logstore_layout {
+  datalog* dlog;
+  offsetlog* olog;
+  monolog_linearizable<__index1 *> *idx1;
+  monolog_linearizable<__index2 *> *idx2;
+  monolog_linearizable<__index3 *> *idx3;
+  monolog_linearizable<__index4 *> *idx4;
+  monolog_linearizable<__index5 *> *idx5;
+  monolog_linearizable<__index6 *> *idx6;
+  monolog_linearizable<__index7 *> *idx7;
+  monolog_linearizable<__index8 *> *idx8;
+  monolog_linearizable<__index16 *> *idx16;
+};
+
+/**
+ * Read-only view of a record in the data log.
+ */
+struct record_view {
+  const unsigned char* data;
+  uint16_t length;
+};
+
 class log_store {
  public:
   typedef std::unordered_set<uint64_t> result_type;
@@ -165,6 +197,32 @@ class log_store {
       return base_.extract(record, record_id, offset, length);
     }
 
+    /**
+     * Get a view of a record in the log-store given its record-id, without
+     * copying it.
+     *
+     * @param view The view to populate.
+     * @param record_id The id of the record being requested.
+     * @return true if the record exists, false otherwise.
+     */
+    bool view(record_view& view, const uint64_t record_id) const {
+      return base_.view(view, record_id);
+    }
+
+    /**
+     * Visit a batch of records without copying them.
+     *
+     * @param record_ids The ids of the records.
+     * @param num_records The number of record ids.
+     * @param fn The visitor, invoked as fn(record_id, view).
+     * @return The number of records visited.
+     */
+    template<typename visitor_type>
+    size_t multi_get(const uint64_t* record_ids, size_t num_records,
+                     visitor_type fn) const {
+      return base_.multi_get(record_ids, num_records, fn);
+    }
+
     /**
      * Filter index-entries based on query.
      *
@@ -178,6 +236,20 @@ class log_store {
       return base_.filter(index_id, tok_min, tok_max);
     }
 
+    /**
+     * Filter index-entries of a radix index based on a key prefix.
+     *
+     * @param index_id The id for the (radix) index to query.
+     * @param prefix The key prefix (big-endian).
+     * @param prefix_bits The length of the prefix in bits.
+     * @return The filter results.
+     */
+    filter_result filter_prefix(const identifier_t index_id, const uint8_t* prefix,
+                                const uint32_t prefix_bits) const {
+      return base_.filter_prefix(index_id, prefix, prefix_bits,
+                                 base_.olog_->num_ids());
+    }
+
     /**
      * Get the stream associated with a given stream id.
      *
@@ -225,26 +297,73 @@ class log_store {
    */
   log_store() {
     /* Initialize data log and offset log */
-    dlog_ = new datalog;
-    olog_ = new offsetlog;
+    dlog_ = allocator::new_object<datalog>();
+    olog_ = allocator::new_object<offsetlog>();
 
     /* Initialize data log tail to zero. */
     dtail_.store(0);
 
     /* Initialize all index classes */
-    idx1_ = new monolog_linearizable<__index1 *>;
-    idx2_ = new monolog_linearizable<__index2 *>;
-    idx3_ = new monolog_linearizable<__index3 *>;
-    idx4_ = new monolog_linearizable<__index4 *>;
-    idx5_ = new monolog_linearizable<__index5 *>;
-    idx6_ = new monolog_linearizable<__index6 *>;
-    idx7_ = new monolog_linearizable<__index7 *>;
-    idx8_ = new monolog_linearizable<__index8 *>;
+    idx1_ = allocator::new_object<monolog_linearizable<__index1 *>>();
+    idx2_ = allocator::new_object<monolog_linearizable<__index2 *>>();
+    idx3_ = allocator::new_object<monolog_linearizable<__index3 *>>();
+    idx4_ = allocator::new_object<monolog_linearizable<__index4 *>>();
+    idx5_ = allocator::new_object<monolog_linearizable<__index5 *>>();
+    idx6_ = allocator::new_object<monolog_linearizable<__index6 *>>();
+    idx7_ = allocator::new_object<monolog_linearizable<__index7 *>>();
+    idx8_ = allocator::new_object<monolog_linearizable<__index8 *>>();
+    idx16_ = allocator::new_object<monolog_linearizable<__index16 *>>();
 
     /* Initialize stream logs */
     streams_ = new monolog_linearizable<streamlog*>;
   }
 
+  /**
+   * Constructor to query the logs of another log-store, e.g., one that lives
+   * in another process and allocates its logs from a shared memory region
+   * mapped into this one. The logs are only read: records become visible as
+   * the other log-store's offset log read tail passes them, exactly as for
+   * its own readers. Inserts, new indexes and streams are not supported.
+   *
+   * @param layout The layout of the other log-store.
+   */
+  explicit log_store(const logstore_layout& layout) {
+    dlog_ = layout.dlog;
+    olog_ = layout.olog;
+    dtail_.store(0);
+    idx1_ = layout.idx1;
+    idx2_ = layout.idx2;
+    idx3_ = layout.idx3;
+    idx4_ = layout.idx4;
+    idx5_ = layout.idx5;
+    idx6_ = layout.idx6;
+    idx7_ = layout.idx7;
+    idx8_ = layout.idx8;
+    idx16_ = layout.idx16;
+    streams_ = new monolog_linearizable<streamlog*>;
+  }
+
+  /**
+   * Get the layout of the log-store's logs.
+   *
+   * @return The layout.
+   */
+  logstore_layout layout() const {
+    logstore_layout l;
+    l.dlog = dlog_;
+    l.olog = olog_;
+    l.idx1 = idx1_;
+    l.idx2 = idx2_;
+    l.idx3 = idx3_;
+    l.idx4 = idx4_;
+    l.idx5 = idx5_;
+    l.idx6 = idx6_;
+    l.idx7 = idx7_;
+    l.idx8 = idx8_;
+    l.idx16 = idx16_;
+    return l;
+  }
+
   /**
    * Get a handle to the log-store.
    *
@@ -264,26 +383,64 @@ class log_store {
   identifier_t add_index(len_t token_length) {
     switch (token_length) {
     case 1:
-      return OFFSET1 + idx1_->push_back(new __index1);
+      return OFFSET1 + idx1_->push_back(allocator::new_object<__index1>());
     case 2:
-      return OFFSET2 + idx2_->push_back(new __index2);
+      return OFFSET2 + idx2_->push_back(allocator::new_object<__index2>());
     case 3:
-      return OFFSET3 + idx3_->push_back(new __index3);
+      return OFFSET3 + idx3_->push_back(allocator::new_object<__index3>());
     case 4:
-      return OFFSET4 + idx4_->push_back(new __index4);
+      return OFFSET4 + idx4_->push_back(allocator::new_object<__index4>());
     case 5:
-      return OFFSET5 + idx5_->push_back(new __index5);
+      return OFFSET5 + idx5_->push_back(allocator::new_object<__index5>());
     case 6:
-      return OFFSET6 + idx6_->push_back(new __index6);
+      return OFFSET6 + idx6_->push_back(allocator::new_object<__index6>());
     case 7:
-      return OFFSET7 + idx7_->push_back(new __index7);
+      return OFFSET7 + idx7_->push_back(allocator::new_object<__index7>());
     case 8:
-      return OFFSET8 + idx8_->push_back(new __index8);
+      return OFFSET8 + idx8_->push_back(allocator::new_object<__index8>());
+    case 16:
+      return OFFSET16 + idx16_->push_back(allocator::new_object<__index16>());
     }
 
     return 0;
   }
 
+  /**
+   * Check if an index is a radix index (i.e., has keys longer than 8 bytes);
+   * radix indexes are queried by key prefix, via filter_prefix().
+   *
+   * @param index_id The id of the index.
+   * @return True if the index is a radix index, false otherwise.
+   */
+  static bool is_radix_index(const identifier_t index_id) {
+    return index_id / OFFSETMIN == OFFSET16 / OFFSETMIN;
+  }
+
+  /**
+   * Atomically filter record ids from a radix index for all keys that match a
+   * prefix.
+   *
+   * @param index_id The id of the (radix) index.
+   * @param prefix The key prefix (big-endian).
+   * @param prefix_bits The length of the prefix in bits.
+   * @param max_rid Largest record-id to consider.
+   * @param min_rid Smallest record-id to consider.
+   * @return The filter results.
+   */
+  filter_result filter_prefix(const identifier_t index_id, const uint8_t* prefix,
+                              const uint32_t prefix_bits,
+                              const uint64_t max_rid,
+                              const uint64_t min_rid = 0) const {
+    std::shared_ptr<entry_list_set> lists = std::make_shared<entry_list_set>();
+    if (is_radix_index(index_id)) {
+      idx16_->at(index_id % OFFSETMIN)->prefix_scan(prefix, prefix_bits,
+          [&lists](entry_list* list) {
+        lists->add(list);
+      });
+    }
+    return filter_result(lists, max_rid, min_rid);
+  }
+
   /**
    * Add a new stream with a specified filter function.
    *
@@ -384,6 +541,83 @@ class log_store {
     return true;
   }
 
+  /**
+   * Get a view of a record in the log-store given its record-id. The view
+   * points into the data log, which is never overwritten or freed while the
+   * log-store exists, so no copy is made.
+   *
+   * @param view The view to populate.
+   * @param record_id The id of the record being requested.
+   * @return true if the record exists, false otherwise.
+   */
+  bool view(record_view& view, const uint64_t record_id) const {
+
+    /* Checks if the record_id has been written yet, returns false on failure. */
+    if (!olog_->is_valid(record_id))
+      return false;
+
+    uint64_t offset;
+    olog_->lookup(record_id, offset, view.length);
+    view.data = (const unsigned char*) dlog_->ptr(offset);
+    return true;
+  }
+
+  /**
+   * Visit a batch of records without copying them.
+   *
+   * Records are visited in data log order rather than in the given order:
+   * the record ids are sorted (so that offset log lookups are sequential), and
+   * the records are then visited by offset, with the record
+   * SLOG_MULTI_GET_PREFETCH positions ahead prefetched, so that scattered
+   * records (e.g., the results of a multi-clause query) do not each stall on a
+   * cache miss. Record ids that have not been written yet are skipped.
+   *
+   * @param record_ids The ids of the records.
+   * @param num_records The number of record ids.
+   * @param fn The visitor, invoked as fn(record_id, view).
+   * @return The number of records visited.
+   */
+  template<typename visitor_type>
+  size_t multi_get(const uint64_t* record_ids, size_t num_records,
+                   visitor_type fn) const {
+    struct located {
+      uint64_t offset;
+      uint64_t record_id;
+      uint16_t length;
+    };
+
+    std::vector<uint64_t> ids(record_ids, record_ids + num_records);
+    std::sort(ids.begin(), ids.end());
+
+    std::vector<located> recs;
+    recs.reserve(num_records);
+    for (uint64_t record_id : ids) {
+      if (!olog_->is_valid(record_id))
+        continue;
+      located rec;
+      rec.record_id = record_id;
+      olog_->lookup(record_id, rec.offset, rec.length);
+      recs.push_back(rec);
+    }
+    std::sort(recs.begin(), recs.end(),
+              [](const located& a, const located& b) {
+                return a.offset < b.offset;
+              });
+
+    size_t n = recs.size();
+    for (size_t i = 0; i < std::min(n, (size_t) SLOG_MULTI_GET_PREFETCH); i++)
+      __builtin_prefetch(dlog_->ptr(recs[i].offset));
+    for (size_t i = 0; i < n; i++) {
+      if (i + SLOG_MULTI_GET_PREFETCH < n)
+        __builtin_prefetch(dlog_->ptr(recs[i + SLOG_MULTI_GET_PREFETCH].offset));
+      record_view view;
+      view.data = (const unsigned char*) dlog_->ptr(recs[i].offset);
+      view.length = recs[i].length;
+      fn(recs[i].record_id, view);
+    }
+    return n;
+  }
+
   /**
    * Filter index-entries based on query.
    *
@@ -445,6 +679,7 @@ class log_store {
     index_size(storage_stats.idx_sizes, idx6_);
     index_size(storage_stats.idx_sizes, idx7_);
     index_size(storage_stats.idx_sizes, idx8_);
+    index_size(storage_stats.idx_sizes, idx16_);
 
     /* Get size of stream-logs */
     stream_size(storage_stats.stream_sizes);
@@ -585,6 +820,29 @@ class log_store {
     }
   }
 
+  /**
+   * Count index-entries for keys matching a prefix in a radix index.
+   * Note: This does not return a consistent count. This should only be
+   * used for heuristic measures, rather than the actual count. For actual
+   * count, use filter_prefix() operation.
+   *
+   * @param index_id The id of the (radix) index.
+   * @param prefix The key prefix (big-endian).
+   * @param prefix_bits The length of the prefix in bits.
+   * @return The count of the filter query.
+   */
+  uint64_t filter_prefix_count(const identifier_t index_id, const uint8_t* prefix,
+                               const uint32_t prefix_bits) const {
+    uint64_t count = 0;
+    if (is_radix_index(index_id)) {
+      idx16_->at(index_id % OFFSETMIN)->prefix_scan(prefix, prefix_bits,
+          [&count](entry_list* list) {
+        count += list->size();
+      });
+    }
+    return count;
+  }
+
   /**
    * Count index-entries for a range in an index.
    * Note: This does not return a consistent count. This should only be
@@ -596,7 +854,8 @@ class log_store {
    * @param tok_max Largest token to consider.
    * @return The count of the filter query.
    */
-  uint64_t filter_count(tiered_index_base* index, const uint64_t tok_min,
+  template<typename index_type>
+  uint64_t filter_count(const index_type* index, const uint64_t tok_min,
                         const uint64_t tok_max) const {
     uint64_t count = 0;
     for (uint64_t i = tok_min; i <= tok_max; i++) {
@@ -614,11 +873,12 @@ class log_store {
    * @param tok_min The smallest token to consider.
    * @param tok_man The largest token to consider.
    * @param max_rid Largest record-id to consider.
-   * @param superset The superset to which the results must belong.
+   * @param min_rid Smallest record-id to consider.
    * @return The filter results.
    */
   filter_result filter(const identifier_t index_id, const uint64_t tok_min,
-                       const uint64_t tok_max, const uint64_t max_rid) const {
+                       const uint64_t tok_max, const uint64_t max_rid,
+                       const uint64_t min_rid = 0) const {
 
     /* Identify which index the filter is on */
     identifier_t idx = index_id / OFFSETMIN;
@@ -626,21 +886,21 @@ class log_store {
 
     switch (idx) {
     case 1:
-      return filter(idx1_->at(off), tok_min, tok_max, max_rid);
+      return filter(idx1_->at(off), tok_min, tok_max, max_rid, min_rid);
     case 2:
-      return filter(idx2_->at(off), tok_min, tok_max, max_rid);
+      return filter(idx2_->at(off), tok_min, tok_max, max_rid, min_rid);
     case 4:
-      return filter(idx3_->at(off), tok_min, tok_max, max_rid);
+      return filter(idx3_->at(off), tok_min, tok_max, max_rid, min_rid);
     case 8:
-      return filter(idx4_->at(off), tok_min, tok_max, max_rid);
+      return filter(idx4_->at(off), tok_min, tok_max, max_rid, min_rid);
     case 16:
-      return filter(idx5_->at(off), tok_min, tok_max, max_rid);
+      return filter(idx5_->at(off), tok_min, tok_max, max_rid, min_rid);
     case 32:
-      return filter(idx6_->at(off), tok_min, tok_max, max_rid);
+      return filter(idx6_->at(off), tok_min, tok_max, max_rid, min_rid);
     case 64:
-      return filter(idx7_->at(off), tok_min, tok_max, max_rid);
+      return filter(idx7_->at(off), tok_min, tok_max, max_rid, min_rid);
     case 128:
-      return filter(idx8_->at(off), tok_min, tok_max, max_rid);
+      return filter(idx8_->at(off), tok_min, tok_max, max_rid, min_rid);
     default:
       return filter_result();
     }
@@ -659,10 +919,13 @@ class log_store {
    * @param tok_min The smallest token to consider.
    * @param tok_max The largest token to consider.
    * @param max_rid Largest record-id to consider.
+   * @param min_rid Smallest record-id to consider.
    */
-  filter_result filter(tiered_index_base* index, const uint64_t tok_min,
-                       const uint64_t tok_max, const uint64_t max_rid) const {
-    return filter_result(index, tok_min, tok_max, max_rid);
+  template<typename index_type>
+  filter_result filter(const index_type* index, const uint64_t tok_min,
+                       const uint64_t tok_max, const uint64_t max_rid,
+                       const uint64_t min_rid = 0) const {
+    return filter_result(index, tok_min, tok_max, max_rid, min_rid);
   }
 
   /**
@@ -724,6 +987,7 @@ class log_store {
   monolog_linearizable<__index6 *> *idx6_;
   monolog_linearizable<__index7 *> *idx7_;
   monolog_linearizable<__index8 *> *idx8_;
+  monolog_linearizable<__index16 *> *idx16_;
 
   /* Stream logs */
   monolog_linearizable<streamlog*> *streams_;
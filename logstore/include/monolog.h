@@ -6,8 +6,13 @@
 #include <atomic>
 #include <fstream>
 
+#include "allocator.h"
+#include "preallocator.h"
 #include "utils.h"
 
+#define SLOG_RESERVED_CHUNK_SHIFT 26  // Reserved ranges are populated 64MB at a time
+#define SLOG_RESERVED_CHUNK       (1UL << SLOG_RESERVED_CHUNK_SHIFT)
+
 namespace slog {
 
 template<typename monolog_impl>
@@ -70,6 +75,11 @@ class __monolog_base {
   static const size_t FBS = 16;
   static const size_t FBS_HIBIT = 4;
 
+  // Number of entries in bucket i (the largest buckets exceed 32 bits).
+  static inline size_t bucket_size(size_t i) {
+    return (size_t) 1 << (i + FBS_HIBIT);
+  }
+
   typedef std::atomic<T*> __atomic_bucket_ref;
 
   __monolog_base() {
@@ -77,12 +87,16 @@ class __monolog_base {
     for (auto& x : buckets_) {
       x.store(null_ptr, std::memory_order_release);
     }
-    buckets_[0].store(new T[FBS], std::memory_order_release);
+    buckets_[0].store(allocator::new_array<T>(FBS), std::memory_order_release);
+    prealloc_bucket_.store(0, std::memory_order_release);
   }
 
   ~__monolog_base() {
-    for (auto& x : buckets_) {
-      delete[] x.load(std::memory_order_acquire);
+    if (prealloc_bucket_.load(std::memory_order_acquire) != 0)
+      preallocator::cancel(this);
+    for (size_t i = 0; i < buckets_.size(); i++) {
+      allocator::delete_array(buckets_[i].load(std::memory_order_acquire),
+                              bucket_size(i));
     }
   }
 
@@ -98,17 +112,19 @@ class __monolog_base {
         try_allocate_bucket(i);
       }
     }
+    maybe_preallocate(bucket_idx2, pos2 ^ ((size_t) 1 << hibit2));
   }
 
   // Sets the data at index idx to val. Allocates memory if necessary.
   void set(size_t idx, const T val) {
     size_t pos = idx + FBS;
     size_t hibit = bit_utils::highest_bit(pos);
-    size_t bucket_off = pos ^ (1 << hibit);
+    size_t bucket_off = pos ^ ((size_t) 1 << hibit);
     size_t bucket_idx = hibit - FBS_HIBIT;
     if (buckets_[bucket_idx].load(std::memory_order_acquire) == NULL) {
       try_allocate_bucket(bucket_idx);
     }
+    maybe_preallocate(bucket_idx, bucket_off);
     buckets_[bucket_idx].load(std::memory_order_acquire)[bucket_off] = val;
   }
 
@@ -117,7 +133,7 @@ class __monolog_base {
   void set_unsafe(size_t idx, const T val) {
     size_t pos = idx + FBS;
     size_t hibit = bit_utils::highest_bit(pos);
-    size_t bucket_off = pos ^ (1 << hibit);
+    size_t bucket_off = pos ^ ((size_t) 1 << hibit);
     size_t bucket_idx = hibit - FBS_HIBIT;
     buckets_[bucket_idx].load(std::memory_order_acquire)[bucket_off] = val;
   }
@@ -126,7 +142,7 @@ class __monolog_base {
   void set(size_t idx, const T* data, const size_t len) {
     size_t pos = idx + FBS;
     size_t hibit = bit_utils::highest_bit(pos);
-    size_t bucket_off = pos ^ (1 << hibit);
+    size_t bucket_off = pos ^ ((size_t) 1 << hibit);
     size_t bucket_idx = hibit - FBS_HIBIT;
     size_t data_remaining = len * sizeof(T);
     size_t data_off = 0;
@@ -134,8 +150,9 @@ class __monolog_base {
       if (buckets_[bucket_idx].load(std::memory_order_acquire) == NULL) {
         try_allocate_bucket(bucket_idx);
       }
+      maybe_preallocate(bucket_idx, bucket_off);
       size_t bucket_remaining =
-        ((1U << (bucket_idx + FBS_HIBIT)) - bucket_off) * sizeof(T);
+        (bucket_size(bucket_idx) - bucket_off) * sizeof(T);
       size_t bytes_to_write = std::min(bucket_remaining, data_remaining);
       data_remaining -= bytes_to_write;
       data_off += bytes_to_write;
@@ -152,13 +169,13 @@ class __monolog_base {
   void set_unsafe(size_t idx, const T* data, const size_t len) {
     size_t pos = idx + FBS;
     size_t hibit = bit_utils::highest_bit(pos);
-    size_t bucket_off = pos ^ (1 << hibit);
+    size_t bucket_off = pos ^ ((size_t) 1 << hibit);
     size_t bucket_idx = hibit - FBS_HIBIT;
     size_t data_remaining = len * sizeof(T);
     size_t data_off = 0;
     while (data_remaining) {
       size_t bucket_remaining =
-        ((1U << (bucket_idx + FBS_HIBIT)) - bucket_off) * sizeof(T);
+        (bucket_size(bucket_idx) - bucket_off) * sizeof(T);
       size_t bytes_to_write = std::min(bucket_remaining, data_remaining);
       data_remaining -= bytes_to_write;
       data_off += bytes_to_write;
@@ -173,7 +190,7 @@ class __monolog_base {
   T get(const size_t idx) const {
     size_t pos = idx + FBS;
     size_t hibit = bit_utils::highest_bit(pos);
-    size_t bucket_off = pos ^ (1 << hibit);
+    size_t bucket_off = pos ^ ((size_t) 1 << hibit);
     size_t bucket_idx = hibit - FBS_HIBIT;
     return buckets_[bucket_idx].load(std::memory_order_acquire)[bucket_off];
   }
@@ -181,7 +198,7 @@ class __monolog_base {
   T& operator[](const size_t idx) {
     size_t pos = idx + FBS;
     size_t hibit = bit_utils::highest_bit(pos);
-    size_t bucket_off = pos ^ (1 << hibit);
+    size_t bucket_off = pos ^ ((size_t) 1 << hibit);
     size_t bucket_idx = hibit - FBS_HIBIT;
     if (buckets_[bucket_idx].load(std::memory_order_acquire) == NULL) {
       try_allocate_bucket(bucket_idx);
@@ -195,13 +212,13 @@ class __monolog_base {
   void get(T* data, const size_t idx, const size_t len) const {
     size_t pos = idx + FBS;
     size_t hibit = bit_utils::highest_bit(pos);
-    size_t bucket_off = pos ^ (1 << hibit);
+    size_t bucket_off = pos ^ ((size_t) 1 << hibit);
     size_t bucket_idx = hibit - FBS_HIBIT;
     size_t data_remaining = len * sizeof(T);
     size_t data_off = 0;
     while (data_remaining) {
       size_t bucket_remaining =
-        ((1U << (bucket_idx + FBS_HIBIT)) - bucket_off) * sizeof(T);
+        (bucket_size(bucket_idx) - bucket_off) * sizeof(T);
       size_t bytes_to_read = std::min(bucket_remaining, data_remaining);
       data_remaining -= bytes_to_read;
       data_off += bytes_to_read;
@@ -214,14 +231,14 @@ class __monolog_base {
   }
 
   size_t storage_size() const {
-    size_t bucket_size = buckets_.size() * sizeof(__atomic_bucket_ref );
+    size_t refs_size = buckets_.size() * sizeof(__atomic_bucket_ref );
     size_t data_size = 0;
     for (size_t i = 0; i < buckets_.size(); i++) {
       if (buckets_[i].load(std::memory_order_acquire) != NULL) {
-        data_size += ((1U << (i + FBS_HIBIT)) * sizeof(T));
+        data_size += bucket_size(i) * sizeof(T);
       }
     }
-    return bucket_size + data_size;
+    return refs_size + data_size;
   }
 
  protected:
@@ -229,8 +246,10 @@ class __monolog_base {
   // succeeded in allocating the bucket, the current thread deallocates and
   // returns.
   size_t try_allocate_bucket(size_t bucket_idx) {
-    size_t size = (1U << (bucket_idx + FBS_HIBIT));
-    T* new_bucket = new T[size];
+    size_t size = bucket_size(bucket_idx);
+    if (size * sizeof(T) >= SLOG_PREALLOC_MIN_BYTES)
+      preallocator::record_stall(size * sizeof(T));
+    T* new_bucket = allocator::new_array<T>(size);
     T* null_ptr = NULL;
 
     // Only one thread will be successful in replacing the NULL reference with newly
@@ -239,13 +258,50 @@ class __monolog_base {
           &buckets_[bucket_idx], &null_ptr, new_bucket, std::memory_order_release,
           std::memory_order_acquire)) {
       // All other threads will deallocate the newly allocated bucket.
-      delete[] new_bucket;
+      allocator::delete_array(new_bucket, size);
     }
 
     return size;
   }
 
+  // Requests the next bucket to be allocated in the background once a writer
+  // crosses the midpoint of the current bucket, if the next bucket is large.
+  inline void maybe_preallocate(size_t bucket_idx, size_t bucket_off) {
+    size_t size = bucket_size(bucket_idx);
+    if (__builtin_expect(2 * size * sizeof(T) < SLOG_PREALLOC_MIN_BYTES, 1)
+        || bucket_off < size / 2 || bucket_idx + 1 >= NBUCKETS)
+      return;
+
+    size_t requested = prealloc_bucket_.load(std::memory_order_relaxed);
+    if (requested > bucket_idx || !preallocator::running()
+        || !prealloc_bucket_.compare_exchange_strong(requested, bucket_idx + 1))
+      return;
+    size_t next_idx = bucket_idx + 1;
+    preallocator::request(this, [this, next_idx] {
+      preallocate_bucket(next_idx);
+    });
+  }
+
+  // Allocates and pre-faults the specified bucket (from the preallocator),
+  // unless a writer allocated it first.
+  void preallocate_bucket(size_t bucket_idx) {
+    if (buckets_[bucket_idx].load(std::memory_order_acquire) != NULL)
+      return;
+    size_t size = bucket_size(bucket_idx);
+    T* new_bucket = allocator::new_array<T>(size);
+    preallocator::prefault(new_bucket, size * sizeof(T));
+    T* null_ptr = NULL;
+    if (!std::atomic_compare_exchange_strong_explicit(
+          &buckets_[bucket_idx], &null_ptr, new_bucket, std::memory_order_release,
+          std::memory_order_acquire)) {
+      allocator::delete_array(new_bucket, size);
+      return;
+    }
+    preallocator::record_prealloc(size * sizeof(T));
+  }
+
   std::array<__atomic_bucket_ref, NBUCKETS> buckets_;  // Stores the pointers to the buckets for MonoLog.
+  std::atomic<size_t> prealloc_bucket_;  // Highest bucket requested from the preallocator
 };
 
 template<class T, size_t NBUCKETS = 1024, size_t BLOCK_SIZE = 1073741824UL>
@@ -253,18 +309,23 @@ class __monolog_linear_base {
  public:
   typedef std::atomic<T*> __atomic_bucket_ref;
   static const size_t BUFFER_SIZE = 1024; // 1KB buffer size
+  static const size_t BUCKET_BYTES = (BLOCK_SIZE + BUFFER_SIZE) * sizeof(T);
 
   __monolog_linear_base() {
     T* null_ptr = NULL;
     for (auto& x : buckets_) {
       x = null_ptr;
     }
-    buckets_[0] = new T[BLOCK_SIZE + BUFFER_SIZE];
+    buckets_[0] = allocator::new_array<T>(BLOCK_SIZE + BUFFER_SIZE);
+    prealloc_bucket_.store(0, std::memory_order_release);
   }
 
   ~__monolog_linear_base() {
+    if (prealloc_bucket_.load(std::memory_order_acquire) != 0)
+      preallocator::cancel(this);
     for (auto& x : buckets_) {
-      delete[] x.load(std::memory_order_acquire);
+      allocator::delete_array(x.load(std::memory_order_acquire),
+                              BLOCK_SIZE + BUFFER_SIZE);
     }
   }
 
@@ -276,6 +337,7 @@ class __monolog_linear_base {
         try_allocate_bucket(i);
       }
     }
+    maybe_preallocate(bucket_idx2, idx2 % BLOCK_SIZE);
   }
 
   // Sets the data at index idx to val. Allocates memory if necessary.
@@ -285,6 +347,7 @@ class __monolog_linear_base {
     if (buckets_[bucket_idx].load(std::memory_order_acquire) == NULL) {
       try_allocate_bucket(bucket_idx);
     }
+    maybe_preallocate(bucket_idx, bucket_off);
     buckets_[bucket_idx].load(std::memory_order_acquire)[bucket_off] = val;
   }
 
@@ -364,7 +427,9 @@ class __monolog_linear_base {
   // succeeded in allocating the bucket, the current thread deallocates and
   // returns.
   void try_allocate_bucket(size_t bucket_idx) {
-    T* bucket = new T[BLOCK_SIZE + BUFFER_SIZE];
+    if (BUCKET_BYTES >= SLOG_PREALLOC_MIN_BYTES)
+      preallocator::record_stall(BUCKET_BYTES);
+    T* bucket = allocator::new_array<T>(BLOCK_SIZE + BUFFER_SIZE);
     T* null_ptr = NULL;
 
     // Only one thread will be successful in replacing the NULL reference with newly
@@ -373,11 +438,223 @@ class __monolog_linear_base {
           &buckets_[bucket_idx], &null_ptr, bucket, std::memory_order_release,
           std::memory_order_acquire)) {
       // All other threads will deallocate the newly allocated bucket.
-      delete[] bucket;
+      allocator::delete_array(bucket, BLOCK_SIZE + BUFFER_SIZE);
     }
   }
 
+  // Requests the next bucket to be allocated in the background once a writer
+  // crosses the midpoint of the current bucket.
+  inline void maybe_preallocate(size_t bucket_idx, size_t bucket_off) {
+    if (BUCKET_BYTES < SLOG_PREALLOC_MIN_BYTES || bucket_off < BLOCK_SIZE / 2
+        || bucket_idx + 1 >= NBUCKETS)
+      return;
+
+    size_t requested = prealloc_bucket_.load(std::memory_order_relaxed);
+    if (requested > bucket_idx || !preallocator::running()
+        || !prealloc_bucket_.compare_exchange_strong(requested, bucket_idx + 1))
+      return;
+    size_t next_idx = bucket_idx + 1;
+    preallocator::request(this, [this, next_idx] {
+      preallocate_bucket(next_idx);
+    });
+  }
+
+  // Allocates and pre-faults the specified bucket (from the preallocator),
+  // unless a writer allocated it first.
+  void preallocate_bucket(size_t bucket_idx) {
+    if (buckets_[bucket_idx].load(std::memory_order_acquire) != NULL)
+      return;
+    T* bucket = allocator::new_array<T>(BLOCK_SIZE + BUFFER_SIZE);
+    preallocator::prefault(bucket, BUCKET_BYTES);
+    T* null_ptr = NULL;
+    if (!std::atomic_compare_exchange_strong_explicit(
+          &buckets_[bucket_idx], &null_ptr, bucket, std::memory_order_release,
+          std::memory_order_acquire)) {
+      allocator::delete_array(bucket, BLOCK_SIZE + BUFFER_SIZE);
+      return;
+    }
+    preallocator::record_prealloc(BUCKET_BYTES);
+  }
+
   std::array<__atomic_bucket_ref, NBUCKETS> buckets_;  // Stores the pointers to the buckets for MonoLog.
+  std::atomic<size_t> prealloc_bucket_;  // Highest bucket requested from the preallocator
+};
+
+/**
+ * Base class for a MonoLog backed by a single contiguous range of virtual
+ * address space.
+ *
+ * The range for all MAX_ENTRIES entries is reserved up front (MAP_NORESERVE),
+ * and pages are only backed by memory as they are first written. Entries are
+ * addressed with a plain pointer add instead of a bucket lookup, and
+ * contiguous ranges are read and written with a single memcpy. Implements the
+ * interfaces of both __monolog_base and __monolog_linear_base, so it can back
+ * entry lists as well as the offset and data logs.
+ *
+ * As writers cross the midpoint of a 64MB chunk of the range, the next chunk
+ * is populated by the preallocator; a writer that reaches a chunk that has not
+ * been populated yet faults its pages in inline, which is counted as a stall.
+ *
+ * Each log costs a mapping, and at least one page once written, so the
+ * variant suits a few large logs better than many small ones.
+ */
+template<class T, size_t MAX_ENTRIES>
+class __monolog_reserved_base {
+ public:
+  static const size_t RESERVED_BYTES = MAX_ENTRIES * sizeof(T);
+
+  __monolog_reserved_base() {
+    data_ = (T*) allocator::reserve(RESERVED_BYTES);
+    reached_chunk_.store(0, std::memory_order_release);
+    populated_chunk_.store(0, std::memory_order_release);
+    prealloc_chunk_.store(0, std::memory_order_release);
+  }
+
+  ~__monolog_reserved_base() {
+    if (prealloc_chunk_.load(std::memory_order_acquire) != 0)
+      preallocator::cancel(this);
+    allocator::release(data_, RESERVED_BYTES);
+  }
+
+  void ensure_alloc(size_t, size_t end_idx) {
+    check_capacity(end_idx);
+    advance(end_idx);
+  }
+
+  // Sets the data at index idx to val.
+  void set(size_t idx, const T val) {
+    check_capacity(idx + 1);
+    advance(idx + 1);
+    data_[idx] = val;
+  }
+
+  void set_unsafe(size_t idx, const T val) {
+    data_[idx] = val;
+  }
+
+  // Sets a contiguous region of the MonoLog to the provided data.
+  void set(size_t idx, const T* data, const size_t len) {
+    check_capacity(idx + len);
+    advance(idx + len);
+    memcpy(data_ + idx, data, len * sizeof(T));
+  }
+
+  void set_unsafe(size_t idx, const T* data, const size_t len) {
+    memcpy(data_ + idx, data, len * sizeof(T));
+  }
+
+  // Write len bytes of data at offset.
+  void write(const size_t offset, const T* data, const size_t len) {
+    check_capacity(offset + len);
+    advance(offset + len);
+    memcpy(data_ + offset, data, len);
+  }
+
+  void write_unsafe(const size_t offset, const T* data, const size_t len) {
+    memcpy(data_ + offset, data, len);
+  }
+
+  T get(const size_t idx) const {
+    return data_[idx];
+  }
+
+  // Copies a contiguous region of the MonoLog into the provided buffer.
+  void get(T* data, const size_t idx, const size_t len) const {
+    memcpy(data, data_ + idx, len * sizeof(T));
+  }
+
+  // Get len bytes of data at offset.
+  void read(const size_t offset, T* data, const size_t len) const {
+    memcpy(data, data_ + offset, len);
+  }
+
+  T& operator[](const size_t idx) {
+    check_capacity(idx + 1);
+    advance(idx + 1);
+    return data_[idx];
+  }
+
+  void* ptr(const size_t offset) {
+    return (void*) (data_ + offset);
+  }
+
+  // Bytes of the range that are backed by memory.
+  size_t storage_size() const {
+    size_t len = std::min(RESERVED_BYTES,
+        (reached_chunk_.load(std::memory_order_acquire) + 1) * SLOG_RESERVED_CHUNK);
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> vec(SLOG_RESERVED_CHUNK / page_size);
+    size_t resident = 0;
+    for (size_t off = 0; off < len; off += SLOG_RESERVED_CHUNK) {
+      size_t chunk_len = std::min(SLOG_RESERVED_CHUNK, len - off);
+      if (mincore((char*) data_ + off, chunk_len, vec.data()) != 0)
+        return len;
+      for (size_t i = 0; i < (chunk_len + page_size - 1) / page_size; i++)
+        resident += (vec[i] & 1);
+    }
+    return resident * page_size;
+  }
+
+ protected:
+  inline void check_capacity(size_t end_idx) const {
+    if (__builtin_expect(end_idx > MAX_ENTRIES, 0))
+      throw std::bad_alloc();
+  }
+
+  // Tracks the chunk the writers have reached, and requests the next chunk to
+  // be populated in the background once a writer crosses a chunk's midpoint.
+  inline void advance(size_t end_idx) {
+    size_t end = end_idx * sizeof(T);
+    size_t chunk = end >> SLOG_RESERVED_CHUNK_SHIFT;
+    if (__builtin_expect(chunk > reached_chunk_.load(std::memory_order_relaxed), 0))
+      reach_chunk(chunk);
+    if (__builtin_expect((end & (SLOG_RESERVED_CHUNK - 1))
+                         >= SLOG_RESERVED_CHUNK / 2, 0)
+        && chunk >= prealloc_chunk_.load(std::memory_order_relaxed))
+      maybe_preallocate(chunk);
+  }
+
+  void reach_chunk(size_t chunk) {
+    size_t reached = reached_chunk_.load(std::memory_order_relaxed);
+    while (reached < chunk) {
+      if (reached_chunk_.compare_exchange_weak(reached, chunk)) {
+        if (populated_chunk_.load(std::memory_order_acquire) < chunk)
+          preallocator::record_stall(SLOG_RESERVED_CHUNK);
+        return;
+      }
+    }
+  }
+
+  void maybe_preallocate(size_t chunk) {
+    if ((chunk + 1) * SLOG_RESERVED_CHUNK >= RESERVED_BYTES)
+      return;
+
+    size_t requested = prealloc_chunk_.load(std::memory_order_relaxed);
+    if (requested > chunk || !preallocator::running()
+        || !prealloc_chunk_.compare_exchange_strong(requested, chunk + 1))
+      return;
+    size_t next_chunk = chunk + 1;
+    preallocator::request(this, [this, next_chunk] {
+      populate_chunk(next_chunk);
+    });
+  }
+
+  // Populates the specified chunk (from the preallocator); writers may
+  // already be writing to it.
+  void populate_chunk(size_t chunk) {
+    size_t off = chunk * SLOG_RESERVED_CHUNK;
+    size_t len = std::min(SLOG_RESERVED_CHUNK, RESERVED_BYTES - off);
+    preallocator::populate((char*) data_ + off, len);
+    preallocator::record_prealloc(len);
+    size_t populated = populated_chunk_.load(std::memory_order_relaxed);
+    while (populated < chunk
+           && !populated_chunk_.compare_exchange_weak(populated, chunk));
+  }
+
+  T* data_;
+  std::atomic<size_t> reached_chunk_;    // Highest chunk writers have reached
+  std::atomic<size_t> populated_chunk_;  // Highest chunk populated in the background
+  std::atomic<size_t> prealloc_chunk_;   // Highest chunk requested from the preallocator
 };
 
 template<class T, size_t NBUCKETS = 32>
@@ -388,6 +665,11 @@ class __atomic_monolog_base {
   static const size_t FBS = 16;
   static const size_t FBS_HIBIT = 4;
 
+  // Number of entries in bucket i (the largest buckets exceed 32 bits).
+  static inline size_t bucket_size(size_t i) {
+    return (size_t) 1 << (i + FBS_HIBIT);
+  }
+
   typedef std::atomic<T> __atomic_ref;
   typedef std::atomic<__atomic_ref *> __atomic_bucket_ref;
 
@@ -396,12 +678,13 @@ class __atomic_monolog_base {
     for (auto& x : buckets_) {
       x.store(null_ptr, std::memory_order_release);
     }
-    buckets_[0].store(new __atomic_ref[FBS], std::memory_order_release);
+    buckets_[0].store(new_bucket(FBS), std::memory_order_release);
   }
 
   ~__atomic_monolog_base() {
-    for (auto& x : buckets_) {
-      delete[] x.load(std::memory_order_acquire);
+    for (size_t i = 0; i < buckets_.size(); i++) {
+      allocator::delete_array(buckets_[i].load(std::memory_order_acquire),
+                              bucket_size(i));
     }
   }
 
@@ -423,7 +706,7 @@ class __atomic_monolog_base {
   void store(size_t idx, const T val) {
     size_t pos = idx + FBS;
     size_t hibit = bit_utils::highest_bit(pos);
-    size_t bucket_off = pos ^ (1 << hibit);
+    size_t bucket_off = pos ^ ((size_t) 1 << hibit);
     size_t bucket_idx = hibit - FBS_HIBIT;
     if (buckets_[bucket_idx].load(std::memory_order_acquire) == NULL) {
       try_allocate_bucket(bucket_idx);
@@ -434,7 +717,7 @@ class __atomic_monolog_base {
   __atomic_ref& operator[](const size_t idx) {
     size_t pos = idx + FBS;
     size_t hibit = bit_utils::highest_bit(pos);
-    size_t bucket_off = pos ^ (1 << hibit);
+    size_t bucket_off = pos ^ ((size_t) 1 << hibit);
     size_t bucket_idx = hibit - FBS_HIBIT;
     if (buckets_[bucket_idx].load(std::memory_order_acquire) == NULL) {
       try_allocate_bucket(bucket_idx);
@@ -450,7 +733,7 @@ class __atomic_monolog_base {
   T load(const size_t idx) const {
     size_t pos = idx + FBS;
     size_t hibit = bit_utils::highest_bit(pos);
-    size_t bucket_off = pos ^ (1 << hibit);
+    size_t bucket_off = pos ^ ((size_t) 1 << hibit);
     size_t bucket_idx = hibit - FBS_HIBIT;
     return buckets_[bucket_idx].load(std::memory_order_acquire)[bucket_off].load(std::memory_order_acquire);
   }
@@ -458,7 +741,7 @@ class __atomic_monolog_base {
   bool cas(const size_t idx, T& expected, T replacement) {
     size_t pos = idx + FBS;
     size_t hibit = bit_utils::highest_bit(pos);
-    size_t bucket_off = pos ^ (1 << hibit);
+    size_t bucket_off = pos ^ ((size_t) 1 << hibit);
     size_t bucket_idx = hibit - FBS_HIBIT;
     return buckets_[bucket_idx].load(std::memory_order_acquire)[bucket_off]
            .atomic_compare_exchange_strong_explicit(expected, replacement,
@@ -470,7 +753,7 @@ class __atomic_monolog_base {
   // succeeded in allocating the bucket, the current thread deallocates and
   // returns.
   size_t try_allocate_bucket(size_t bucket_idx) {
-    size_t size = (1U << (bucket_idx + FBS_HIBIT));
+    size_t size = bucket_size(bucket_idx);
     __atomic_ref* bucket = new_bucket(size);
     __atomic_ref* null_ptr = NULL;
 
@@ -479,14 +762,14 @@ class __atomic_monolog_base {
     if (!std::atomic_compare_exchange_strong_explicit(&buckets_[bucket_idx], &null_ptr,
         bucket, std::memory_order_release, std::memory_order_acquire)) {
       // All other threads will deallocate the newly allocated bucket.
-      delete[] bucket;
+      allocator::delete_array(bucket, size);
     }
 
     return size;
   }
 
   __atomic_ref* new_bucket(size_t size) {
-    __atomic_ref* bucket = new __atomic_ref[size];
+    __atomic_ref* bucket = allocator::new_array<__atomic_ref>(size);
     for (size_t i = 0; i < size; i++) {
       bucket[i].store(T(0), std::memory_order_release);
     }
@@ -504,9 +787,13 @@ class __atomic_monolog_base {
  *   read operations can access data for all completed writes.
  * - Completion times for write operations are strictly ordered by their
  *   start times.
+ *
+ * The base_type determines how entries are stored: in exponentially growing
+ * buckets (__monolog_base), or in one reserved range (__monolog_reserved_base).
  */
-template<class T, size_t NBUCKETS = 32>
-class monolog_linearizable : public __monolog_base<T, NBUCKETS> {
+template<class T, size_t NBUCKETS = 32,
+         class base_type = __monolog_base<T, NBUCKETS>>
+class monolog_linearizable : public base_type {
  public:
   // Type definitions
   typedef size_t size_type;
@@ -515,7 +802,7 @@ class monolog_linearizable : public __monolog_base<T, NBUCKETS> {
   typedef T difference_type;
   typedef T* pointer;
   typedef T reference;
-  typedef monolog_iterator<monolog_linearizable<T, NBUCKETS>> iterator;
+  typedef monolog_iterator<monolog_linearizable<T, NBUCKETS, base_type>> iterator;
 
   monolog_linearizable()
     : write_tail_(0),
@@ -569,9 +856,13 @@ class monolog_linearizable : public __monolog_base<T, NBUCKETS> {
  *
  * Maintains a single tail that ensures:
  * - Write operations are atomic
+ *
+ * The base_type determines how entries are stored, as for
+ * monolog_linearizable.
  */
-template<class T, size_t NBUCKETS = 32>
-class monolog_relaxed : public __monolog_base<T, NBUCKETS> {
+template<class T, size_t NBUCKETS = 32,
+         class base_type = __monolog_base<T, NBUCKETS>>
+class monolog_relaxed : public base_type {
  public:
   // Type definitions
   typedef size_t size_type;
@@ -580,7 +871,7 @@ class monolog_relaxed : public __monolog_base<T, NBUCKETS> {
   typedef T difference_type;
   typedef T* pointer;
   typedef T reference;
-  typedef monolog_iterator<monolog_relaxed<T, NBUCKETS>> iterator;
+  typedef monolog_iterator<monolog_relaxed<T, NBUCKETS, base_type>> iterator;
 
   monolog_relaxed()
     : tail_(0) {
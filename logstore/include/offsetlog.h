@@ -6,11 +6,19 @@
 #include "monolog.h"
 #include "utils.h"
 
+#ifndef SLOG_OFFSETLOG_RESERVE
+#define SLOG_OFFSETLOG_RESERVE (1UL << 34)  // Max records in a reserved offset log
+#endif
+
 namespace slog {
 
 class offsetlog {
  public:
+#ifdef SLOG_RESERVED_OFFSETLOG
+  typedef __monolog_reserved_base<uint64_t, SLOG_OFFSETLOG_RESERVE> offlen_type;
+#else
   typedef __monolog_linear_base <uint64_t, 1024, 16777216> offlen_type;
+#endif
 
   offsetlog() {
     current_write_id_.store(0L);
@@ -0,0 +1,246 @@
+#ifndef SLOG_PREALLOCATOR_H_
+#define SLOG_PREALLOCATOR_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "allocator.h"
+
+#define SLOG_PREALLOC_MIN_BYTES  (1UL << 21)  // Smaller buckets are allocated inline
+#define SLOG_PREFAULT_STRIDE     4096
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE      23
+#endif
+
+namespace slog {
+
+/**
+ * Background allocator for the buckets of growing logs.
+ *
+ * When a writer crosses the midpoint of a large bucket (at least
+ * SLOG_PREALLOC_MIN_BYTES) of a data log, offset log or entry list, the log
+ * asks the preallocator to allocate and pre-fault its next bucket. By the time
+ * the tail reaches that bucket it is already in place and its pages are
+ * mapped, so writers neither allocate nor page-fault on the hot path. Smaller
+ * buckets are cheap to allocate, and are always allocated inline.
+ *
+ * Buckets are bound to the NUMA node of the writer that requested them, not
+ * to the node of the preallocator thread.
+ *
+ * A writer that still finds a large bucket missing allocates it inline. While
+ * the preallocator runs, these stalls (it fell behind) are counted; when it
+ * does not run, all buckets are allocated inline by design, and none are.
+ */
+class preallocator {
+ public:
+  struct prealloc_stats {
+    std::atomic<uint64_t> requests;        // Buckets requested by writers
+    std::atomic<uint64_t> prealloc_bytes;  // Bytes allocated in the background
+    std::atomic<uint64_t> stalls;          // Large buckets allocated inline
+    std::atomic<uint64_t> stall_bytes;
+  };
+
+  /**
+   * Start the preallocator thread.
+   *
+   * @param core The core to pin the thread to, or -1 to not pin it.
+   */
+  static void start(int core = -1) {
+    preallocator& p = instance();
+    std::lock_guard<std::mutex> lock(p.mutex_);
+    if (p.running_.load(std::memory_order_acquire))
+      return;
+    p.running_.store(true, std::memory_order_release);
+    p.thread_ = std::thread(&preallocator::run, &p);
+    if (core >= 0) {
+      cpu_set_t cpuset;
+      CPU_ZERO(&cpuset);
+      CPU_SET(core, &cpuset);
+      pthread_setaffinity_np(p.thread_.native_handle(), sizeof(cpu_set_t),
+                             &cpuset);
+    }
+  }
+
+  /**
+   * Stop the preallocator thread; pending requests are dropped.
+   */
+  static void stop() {
+    instance().shutdown();
+  }
+
+  static bool running() {
+    return instance().running_.load(std::memory_order_relaxed);
+  }
+
+  static const prealloc_stats& stats() {
+    return instance().stats_;
+  }
+
+  /**
+   * Request a bucket to be allocated in the background.
+   *
+   * @param owner The log the bucket belongs to.
+   * @param task Allocates (and pre-faults) the bucket.
+   */
+  static void request(const void* owner, std::function<void()> task) {
+    preallocator& p = instance();
+    int node = allocator::current_node();
+    std::lock_guard<std::mutex> lock(p.mutex_);
+    if (!p.running_.load(std::memory_order_acquire))
+      return;
+    p.queue_.push_back(pending { owner, node, task });
+    p.stats_.requests.fetch_add(1, std::memory_order_relaxed);
+    p.cv_.notify_all();  // cv_ is shared with cancel()
+  }
+
+  /**
+   * Drop all pending requests for a log, and wait for a running one to
+   * complete; must be invoked before the log is destroyed.
+   *
+   * @param owner The log.
+   */
+  static void cancel(const void* owner) {
+    preallocator& p = instance();
+    std::unique_lock<std::mutex> lock(p.mutex_);
+    for (auto it = p.queue_.begin(); it != p.queue_.end();) {
+      if (it->owner == owner)
+        it = p.queue_.erase(it);
+      else
+        ++it;
+    }
+    p.cv_.wait(lock, [&p, owner] { return p.active_ != owner; });
+  }
+
+  /**
+   * Record a large bucket that a writer had to allocate inline; ignored if the
+   * preallocator is not running.
+   *
+   * @param bytes The size of the bucket.
+   */
+  static void record_stall(size_t bytes) {
+    if (!running())
+      return;
+    prealloc_stats& st = instance().stats_;
+    st.stalls.fetch_add(1, std::memory_order_relaxed);
+    st.stall_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  /**
+   * Record a bucket allocated in the background.
+   *
+   * @param bytes The size of the bucket.
+   */
+  static void record_prealloc(size_t bytes) {
+    instance().stats_.prealloc_bytes.fetch_add(bytes,
+                                               std::memory_order_relaxed);
+  }
+
+  /**
+   * Touch every page of a buffer, so that it is backed by memory before it is
+   * written to.
+   *
+   * @param ptr The buffer.
+   * @param bytes The size of the buffer.
+   */
+  static void prefault(void* ptr, size_t bytes) {
+    volatile char* p = (volatile char*) ptr;
+    for (size_t off = 0; off < bytes; off += SLOG_PREFAULT_STRIDE)
+      p[off] = 0;
+  }
+
+  /**
+   * Back every page of a buffer that writers may already be writing to with
+   * memory, without modifying its contents.
+   *
+   * @param ptr The buffer (page-aligned).
+   * @param bytes The size of the buffer.
+   */
+  static void populate(void* ptr, size_t bytes) {
+    if (madvise(ptr, bytes, MADV_POPULATE_WRITE) == 0)
+      return;
+    char* p = (char*) ptr;
+    for (size_t off = 0; off < bytes; off += SLOG_PREFAULT_STRIDE)
+      __atomic_fetch_add(p + off, 0, __ATOMIC_RELAXED);
+  }
+
+ private:
+  struct pending {
+    const void* owner;
+    int node;
+    std::function<void()> task;
+  };
+
+  preallocator()
+    : active_(NULL) {
+    running_.store(false);
+    stats_.requests.store(0);
+    stats_.prealloc_bytes.store(0);
+    stats_.stalls.store(0);
+    stats_.stall_bytes.store(0);
+  }
+
+  ~preallocator() {
+    shutdown();
+  }
+
+  static preallocator& instance() {
+    static preallocator p;
+    return p;
+  }
+
+  void shutdown() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      running_.store(false, std::memory_order_release);
+      queue_.clear();
+      cv_.notify_all();
+    }
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [this] {
+        return !queue_.empty() || !running_.load(std::memory_order_acquire);
+      });
+      if (!running_.load(std::memory_order_acquire))
+        break;
+
+      pending req = queue_.front();
+      queue_.pop_front();
+      active_ = req.owner;
+      lock.unlock();
+
+      allocator::set_thread_node(req.node);
+      req.task();
+
+      lock.lock();
+      active_ = NULL;
+      cv_.notify_all();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<pending> queue_;
+  const void* active_;
+  std::atomic<bool> running_;
+  std::thread thread_;
+  prealloc_stats stats_;
+};
+
+}
+
+#endif /* SLOG_PREALLOCATOR_H_ */
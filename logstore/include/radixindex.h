@@ -0,0 +1,514 @@
+#ifndef RADIXINDEX_H_
+#define RADIXINDEX_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "allocator.h"
+#include "entrylist.h"
+#include "slab.h"
+
+#define SLOG_RADIX_INITIAL_SLOTS  8   // Slots in the first table of a level
+#define SLOG_RADIX_GROWTH         16  // Each chained table is this much larger
+#define SLOG_RADIX_PROBES         8   // Slots probed per table before the next
+
+namespace slog {
+
+/**
+ * @brief A level of a radix index over fixed-length byte-string keys.
+ * @details A level of a radix index; each level consumes one 64-bit word of
+ * the key (e.g., the network and interface halves of an IPv6 address), and
+ * maps it to a next-level node with an insert-only hash table. Only keys that
+ * have been inserted take space, so a sparse address costs a couple of nodes
+ * and slots instead of a path of 256-slot arrays, and a lookup takes a few
+ * dependent loads per word instead of one per byte.
+ *
+ * The hash table is a chain of open-addressing tables of growing size. A key
+ * is probed in a window of SLOG_RADIX_PROBES slots of each table in turn, and
+ * lives in the first empty slot of its windows when it is inserted: a writer
+ * reserves the slot with a CAS, and only then creates the node from its slab
+ * and publishes it. The loser of a race waits for the winner's node, compares
+ * its key, and either returns it or probes on, so no node is created in vain.
+ * Published slots are never cleared, so a reader that finds an empty slot in
+ * a key's window knows the key does not exist; readers skip reserved slots,
+ * and never wait. A writer that finds a full window in the last table chains
+ * a larger one, reserved the same way.
+ *
+ * @tparam WORDS Number of levels (64-bit key words) below and including this
+ * one.
+ * @tparam value_type = entry_list The value type for the index.
+ */
+template<size_t WORDS, typename value_type = entry_list>
+class __radix_level;
+
+/**
+ * @brief Insert-only, lock-free hash table of radix nodes, keyed by a 64-bit
+ * key word; see __radix_level.
+ *
+ * @tparam node_type The node type; has a 64-bit key.
+ */
+template<typename node_type>
+class __radix_table {
+ public:
+  typedef std::atomic<node_type*> atomic_ref;
+
+  __radix_table() {
+    head_.store(NULL, std::memory_order_release);
+  }
+
+  ~__radix_table() {
+    table* t = published(head_);
+    while (t != NULL) {
+      table* next = published(t->next);
+      for (size_t i = 0; i <= t->mask; i++) {
+        node_type* node = t->slots()[i].load(std::memory_order_acquire);
+        if (node != reserved())
+          slab::delete_object(node);
+      }
+      allocator::deallocate(t, table_bytes(t->mask));
+      t = next;
+    }
+  }
+
+  /**
+   * @brief Creates and fetches the node for a key word.
+   *
+   * @param key The key word.
+   * @return Pointer to the node.
+   */
+  node_type* get(const uint64_t key) {
+    const uint64_t h = hash(key);
+    table* t = next_table(head_, SLOG_RADIX_INITIAL_SLOTS - 1);
+    while (true) {
+      for (size_t i = 0; i < probes(t); i++) {
+        atomic_ref& slot = t->slots()[(h + i) & t->mask];
+        node_type* node = slot.load(std::memory_order_acquire);
+        while (node == NULL || node == reserved()) {
+          if (node == NULL && slot.compare_exchange_strong(node, reserved(),
+              std::memory_order_acquire, std::memory_order_acquire))
+            return create(slot, key);
+          // Another writer is inserting a key here; wait to compare it
+          pause();
+          node = slot.load(std::memory_order_acquire);
+        }
+        if (node->key == key)
+          return node;
+      }
+      t = next_table(t->next, (t->mask + 1) * SLOG_RADIX_GROWTH - 1);
+    }
+  }
+
+  /**
+   * @brief Function for getting the node for a key word.
+   *
+   * @param key The key word.
+   * @return Pointer to the node, or NULL if the key does not exist.
+   */
+  node_type* at(const uint64_t key) const {
+    const uint64_t h = hash(key);
+    table* t = published(head_);
+    while (t != NULL) {
+      for (size_t i = 0; i < probes(t); i++) {
+        node_type* node = t->slots()[(h + i) & t->mask].load(
+            std::memory_order_acquire);
+        if (node == NULL)
+          return NULL;
+        if (node != reserved() && node->key == key)
+          return node;
+      }
+      t = published(t->next);
+    }
+    return NULL;
+  }
+
+  /**
+   * @brief Invoke a function on all nodes whose key words match under a mask.
+   *
+   * @param key The key word to match.
+   * @param mask The bits of the key word to match.
+   * @param fn The function to invoke on each node.
+   */
+  template<typename function_type>
+  void scan(const uint64_t key, const uint64_t mask, function_type& fn) const {
+    for (table* t = published(head_); t != NULL;
+         t = published(t->next)) {
+      for (size_t i = 0; i <= t->mask; i++) {
+        node_type* node = t->slots()[i].load(std::memory_order_acquire);
+        if (node != NULL && node != reserved()
+            && ((node->key ^ key) & mask) == 0)
+          fn(node);
+      }
+    }
+  }
+
+  /**
+   * @brief Get the storage size in bytes of the table and its nodes.
+   * @return The storage size in bytes.
+   */
+  size_t storage_size() {
+    size_t tot_size = sizeof(__radix_table);
+    for (table* t = published(head_); t != NULL;
+         t = published(t->next)) {
+      tot_size += table_bytes(t->mask);
+      for (size_t i = 0; i <= t->mask; i++) {
+        node_type* node = t->slots()[i].load(std::memory_order_acquire);
+        if (node != NULL && node != reserved())
+          tot_size += node->storage_size();
+      }
+    }
+    return tot_size;
+  }
+
+ private:
+  // Table header; the slots follow it in the same allocation.
+  struct table {
+    size_t mask;
+    std::atomic<table*> next;
+
+    atomic_ref* slots() {
+      return reinterpret_cast<atomic_ref*>(this + 1);
+    }
+  };
+
+  static size_t table_bytes(const size_t mask) {
+    return sizeof(table) + (mask + 1) * sizeof(atomic_ref);
+  }
+
+  static size_t probes(const table* t) {
+    return t->mask < SLOG_RADIX_PROBES ? t->mask + 1 : SLOG_RADIX_PROBES;
+  }
+
+  // Spreads key words that differ only in a few (e.g., low) bits.
+  static uint64_t hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ULL;
+    key ^= key >> 33;
+    return key;
+  }
+
+  // Get the table referenced by ref, creating one with mask + 1 slots if
+  // there is none. Only the thread that reserves the reference creates the
+  // table; the others wait for it.
+  static table* next_table(std::atomic<table*>& ref, const size_t mask) {
+    table* t = ref.load(std::memory_order_acquire);
+    if (__builtin_expect(t != NULL && t != reserved_table(), 1))
+      return t;
+
+    if (t == NULL && ref.compare_exchange_strong(t, reserved_table(),
+        std::memory_order_acquire, std::memory_order_acquire)) {
+      try {
+        t = (table*) allocator::allocate(table_bytes(mask));
+      } catch (...) {
+        ref.store(NULL, std::memory_order_release);
+        throw;
+      }
+      t->mask = mask;
+      t->next.store(NULL, std::memory_order_relaxed);
+      for (size_t i = 0; i <= mask; i++)
+        t->slots()[i].store(NULL, std::memory_order_relaxed);
+      ref.store(t, std::memory_order_release);
+      return t;
+    }
+    while (t == reserved_table()) {
+      pause();
+      t = ref.load(std::memory_order_acquire);
+    }
+    return t != NULL ? t : next_table(ref, mask);
+  }
+
+  // Create the node for a key in a slot reserved by this thread. If that
+  // fails, the slot is emptied again for the writers waiting on it.
+  static node_type* create(atomic_ref& slot, const uint64_t key) {
+    node_type* node;
+    try {
+      node = slab::new_object<node_type>();
+    } catch (...) {
+      slot.store(NULL, std::memory_order_release);
+      throw;
+    }
+    node->key = key;
+    slot.store(node, std::memory_order_release);
+    return node;
+  }
+
+  // Get the table referenced by ref, or NULL if it is still being created
+  static table* published(const std::atomic<table*>& ref) {
+    table* t = ref.load(std::memory_order_acquire);
+    return t == reserved_table() ? NULL : t;
+  }
+
+  // Marks a slot (or table reference) while its creator builds the node
+  static node_type* reserved() {
+    return reinterpret_cast<node_type*>(1);
+  }
+
+  static table* reserved_table() {
+    return reinterpret_cast<table*>(1);
+  }
+
+  static inline void pause() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+
+  std::atomic<table*> head_;
+};
+
+/**
+ * @brief Size of a slab-allocated object, i.e., rounded up to a cache line.
+ */
+template<typename T>
+constexpr size_t __radix_node_size() {
+  return (sizeof(T) + SLOG_SLAB_ALIGN - 1) & ~(SLOG_SLAB_ALIGN - 1);
+}
+
+/**
+ * @brief Read a key word (big-endian) from the first len bytes of a key.
+ */
+inline uint64_t __radix_word(const uint8_t* key, size_t len = 8) {
+  uint64_t word = 0;
+  for (size_t i = 0; i < 8; i++)
+    word = (word << 8) | (i < len ? key[i] : 0);
+  return word;
+}
+
+template<size_t WORDS, typename value_type>
+class __radix_level {
+ public:
+  typedef __radix_level<WORDS - 1, value_type> child_type;
+
+  struct node {
+    uint64_t key;
+    child_type child;
+
+    size_t storage_size() {
+      return __radix_node_size<node>() - sizeof(child_type)
+          + child.storage_size();
+    }
+  };
+
+  /**
+   * @brief Creates and fetches the value corresponding to the key.
+   * @details Obtain the value corresponding to the key; creates required
+   * internal structure for the value if it does not exist.
+   *
+   * @param key The (remaining) key bytes.
+   * @return Pointer to the value.
+   */
+  value_type* get(const uint8_t* key) {
+    return nodes_.get(__radix_word(key))->child.get(key + 8);
+  }
+
+  /**
+   * @brief Function for getting the value corresponding to a key.
+   * @details Function for getting the value corresponding to a key.
+   *
+   * @param key The (remaining) key bytes.
+   * @return Pointer to the value, or NULL if the key does not exist.
+   */
+  value_type* at(const uint8_t* key) const {
+    node* n = nodes_.at(__radix_word(key));
+    if (n)
+      return n->child.at(key + 8);
+    return NULL;
+  }
+
+  /**
+   * @brief Invoke a function on all values whose keys match a prefix.
+   * @details Invoke a function on all values whose keys match a prefix. A
+   * prefix that covers this level's key word is looked up; a shorter one
+   * visits all nodes of the level, and matches their key words.
+   *
+   * @param prefix The (remaining) prefix bytes.
+   * @param prefix_bits The (remaining) number of prefix bits.
+   * @param fn The function to invoke on each value.
+   */
+  template<typename function_type>
+  void prefix_scan(const uint8_t* prefix, size_t prefix_bits,
+                   function_type& fn) const {
+    if (prefix_bits >= 64) {
+      node* n = nodes_.at(__radix_word(prefix));
+      if (n)
+        n->child.prefix_scan(prefix + 8, prefix_bits - 64, fn);
+      return;
+    }
+
+    uint64_t mask = prefix_bits ? ~0ULL << (64 - prefix_bits) : 0;
+    auto visit = [&fn](node* n) {
+      n->child.prefix_scan(NULL, 0, fn);
+    };
+    nodes_.scan(prefix_bits ? __radix_word(prefix, (prefix_bits + 7) / 8) : 0,
+                mask, visit);
+  }
+
+  /**
+   * @brief Get the storage size in bytes of the level.
+   * @details Get the storage size in bytes of the level.
+   * @return The storage size in bytes of the level.
+   */
+  size_t storage_size() {
+    return nodes_.storage_size();
+  }
+
+ private:
+  __radix_table<node> nodes_;
+};
+
+/**
+ * @brief The last level of a radix index, which holds the values.
+ * @details The last level of a radix index, which holds the values.
+ *
+ * @tparam value_type The value type for the index.
+ */
+template<typename value_type>
+class __radix_level<1, value_type> {
+ public:
+  struct node {
+    uint64_t key;
+    value_type value;
+
+    size_t storage_size() {
+      return __radix_node_size<node>() - sizeof(value_type)
+          + value.storage_size();
+    }
+  };
+
+  value_type* get(const uint8_t* key) {
+    return &nodes_.get(__radix_word(key))->value;
+  }
+
+  value_type* at(const uint8_t* key) const {
+    node* n = nodes_.at(__radix_word(key));
+    if (n)
+      return &n->value;
+    return NULL;
+  }
+
+  template<typename function_type>
+  void prefix_scan(const uint8_t* prefix, size_t prefix_bits,
+                   function_type& fn) const {
+    if (prefix_bits >= 64) {
+      node* n = nodes_.at(__radix_word(prefix));
+      if (n)
+        fn(&n->value);
+      return;
+    }
+
+    uint64_t mask = prefix_bits ? ~0ULL << (64 - prefix_bits) : 0;
+    auto visit = [&fn](node* n) {
+      fn(&n->value);
+    };
+    nodes_.scan(prefix_bits ? __radix_word(prefix, (prefix_bits + 7) / 8) : 0,
+                mask, visit);
+  }
+
+  size_t storage_size() {
+    return nodes_.storage_size();
+  }
+
+ private:
+  __radix_table<node> nodes_;
+};
+
+/**
+ * @brief Radix index for fixed-length keys that are too long for tiered
+ * indexes (e.g., 128-bit IPv6 addresses).
+ * @details Radix index with one level per 64-bit key word. Keys are
+ * byte-strings in big-endian (network) order, so that a prefix of a key is a
+ * prefix of its words: prefixes of whole words are looked up, and only the
+ * level of the first partial word is scanned. For IPv6 addresses, scans of
+ * /64 and longer prefixes therefore only visit the addresses of one network.
+ *
+ * @tparam KEY_LEN The key length in bytes (a multiple of 8).
+ * @tparam value_type = entry_list The value type for the index.
+ */
+template<size_t KEY_LEN, typename value_type = entry_list>
+class __radix_index {
+  static_assert(KEY_LEN > 0 && KEY_LEN % 8 == 0,
+                "Radix index keys must be a multiple of 8 bytes");
+
+ public:
+  /**
+   * @brief Creates and fetches the value corresponding to the key.
+   * @details Obtain the value corresponding to the key; creates required
+   * internal structure for the value if it does not exist.
+   *
+   * @param key The key (KEY_LEN bytes).
+   * @return Pointer to the value.
+   */
+  value_type* get(const uint8_t* key) {
+    return root_.get(key);
+  }
+
+  /**
+   * @brief Function for getting the value corresponding to a key.
+   * @details Function for getting the value corresponding to a key.
+   *
+   * @param key The key (KEY_LEN bytes).
+   * @return Pointer to the value, or NULL if the key does not exist.
+   */
+  value_type* at(const uint8_t* key) const {
+    return root_.at(key);
+  }
+
+  /**
+   * @brief Add a new (key, value-entry) pair to the index.
+   * @details Add a new (key, value-entry) pair to the index.
+   *
+   * @param key The key to add (KEY_LEN bytes).
+   * @param val The value-entry to add.
+   */
+  void add_entry(const uint8_t* key, const uint64_t val) {
+    value_type* list = get(key);
+    list->push_back(val);
+  }
+
+  /**
+   * @brief Invoke a function on all values whose keys match a prefix.
+   * @details Invoke a function on all values whose keys match a prefix.
+   *
+   * @param prefix The prefix (at least ceil(prefix_bits / 8) bytes).
+   * @param prefix_bits The prefix length in bits (at most 8 * KEY_LEN).
+   * @param fn The function to invoke on each value.
+   */
+  template<typename function_type>
+  void prefix_scan(const uint8_t* prefix, size_t prefix_bits,
+                   function_type fn) const {
+    if (prefix_bits > 8 * KEY_LEN)
+      prefix_bits = 8 * KEY_LEN;
+    root_.prefix_scan(prefix, prefix_bits, fn);
+  }
+
+  /**
+   * @brief Get the key length (in bytes) for the index.
+   * @details Get the key length (in bytes) for the index.
+   * @return The key length (in bytes) for the index.
+   */
+  size_t key_length() {
+    return KEY_LEN;
+  }
+
+  /**
+   * @brief Get the storage size in bytes of the index.
+   * @details Get the storage size in bytes of the index.
+   * @return The storage size in bytes of the index.
+   */
+  size_t storage_size() {
+    return root_.storage_size();
+  }
+
+ private:
+  __radix_level<KEY_LEN / 8, value_type> root_;
+};
+
+/**
+ * Useful type-definitions.
+ */
+typedef __radix_index<16> __index16;
+
+}
+
+#endif /* RADIXINDEX_H_ */
@@ -0,0 +1,314 @@
+#ifndef SLOG_SHMREGION_H_
+#define SLOG_SHMREGION_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define SLOG_SHM_MAGIC         0x6e706c7973686d31ULL  // "nplyshm1"
+#define SLOG_SHM_VERSION       1
+#define SLOG_SHM_DEFAULT_BASE  0x600000000000UL  // Clear of the heap, libraries and stacks
+#define SLOG_SHM_HEADER_SIZE   4096
+
+namespace slog {
+
+/**
+ * A named shared memory region that logs and indexes are allocated from, so
+ * that other processes can query them in place.
+ *
+ * The region is a POSIX shared memory object, mapped at the same fixed
+ * address in every process; the pointers that link buckets, indexes and entry
+ * lists are therefore valid in every process, and readers follow them without
+ * any translation. The object is sized up front but sparse: pages are only
+ * backed by memory as the writer first touches them.
+ *
+ * The creating process maps the region read-write and carves allocations out
+ * of it with a bump pointer; memory is only released when the region is
+ * destroyed. Readers attach to it by name and map it read-only, so they cannot
+ * corrupt the store, and see writes as soon as the writer publishes them
+ * (e.g., through the offset log's read tail).
+ *
+ * The first page holds a header: the layout fingerprint of the structures in
+ * the region (readers must be built with the same definitions), the bump
+ * pointer, and a root object published by the writer, from which readers find
+ * everything else.
+ *
+ * The creator holds an exclusive flock on the region for as long as it lives;
+ * the kernel drops it when the creator exits, however it exits. A region that
+ * exists but is not locked was left behind by a creator that did not exit
+ * cleanly, and a new creator may replace it.
+ */
+class shm_region {
+ public:
+  /**
+   * Create a region; fails if a live region with the same name exists, i.e.,
+   * one whose creator is still running. A stale region with the same name is
+   * removed and replaced.
+   *
+   * @param name The name of the region (e.g., "/netplay").
+   * @param capacity The size of the region, in bytes.
+   * @param layout The fingerprint of the structures stored in the region.
+   * @param base The address to map the region at.
+   * @return The region, mapped read-write.
+   */
+  static shm_region* create(const std::string& name, size_t capacity,
+                            uint64_t layout,
+                            uintptr_t base = SLOG_SHM_DEFAULT_BASE) {
+    capacity = round_up(capacity, SLOG_SHM_HEADER_SIZE);
+    if (capacity <= SLOG_SHM_HEADER_SIZE)
+      throw std::invalid_argument("Shared memory region too small");
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0640);
+    if (fd < 0 && errno == EEXIST) {
+      if (remove_stale(name))
+        fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0640);
+      else
+        errno = EEXIST;  // Its creator is still running
+    }
+    if (fd < 0)
+      throw_errno("Could not create shared memory region " + name);
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || !named(fd, name)) {
+      // Another creator judged the region stale before we locked it
+      close(fd);
+      throw std::runtime_error("Could not lock shared memory region " + name);
+    }
+    if (ftruncate(fd, capacity) != 0) {
+      int err = errno;
+      close(fd);
+      shm_unlink(name.c_str());
+      errno = err;
+      throw_errno("Could not size shared memory region " + name);
+    }
+
+    void* ptr = map(fd, base, capacity, PROT_READ | PROT_WRITE);
+    if (ptr == NULL) {
+      int err = errno;
+      close(fd);
+      shm_unlink(name.c_str());
+      errno = err;
+      throw_errno("Could not map shared memory region " + name);
+    }
+
+    header* hdr = (header*) ptr;
+    hdr->version = SLOG_SHM_VERSION;
+    hdr->layout = layout;
+    hdr->base = base;
+    hdr->capacity = capacity;
+    hdr->used.store(SLOG_SHM_HEADER_SIZE, std::memory_order_relaxed);
+    hdr->root.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    hdr->magic = SLOG_SHM_MAGIC;
+    return new shm_region(name, fd, hdr, true);
+  }
+
+  /**
+   * Attach to an existing region, read-only.
+   *
+   * @param name The name of the region.
+   * @param layout The fingerprint of the structures the reader expects.
+   * @return The region, mapped read-only.
+   */
+  static shm_region* attach(const std::string& name, uint64_t layout) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+      throw_errno("Could not open shared memory region " + name);
+
+    header hdr;
+    if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t) sizeof(hdr)
+        || hdr.magic != SLOG_SHM_MAGIC || hdr.version != SLOG_SHM_VERSION) {
+      close(fd);
+      throw std::runtime_error("Not a shared memory store: " + name);
+    }
+    if (hdr.layout != layout) {
+      close(fd);
+      throw std::runtime_error("Shared memory store " + name
+                               + " was created by an incompatible build");
+    }
+
+    void* ptr = map(fd, hdr.base, hdr.capacity, PROT_READ);
+    if (ptr == NULL) {
+      close(fd);
+      throw_errno("Could not map shared memory region " + name);
+    }
+    return new shm_region(name, fd, (header*) ptr, false);
+  }
+
+  /**
+   * Remove the name of a region if it is stale, i.e., its creator has exited
+   * without removing it; readers that are still attached keep their mappings.
+   * A live region is never removed.
+   *
+   * @param name The name of the region.
+   * @return True if a stale region was removed.
+   */
+  static bool remove_stale(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+      return false;
+    // Unlink only if the name still refers to the region we locked, not to
+    // one that another creator has just replaced it with
+    bool stale = flock(fd, LOCK_EX | LOCK_NB) == 0 && named(fd, name);
+    if (stale)
+      shm_unlink(name.c_str());
+    close(fd);
+    return stale;
+  }
+
+  /**
+   * Unmap the region; the creator also removes its name, although readers
+   * that are still attached keep their mappings.
+   */
+  ~shm_region() {
+    munmap(hdr_, hdr_->capacity);
+    close(fd_);
+    if (owner_)
+      shm_unlink(name_.c_str());
+  }
+
+  /**
+   * Allocate memory from the region; only the creator may allocate.
+   *
+   * @param bytes The number of bytes.
+   * @param align The alignment (a power of two).
+   * @return The allocated memory, zero-filled if never used before.
+   */
+  void* allocate(size_t bytes, size_t align) {
+    uint64_t off = hdr_->used.load(std::memory_order_relaxed);
+    uint64_t start;
+    do {
+      start = round_up(off, align);
+      if (start + bytes > hdr_->capacity)
+        throw std::bad_alloc();
+    } while (!hdr_->used.compare_exchange_weak(off, start + bytes,
+                                               std::memory_order_relaxed));
+    return (char*) hdr_ + start;
+  }
+
+  /**
+   * Publish the root object, from which readers find the rest of the store.
+   *
+   * @param root The root object (allocated from the region).
+   */
+  void publish(const void* root) {
+    if (!contains(root))
+      throw std::invalid_argument("Root object is not in the shared memory region");
+    hdr_->root.store((uintptr_t) root, std::memory_order_release);
+  }
+
+  /**
+   * Get the root object.
+   *
+   * @return The root object, or NULL if the writer has not published it yet.
+   */
+  const void* root() const {
+    return (const void*) hdr_->root.load(std::memory_order_acquire);
+  }
+
+  bool contains(const void* ptr) const {
+    return (const char*) ptr >= (const char*) hdr_
+        && (const char*) ptr < (const char*) hdr_ + hdr_->capacity;
+  }
+
+  void* base() const {
+    return hdr_;
+  }
+
+  size_t capacity() const {
+    return hdr_->capacity;
+  }
+
+  /* Bytes allocated so far, including the header */
+  size_t used() const {
+    return hdr_->used.load(std::memory_order_relaxed);
+  }
+
+  const std::string& name() const {
+    return name_;
+  }
+
+  /* Distinguishes this region from every other one mapped by this process,
+   * including earlier ones mapped at the same address */
+  uint64_t id() const {
+    return id_;
+  }
+
+ private:
+  struct header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t layout;
+    uint64_t base;
+    uint64_t capacity;
+    std::atomic<uint64_t> used;
+    std::atomic<uint64_t> root;
+  };
+
+  shm_region(const std::string& name, int fd, header* hdr, bool owner)
+    : name_(name), fd_(fd), hdr_(hdr), owner_(owner), id_(next_id()) {
+  }
+
+  static uint64_t next_id() {
+    static std::atomic<uint64_t> id(0);
+    return id.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+  static inline uint64_t round_up(uint64_t x, uint64_t align) {
+    return (x + align - 1) & ~(align - 1);
+  }
+
+  /* Map at exactly base, or fail: pointers in the region are only valid there */
+  static void* map(int fd, uintptr_t base, size_t len, int prot) {
+    void* ptr = mmap((void*) base, len, prot, MAP_SHARED | MAP_FIXED_NOREPLACE
+                     | MAP_NORESERVE, fd, 0);
+    if (ptr == MAP_FAILED)
+      return NULL;
+    if (ptr != (void*) base) {
+      // Kernels without MAP_FIXED_NOREPLACE treat the address as a hint
+      munmap(ptr, len);
+      errno = EEXIST;
+      return NULL;
+    }
+    return ptr;
+  }
+
+  /* Whether the name refers to the region open as fd */
+  static bool named(int fd, const std::string& name) {
+    int cur = shm_open(name.c_str(), O_RDONLY, 0);
+    if (cur < 0)
+      return false;
+    struct stat a, b;
+    bool same = fstat(fd, &a) == 0 && fstat(cur, &b) == 0
+        && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+    close(cur);
+    return same;
+  }
+
+  static void throw_errno(const std::string& msg) {
+    throw std::runtime_error(msg + ": " + strerror(errno));
+  }
+
+  std::string name_;
+  int fd_;
+  header* hdr_;
+  bool owner_;
+  uint64_t id_;
+};
+
+}
+
+#endif /* SLOG_SHMREGION_H_ */
@@ -0,0 +1,240 @@
+#ifndef SLOG_SLAB_H_
+#define SLOG_SLAB_H_
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+#include "allocator.h"
+
+#define SLOG_SLAB_CHUNK_SIZE  (1UL << 21)  // Slabs are carved out of 2MB chunks
+#define SLOG_SLAB_MAX_OBJECT  (1UL << 16)  // Larger objects bypass the slabs
+#define SLOG_SLAB_ALIGN       64
+
+namespace slog {
+
+/**
+ * Per-thread slab allocator for the objects that indexes create lazily, on
+ * first touch of a key: entry lists and nested index nodes.
+ *
+ * Each thread (i.e., each writer) has its own slab per object type, so
+ * allocations on the ingest path take no locks and touch no shared state.
+ * Objects are rounded up to a cache line, and carved out of 2MB chunks
+ * obtained from the allocator (so they are backed by huge pages in the huge
+ * page modes). Freed objects go on the freeing thread's free list for their
+ * type and are reused by it; chunks are never returned. A thread keeps a slab
+ * per allocator source (see allocator::source()), so that objects and chunks
+ * obtained from one source (e.g., the heap) are never handed out once
+ * allocations come from another (e.g., the shared memory region). The shared
+ * slab is dropped once allocations come from another region, since the
+ * memory it holds may be gone. Objects larger than SLOG_SLAB_MAX_OBJECT (e.g., 64K-entry
+ * indexlets) are allocated directly.
+ */
+class slab {
+ public:
+  struct slab_stats {
+    std::atomic<uint64_t> num_allocs;
+    std::atomic<uint64_t> alloc_cycles;  // Including object construction
+    std::atomic<uint64_t> chunk_bytes;   // Memory obtained from the allocator
+    std::atomic<uint64_t> live_bytes;    // Memory in use by live objects
+    std::atomic<uint64_t> free_bytes;    // Memory on free lists
+  };
+
+  static const slab_stats& stats() {
+    return stats_ref();
+  }
+
+  template<typename T>
+  static T* new_object() {
+    uint64_t start = cycles();
+    T* obj = new (allocate<T>()) T();
+    slab_stats& st = stats_ref();
+    st.num_allocs.fetch_add(1, std::memory_order_relaxed);
+    st.alloc_cycles.fetch_add(cycles() - start, std::memory_order_relaxed);
+    return obj;
+  }
+
+  template<typename T>
+  static void delete_object(T* obj) {
+    if (obj == NULL)
+      return;
+    obj->~T();
+    release<T>(obj);
+  }
+
+ private:
+  struct free_node {
+    free_node* next;
+  };
+
+  struct cache {
+    char* cur;
+    size_t left;
+    free_node* free_list;
+    size_t free_bytes;
+    uint64_t region_id;  // Of the shared memory region, for SHARED_SOURCE
+  };
+
+  static slab_stats& stats_ref() {
+    static slab_stats s;
+    return s;
+  }
+
+  static inline uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+  }
+
+  template<typename T>
+  static constexpr size_t object_size() {
+    return (sizeof(T) + SLOG_SLAB_ALIGN - 1) & ~(SLOG_SLAB_ALIGN - 1);
+  }
+
+  template<typename T>
+  static cache& local_cache(const size_t source) {
+    static thread_local cache c[allocator::NUM_SOURCES];
+    cache& sc = c[source];
+    if (source == allocator::SHARED_SOURCE
+        && sc.region_id != allocator::shared_region()->id()) {
+      // The objects and chunk are in a region that may be gone
+      stats_ref().free_bytes.fetch_sub(sc.free_bytes, std::memory_order_relaxed);
+      sc.cur = NULL;
+      sc.left = 0;
+      sc.free_list = NULL;
+      sc.free_bytes = 0;
+      sc.region_id = allocator::shared_region()->id();
+    }
+    return sc;
+  }
+
+  template<typename T>
+  static void* allocate() {
+    slab_stats& st = stats_ref();
+    const size_t size = object_size<T>();
+    if (size > SLOG_SLAB_MAX_OBJECT) {
+      st.chunk_bytes.fetch_add(sizeof(T), std::memory_order_relaxed);
+      st.live_bytes.fetch_add(sizeof(T), std::memory_order_relaxed);
+      return allocator::allocate(sizeof(T));
+    }
+
+    cache& c = local_cache<T>(allocator::source());
+    st.live_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (c.free_list != NULL) {
+      free_node* node = c.free_list;
+      c.free_list = node->next;
+      c.free_bytes -= size;
+      st.free_bytes.fetch_sub(size, std::memory_order_relaxed);
+      return node;
+    }
+
+    if (c.left < size) {
+      char* chunk = (char*) allocator::allocate(SLOG_SLAB_CHUNK_SIZE);
+      char* aligned = (char*) (((uintptr_t) chunk + SLOG_SLAB_ALIGN - 1)
+                               & ~(uintptr_t) (SLOG_SLAB_ALIGN - 1));
+      c.cur = aligned;
+      c.left = SLOG_SLAB_CHUNK_SIZE - (aligned - chunk);
+      st.chunk_bytes.fetch_add(SLOG_SLAB_CHUNK_SIZE, std::memory_order_relaxed);
+    }
+    void* ptr = c.cur;
+    c.cur += size;
+    c.left -= size;
+    return ptr;
+  }
+
+  template<typename T>
+  static void release(T* obj) {
+    slab_stats& st = stats_ref();
+    const size_t size = object_size<T>();
+    if (size > SLOG_SLAB_MAX_OBJECT) {
+      allocator::deallocate(obj, sizeof(T));
+      st.chunk_bytes.fetch_sub(sizeof(T), std::memory_order_relaxed);
+      st.live_bytes.fetch_sub(sizeof(T), std::memory_order_relaxed);
+      return;
+    }
+
+    cache& c = local_cache<T>(allocator::source_of(obj));
+    free_node* node = (free_node*) obj;
+    node->next = c.free_list;
+    c.free_list = node;
+    c.free_bytes += size;
+    st.live_bytes.fetch_sub(size, std::memory_order_relaxed);
+    st.free_bytes.fetch_add(size, std::memory_order_relaxed);
+  }
+};
+
+/**
+ * Reference to an object that is created lazily, from the slab of the first
+ * thread that needs it.
+ *
+ * The first thread to find the reference empty reserves it with a CAS, and
+ * only then creates the object and publishes it; threads that lose the race
+ * wait for the winner's object instead of creating one of their own, so no
+ * object is ever built and thrown away. Readers see a reserved reference as
+ * empty, and never wait.
+ */
+template<typename T>
+class lazy_ref {
+ public:
+  lazy_ref() {
+    ref_.store(NULL, std::memory_order_release);
+  }
+
+  // Get the object, or NULL if it has not been published yet.
+  T* load() const {
+    T* obj = ref_.load(std::memory_order_acquire);
+    return obj == reserved() ? NULL : obj;
+  }
+
+  // Get the object, creating it if necessary.
+  T* get() {
+    T* obj = ref_.load(std::memory_order_acquire);
+    if (__builtin_expect(obj != NULL && obj != reserved(), 1))
+      return obj;
+    return create(obj);
+  }
+
+  // Destroy the object, if any; not safe against concurrent access.
+  void reset() {
+    slab::delete_object(load());
+    ref_.store(NULL, std::memory_order_release);
+  }
+
+ private:
+  static T* reserved() {
+    return reinterpret_cast<T*>(1);
+  }
+
+  T* create(T* obj) {
+    if (obj == NULL && ref_.compare_exchange_strong(obj, reserved(),
+        std::memory_order_acquire, std::memory_order_acquire)) {
+      try {
+        obj = slab::new_object<T>();
+      } catch (...) {
+        ref_.store(NULL, std::memory_order_release);
+        throw;
+      }
+      ref_.store(obj, std::memory_order_release);
+      return obj;
+    }
+    // Another thread is creating the object (or has failed to, and left the
+    // reference empty for this one to retry)
+    while ((obj = ref_.load(std::memory_order_acquire)) == reserved())
+      pause();
+    return obj != NULL ? obj : create(obj);
+  }
+
+  static inline void pause() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+
+  std::atomic<T*> ref_;
+};
+
+}
+
+#endif /* SLOG_SLAB_H_ */
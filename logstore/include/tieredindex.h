@@ -5,6 +5,7 @@
 #include <array>
 
 #include "entrylist.h"
+#include "slab.h"
 
 namespace slog {
 
@@ -12,7 +13,11 @@ namespace slog {
  * @brief The unit of indexing in tiered indexes.
  * @details The basic unit of indexing in tiered indexes. An
  * indexlet stores a fixed-size array with atomic references to
- * objects of value type.
+ * objects of value type. Objects are created lazily, from the
+ * creating thread's slab (see lazy_ref): a writer that finds a slot
+ * empty reserves it with a CAS, and only then creates the object;
+ * writers that lose the race wait for the winner's object, so no
+ * object is created in vain. Readers never wait.
  * 
  * @tparam T Tyepe of the value.
  * @tparam SIZE = 65536 Size of the fixed-size array.
@@ -20,7 +25,7 @@ namespace slog {
 template<typename T, size_t SIZE = 65536>
 class indexlet {
  public:
-  typedef std::atomic<T*> atomic_ref;
+  typedef lazy_ref<T> atomic_ref;
 
   /**
    * @brief Constructor for the indexlet.
@@ -28,9 +33,6 @@ class indexlet {
    * null.
    */
   indexlet() {
-    for (uint32_t i = 0; i < SIZE; i++) {
-      idx_[i].store(NULL, std::memory_order_release);
-    }
   }
 
   /**
@@ -39,7 +41,7 @@ class indexlet {
    */
   virtual ~indexlet() {
     for (uint32_t i = 0; i < SIZE; i++) {
-      delete idx_[i].load(std::memory_order_acquire);
+      idx_[i].reset();
     }
   }
 
@@ -52,21 +54,7 @@ class indexlet {
    * @return Pointer to the value.
    */
   T* get(const uint32_t i) {
-    if (idx_[i].load(std::memory_order_acquire) == NULL) {
-      T* item = new T();
-      T* null_ptr = NULL;
-
-      // Only one thread will be successful in replacing the NULL reference with newly
-      // allocated item.
-      if (!std::atomic_compare_exchange_strong_explicit(
-            &idx_[i], &null_ptr, item, std::memory_order_release,
-            std::memory_order_acquire)) {
-        // All other threads will deallocate the newly allocated item.
-        delete item;
-      }
-    }
-
-    return idx_[i].load(std::memory_order_acquire);
+    return idx_[i].get();
   }
 
   /**
@@ -88,7 +76,7 @@ class indexlet {
    * @return Pointer to the value.
    */
   T* at(const uint32_t i) const {
-    return idx_[i].load(std::memory_order_acquire);
+    return idx_[i].load();
   }
 
   /**
@@ -108,8 +96,9 @@ class indexlet {
   size_t storage_size() {
     size_t tot_size = SIZE * sizeof(atomic_ref);
     for (uint32_t i = 0; i < SIZE; i++) {
-      if (idx_[i].load(std::memory_order_acquire) != NULL) {
-        tot_size += idx_[i].load(std::memory_order_acquire)->storage_size();
+      T* item = at(i);
+      if (item != NULL) {
+        tot_size += item->storage_size();
       }
     }
     return tot_size;
@@ -123,7 +112,12 @@ class indexlet {
  * @brief Base class for tiered indexes.
  * @details This is the base class for tiered indexes,
  * and exposes a pure virtual at() function for getting
- * the index value for a certain key.
+ * the index value for a certain key. The tiered indexes
+ * override it as final, so lookups through a concrete index
+ * type never go through the vtable; this keeps indexes that
+ * are mapped from shared memory by another process (whose
+ * vtable pointers are only valid in the creating process)
+ * usable there.
  *
  * @tparam value_type = entry_list The value type for the index.
  */
@@ -193,7 +187,7 @@ class __index_depth1 : public __tiered_index_base<value_type> {
    * @param key The key to lookup.
    * @return Pointer to the value.
    */
-  value_type* at(const uint64_t key) const override {
+  value_type* at(const uint64_t key) const final {
     return idx_.at(key);
   }
 
@@ -279,7 +273,7 @@ class __index_depth2 : public __tiered_index_base<value_type> {
    * @param key The key to lookup.
    * @return Pointer to the value.
    */
-  value_type* at(const uint64_t key) const override {
+  value_type* at(const uint64_t key) const final {
     __index_depth1 <SIZE2, value_type>* ilet = idx_.at(key / SIZE2);
     if (ilet)
       return ilet->at(key % SIZE2);
@@ -369,7 +363,7 @@ class __index_depth3 : public __tiered_index_base<value_type> {
    * @param key The key to lookup.
    * @return Pointer to the value.
    */
-  value_type* at(const uint64_t key) const override {
+  value_type* at(const uint64_t key) const final {
     __index_depth2 <SIZE2, SIZE3, value_type>* ilet = idx_.at(key / (SIZE2 * SIZE3));
     if (ilet)
       return ilet->at(key % (SIZE2 * SIZE3));
@@ -460,7 +454,7 @@ class __index_depth4 : public __tiered_index_base<value_type> {
    * @param key The key to lookup.
    * @return Pointer to the value.
    */
-  value_type* at(const uint64_t key) const override {
+  value_type* at(const uint64_t key) const final {
     __index_depth3 <SIZE2, SIZE3, SIZE4, value_type>* ilet = idx_.at(key / (SIZE2 * SIZE3 * SIZE4));
     if (ilet)
       return ilet->at(key % (SIZE2 * SIZE3 * SIZE4));
@@ -1,25 +1,133 @@
 #ifndef AGGREGATES_H_
 #define AGGREGATES_H_
 
+#include <algorithm>
+#include <limits>
 #include <unordered_set>
 #include <type_traits>
+#include <vector>
 
 #include "complex_character_index.h"
 #include "datalog.h"
+#include "ddsketch.h"
 #include "offsetlog.h"
+#include "hyperloglog.h"
+#include "top_k.h"
+
+#define AGGREGATE_BLOCK_SIZE 64    // Records gathered per block
+#define AGGREGATE_HEADER_BYTES 54  // Ethernet + IPv4 + TCP headers
 
 namespace netplay {
 
 namespace aggregate {
 
+/**
+ * Gathers the values of an attribute for the records in a container, one
+ * block of AGGREGATE_BLOCK_SIZE records at a time. The offsets of a block are
+ * resolved through the offset log first, and each packet is prefetched as
+ * soon as its offset is known; the values are then read from the (by then
+ * cached) packets into a contiguous array, which is handed to a reducer.
+ * Reducers are plain loops over that array, without lookups or branches, so
+ * that the compiler vectorizes them.
+ */
+template<typename T>
+struct projection {
+  typedef typename T::value_type value_type;
+
+  /**
+   * Gather the attribute values of the records in a container.
+   *
+   * @param container The container of record ids.
+   * @param dlog The data log.
+   * @param olog The offset log.
+   * @param reduce The reducer, invoked as reduce(values, num_values).
+   */
+  template<typename container_type, typename reducer_type>
+  static void scan(container_type& container, slog::datalog* dlog,
+                   slog::offsetlog* olog, reducer_type& reduce) {
+    uint64_t ids[AGGREGATE_BLOCK_SIZE];
+    size_t n = 0;
+    for (uint64_t record_id : container) {
+      ids[n++] = record_id;
+      if (n == AGGREGATE_BLOCK_SIZE) {
+        gather(ids, n, dlog, olog, reduce);
+        n = 0;
+      }
+    }
+    if (n > 0)
+      gather(ids, n, dlog, olog, reduce);
+  }
+
+ private:
+  template<typename reducer_type>
+  static void gather(const uint64_t* ids, size_t n, slog::datalog* dlog,
+                     slog::offsetlog* olog, reducer_type& reduce) {
+    unsigned char* pkts[AGGREGATE_BLOCK_SIZE];
+    uint16_t lens[AGGREGATE_BLOCK_SIZE];
+    value_type values[AGGREGATE_BLOCK_SIZE];
+    for (size_t i = 0; i < n; i++) {
+      uint64_t offset;
+      olog->lookup(ids[i], offset, lens[i]);
+      pkts[i] = (unsigned char*) dlog->ptr(offset) + sizeof(uint64_t);
+      __builtin_prefetch(pkts[i]);
+      __builtin_prefetch(pkts[i] + AGGREGATE_HEADER_BYTES - 1);
+    }
+    for (size_t i = 0; i < n; i++)
+      values[i] = T::get(pkts[i], lens[i]);
+    reduce((const value_type*) values, n);
+  }
+};
+
+/*
+ * Aggregates over the results of a cast or character. Aggregates of
+ * attribute values (sum, minimum, maximum, average) read the values through
+ * the data and offset logs; result sets and counts only need record ids, and
+ * byte counts only the offset log.
+ */
+
 template<typename T>
 struct result_set {
   typedef std::unordered_set<typename T::value_type> result_type;
   typedef T attribute_type;
 
   template<typename container_type>
-  static inline result_type aggregate(container_type& container) {
-    return container;
+  static inline result_type aggregate(container_type& container,
+                                      slog::datalog* = NULL,
+                                      slog::offsetlog* = NULL) {
+    result_type res;
+    for (uint64_t record_id : container)
+      res.insert(record_id);
+    return res;
+  }
+
+  /* Merge results from another shard, whose record ids start at id_base */
+  static inline void merge(result_type& into, const result_type& from,
+                           const uint64_t id_base) {
+    for (auto x : from)
+      into.insert(x + id_base);
+  }
+};
+
+/* The record ids of the matching packets, e.g., to stream them to a client */
+template<typename T>
+struct record_ids {
+  typedef std::vector<uint64_t> result_type;
+  typedef T attribute_type;
+
+  template<typename container_type>
+  static inline result_type aggregate(container_type& container,
+                                      slog::datalog* = NULL,
+                                      slog::offsetlog* = NULL) {
+    result_type res;
+    for (uint64_t record_id : container)
+      res.push_back(record_id);
+    return res;
+  }
+
+  static inline void merge(result_type& into, const result_type& from,
+                           const uint64_t id_base) {
+    for (uint64_t x : from)
+      into.push_back(x + id_base);
   }
 };
 
@@ -29,25 +137,72 @@ struct count {
   typedef T attribute_type;
 
   template<typename container_type>
-  static inline result_type aggregate(container_type& container) {
+  static inline result_type aggregate(container_type& container,
+                                      slog::datalog* = NULL,
+                                      slog::offsetlog* = NULL) {
     return container.size();
   }
+
+  static inline void merge(result_type& into, const result_type& from,
+                           const uint64_t) {
+    into += from;
+  }
+};
+
+/* Total length of the records, in bytes; only reads the offset log */
+template<typename T>
+struct bytes {
+  typedef uint64_t result_type;
+  typedef T attribute_type;
+
+  template<typename container_type>
+  static inline result_type aggregate(container_type& container,
+                                      slog::datalog*, slog::offsetlog* olog) {
+    result_type total = 0;
+    for (uint64_t record_id : container) {
+      uint64_t offset;
+      uint16_t length;
+      olog->lookup(record_id, offset, length);
+      total += length;
+    }
+    return total;
+  }
+
+  static inline void merge(result_type& into, const result_type& from,
+                           const uint64_t) {
+    into += from;
+  }
 };
 
 template<typename T>
 struct sum {
-  typedef typename T::value_type result_type;
-  static_assert(std::is_arithmetic<result_type>::value,
-                "Result type must be numeric");
+  typedef typename T::value_type value_type;
+  static_assert(std::is_arithmetic<value_type>::value,
+                "Attribute type must be numeric");
+  typedef typename std::conditional<std::is_floating_point<value_type>::value,
+      double, typename std::conditional<std::is_signed<value_type>::value,
+      int64_t, uint64_t>::type>::type result_type;
   typedef T attribute_type;
 
   template<typename container_type>
-  static inline result_type aggregate(container_type& container) {
+  static inline result_type aggregate(container_type& container,
+                                      slog::datalog* dlog,
+                                      slog::offsetlog* olog) {
     result_type s = 0;
-    for (result_type x : container)
-      s += x;
+    auto reduce = [&s](const value_type* values, size_t n) {
+      result_type block = 0;
+      for (size_t i = 0; i < n; i++)
+        block += values[i];
+      s += block;
+    };
+    projection<T>::scan(container, dlog, olog, reduce);
     return s;
   }
+
+  static inline void merge(result_type& into, const result_type& from,
+                           const uint64_t) {
+    into += from;
+  }
 };
 
 template<typename T>
@@ -58,12 +213,24 @@ struct maximum {
   typedef T attribute_type;
 
   template<typename container_type>
-  static inline result_type aggregate_type(container_type& value) {
-    result_type m = std::numeric_limits<result_type>::min();
-    for (result_type x : value)
-      if (x > m) m = x;
+  static inline result_type aggregate(container_type& container,
+                                      slog::datalog* dlog,
+                                      slog::offsetlog* olog) {
+    result_type m = std::numeric_limits<result_type>::lowest();
+    auto reduce = [&m](const result_type* values, size_t n) {
+      result_type block = m;
+      for (size_t i = 0; i < n; i++)
+        block = values[i] > block ? values[i] : block;
+      m = block;
+    };
+    projection<T>::scan(container, dlog, olog, reduce);
     return m;
   }
+
+  static inline void merge(result_type& into, const result_type& from,
+                           const uint64_t) {
+    into = std::max(into, from);
+  }
 };
 
 template<typename T>
@@ -74,16 +241,187 @@ struct minimum {
   typedef T attribute_type;
 
   template<typename container_type>
-  static inline result_type aggregate(container_type& container) {
+  static inline result_type aggregate(container_type& container,
+                                      slog::datalog* dlog,
+                                      slog::offsetlog* olog) {
     result_type m = std::numeric_limits<result_type>::max();
-    for (result_type x : container)
-      if (x < m) m = x;
+    auto reduce = [&m](const result_type* values, size_t n) {
+      result_type block = m;
+      for (size_t i = 0; i < n; i++)
+        block = values[i] < block ? values[i] : block;
+      m = block;
+    };
+    projection<T>::scan(container, dlog, olog, reduce);
     return m;
   }
+
+  static inline void merge(result_type& into, const result_type& from,
+                           const uint64_t) {
+    into = std::min(into, from);
+  }
+};
+
+/* Sum and count of values; kept separately so that averages can be merged */
+struct mean {
+  double sum;
+  uint64_t count;
+
+  double value() const {
+    return count == 0 ? 0.0 : sum / (double) count;
+  }
+};
+
+template<typename T>
+struct average {
+  typedef typename T::value_type value_type;
+  static_assert(std::is_arithmetic<value_type>::value,
+                "Attribute type must be numeric");
+  typedef mean result_type;
+  typedef T attribute_type;
+
+  template<typename container_type>
+  static inline result_type aggregate(container_type& container,
+                                      slog::datalog* dlog,
+                                      slog::offsetlog* olog) {
+    result_type res = { 0.0, 0 };
+    auto reduce = [&res](const value_type* values, size_t n) {
+      double block = 0.0;
+      for (size_t i = 0; i < n; i++)
+        block += values[i];
+      res.sum += block;
+      res.count += n;
+    };
+    projection<T>::scan(container, dlog, olog, reduce);
+    return res;
+  }
+
+  static inline void merge(result_type& into, const result_type& from,
+                           const uint64_t) {
+    into.sum += from.sum;
+    into.count += from.count;
+  }
+};
+
+/*
+ * Most frequent values of an attribute (e.g., top talkers by
+ * attribute::ipv4_src_addr, or by attribute::inner_five_tuple), in a
+ * Space-Saving sketch of CAPACITY counters; read them with result.top(k).
+ * Counts overestimate by at most result.error_bound().
+ *
+ * Sketches merge across shards, and since top_k also has a per-packet
+ * update, it can be executed with per-thread partials through
+ * packet_store::execute_group_by.
+ */
+template<typename T, size_t CAPACITY = TOP_K_CAPACITY>
+struct top_k {
+  typedef typename T::value_type value_type;
+  typedef T attribute_type;
+
+  struct result_type : public space_saving<value_type> {
+    result_type()
+      : space_saving<value_type>(CAPACITY) {
+    }
+  };
+
+  template<typename container_type>
+  static inline result_type aggregate(container_type& container,
+                                      slog::datalog* dlog,
+                                      slog::offsetlog* olog) {
+    result_type sketch;
+    auto reduce = [&sketch](const value_type* values, size_t n) {
+      for (size_t i = 0; i < n; i++)
+        sketch.offer(values[i]);
+    };
+    projection<T>::scan(container, dlog, olog, reduce);
+    return sketch;
+  }
+
+  static inline void update(result_type& sketch, void* pkt, uint16_t len) {
+    sketch.offer(T::get(pkt, len));
+  }
+
+  static inline void merge(result_type& into, const result_type& from,
+                           const uint64_t) {
+    into.merge(from);
+  }
+};
+
+/*
+ * Number of distinct values of an attribute (e.g., distinct sources with
+ * attribute::ipv4_src_addr), estimated with a HyperLogLog sketch of 2^P
+ * registers; read it with result.estimate(). Like top_k, it merges across
+ * shards and can be executed with per-thread partials.
+ */
+template<typename T, size_t P = HLL_PRECISION>
+struct distinct_count {
+  typedef typename T::value_type value_type;
+  typedef hyperloglog<P> result_type;
+  typedef T attribute_type;
+
+  template<typename container_type>
+  static inline result_type aggregate(container_type& container,
+                                      slog::datalog* dlog,
+                                      slog::offsetlog* olog) {
+    result_type sketch;
+    auto reduce = [&sketch](const value_type* values, size_t n) {
+      for (size_t i = 0; i < n; i++)
+        sketch.add(hll_hash(values[i]));
+    };
+    projection<T>::scan(container, dlog, olog, reduce);
+    return sketch;
+  }
+
+  static inline void update(result_type& sketch, void* pkt, uint16_t len) {
+    sketch.add(hll_hash(T::get(pkt, len)));
+  }
+
+  static inline void merge(result_type& into, const result_type& from,
+                           const uint64_t) {
+    into.merge(from);
+  }
+};
+
+/*
+ * Quantiles of a numeric attribute (e.g., packet sizes with
+ * attribute::host_order<attribute::ipv4_total_length>), in a DDSketch with a
+ * relative error of DDSKETCH_ALPHA; read them with result.quantile(q).
+ * Attribute values are taken as stored in the packet, so multi-byte fields
+ * need attribute::host_order. Like top_k, it merges across shards and can be
+ * executed with per-thread partials.
+ */
+template<typename T>
+struct quantiles {
+  typedef typename T::value_type value_type;
+  static_assert(std::is_arithmetic<value_type>::value,
+                "Attribute type must be numeric");
+  typedef ddsketch<> result_type;
+  typedef T attribute_type;
+
+  template<typename container_type>
+  static inline result_type aggregate(container_type& container,
+                                      slog::datalog* dlog,
+                                      slog::offsetlog* olog) {
+    result_type sketch;
+    auto reduce = [&sketch](const value_type* values, size_t n) {
+      for (size_t i = 0; i < n; i++)
+        sketch.add((double) values[i]);
+    };
+    projection<T>::scan(container, dlog, olog, reduce);
+    return sketch;
+  }
+
+  static inline void update(result_type& sketch, void* pkt, uint16_t len) {
+    sketch.add((double) T::get(pkt, len));
+  }
+
+  static inline void merge(result_type& into, const result_type& from,
+                           const uint64_t) {
+    into.merge(from);
+  }
 };
 
 }
 
 }
 
-#endif  // AGGREGATES_H_
\ No newline at end of file
+#endif  // AGGREGATES_H_
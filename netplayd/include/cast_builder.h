@@ -3,9 +3,12 @@
 
 #include "aggregates.h"
 #include "expression.h"
+#include "group_by.h"
+#include "netplay_utils.h"
 #include "packet_attributes.h"
 #include "query_plan.h"
 #include "query_planner.h"
+#include "sharded_packet_store.h"
 
 namespace netplay {
 
@@ -28,6 +31,33 @@ class cast {
     return store_->execute_cast<aggregate_type>(plan_);
   }
 
+  /* Execute through the result cache (see packet_store::execute_cast_cached) */
+  template<typename aggregate_type>
+  typename aggregate_type::result_type execute_cached() {
+    return store_->execute_cast_cached<aggregate_type>(plan_);
+  }
+
+  /* Execute casts on the same store with shared scans (see packet_store::execute_casts) */
+  template<typename aggregate_type>
+  static std::vector<typename aggregate_type::result_type> execute_batch(
+      std::vector<cast>& casts) {
+    std::vector<query_plan> plans;
+    for (cast& c : casts)
+      plans.push_back(c.plan_);
+    if (casts.empty())
+      return std::vector<typename aggregate_type::result_type>();
+    return casts.front().store_->execute_casts<aggregate_type>(plans);
+  }
+
+  template<typename group_type>
+  typename group_type::result_type execute_group_by(size_t num_threads = 1) {
+    return store_->execute_group_by<group_type>(plan_, num_threads);
+  }
+
+  uint64_t export_pcap(pcap_writer& writer) {
+    return store_->export_cast(writer, plan_);
+  }
+
  private:
   query_plan plan_;
   packet_store* store_;
@@ -49,11 +79,93 @@ class cast_builder {
     return cast(exp_, store_);
   }
 
+  /* Build a continuous cast (see packet_store::add_standing_cast) */
+  template<typename aggregate_type>
+  standing_cast<aggregate_type>* build_standing() {
+    packet_store::handle* handle = store_->get_handle();
+    auto f = netplay_utils::build_filter_list(handle, exp_);
+    delete handle;
+    return store_->add_standing_cast<aggregate_type>(f);
+  }
+
  private:
   packet_store* store_;
   expression* exp_;
 };
 
+class sharded_cast {
+ public:
+  sharded_cast(expression* exp, sharded_packet_store* store) {
+    store_ = store;
+    plans_ = store->plan(exp);
+  }
+
+  sharded_cast(const sharded_cast& other) {
+    store_ = other.store_;
+    plans_ = other.plans_;
+  }
+
+  template<typename aggregate_type>
+  typename aggregate_type::result_type execute() {
+    return store_->execute_cast<aggregate_type>(plans_);
+  }
+
+  template<typename aggregate_type>
+  typename aggregate_type::result_type execute_cached() {
+    return store_->execute_cast_cached<aggregate_type>(plans_);
+  }
+
+  template<typename aggregate_type>
+  static std::vector<typename aggregate_type::result_type> execute_batch(
+      std::vector<sharded_cast>& casts) {
+    std::vector<sharded_packet_store::sharded_plan> plans;
+    for (sharded_cast& c : casts)
+      plans.push_back(c.plans_);
+    if (casts.empty())
+      return std::vector<typename aggregate_type::result_type>();
+    return casts.front().store_->execute_casts<aggregate_type>(plans);
+  }
+
+  template<typename group_type>
+  typename group_type::result_type execute_group_by(size_t num_threads = 1) {
+    return store_->execute_group_by<group_type>(plans_, num_threads);
+  }
+
+  uint64_t export_pcap(pcap_writer& writer) {
+    return store_->export_cast(writer, plans_);
+  }
+
+ private:
+  sharded_packet_store::sharded_plan plans_;
+  sharded_packet_store* store_;
+};
+
+class sharded_cast_builder {
+ public:
+  sharded_cast_builder(sharded_packet_store* store, const std::string& exp) {
+    store_ = store;
+    parser p(exp);
+    exp_ = p.parse();
+  }
+
+  ~sharded_cast_builder() {
+    free_expression(exp_);
+  }
+
+  sharded_cast build() {
+    return sharded_cast(exp_, store_);
+  }
+
+  template<typename aggregate_type>
+  std::vector<standing_cast<aggregate_type>*> build_standing() {
+    return store_->add_standing_cast<aggregate_type>(exp_);
+  }
+
+ private:
+  sharded_packet_store* store_;
+  expression* exp_;
+};
+
 }
 
 #endif  // CAST_BUILDER_H_
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include "expression.h"
 #include "query_parser.h"
 #include "netplay_utils.h"
+#include "sharded_packet_store.h"
 
 namespace netplay {
 
@@ -25,6 +26,14 @@ class complex_character {
     return store_->query_character<aggregate_type>(id_, ts_beg, ts_end);
   }
 
+  uint64_t export_pcap(pcap_writer& writer, const uint64_t ts_beg, const uint64_t ts_end) {
+    return store_->export_character(writer, id_, ts_beg, ts_end);
+  }
+
+  uint32_t id() const {
+    return id_;
+  }
+
  private:
   uint32_t id_;
   packet_store* store_;
@@ -55,6 +64,58 @@ class character_builder {
   packet_store* store_;
 };
 
+class sharded_complex_character {
+ public:
+  sharded_complex_character(sharded_packet_store* store, uint32_t id) {
+    store_ = store;
+    id_ = id;
+  }
+
+  sharded_complex_character(const sharded_complex_character& other) {
+    store_ = other.store_;
+    id_ = other.id_;
+  }
+
+  template<typename aggregate_type>
+  typename aggregate_type::result_type execute(const uint64_t ts_beg, const uint64_t ts_end) {
+    return store_->query_character<aggregate_type>(id_, ts_beg, ts_end);
+  }
+
+  uint64_t export_pcap(pcap_writer& writer, const uint64_t ts_beg, const uint64_t ts_end) {
+    return store_->export_character(writer, id_, ts_beg, ts_end);
+  }
+
+  uint32_t id() const {
+    return id_;
+  }
+
+ private:
+  uint32_t id_;
+  sharded_packet_store* store_;
+};
+
+class sharded_character_builder {
+ public:
+  sharded_character_builder(sharded_packet_store* store, const std::string& exp) {
+    store_ = store;
+    parser p(exp);
+    exp_ = p.parse();
+  }
+
+  ~sharded_character_builder() {
+    free_expression(exp_);
+  }
+
+  sharded_complex_character build() {
+    uint32_t id = store_->add_complex_character(exp_);
+    return sharded_complex_character(store_, id);
+  }
+
+ private:
+  expression* exp_;
+  sharded_packet_store* store_;
+};
+
 }
 
 #endif  // CHARACTER_BUILDER_H_
\ No newline at end of file
@@ -0,0 +1,537 @@
+#ifndef CHARACTER_STORE_H_
+#define CHARACTER_STORE_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "complex_character_index.h"
+#include "ddsketch.h"
+#include "hyperloglog.h"
+#include "packet_filter.h"
+#include "packet_metadata.h"
+#include "rollup.h"
+#include "standing_cast.h"
+#include "top_k.h"
+
+#define MAX_FILTERS 65536
+#define MAX_STANDING_TOP_K 64
+#define MAX_STANDING_CASTS 64
+#define MAX_DISTINCT_CHARACTERS 64
+#define HLL_CHAR_PRECISION 10  // Per-second sketches: 1KB, ~3.2% standard error
+#define MAX_QUANTILE_CHARACTERS 64
+#define CHAR_COUNTER_BLOCK 64  // Characters per block of per-second counters
+#define FLOW_CLOCK_MAX_FLOWS (1UL << 20)  // Flows tracked per writer for inter-arrival times
+
+namespace netplay {
+
+/* Distributions kept in per-second quantile sketches of complex characters */
+enum quantile_metric {
+  QUANTILE_PKT_SIZE = 0,      // Packet length, in bytes
+  QUANTILE_INTERARRIVAL = 1,  // Time since the previous packet of the flow, in ns
+  NUM_QUANTILE_METRICS = 2
+};
+
+/* Packets and bytes over a time range */
+struct traffic_counts {
+  uint64_t pkts;
+  uint64_t bytes;
+};
+
+/**
+ * The complex characters of a packet store, and everything else that is
+ * maintained on ingest besides its logs and indexes: per-character counters,
+ * per-second distinct-count and quantile sketches, standing top-K queries,
+ * and the continuous casts.
+ *
+ * Each writer updates them through its own character_store::writer, with the
+ * metadata of the packets it stores, so packets are parsed only once.
+ * Queries take time ranges that the packet store has already clamped to its
+ * stored seconds; the packet store owns the logs and indexes, and remains
+ * the entry point for queries.
+ */
+class character_store {
+ public:
+  typedef complex_character_index::result filter_result;
+  typedef hyperloglog<HLL_CHAR_PRECISION> char_sketch;
+  typedef slog::indexlet<char_sketch, MAX_DISTINCT_CHARACTERS> sketch_index;
+  typedef slog::__index_depth2<65536, 65536, sketch_index> time_sketch_index;
+  typedef ddsketch<uint32_t> char_quantiles;
+  typedef slog::indexlet<char_quantiles, MAX_QUANTILE_CHARACTERS> quantile_index;
+  typedef slog::__index_depth2<65536, 65536, quantile_index> time_quantile_index;
+  typedef ddsketch<> quantile_sketch;
+
+  /* Packet and byte counters of a block of characters, per rollup bucket */
+  struct char_counter_block {
+    char_counter_block() {
+      for (size_t i = 0; i < CHAR_COUNTER_BLOCK; i++) {
+        pkts[i].store(0, std::memory_order_relaxed);
+        bytes[i].store(0, std::memory_order_relaxed);
+      }
+    }
+
+    std::atomic<uint64_t> pkts[CHAR_COUNTER_BLOCK];
+    std::atomic<uint64_t> bytes[CHAR_COUNTER_BLOCK];
+  };
+  typedef slog::indexlet<char_counter_block, MAX_FILTERS / CHAR_COUNTER_BLOCK> counter_index;
+  typedef time_rollup<counter_index> char_counter_rollup;
+
+  /**
+   * The state of a single writer: its partial top-K sketches, its flow
+   * clocks, and the counts of the current burst. Each writer **must** have
+   * its own.
+   */
+  class writer {
+   public:
+    writer(character_store& chars)
+      : chars_(chars) {
+    }
+
+    /**
+     * Start a burst of packets; characters and standing queries added since
+     * the last burst take effect from this one.
+     *
+     * @param now The current second.
+     * @param arrival_ns The arrival times of the packets, in ns, or NULL to
+     * time the whole burst once (used for flow inter-arrival times).
+     */
+    void begin_burst(const uint32_t now, const uint64_t* arrival_ns) {
+      num_chars_ = chars_.num_filters_.load(std::memory_order_acquire);
+      num_top_k_ = chars_.num_top_k_.load(std::memory_order_acquire);
+      char_index_ = chars_.char_idx_->get(now);
+      if (char_pkts_.size() < num_chars_) {
+        char_pkts_.resize(num_chars_, 0);
+        char_bytes_.resize(num_chars_, 0);
+      }
+
+      sketches_ = NULL;
+      if (chars_.num_distinct_.load(std::memory_order_acquire) > 0)
+        sketches_ = chars_.distinct_idx_->get(now);
+
+      while (top_k_partials_.size() < num_top_k_)
+        top_k_partials_.push_back(
+            chars_.top_k_[top_k_partials_.size()]->add_writer());
+      if (top_k_keys_.size() < num_top_k_)
+        top_k_keys_.resize(num_top_k_);
+
+      quantiles_ = NULL;
+      arrival_ns_ = arrival_ns;
+      size_t num_quantiles = chars_.num_quantiles_.load(std::memory_order_acquire);
+      if (num_quantiles > 0) {
+        quantiles_ = chars_.quantile_idx_->get(now);
+        if (arrival_ns == NULL)
+          burst_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now().time_since_epoch()).count();
+        if (flow_clocks_.size() < num_quantiles)
+          flow_clocks_.resize(num_quantiles);
+      }
+    }
+
+    /**
+     * Add a packet of the burst to the characters it matches, and collect
+     * its keys for the standing top-K queries.
+     *
+     * @param md The metadata of the packet.
+     * @param record_id The record id of the packet.
+     * @param pos The position of the packet in the burst.
+     */
+    inline void add(const packet_metadata& md, const uint64_t record_id,
+                    const size_t pos) {
+      for (size_t i = 0; i < num_chars_; i++) {
+        for (auto& filter : chars_.filters_[i]) {
+          if (filter.apply(md)) {
+            char_index_->get(i)->push_back(record_id);
+            if (char_pkts_[i]++ == 0)
+              matched_chars_.push_back(i);
+            char_bytes_[i] += md.pkt_len;
+            if (sketches_ != NULL)
+              chars_.add_distinct(sketches_, i, md);
+            if (quantiles_ != NULL)
+              add_quantiles(i, md, arrival_ns_ ? arrival_ns_[pos] : burst_ns_);
+            break;
+          }
+        }
+      }
+      for (size_t q = 0; q < num_top_k_; q++) {
+        five_tuple key;
+        if (chars_.top_k_[q]->match(md, key))
+          top_k_keys_[q].push_back(key);
+      }
+    }
+
+    /**
+     * End a burst: counters are updated once per burst, at every rollup
+     * level, and so are the standing top-K queries.
+     *
+     * @param now The current second.
+     */
+    void end_burst(const uint32_t now) {
+      if (!matched_chars_.empty()) {
+        counter_index* counters[NUM_ROLLUP_LEVELS];
+        chars_.char_rollup_->get(now, counters);
+        for (uint32_t c : matched_chars_) {
+          for (size_t l = 0; l < NUM_ROLLUP_LEVELS; l++) {
+            char_counter_block* block = counters[l]->get(c / CHAR_COUNTER_BLOCK);
+            block->pkts[c % CHAR_COUNTER_BLOCK].fetch_add(char_pkts_[c],
+                std::memory_order_relaxed);
+            block->bytes[c % CHAR_COUNTER_BLOCK].fetch_add(char_bytes_[c],
+                std::memory_order_relaxed);
+          }
+          char_pkts_[c] = 0;
+          char_bytes_[c] = 0;
+        }
+        matched_chars_.clear();
+      }
+
+      for (size_t q = 0; q < num_top_k_; q++) {
+        if (!top_k_keys_[q].empty())
+          top_k_partials_[q]->update(top_k_keys_[q]);
+      }
+    }
+
+   private:
+    /*
+     * Add a packet to a character's quantile sketches for the current second.
+     * Inter-arrival times are measured within the flow (5-tuple) of the
+     * packet, against the last packet of the flow that this writer inserted
+     * into the character; with RSS, all packets of a flow reach the same
+     * writer. Packets are timed by their arrival times where the port
+     * provides them (kernel timestamps for AF_PACKET, the receive poll for
+     * DPDK ports), and once per burst otherwise. Packets with the same time
+     * (e.g., of the same DPDK receive burst) are not sampled: the time
+     * between them is unknown, and is not recorded as 0ns.
+     */
+    inline void add_quantiles(const size_t char_id, const packet_metadata& md,
+                              const uint64_t now_ns) {
+      uint8_t slot = chars_.quantile_slot_[QUANTILE_PKT_SIZE][char_id].load(
+          std::memory_order_acquire);
+      if (slot != 0)
+        quantiles_->get(slot - 1)->add_atomic(md.pkt_len);
+
+      slot = chars_.quantile_slot_[QUANTILE_INTERARRIVAL][char_id].load(
+          std::memory_order_acquire);
+      if (slot == 0)
+        return;
+      flow_clock& clock = flow_clocks_[slot - 1];
+      if (clock.size() >= FLOW_CLOCK_MAX_FLOWS)
+        clock.clear();
+      five_tuple key;
+      flow_key_of(md, KEY_FIVE_TUPLE, key);
+      auto res = clock.insert(std::make_pair(key, now_ns));
+      if (!res.second && res.first->second < now_ns) {
+        quantiles_->get(slot - 1)->add_atomic(now_ns - res.first->second);
+        res.first->second = now_ns;
+      }
+    }
+
+    struct flow_hash {
+      size_t operator()(const five_tuple& key) const {
+        return sketch_key<five_tuple>::hash(key);
+      }
+    };
+
+    struct flow_equal {
+      bool operator()(const five_tuple& a, const five_tuple& b) const {
+        return sketch_key<five_tuple>::equal(a, b);
+      }
+    };
+
+    /* Last arrival time (ns) per flow */
+    typedef std::unordered_map<five_tuple, uint64_t, flow_hash, flow_equal> flow_clock;
+
+    character_store& chars_;
+
+    /* The current burst */
+    size_t num_chars_;
+    size_t num_top_k_;
+    complex_character_index::char_index* char_index_;
+    sketch_index* sketches_;
+    quantile_index* quantiles_;
+    const uint64_t* arrival_ns_;
+    uint64_t burst_ns_;
+
+    std::vector<standing_top_k::partial*> top_k_partials_;  // Per standing query
+    std::vector<std::vector<five_tuple>> top_k_keys_;
+    std::vector<flow_clock> flow_clocks_;  // Per quantile slot
+    std::vector<uint32_t> char_pkts_;      // Per character, for the current burst
+    std::vector<uint64_t> char_bytes_;
+    std::vector<uint32_t> matched_chars_;
+  };
+
+  character_store() {
+    char_idx_ = new complex_character_index();
+    char_rollup_ = new char_counter_rollup();
+    num_filters_.store(0U, std::memory_order_release);
+    num_top_k_.store(0U, std::memory_order_release);
+    num_casts_.store(0U, std::memory_order_release);
+
+    distinct_idx_ = new time_sketch_index();
+    for (auto& slot : distinct_slot_)
+      slot.store(0, std::memory_order_relaxed);
+    num_distinct_.store(0U, std::memory_order_release);
+
+    quantile_idx_ = new time_quantile_index();
+    for (auto& slots : quantile_slot_)
+      for (auto& slot : slots)
+        slot.store(0, std::memory_order_relaxed);
+    num_quantiles_.store(0U, std::memory_order_release);
+  }
+
+  ~character_store() {
+    for (uint32_t i = 0; i < num_casts_.load(std::memory_order_acquire); i++)
+      delete casts_[i];
+    for (uint32_t i = 0; i < num_top_k_.load(std::memory_order_acquire); i++)
+      delete top_k_[i];
+    delete distinct_idx_;
+    delete quantile_idx_;
+    delete char_rollup_;
+  }
+
+  /**
+   * Add a new complex character with specified packet filter.
+   *
+   * @param filter The packet filter.
+   * @return The id of the newly created complex character.
+   */
+  uint32_t add_complex_character(const filter_list& filter) {
+    size_t idx = num_filters_.fetch_add(1UL, std::memory_order_release);
+    filters_[idx] = filter;
+    return idx;
+  }
+
+  uint32_t num_complex_characters() const {
+    return num_filters_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Look up the packets of a complex character within a time range.
+   *
+   * @param char_id The id of the complex character.
+   * @param max_rid Largest record-id to consider.
+   * @param range The time range, clamped to the stored seconds; an empty
+   * range (first > second) has no packets.
+   * @return The record ids of the packets.
+   */
+  filter_result lookup(const uint32_t char_id, const uint64_t max_rid,
+                       const time_range range) {
+    return char_idx_->filter(max_rid, char_id, range);
+  }
+
+  /**
+   * Count the packets and bytes of a complex character within a time range,
+   * from its hour, minute and second counters; neither reads the
+   * character's entry lists nor allocates.
+   *
+   * @param char_id The id of the complex character.
+   * @param ts_beg The beginning of the (clamped) time range.
+   * @param ts_end The end of the (clamped) time range.
+   * @return The packet and byte counts.
+   */
+  traffic_counts count(const uint32_t char_id, const uint32_t ts_beg,
+                       const uint32_t ts_end) const {
+    traffic_counts res = { 0, 0 };
+    char_rollup_->cover(ts_beg, ts_end, [&res, char_id](counter_index* counters) {
+      char_counter_block* block = counters->at(char_id / CHAR_COUNTER_BLOCK);
+      if (block == NULL)
+        return;
+      res.pkts += block->pkts[char_id % CHAR_COUNTER_BLOCK].load(
+          std::memory_order_relaxed);
+      res.bytes += block->bytes[char_id % CHAR_COUNTER_BLOCK].load(
+          std::memory_order_relaxed);
+    });
+    return res;
+  }
+
+  /**
+   * Maintain per-second distinct-count sketches for a complex character, so
+   * that distinct counts over a time range merge one sketch per second
+   * instead of visiting every packet (see distinct).
+   *
+   * @param char_id The id of the complex character.
+   * @param fields The 5-tuple fields whose distinct values are counted (see
+   *  flow_key).
+   */
+  void add_distinct_count(const uint32_t char_id, uint32_t fields) {
+    std::lock_guard<std::mutex> lock(standing_mutex_);
+    if (distinct_slot_[char_id].load(std::memory_order_relaxed) != 0)
+      return;
+    uint32_t slot = num_distinct_.load(std::memory_order_relaxed);
+    if (slot == MAX_DISTINCT_CHARACTERS)
+      throw std::length_error("Too many characters with distinct counts");
+    distinct_fields_[slot] = fields;
+    distinct_slot_[char_id].store(slot + 1, std::memory_order_release);
+    num_distinct_.store(slot + 1, std::memory_order_release);
+  }
+
+  /**
+   * Estimate the number of distinct keys among the packets of a complex
+   * character within a time range, by merging its per-second sketches.
+   * Only seconds after add_distinct_count() are covered.
+   *
+   * @param char_id The id of the complex character.
+   * @param ts_beg The beginning of the (clamped) time range.
+   * @param ts_end The end of the (clamped) time range.
+   * @return The merged sketch.
+   */
+  char_sketch distinct(const uint32_t char_id, const uint32_t ts_beg,
+                       const uint32_t ts_end) const {
+    uint8_t slot = distinct_slot_[char_id].load(std::memory_order_acquire);
+    if (slot == 0)
+      throw std::invalid_argument("Character has no distinct-count sketches");
+    char_sketch res;
+    for (uint64_t ts = ts_beg; ts <= ts_end; ts++) {
+      sketch_index* sketches = distinct_idx_->at(ts);
+      if (sketches == NULL)
+        continue;
+      char_sketch* sketch = sketches->at(slot - 1);
+      if (sketch != NULL)
+        res.merge(*sketch);
+    }
+    return res;
+  }
+
+  /**
+   * Maintain per-second quantile sketches of a distribution (packet sizes or
+   * flow inter-arrival times) for a complex character, so that quantiles
+   * over a time range merge one sketch per second instead of visiting every
+   * packet (see quantiles).
+   *
+   * @param char_id The id of the complex character.
+   * @param metric The distribution (see quantile_metric).
+   */
+  void add_quantiles(const uint32_t char_id, const quantile_metric metric) {
+    std::lock_guard<std::mutex> lock(standing_mutex_);
+    if (quantile_slot_[metric][char_id].load(std::memory_order_relaxed) != 0)
+      return;
+    uint32_t slot = num_quantiles_.load(std::memory_order_relaxed);
+    if (slot == MAX_QUANTILE_CHARACTERS)
+      throw std::length_error("Too many characters with quantile sketches");
+    quantile_slot_[metric][char_id].store(slot + 1, std::memory_order_release);
+    num_quantiles_.store(slot + 1, std::memory_order_release);
+  }
+
+  /**
+   * Get the distribution of a metric among the packets of a complex
+   * character within a time range, by merging its per-second sketches.
+   * Only seconds after add_quantiles() are covered.
+   *
+   * @param char_id The id of the complex character.
+   * @param metric The distribution (see quantile_metric).
+   * @param ts_beg The beginning of the (clamped) time range.
+   * @param ts_end The end of the (clamped) time range.
+   * @return The merged sketch; read quantiles with quantile(q).
+   */
+  quantile_sketch quantiles(const uint32_t char_id, const quantile_metric metric,
+                            const uint32_t ts_beg, const uint32_t ts_end) const {
+    uint8_t slot = quantile_slot_[metric][char_id].load(std::memory_order_acquire);
+    if (slot == 0)
+      throw std::invalid_argument("Character has no quantile sketches");
+    quantile_sketch res;
+    for (uint64_t ts = ts_beg; ts <= ts_end; ts++) {
+      quantile_index* sketches = quantile_idx_->at(ts);
+      if (sketches == NULL)
+        continue;
+      char_quantiles* sketch = sketches->at(slot - 1);
+      if (sketch != NULL)
+        res.merge(*sketch);
+    }
+    return res;
+  }
+
+  /**
+   * Add a standing top-K query, maintained on ingest.
+   *
+   * @param filter The packet filter; an empty filter matches all packets.
+   * @param fields The 5-tuple fields that form the key (see flow_key).
+   * @param capacity The number of counters in the sketch.
+   * @return The id of the newly created query.
+   */
+  uint32_t add_standing_top_k(const filter_list& filter, uint32_t fields,
+                              size_t capacity = TOP_K_CAPACITY) {
+    std::lock_guard<std::mutex> lock(standing_mutex_);
+    uint32_t idx = num_top_k_.load(std::memory_order_relaxed);
+    if (idx == MAX_STANDING_TOP_K)
+      throw std::length_error("Too many standing top-K queries");
+    top_k_[idx] = new standing_top_k(filter, fields, capacity);
+    num_top_k_.store(idx + 1, std::memory_order_release);
+    return idx;
+  }
+
+  standing_top_k* get_standing_top_k(const uint32_t id) const {
+    return top_k_[id];
+  }
+
+  /**
+   * Add a continuous cast; the packet store keeps its aggregate up to date.
+   *
+   * @param filter The packet filter; an empty filter matches all packets.
+   * @return The cast, owned by the character store.
+   */
+  template<typename aggregate_type>
+  standing_cast<aggregate_type>* add_standing_cast(const filter_list& filter) {
+    std::lock_guard<std::mutex> lock(standing_mutex_);
+    uint32_t idx = num_casts_.load(std::memory_order_relaxed);
+    if (idx == MAX_STANDING_CASTS)
+      throw std::length_error("Too many standing casts");
+    standing_cast<aggregate_type>* c = new standing_cast<aggregate_type>(filter);
+    casts_[idx] = c;
+    num_casts_.store(idx + 1, std::memory_order_release);
+    return c;
+  }
+
+  uint32_t num_standing_casts() const {
+    return num_casts_.load(std::memory_order_acquire);
+  }
+
+  standing_cast_base* get_standing_cast(const uint32_t id) const {
+    return casts_[id];
+  }
+
+ private:
+  /* Add a packet to a character's sketch for the current second */
+  inline void add_distinct(sketch_index* sketches, const size_t char_id,
+                           const packet_metadata& md) {
+    uint8_t slot = distinct_slot_[char_id].load(std::memory_order_acquire);
+    if (slot == 0)
+      return;
+    five_tuple key;
+    flow_key_of(md, distinct_fields_[slot - 1], key);
+    sketches->get(slot - 1)->add_atomic(hll_hash(key));
+  }
+
+  /* Complex characters */
+  std::array<filter_list, MAX_FILTERS> filters_;
+  std::atomic<uint32_t> num_filters_;
+  complex_character_index* char_idx_;
+  char_counter_rollup* char_rollup_;  // Character counters
+
+  /* Standing top-K queries */
+  std::array<standing_top_k*, MAX_STANDING_TOP_K> top_k_;
+  std::atomic<uint32_t> num_top_k_;
+
+  /* Continuous casts */
+  std::array<standing_cast_base*, MAX_STANDING_CASTS> casts_;
+  std::atomic<uint32_t> num_casts_;
+
+  /* Per-second distinct-count sketches of complex characters */
+  time_sketch_index* distinct_idx_;
+  std::array<std::atomic<uint8_t>, MAX_FILTERS> distinct_slot_;  // Slot + 1
+  std::array<uint32_t, MAX_DISTINCT_CHARACTERS> distinct_fields_;
+  std::atomic<uint32_t> num_distinct_;
+
+  /* Per-second quantile sketches of complex characters */
+  time_quantile_index* quantile_idx_;
+  std::array<std::atomic<uint8_t>, MAX_FILTERS> quantile_slot_[NUM_QUANTILE_METRICS];  // Slot + 1
+  std::atomic<uint32_t> num_quantiles_;
+
+  std::mutex standing_mutex_;
+};
+
+}
+
+#endif /* CHARACTER_STORE_H_ */
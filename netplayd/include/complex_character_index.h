@@ -32,6 +32,11 @@ class complex_character_index {
         cur_idx_ = -1;
         cur_ts_ = res_->range_.first;
         cur_list_ = NULL;
+        if (cur_ts_ > res_->range_.second) {  // Empty range
+          cur_idx_ = 0;
+          cur_ts_ = res_->range_.second + 1;
+          return;
+        }
         char_index* c = res_->index_->at(cur_ts_);
         if (c != NULL)
           cur_list_ = c->at(res_->char_id_);
@@ -0,0 +1,131 @@
+#ifndef DDSKETCH_H_
+#define DDSKETCH_H_
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#define DDSKETCH_ALPHA 0.02  // Relative accuracy of quantiles
+#define DDSKETCH_BINS  1024  // Covers values up to ~1e17 at 2% accuracy
+
+namespace netplay {
+
+/**
+ * DDSketch quantile sketch for non-negative values (Masson et al.,
+ * "DDSketch: A Fast and Fully-Mergeable Quantile Sketch with Relative-Error
+ * Guarantees").
+ *
+ * Values are counted in logarithmic bins: bin i holds values in
+ * (gamma^(i-1), gamma^i], with gamma = (1 + alpha) / (1 - alpha), so every
+ * quantile is returned within a relative error of alpha (DDSKETCH_ALPHA).
+ * Values below 1 (e.g., zero gaps) are counted separately and reported as 0,
+ * and values beyond the last bin are counted in it.
+ *
+ * The bins are a fixed array, so sketches merge by adding bins (across
+ * threads, shards and time buckets), and add_atomic() lets several writers
+ * update a shared sketch without locks. count_type may be narrowed (e.g., to
+ * uint32_t) for sketches that are kept per second.
+ */
+template<typename count_type = uint64_t, size_t NUM_BINS = DDSKETCH_BINS>
+class ddsketch {
+ public:
+  ddsketch() {
+    memset(bins_, 0, sizeof(bins_));
+    zeros_ = 0;
+  }
+
+  /**
+   * Add a value to the sketch.
+   *
+   * @param value The value.
+   */
+  inline void add(const double value) {
+    if (value < 1.0)
+      zeros_++;
+    else
+      bins_[bin_of(value)]++;
+  }
+
+  /**
+   * Add a value to a sketch shared by several writers.
+   *
+   * @param value The value.
+   */
+  inline void add_atomic(const double value) {
+    count_type* c = (value < 1.0) ? &zeros_ : &bins_[bin_of(value)];
+    __atomic_fetch_add(c, 1, __ATOMIC_RELAXED);
+  }
+
+  /**
+   * Merge another sketch (which may be updated concurrently) into this one.
+   *
+   * @param other The other sketch.
+   */
+  template<typename other_count_type>
+  void merge(const ddsketch<other_count_type, NUM_BINS>& other) {
+    zeros_ += other.zeros();
+    for (size_t i = 0; i < NUM_BINS; i++)
+      bins_[i] += other.bin(i);
+  }
+
+  /**
+   * Estimate a quantile.
+   *
+   * @param q The quantile, in [0, 1].
+   * @return The estimate, within a relative error of DDSKETCH_ALPHA; 0 if
+   *  the sketch is empty.
+   */
+  double quantile(const double q) const {
+    uint64_t n = count();
+    if (n == 0)
+      return 0.0;
+    uint64_t rank = (uint64_t) (q * (double) (n - 1));
+    uint64_t seen = zeros_;
+    if (rank < seen)
+      return 0.0;
+    for (size_t i = 0; i < NUM_BINS; i++) {
+      seen += bins_[i];
+      if (rank < seen)
+        return 2.0 * std::pow(gamma(), (double) i) / (gamma() + 1.0);
+    }
+    return 2.0 * std::pow(gamma(), (double) (NUM_BINS - 1)) / (gamma() + 1.0);
+  }
+
+  /**
+   * Get the number of values in the sketch.
+   *
+   * @return The number of values.
+   */
+  uint64_t count() const {
+    uint64_t n = zeros_;
+    for (size_t i = 0; i < NUM_BINS; i++)
+      n += bins_[i];
+    return n;
+  }
+
+  count_type zeros() const {
+    return __atomic_load_n(&zeros_, __ATOMIC_RELAXED);
+  }
+
+  count_type bin(const size_t i) const {
+    return __atomic_load_n(&bins_[i], __ATOMIC_RELAXED);
+  }
+
+ private:
+  static inline double gamma() {
+    return (1.0 + DDSKETCH_ALPHA) / (1.0 - DDSKETCH_ALPHA);
+  }
+
+  static inline size_t bin_of(const double value) {
+    static const double inv_log_gamma = 1.0 / std::log(gamma());
+    double idx = std::ceil(std::log(value) * inv_log_gamma);
+    return idx < (double) (NUM_BINS - 1) ? (size_t) idx : NUM_BINS - 1;
+  }
+
+  count_type bins_[NUM_BINS];
+  count_type zeros_;
+};
+
+}
+
+#endif /* DDSKETCH_H_ */
@@ -48,7 +48,7 @@ struct negation : public expression {
   expression* child;
 };
 
-void print_expression(expression* exp) {
+inline void print_expression(expression* exp) {
   switch (exp->type) {
     case expression_type::PREDICATE: {
       predicate *p = (predicate*) exp;
@@ -90,7 +90,7 @@ void print_expression(expression* exp) {
   }
 }
 
-void free_expression(expression* exp) {
+inline void free_expression(expression* exp) {
   switch (exp->type) {
     case expression_type::PREDICATE: {
       predicate *p = (predicate*) exp;
@@ -0,0 +1,316 @@
+#ifndef GROUP_BY_H_
+#define GROUP_BY_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#define GROUP_TABLE_MIN_CAPACITY 64
+#define GROUP_QUEUE_DEPTH 4  // Pending batches per group-by worker
+
+namespace netplay {
+
+/**
+ * Open-addressing hash table from group keys to accumulators.
+ *
+ * Keys and their accumulators are stored inline in a single power-of-two
+ * array and probed linearly, so that a lookup usually touches a single cache
+ * line, and no memory is allocated per group. Keys are hashed with a
+ * multiplicative (Fibonacci) hash, and the table doubles once it is 3/4 full.
+ * Groups are never removed.
+ */
+template<typename key_type, typename acc_type>
+class group_table {
+ public:
+  static_assert(std::is_integral<key_type>::value,
+                "Group keys must be integral attributes");
+
+  group_table()
+    : size_(0) {
+    resize(GROUP_TABLE_MIN_CAPACITY);
+  }
+
+  /**
+   * Get the accumulator of a group, inserting the group if it is new.
+   *
+   * @param key The group key.
+   * @param init The initial accumulator value for a new group.
+   * @return The accumulator of the group.
+   */
+  acc_type& get(const key_type key, const acc_type& init) {
+    bool inserted;
+    return get(key, init, inserted);
+  }
+
+  acc_type& get(const key_type key, const acc_type& init, bool& inserted) {
+    if ((size_ + 1) * 4 > slots_.size() * 3)
+      resize(slots_.size() * 2);
+
+    size_t i = slot_of(key);
+    while (slots_[i].used) {
+      if (slots_[i].key == key) {
+        inserted = false;
+        return slots_[i].acc;
+      }
+      i = (i + 1) & mask_;
+    }
+    slots_[i].key = key;
+    slots_[i].acc = init;
+    slots_[i].used = true;
+    size_++;
+    inserted = true;
+    return slots_[i].acc;
+  }
+
+  /**
+   * Find the accumulator of a group.
+   *
+   * @param key The group key.
+   * @return The accumulator of the group, or NULL if there is no such group.
+   */
+  const acc_type* find(const key_type key) const {
+    size_t i = slot_of(key);
+    while (slots_[i].used) {
+      if (slots_[i].key == key)
+        return &slots_[i].acc;
+      i = (i + 1) & mask_;
+    }
+    return NULL;
+  }
+
+  /**
+   * Visit every group.
+   *
+   * @param fn The visitor, invoked as fn(key, accumulator).
+   */
+  template<typename visitor_type>
+  void for_each(visitor_type fn) const {
+    for (const slot& s : slots_)
+      if (s.used)
+        fn(s.key, s.acc);
+  }
+
+  /**
+   * Merge the groups of another table into this one.
+   *
+   * @param other The other table.
+   * @param merge_fn Merges two accumulators, as merge_fn(into, from).
+   */
+  template<typename merge_type>
+  void merge(const group_table& other, merge_type merge_fn) {
+    other.for_each([this, &merge_fn](key_type key, const acc_type& acc) {
+      bool inserted;
+      acc_type& into = get(key, acc, inserted);
+      if (!inserted)
+        merge_fn(into, acc);
+    });
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  struct slot {
+    key_type key;
+    acc_type acc;
+    bool used;
+  };
+
+  inline size_t slot_of(const key_type key) const {
+    return ((uint64_t) key * 0x9E3779B97F4A7C15ULL) >> shift_;
+  }
+
+  void resize(size_t capacity) {
+    std::vector<slot> old;
+    old.swap(slots_);
+    slots_.assign(capacity, slot());
+    mask_ = capacity - 1;
+    shift_ = 64 - __builtin_ctzll(capacity);
+    for (const slot& s : old) {
+      if (!s.used)
+        continue;
+      size_t i = slot_of(s.key);
+      while (slots_[i].used)
+        i = (i + 1) & mask_;
+      slots_[i] = s;
+    }
+  }
+
+  std::vector<slot> slots_;
+  size_t size_;
+  size_t mask_;
+  unsigned shift_;
+};
+
+/**
+ * Functions computed per group; each takes the packet attribute it
+ * aggregates (count takes none).
+ */
+namespace group {
+
+template<typename T = void>
+struct count {
+  typedef uint64_t acc_type;
+
+  static inline acc_type init() {
+    return 0;
+  }
+
+  static inline void update(acc_type& acc, void*, uint16_t) {
+    acc++;
+  }
+
+  static inline void merge(acc_type& into, const acc_type& from) {
+    into += from;
+  }
+};
+
+template<typename T>
+struct sum {
+  static_assert(std::is_arithmetic<typename T::value_type>::value,
+                "Attribute type must be numeric");
+  typedef typename std::conditional<
+      std::is_floating_point<typename T::value_type>::value, double,
+      uint64_t>::type acc_type;
+  typedef T attribute_type;
+
+  static inline acc_type init() {
+    return 0;
+  }
+
+  static inline void update(acc_type& acc, void* pkt, uint16_t len) {
+    acc += T::get(pkt, len);
+  }
+
+  static inline void merge(acc_type& into, const acc_type& from) {
+    into += from;
+  }
+};
+
+template<typename T>
+struct maximum {
+  typedef typename T::value_type acc_type;
+  static_assert(std::is_arithmetic<acc_type>::value,
+                "Attribute type must be numeric");
+  typedef T attribute_type;
+
+  static inline acc_type init() {
+    return std::numeric_limits<acc_type>::lowest();
+  }
+
+  static inline void update(acc_type& acc, void* pkt, uint16_t len) {
+    acc = std::max(acc, T::get(pkt, len));
+  }
+
+  static inline void merge(acc_type& into, const acc_type& from) {
+    into = std::max(into, from);
+  }
+};
+
+template<typename T>
+struct minimum {
+  typedef typename T::value_type acc_type;
+  static_assert(std::is_arithmetic<acc_type>::value,
+                "Attribute type must be numeric");
+  typedef T attribute_type;
+
+  static inline acc_type init() {
+    return std::numeric_limits<acc_type>::max();
+  }
+
+  static inline void update(acc_type& acc, void* pkt, uint16_t len) {
+    acc = std::min(acc, T::get(pkt, len));
+  }
+
+  static inline void merge(acc_type& into, const acc_type& from) {
+    into = std::min(into, from);
+  }
+};
+
+}
+
+/**
+ * Group-by aggregation: packets are grouped by a key attribute, and a group
+ * function (e.g., group::count<>, group::sum<attribute::ipv4_total_length>)
+ * is computed per group. For instance,
+ *
+ *   group_by<attribute::ipv4_src_addr, group::count<>>
+ *
+ * counts packets per source address. Attribute values are taken as stored
+ * in the packet (i.e., in network byte order).
+ *
+ * Like the aggregates, group_by types can be merged across shards (and
+ * across per-thread partials).
+ */
+template<typename key_attribute, typename function_type>
+struct group_by {
+  typedef typename key_attribute::value_type key_type;
+  typedef typename function_type::acc_type acc_type;
+  typedef group_table<key_type, acc_type> result_type;
+  typedef key_attribute attribute_type;
+
+  static inline void update(result_type& groups, void* pkt, uint16_t len) {
+    function_type::update(groups.get(key_attribute::get(pkt, len),
+                                     function_type::init()), pkt, len);
+  }
+
+  static inline void merge(result_type& into, const result_type& from,
+                           const uint64_t) {
+    into.merge(from, [](acc_type& a, const acc_type& b) {
+      function_type::merge(a, b);
+    });
+  }
+};
+
+/**
+ * Bounded queue of record id batches, handed from the thread scanning a cast
+ * to the group-by workers.
+ */
+class group_by_queue {
+ public:
+  group_by_queue(size_t depth)
+    : depth_(depth), closed_(false) {
+  }
+
+  void push(std::vector<uint64_t>&& batch) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this] { return batches_.size() < depth_; });
+    batches_.push_back(std::move(batch));
+    not_empty_.notify_one();
+  }
+
+  bool pop(std::vector<uint64_t>& batch) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return !batches_.empty() || closed_; });
+    if (batches_.empty())
+      return false;
+    batch = std::move(batches_.front());
+    batches_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+ private:
+  size_t depth_;
+  bool closed_;
+  std::deque<std::vector<uint64_t>> batches_;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+};
+
+}
+
+#endif /* GROUP_BY_H_ */
@@ -0,0 +1,147 @@
+#ifndef HYPERLOGLOG_H_
+#define HYPERLOGLOG_H_
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "top_k.h"
+
+#define HLL_PRECISION 12  // 4096 registers, ~1.6% standard error
+
+namespace netplay {
+
+/* 64-bit finalizer (MurmurHash3 fmix64); spreads keys over all bits */
+static inline uint64_t hll_mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/* Hash of an attribute value for distinct counting */
+template<typename T>
+static inline uint64_t hll_hash(const T& key,
+    typename std::enable_if<std::is_integral<T>::value>::type* = 0) {
+  return hll_mix((uint64_t) key);
+}
+
+template<typename T>
+static inline uint64_t hll_hash(const T& key,
+    typename std::enable_if<!std::is_integral<T>::value>::type* = 0) {
+  return hll_mix(sketch_key<T>::hash(key));
+}
+
+/**
+ * HyperLogLog sketch for the number of distinct keys in a stream (Flajolet
+ * et al., "HyperLogLog: the analysis of a near-optimal cardinality estimation
+ * algorithm"), with 2^P one-byte registers and a standard error of about
+ * 1.04 / sqrt(2^P). Small cardinalities are estimated by linear counting.
+ *
+ * Sketches merge by taking the register-wise maximum, so sketches of
+ * threads, shards or time intervals combine losslessly. add_atomic() lets
+ * several writers update a shared sketch without locks.
+ */
+template<size_t P = HLL_PRECISION>
+class hyperloglog {
+ public:
+  static_assert(P >= 4 && P <= 18, "Precision must be in [4, 18]");
+  static const size_t NUM_REGISTERS = 1UL << P;
+
+  hyperloglog() {
+    memset(registers_, 0, sizeof(registers_));
+  }
+
+  /**
+   * Add a (hashed) key to the sketch.
+   *
+   * @param hash The 64-bit hash of the key.
+   */
+  inline void add(const uint64_t hash) {
+    size_t idx;
+    uint8_t rank;
+    locate(hash, idx, rank);
+    if (rank > registers_[idx])
+      registers_[idx] = rank;
+  }
+
+  /**
+   * Add a (hashed) key to a sketch shared by several writers.
+   *
+   * @param hash The 64-bit hash of the key.
+   */
+  inline void add_atomic(const uint64_t hash) {
+    size_t idx;
+    uint8_t rank;
+    locate(hash, idx, rank);
+    uint8_t cur = __atomic_load_n(&registers_[idx], __ATOMIC_RELAXED);
+    while (rank > cur
+           && !__atomic_compare_exchange_n(&registers_[idx], &cur, rank, true,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+  }
+
+  /**
+   * Merge another sketch (which may be updated concurrently) into this one.
+   *
+   * @param other The other sketch.
+   */
+  void merge(const hyperloglog& other) {
+    for (size_t i = 0; i < NUM_REGISTERS; i++) {
+      uint8_t r = __atomic_load_n(&other.registers_[i], __ATOMIC_RELAXED);
+      registers_[i] = r > registers_[i] ? r : registers_[i];
+    }
+  }
+
+  /**
+   * Estimate the number of distinct keys.
+   *
+   * @return The estimate.
+   */
+  uint64_t estimate() const {
+    const double m = (double) NUM_REGISTERS;
+    double sum = 0.0;
+    size_t zeros = 0;
+    for (size_t i = 0; i < NUM_REGISTERS; i++) {
+      sum += std::ldexp(1.0, -registers_[i]);
+      zeros += (registers_[i] == 0);
+    }
+    double e = alpha() * m * m / sum;
+    if (e <= 2.5 * m && zeros > 0)
+      e = m * std::log(m / (double) zeros);
+    return (uint64_t) (e + 0.5);
+  }
+
+  size_t storage_size() const {
+    return sizeof(registers_);
+  }
+
+ private:
+  static inline void locate(const uint64_t hash, size_t& idx, uint8_t& rank) {
+    idx = hash >> (64 - P);
+    uint64_t w = (hash << P) | (1UL << (P - 1));
+    rank = __builtin_clzll(w) + 1;
+  }
+
+  static double alpha() {
+    switch (P) {
+    case 4:
+      return 0.673;
+    case 5:
+      return 0.697;
+    case 6:
+      return 0.709;
+    default:
+      return 0.7213 / (1.0 + 1.079 / (double) NUM_REGISTERS);
+    }
+  }
+
+  uint8_t registers_[NUM_REGISTERS];
+};
+
+}
+
+#endif /* HYPERLOGLOG_H_ */
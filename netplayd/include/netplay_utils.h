@@ -2,6 +2,7 @@
 #define NETPLAY_UTILS_H_
 
 #include <inttypes.h>
+#include <arpa/inet.h>
 
 #include <ctime>
 
@@ -31,39 +32,61 @@ class netplay_utils {
   typedef clause::iterator clause_iterator;
 
   static filter_list build_filter_list(const packet_store::handle* h, expression* e) {
-    uint32_t now = std::time(NULL);    
     filter_list list;
-    
-    if (e->type == expression_type::PREDICATE) {
-      clause _clause;
-      _clause.push_back(netplay_utils::build_index_filter(h, (predicate*) e, now));
+    for (const clause& _clause : build_clauses(h, e))
       list.push_back(build_packet_filter(h, _clause));
+    return list;
+  }
+
+  /**
+   * Build the clauses of a filter expression in DNF, one per conjunction.
+   * A predicate that selects two disjoint ranges of an index (e.g.,
+   * vlan != 10) splits its conjunction into one clause per range.
+   *
+   * @param h A handle to the packet store.
+   * @param e The expression.
+   * @return The clauses.
+   */
+  static std::vector<clause> build_clauses(const packet_store::handle* h,
+                                           expression* e) {
+    uint32_t now = std::time(NULL);
+    std::vector<conjunction*> conjunctions;
+    conjunction single;
+    if (e->type == expression_type::PREDICATE) {
+      single.children.push_back(e);
+      conjunctions.push_back(&single);
     } else if (e->type == expression_type::AND) {
-      conjunction* c = (conjunction*) e;
-      clause _clause;
-      for (expression* child : c->children) {
-        if (child->type != expression_type::PREDICATE)
-          throw parse_exception("Filter expression not in DNF");
-        _clause.push_back(netplay_utils::build_index_filter(h, (predicate*) child, now));
-      }
-      list.push_back(build_packet_filter(h, _clause));
+      conjunctions.push_back((conjunction*) e);
     } else if (e->type == expression_type::OR) {
       disjunction *d = (disjunction*) e;
       for (expression* dchild : d->children) {
         if (dchild->type != expression_type::AND)
           throw parse_exception("Filter expression not in DNF");
-        conjunction* c = (conjunction*) dchild;
-        clause _clause;
-        for (expression* cchild : c->children) {
-          if (cchild->type != expression_type::PREDICATE)
-            throw parse_exception("Filter expression not in DNF");
-          _clause.push_back(netplay_utils::build_index_filter(h, (predicate*) cchild, now));
-        }
-        list.push_back(build_packet_filter(h, _clause));
+        conjunctions.push_back((conjunction*) dchild);
       }
     }
 
-    return list;
+    std::vector<clause> clauses;
+    for (conjunction* c : conjunctions) {
+      std::vector<clause> expanded(1);
+      for (expression* child : c->children) {
+        if (child->type != expression_type::PREDICATE)
+          throw parse_exception("Filter expression not in DNF");
+        std::vector<index_filter> alternatives =
+            build_index_filters(h, (predicate*) child, now);
+        std::vector<clause> next;
+        for (const clause& partial : expanded) {
+          for (const index_filter& f : alternatives) {
+            next.push_back(partial);
+            next.back().push_back(f);
+          }
+        }
+        expanded.swap(next);
+      }
+      clauses.insert(clauses.end(), expanded.begin(), expanded.end());
+    }
+    single.children.clear();  // Not owned
+    return clauses;
   }
 
   static packet_filter build_packet_filter(const packet_store::handle* h,
@@ -74,6 +97,10 @@ class netplay_utils {
     pf.src_port = packet_filter::range(0, UINT64_MAX);
     pf.dst_port = packet_filter::range(0, UINT64_MAX);
     pf.timestamp = packet_filter::range(0, UINT64_MAX);
+    pf.vlan = packet_filter::range(0, UINT64_MAX);
+    pf.vni = packet_filter::range(0, UINT64_MAX);
+    pf.src_addr6.len = 0;
+    pf.dst_addr6.len = 0;
 
     for (const index_filter& f : clause) {
       if (f.index_id == h->srcip_idx())
@@ -86,6 +113,14 @@ class netplay_utils {
         pf.dst_port = f.tok_range;
       else if (f.index_id == h->timestamp_idx())
         pf.timestamp = f.tok_range;
+      else if (f.index_id == h->vlan_idx())
+        pf.vlan = f.tok_range;
+      else if (f.index_id == h->vni_idx())
+        pf.vni = f.tok_range;
+      else if (f.index_id == h->srcip6_idx())
+        pf.src_addr6 = f.prefix;
+      else if (f.index_id == h->dstip6_idx())
+        pf.dst_addr6 = f.prefix;
       else
         throw parse_exception("Invalid idx id " + std::to_string(f.index_id));
     }
@@ -98,6 +133,20 @@ class netplay_utils {
       uint32_t index_id = i->index_id;
       index_filter::range tok_range = i->tok_range;
 
+      if (packet_store::is_radix_index(index_id)) {
+        for (clause_iterator j = i + 1; j != clause.end(); ) {
+          if (index_id == j->index_id) {
+            if (!merge_prefix(i->prefix, j->prefix))
+              return false;
+            j = clause.erase(j);
+          } else {
+            j++;
+          }
+        }
+        i++;
+        continue;
+      }
+
       for (clause_iterator j = i + 1; j != clause.end(); ) {
         if (index_id == j->index_id) {
           tok_range.first = std::max(tok_range.first, j->tok_range.first);
@@ -118,6 +167,39 @@ class netplay_utils {
     return true;
   }
 
+  /**
+   * Intersect two IPv6 prefixes; the intersection of two prefixes is the
+   * longer one if the shorter one contains it, and empty otherwise.
+   *
+   * @param p The prefix to intersect into.
+   * @param q The prefix to intersect with.
+   * @return False if the intersection is empty, true otherwise.
+   */
+  static bool merge_prefix(ip6_prefix& p, const ip6_prefix& q) {
+    if (q.len > p.len) {
+      if (!p.matches(q.addr))
+        return false;
+      p = q;
+    } else if (!q.matches(p.addr)) {
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * Build the index filters of a predicate: usually one, but two for
+   * predicates that select two disjoint ranges of an index (see
+   * tag_filters), of which a packet must match either.
+   */
+  static std::vector<index_filter> build_index_filters(
+      const packet_store::handle* h, const predicate* p, const uint32_t now) {
+    if (p->attr == "vlan")
+      return tag_filters(h->vlan_idx(), p->op, p->value, 1, 4095);
+    else if (p->attr == "vni")
+      return tag_filters(h->vni_idx(), p->op, p->value, 0, 16777215);
+    return std::vector<index_filter>(1, build_index_filter(h, p, now));
+  }
+
   static index_filter build_index_filter(const packet_store::handle* h,
                                          const predicate* p, const uint32_t now) {
     // TODO: replace this with a map lookup
@@ -131,6 +213,10 @@ class netplay_utils {
       return port_filter(h->dstport_idx(), p->op, p->value);
     else if (p->attr == "timestamp")
       return time_filter(h->timestamp_idx(), p->op, p->value, now);
+    else if (p->attr == "ipv6_src")
+      return ip6_filter(h->srcip6_idx(), p->op, p->value);
+    else if (p->attr == "ipv6_dst")
+      return ip6_filter(h->dstip6_idx(), p->op, p->value);
     else
       throw parse_exception("Invaild attribute: " + p->attr);
   }
@@ -175,6 +261,46 @@ class netplay_utils {
                                ip | (~ip_prefix_mask[32 - prefix]));
   }
 
+  static index_filter ip6_filter(const uint32_t index_id, const std::string& op,
+                                 const std::string& ip_string) {
+    index_filter f;
+    f.index_id = index_id;
+    f.tok_range = index_filter::range(0, 0);
+    if (op == "in" || op == "!in") {
+      f.prefix = ip6_range(ip_string);
+    } else if (op == "==" || op == "!=") {
+      ip6_string_to_bytes(ip_string, f.prefix.addr);
+      f.prefix.len = 128;
+    } else {
+      throw parse_exception("Specify IPv6 ranges with prefix notation");
+    }
+    return f;
+  }
+
+  static ip6_prefix ip6_range(const std::string& ip_string) {
+    size_t loc = ip_string.find_first_of('/');
+    if (loc == std::string::npos)
+      throw parse_exception("Malformed IPv6 range: " + ip_string);
+
+    ip6_prefix p;
+    int len = -1;
+    try {
+      len = std::stoi(ip_string.substr(loc + 1));
+    } catch (std::exception& e) {
+      throw parse_exception("Malformed IPv6 range: " + ip_string);
+    }
+    if (len < 0 || len > 128)
+      throw parse_exception("Malformed IPv6 range: " + ip_string);
+    p.len = len;
+    ip6_string_to_bytes(ip_string.substr(0, loc), p.addr);
+    return p;
+  }
+
+  static void ip6_string_to_bytes(const std::string& ip, uint8_t* addr) {
+    if (inet_pton(AF_INET6, ip.c_str(), addr) != 1)
+      throw parse_exception("Malformed IPv6 address: " + ip);
+  }
+
   static uint32_t ip_string_to_uint32(const char* ip) {
     unsigned char tmp[4];
     sscanf(ip, "%hhu.%hhu.%hhu.%hhu", &tmp[3], &tmp[2], &tmp[1], &tmp[0]);
@@ -211,6 +337,70 @@ class netplay_utils {
     return f;
   }
 
+  /**
+   * Build the index filters for a VLAN id or VNI predicate: one range, or
+   * the two ranges on either side of the tag for !=, within [min_tag,
+   * max_tag] (untagged packets have VLAN id 0, and are not indexed, so VLAN
+   * predicates only match tagged packets). Comparisons that no tag
+   * satisfies (e.g., vlan < 1) give an empty range (first > second), which
+   * matches no packet.
+   */
+  static std::vector<index_filter> tag_filters(const uint32_t index_id,
+                                               const std::string& op,
+                                               const std::string& tag_string,
+                                               const uint32_t min_tag,
+                                               const uint32_t max_tag) {
+    uint64_t tag = 0;
+    try {
+      tag = std::stoul(tag_string);
+    } catch (std::exception& e) {
+      throw parse_exception("Malformed tag string: " + tag_string);
+    }
+    if (tag > max_tag)
+      throw parse_exception("Tag out of range: " + tag_string);
+
+    std::vector<index_filter> filters;
+    index_filter f;
+    f.index_id = index_id;
+
+    if (op == "==") {
+      f.tok_range = index_filter::range(tag, tag);
+    } else if (op == "!=") {
+      if (tag > min_tag) {
+        f.tok_range = index_filter::range(min_tag, tag - 1);
+        filters.push_back(f);
+      }
+      if (tag < max_tag) {
+        f.tok_range = index_filter::range(std::max<uint64_t>(tag + 1, min_tag),
+                                          max_tag);
+        filters.push_back(f);
+      }
+      if (filters.empty()) {
+        f.tok_range = index_filter::range(1, 0);
+        filters.push_back(f);
+      }
+      return filters;
+    } else if (op == "<") {
+      f.tok_range = index_filter::range(min_tag, tag - 1);
+      if (tag == 0)
+        f.tok_range = index_filter::range(1, 0);
+    } else if (op == "<=") {
+      f.tok_range = index_filter::range(min_tag, tag);
+    } else if (op == ">") {
+      f.tok_range = index_filter::range(tag + 1, max_tag);
+    } else if (op == ">=") {
+      f.tok_range = index_filter::range(tag, max_tag);
+    } else {
+      throw parse_exception("Specify tag ranges with <,>,<=,>= operators");
+    }
+
+    f.tok_range.first = std::max<uint64_t>(f.tok_range.first, min_tag);
+    if (f.tok_range.first > f.tok_range.second)
+      f.tok_range = index_filter::range(1, 0);
+    filters.push_back(f);
+    return filters;
+  }
+
   static index_filter time_filter(const uint32_t index_id, const std::string & op,
                                   const std::string & time_string, const uint32_t now) {
     size_t loc = time_string.find("now");
@@ -5,7 +5,10 @@
 
 #include <ctime>
 #include <chrono>
+#include <algorithm>
+#include <stdexcept>
 
+#include <rte_cycles.h>
 #include <rte_mbuf.h>
 #include <rte_ether.h>
 #include <rte_ip.h>
@@ -14,29 +17,145 @@
 #include <rte_lpm.h>
 
 #include "packetstore.h"
+#include "afpacket_port.h"
+#include "poll_policy.h"
 #include "tokens.h"
 
 namespace netplay {
 
 #define BATCH_SIZE        32
+#define AFPACKET_BATCH    1024
+#define COALESCE_MAX_PKTS 2048   // Buffered packets without a packet budget
 
-template<typename vport_init>
+/**
+ * Configuration for writers.
+ */
+struct writer_config {
+  writer_config() {
+    burst_size = BATCH_SIZE;
+    coalesce_pkts = 1;
+    coalesce_usecs = 0;
+    policy = poll_policy::BUSY;
+    cycles_per_usec = 1;
+  }
+
+  uint16_t burst_size;        // Maximum number of packets received at once
+  uint16_t coalesce_pkts;     // Number of packets to coalesce before insertion
+                              // (0: no packet budget)
+  uint64_t coalesce_usecs;    // Maximum time packets are held for coalescing
+                              // (0: no time budget)
+  poll_policy::mode policy;   // What to do when the port has no packets
+  uint64_t cycles_per_usec;   // TSC frequency (in cycles per microsecond)
+};
+
+/**
+ * Insert and polling statistics for a writer; updated only by the writer
+ * thread, and read (racily) by the daemon for monitoring.
+ */
+struct writer_stats {
+  writer_stats() {
+    num_batches = 0;
+    num_pkts = 0;
+    wait_cycles = 0;
+    insert_cycles = 0;
+    num_wakeups = 0;
+    wakeup_cycles = 0;
+  }
+
+  inline void record(uint64_t pkts, uint64_t wait, uint64_t insert) {
+    num_batches++;
+    num_pkts += pkts;
+    wait_cycles += wait;
+    insert_cycles += insert;
+  }
+
+  inline void record_wakeup(uint64_t wait) {
+    num_wakeups++;
+    wakeup_cycles += wait;
+  }
+
+  uint64_t num_batches;    // Number of insert_pktburst calls
+  uint64_t num_pkts;       // Number of packets inserted
+  uint64_t wait_cycles;    // Cycles between first packet of a batch and insert
+  uint64_t insert_cycles;  // Cycles spent in insert_pktburst
+  uint64_t num_wakeups;    // Number of idle -> active transitions
+  uint64_t wakeup_cycles;  // Cycles spent in the last wait before each wakeup
+};
+
+/**
+ * Writer for DPDK ports.
+ *
+ * Bursts received from the port are coalesced until either coalesce_pkts
+ * packets are buffered or coalesce_usecs have passed since the first buffered
+ * packet arrived, and then inserted with a single insert_pktburst call. This
+ * amortizes the fixed per-call costs of insertion under load, while bounding
+ * the delay before packets become visible to queries at low rates. A zero
+ * budget leaves that axis unbounded (without a packet budget, at most
+ * COALESCE_MAX_PKTS packets are buffered), but at least one budget is
+ * required. A packet budget no larger than burst_size inserts every burst as
+ * it is received.
+ *
+ * When the port is empty, the writer follows the configured poll_policy.
+ */
+template<typename vport_type>
 class netplay_writer {
  public:
-  netplay_writer(int core, dpdk::virtual_port<vport_init>* vport, packet_store::handle* handle) {
+  netplay_writer(int core, vport_type* vport, packet_store::handle* handle,
+                 const writer_config& conf = writer_config())
+    : policy_(conf.policy) {
     rec_pkts_ = 0;
     core_ = core;
     vport_ = vport;
     handle_ = handle;
+    if (conf.coalesce_pkts == 0 && conf.coalesce_usecs == 0)
+      throw std::invalid_argument("Coalescing needs a packet or time budget");
+    burst_size_ = conf.burst_size;
+    coalesce_pkts_ = conf.coalesce_pkts;
+    coalesce_cycles_ = conf.coalesce_usecs * conf.cycles_per_usec;
+    cycles_per_usec_ = conf.cycles_per_usec;
   }
 
   void start() {
-    struct rte_mbuf* pkts[BATCH_SIZE];
-    
+    uint16_t capacity = std::max<uint16_t>(burst_size_, coalesce_pkts_ ?
+                                           coalesce_pkts_ : COALESCE_MAX_PKTS);
+    struct rte_mbuf** pkts = new struct rte_mbuf*[capacity];
+    uint64_t* arrival_ns = new uint64_t[capacity];
+    uint16_t buffered = 0;
+    uint64_t first_arrival = 0;
+    vport_type* vport = vport_;
+    auto intr_wait = [vport](int timeout_ms) {
+      return vport->wait_rx(timeout_ms);
+    };
+
     while (1) {
-      uint16_t recv = vport_->recv_pkts(pkts, BATCH_SIZE);
-      handle_->insert_pktburst(pkts, recv);
-      rec_pkts_ += recv;
+      uint16_t max_recv = std::min<uint16_t>(burst_size_, capacity - buffered);
+      uint16_t recv = vport_->recv_pkts(pkts + buffered, max_recv);
+      if (recv == 0 && buffered == 0) {
+        policy_.idle(intr_wait);
+        continue;
+      }
+
+      uint64_t wakeup_cycles;
+      if (recv > 0 && policy_.active(wakeup_cycles))
+        stats_.record_wakeup(wakeup_cycles);
+
+      uint64_t now = rte_rdtsc();
+      if (buffered == 0)
+        first_arrival = now;
+      uint64_t now_ns = cycles_to_ns(now);
+      for (uint16_t i = buffered; i < buffered + recv; i++)
+        arrival_ns[i] = now_ns;
+      buffered += recv;
+
+      if (buffered < capacity
+          && (coalesce_pkts_ == 0 || buffered < coalesce_pkts_)
+          && (coalesce_cycles_ == 0 || now - first_arrival < coalesce_cycles_))
+        continue;
+
+      handle_->insert_pktburst(pkts, buffered, arrival_ns);
+      stats_.record(buffered, now - first_arrival, rte_rdtsc() - now);
+      rec_pkts_ += buffered;
+      buffered = 0;
     }
   }
 
@@ -48,7 +167,17 @@ class netplay_writer {
     return rec_pkts_;
   }
 
+  const writer_stats& stats() const {
+    return stats_;
+  }
+
  private:
+  /* Packets are timed when the receive poll returns them */
+  inline uint64_t cycles_to_ns(uint64_t cycles) const {
+    return cycles / cycles_per_usec_ * 1000
+        + cycles % cycles_per_usec_ * 1000 / cycles_per_usec_;
+  }
+
   inline uint64_t curusec() {
     using namespace ::std::chrono;
     auto ts = steady_clock::now().time_since_epoch();
@@ -57,10 +186,95 @@ class netplay_writer {
 
   int core_;
   uint64_t rec_pkts_;
-  dpdk::virtual_port<vport_init>* vport_;
+  uint16_t burst_size_;
+  uint16_t coalesce_pkts_;
+  uint64_t coalesce_cycles_;
+  uint64_t cycles_per_usec_;
+  poll_policy policy_;
+  writer_stats stats_;
+  vport_type* vport_;
+  packet_store::handle* handle_;
+};
+
+/**
+ * Writer for AF_PACKET ports: consumes whole TPACKET_V3 blocks, inserting
+ * their packets in batches of up to burst_size packets directly from the
+ * memory-mapped ring. Blocks are already coalesced by the kernel (see
+ * AFPACKET_BLOCK_TIMEOUT), so coalesce_pkts and coalesce_usecs are ignored;
+ * the interrupt poll policy blocks in poll() on the ring.
+ */
+template<>
+class netplay_writer<dpdk::afpacket_port> {
+ public:
+  netplay_writer(int core, dpdk::afpacket_port* vport, packet_store::handle* handle,
+                 const writer_config& conf = writer_config())
+    : policy_(conf.policy) {
+    rec_pkts_ = 0;
+    core_ = core;
+    vport_ = vport;
+    handle_ = handle;
+    burst_size_ = conf.burst_size;
+  }
+
+  void start() {
+    unsigned char** pkts = new unsigned char*[burst_size_];
+    uint16_t* lens = new uint16_t[burst_size_];
+    uint64_t* arrival_ns = new uint64_t[burst_size_];
+
+    /* Open the ring on the writer thread, so that it is local to its core */
+    dpdk::afpacket_ring* ring = vport_->open_ring();
+    packet_store::handle* handle = handle_;
+    writer_stats* stats = &stats_;
+    auto insert = [handle, stats](unsigned char** p, uint16_t* l, uint64_t* ts,
+                                  uint16_t cnt) {
+      uint64_t start = rte_rdtsc();
+      handle->insert_pktburst(p, l, cnt, ts);
+      stats->record(cnt, 0, rte_rdtsc() - start);
+    };
+    auto intr_wait = [ring](int timeout_ms) {
+      ring->wait(timeout_ms);
+      return true;
+    };
+
+    while (1) {
+      struct tpacket_block_desc* block = ring->next_block();
+      if (block == NULL) {
+        policy_.idle(intr_wait);
+        continue;
+      }
+
+      uint64_t wakeup_cycles;
+      if (policy_.active(wakeup_cycles))
+        stats_.record_wakeup(wakeup_cycles);
+
+      rec_pkts_ += dpdk::afpacket_ring::for_each_batch(block, pkts, lens,
+                   arrival_ns, burst_size_, insert);
+      ring->release_block(block);
+    }
+  }
+
+  int core() {
+    return core_;
+  }
+
+  uint64_t rec_pkts() {
+    return rec_pkts_;
+  }
+
+  const writer_stats& stats() const {
+    return stats_;
+  }
+
+ private:
+  int core_;
+  uint64_t rec_pkts_;
+  uint16_t burst_size_;
+  poll_policy policy_;
+  writer_stats stats_;
+  dpdk::afpacket_port* vport_;
   packet_store::handle* handle_;
 };
 
 }
 
-#endif  // NETPLAY_WRITER_H_
\ No newline at end of file
+#endif  // NETPLAY_WRITER_H_
@@ -4,13 +4,20 @@
 #include <stdint.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <time.h>
 
 #include <chrono>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include <rte_mbuf.h>
 
 #include "packetstore.h"
+#include "sharded_packet_store.h"
+#include "query_server.h"
+#include "shm_store.h"
 #include "virtual_port.h"
 #include "netplay_writer.h"
 
@@ -18,43 +25,98 @@ namespace netplay {
 
 #define SLEEP_INTERVAL        10000000
 #define BENCH_SLEEP_INTERVAL  20000000
+#define CALIBRATION_INTERVAL  100000
 
-template<typename vport_init>
+template<typename vport_type>
 void* writer_thread(void* arg) {
-  netplay_writer<vport_init>* writer = (netplay_writer<vport_init>*) arg;
+  netplay_writer<vport_type>* writer = (netplay_writer<vport_type>*) arg;
   dpdk::init_thread(writer->core());
   writer->start();
 
   return NULL;
 }
 
-template<typename vport_init>
+template<typename vport_type>
 class netplay_daemon {
  public:
   typedef std::map<int, std::string> interface_map;
-  typedef std::map<std::string, dpdk::virtual_port<vport_init>*> port_map;
+  typedef std::map<std::string, vport_type*> port_map;
+  typedef netplay_writer<vport_type> writer_t;
+
+  /**
+   * Constructor to initialize the daemon.
+   *
+   * @param mapping Mapping from writer cores to the interfaces they poll.
+   * @param mempool The DPDK mempool (NULL for non-DPDK ports).
+   * @param query_conf The configuration for the query server; its cores
+   *  must not be writer cores.
+   * @param conf The configuration for writers.
+   * @param sharded Whether each writer should get its own packet store shard.
+   *  If the allocator draws from a shared memory region, the store is
+   *  published in it for other processes to query (see shm_store.h).
+   */
   netplay_daemon(const interface_map& mapping, struct rte_mempool* mempool,
-                 int query_server_port): core_interface_mapping_(mapping) {
-    query_server_port_ = query_server_port;
+                 const query_server_config& query_conf,
+                 const writer_config& conf, bool sharded = false)
+    : core_interface_mapping_(mapping), writer_conf_(conf),
+      query_conf_(query_conf) {
+    for (int core : query_conf_.cores) {
+      if (core_interface_mapping_.find(core) != core_interface_mapping_.end())
+        throw std::invalid_argument("Query core " + std::to_string(core)
+                                    + " is also a writer core");
+    }
+    query_server_ = NULL;
+    cycles_per_usec_ = calibrate_cycles_per_usec();
+    writer_conf_.cycles_per_usec = cycles_per_usec_;
     mempool_ = mempool;
-    pkt_store_ = new packet_store();
+    pkt_store_ = NULL;
+    sharded_store_ = NULL;
+    if (sharded) {
+      std::vector<int> cores;
+      for (auto& entry : core_interface_mapping_)
+        cores.push_back(entry.first);
+      sharded_store_ = new sharded_packet_store(cores);
+    } else {
+      pkt_store_ = new packet_store();
+    }
+
+    slog::shm_region* region = slog::allocator::shared_region();
+    if (region != NULL) {
+      if (sharded_store_)
+        shm_store::publish(region, sharded_store_);
+      else
+        shm_store::publish(region, pkt_store_);
+    }
   }
 
   void start() {
-    typedef netplay_writer<vport_init> writer_t;
+    size_t shard_id = 0;
     for (auto& entry : core_interface_mapping_) {
       printf("Starting writer on core %d polling interface %s...\n",
              entry.first, entry.second.c_str());
       pthread_t writer_thread_id;
-      packet_store::handle* handle = pkt_store_->get_handle();
+      packet_store::handle* handle = sharded_store_ ?
+                                     sharded_store_->get_handle(shard_id++) :
+                                     pkt_store_->get_handle();
       if (interface_port_mapping_.find(entry.second) == interface_port_mapping_.end())
         interface_port_mapping_[entry.second] =
-          new dpdk::virtual_port<vport_init>(entry.second.c_str(), mempool_);
-      dpdk::virtual_port<vport_init>* vport = interface_port_mapping_[entry.second];
-      writer_t* writer = new writer_t(entry.first, vport, handle);
-      pthread_create(&writer_thread_id, NULL, &writer_thread<vport_init>,
+          new vport_type(entry.second.c_str(), mempool_);
+      vport_type* vport = interface_port_mapping_[entry.second];
+      writer_t* writer = new writer_t(entry.first, vport, handle, writer_conf_);
+      writers_.push_back(writer);
+      pthread_create(&writer_thread_id, NULL, &writer_thread<vport_type>,
                      (void*) writer);
       pthread_detach(writer_thread_id);
+      writer_thread_ids_.push_back(writer_thread_id);
+    }
+
+    if (query_conf_.port > 0) {
+      printf("Starting query server on %s:%d...\n", query_conf_.addr.c_str(),
+             query_conf_.port);
+      query_server_ = sharded_store_ ?
+                      new query_server(sharded_store_, query_conf_) :
+                      new query_server(pkt_store_, query_conf_);
+      query_server_->start();
     }
   }
 
@@ -63,29 +125,52 @@ class netplay_daemon {
     uint64_t start_pkts = processed_pkts();
     uint64_t epoch = start;
     uint64_t epoch_pkts = start_pkts;
+    writer_stats epoch_stats = aggregate_stats();
+    uint64_t epoch_cpu = writer_cpu_usecs();
+    uint64_t epoch_stalls = slog::preallocator::stats().stalls.load();
+    uint64_t epoch_requests = 0;
     while (1) {
       usleep(SLEEP_INTERVAL);
       uint64_t pkts = processed_pkts();
       uint64_t now = curusec();
+      writer_stats stats = aggregate_stats();
+      uint64_t cpu = writer_cpu_usecs();
 
       double epoch_rate = (double) (pkts - epoch_pkts) * 1000000.0 / (double) (now - epoch);
       double tot_rate = (double) (pkts - start_pkts) * 1000000.0 / (double) (now - start);
       printf("[%" PRIu64 "] Packet rate: %lf pkts/s (since last epoch), "
              "%lf pkts/s (since start)\n", (now - start), epoch_rate, tot_rate);
+      print_insert_stats(now - start, epoch_stats, stats);
+      print_poll_stats(now - start, epoch_stats, stats, cpu - epoch_cpu, now - epoch);
+      epoch_stalls = print_prealloc_stats(now - start, epoch_stalls);
+      print_cache_stats(now - start);
+      print_shm_stats(now - start);
+      epoch_requests = print_query_stats(now - start, now - epoch, epoch_requests);
       epoch = now;
       epoch_pkts = pkts;
+      epoch_stats = stats;
+      epoch_cpu = cpu;
     }
   }
 
   void bench() {
     uint64_t start = curusec();
     uint64_t start_pkts = processed_pkts();
+    writer_stats start_stats = aggregate_stats();
 
     usleep(BENCH_SLEEP_INTERVAL);
     uint64_t pkts = processed_pkts();
     uint64_t now = curusec();
+    writer_stats stats = aggregate_stats();
     double tot_rate = (double) (pkts - start_pkts) * 1000000.0 / (double) (now - start);
-    fprintf(stderr, "%zu\t%lf\n", core_interface_mapping_.size(), tot_rate);
+    uint64_t batches = stats.num_batches - start_stats.num_batches;
+    uint64_t batch_pkts = stats.num_pkts - start_stats.num_pkts;
+    double avg_batch = batches ? (double) batch_pkts / (double) batches : 0.0;
+    double avg_latency = batches ? (double) (stats.wait_cycles - start_stats.wait_cycles
+        + stats.insert_cycles - start_stats.insert_cycles) / (double) batches
+        / cycles_per_usec_ : 0.0;
+    fprintf(stderr, "%zu\t%lf\t%lf\t%lf\n", core_interface_mapping_.size(),
+            tot_rate, avg_batch, avg_latency);
   }
 
  private:
@@ -96,14 +181,144 @@ class netplay_daemon {
   }
 
   uint64_t processed_pkts() {
-    return pkt_store_->num_pkts();
+    return sharded_store_ ? sharded_store_->num_pkts() : pkt_store_->num_pkts();
+  }
+
+  writer_stats aggregate_stats() {
+    writer_stats agg;
+    for (writer_t* writer : writers_) {
+      const writer_stats& stats = writer->stats();
+      agg.num_batches += stats.num_batches;
+      agg.num_pkts += stats.num_pkts;
+      agg.wait_cycles += stats.wait_cycles;
+      agg.insert_cycles += stats.insert_cycles;
+      agg.num_wakeups += stats.num_wakeups;
+      agg.wakeup_cycles += stats.wakeup_cycles;
+    }
+    return agg;
+  }
+
+  void print_insert_stats(uint64_t elapsed, const writer_stats& prev,
+                          const writer_stats& cur) {
+    uint64_t batches = cur.num_batches - prev.num_batches;
+    if (batches == 0)
+      return;
+    uint64_t pkts = cur.num_pkts - prev.num_pkts;
+    double wait = (double) (cur.wait_cycles - prev.wait_cycles);
+    double insert = (double) (cur.insert_cycles - prev.insert_cycles);
+    printf("[%" PRIu64 "] Insert batch: %lf pkts, coalescing delay: %lf us, "
+           "insert cost: %lf ns/pkt, visibility latency: %lf us\n", elapsed,
+           (double) pkts / (double) batches,
+           wait / (double) batches / cycles_per_usec_,
+           pkts ? insert * 1000.0 / (double) pkts / cycles_per_usec_ : 0.0,
+           (wait + insert) / (double) batches / cycles_per_usec_);
+  }
+
+  void print_poll_stats(uint64_t elapsed, const writer_stats& prev,
+                        const writer_stats& cur, uint64_t cpu_usecs,
+                        uint64_t wall_usecs) {
+    uint64_t wakeups = cur.num_wakeups - prev.num_wakeups;
+    double wait = (double) (cur.wakeup_cycles - prev.wakeup_cycles);
+    double cpu = writers_.empty() ? 0.0 : (double) cpu_usecs * 100.0
+                 / ((double) wall_usecs * (double) writers_.size());
+    printf("[%" PRIu64 "] Poll policy: %s, writer CPU: %lf%%, wakeups: %" PRIu64
+           ", wakeup latency: %lf us\n", elapsed,
+           poll_policy::name(writer_conf_.policy), cpu, wakeups,
+           wakeups ? wait / (double) wakeups / cycles_per_usec_ : 0.0);
+  }
+
+  void print_cache_stats(uint64_t elapsed) {
+    uint64_t hits = 0, misses = 0, extended = 0, evictions = 0, bytes = 0;
+    size_t num_stores = sharded_store_ ? sharded_store_->num_shards() : 1;
+    for (size_t i = 0; i < num_stores; i++) {
+      packet_store* store = sharded_store_ ? sharded_store_->shard(i) : pkt_store_;
+      result_cache& cache = store->get_result_cache();
+      hits += cache.stats().hits.load();
+      misses += cache.stats().misses.load();
+      extended += cache.stats().extended_records.load();
+      evictions += cache.stats().evictions.load();
+      bytes += cache.size_bytes();
+    }
+    if (hits + misses == 0)
+      return;
+    printf("[%" PRIu64 "] Result cache: hits: %" PRIu64 ", misses: %" PRIu64
+           ", records scanned to extend hits: %" PRIu64 ", evictions: %" PRIu64
+           ", size: %" PRIu64 " KB\n", elapsed, hits, misses, extended, evictions,
+           bytes >> 10);
+  }
+
+  void print_shm_stats(uint64_t elapsed) {
+    slog::shm_region* region = slog::allocator::shared_region();
+    if (region == NULL)
+      return;
+    printf("[%" PRIu64 "] Shared memory %s: allocated: %" PRIu64 " MB of %"
+           PRIu64 " MB\n", elapsed, region->name().c_str(),
+           (uint64_t) region->used() >> 20, (uint64_t) region->capacity() >> 20);
+  }
+
+  /* Returns the total number of requests served so far */
+  uint64_t print_query_stats(uint64_t elapsed, uint64_t wall_usecs,
+                             uint64_t prev_requests) {
+    if (query_server_ == NULL)
+      return 0;
+    const query_server::server_stats& st = query_server_->stats();
+    uint64_t requests = st.requests.load();
+    printf("[%" PRIu64 "] Query server: connections: %" PRIu64 ", requests: %"
+           PRIu64 " (%lf requests/s), errors: %" PRIu64 ", sent: %" PRIu64
+           " KB\n", elapsed, st.connections.load(), requests,
+           (double) (requests - prev_requests) * 1000000.0 / (double) wall_usecs,
+           st.errors.load(), st.bytes_sent.load() >> 10);
+    return requests;
+  }
+
+  /* Returns the total number of inline bucket allocations so far */
+  uint64_t print_prealloc_stats(uint64_t elapsed, uint64_t prev_stalls) {
+    const slog::preallocator::prealloc_stats& st = slog::preallocator::stats();
+    uint64_t stalls = st.stalls.load();
+    printf("[%" PRIu64 "] Preallocator: %s, requests: %" PRIu64 ", preallocated: %"
+           PRIu64 " MB, inline allocations: %" PRIu64 " (%" PRIu64 " since last"
+           " epoch)\n", elapsed, slog::preallocator::running() ? "on" : "off",
+           st.requests.load(), st.prealloc_bytes.load() >> 20, stalls,
+           stalls - prev_stalls);
+    return stalls;
+  }
+
+  /* Total CPU time consumed by all writer threads, in microseconds */
+  uint64_t writer_cpu_usecs() {
+    uint64_t total = 0;
+    for (pthread_t tid : writer_thread_ids_) {
+      clockid_t cid;
+      struct timespec ts;
+      if (pthread_getcpuclockid(tid, &cid) != 0 || clock_gettime(cid, &ts) != 0)
+        continue;
+      total += ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+    }
+    return total;
+  }
+
+  /* Does not rely on rte_get_tsc_hz(), since non-DPDK ports skip EAL init */
+  static uint64_t calibrate_cycles_per_usec() {
+    using namespace ::std::chrono;
+    auto t0 = steady_clock::now();
+    uint64_t c0 = rte_rdtsc();
+    usleep(CALIBRATION_INTERVAL);
+    uint64_t c1 = rte_rdtsc();
+    auto t1 = steady_clock::now();
+    uint64_t usecs = duration_cast<microseconds>(t1 - t0).count();
+    return std::max<uint64_t>(1, (c1 - c0) / std::max<uint64_t>(1, usecs));
   }
 
-  int query_server_port_;
+  uint64_t cycles_per_usec_;
+  std::vector<writer_t*> writers_;
+  std::vector<pthread_t> writer_thread_ids_;
   interface_map core_interface_mapping_;
+  writer_config writer_conf_;
+  query_server_config query_conf_;
+  query_server* query_server_;
   port_map interface_port_mapping_;
   struct rte_mempool* mempool_;
   packet_store *pkt_store_;
+  sharded_packet_store *sharded_store_;
 };
 
 }
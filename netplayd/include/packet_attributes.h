@@ -2,6 +2,8 @@
 #define PACKET_ATTRIBUTES_H_
 
 #include <cstdint>
+#include <cstring>
+#include <type_traits>
 
 #include <rte_mbuf.h>
 #include <rte_ether.h>
@@ -10,14 +12,22 @@
 #include <rte_udp.h>
 #include <rte_lpm.h>
 
+#include "packet_metadata.h"
+
 namespace netplay {
 namespace attribute {
 
+/*
+ * Packet attributes, read with T::get(pkt, len) from a packet of len bytes.
+ * Attributes at fixed offsets assume that the headers they read are present;
+ * attributes that walk the headers only read within the packet.
+ */
+
 /* Entire packet header */
 struct packet_header {
   typedef void* value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     return pkt;
   }
 };
@@ -26,7 +36,7 @@ struct packet_header {
 struct ether_s_addr {
   typedef struct ether_addr value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     return eth->s_addr;
   }
@@ -35,7 +45,7 @@ struct ether_s_addr {
 struct ether_d_addr {
   typedef struct ether_addr value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     return eth->d_addr;
   }
@@ -44,17 +54,51 @@ struct ether_d_addr {
 struct ether_type {
   typedef uint16_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     return eth->ether_type;
   }
 };
 
+/* Encapsulation attributes (walk VLAN tags and VXLAN/GRE tunnels) */
+struct vlan_id {
+  typedef uint16_t value_type;
+
+  static inline value_type get(void* pkt, uint16_t len) {
+    packet_metadata md;
+    parse_packet((const unsigned char*) pkt, len, md);
+    return md.vlan_id;
+  }
+};
+
+struct tunnel_vni {
+  typedef uint32_t value_type;
+
+  static inline value_type get(void* pkt, uint16_t len) {
+    packet_metadata md;
+    parse_packet((const unsigned char*) pkt, len, md);
+    return md.vni;
+  }
+};
+
+struct inner_five_tuple {
+  typedef five_tuple value_type;
+
+  static inline value_type get(void* pkt, uint16_t len) {
+    packet_metadata md;
+    parse_packet((const unsigned char*) pkt, len, md);
+    value_type t;
+    memset(&t, 0, sizeof(t));
+    five_tuple_of(md, t);
+    return t;
+  }
+};
+
 /* IPv4 attributes */
 struct ipv4_version_ihl {
   typedef uint8_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     return ip->version_ihl;
@@ -64,7 +108,7 @@ struct ipv4_version_ihl {
 struct ipv4_tos {
   typedef uint8_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     return ip->type_of_service;
@@ -74,7 +118,7 @@ struct ipv4_tos {
 struct ipv4_total_length {
   typedef uint16_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     return ip->total_length;
@@ -84,7 +128,7 @@ struct ipv4_total_length {
 struct ipv4_packet_id {
   typedef uint16_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     return ip->packet_id; 
@@ -94,7 +138,7 @@ struct ipv4_packet_id {
 struct ipv4_fragment_offset {
   typedef uint16_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     return ip->fragment_offset; 
@@ -104,7 +148,7 @@ struct ipv4_fragment_offset {
 struct ipv4_ttl {
   typedef uint8_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     return ip->time_to_live; 
@@ -114,7 +158,7 @@ struct ipv4_ttl {
 struct ipv4_next_proto_id {
   typedef uint8_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     return ip->next_proto_id; 
@@ -124,7 +168,7 @@ struct ipv4_next_proto_id {
 struct ipv4_hdr_checksum {
   typedef uint16_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     return ip->hdr_checksum; 
@@ -134,7 +178,7 @@ struct ipv4_hdr_checksum {
 struct ipv4_src_addr {
   typedef uint32_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     return ip->src_addr; 
@@ -144,18 +188,87 @@ struct ipv4_src_addr {
 struct ipv4_dst_addr {
   typedef uint32_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     return ip->dst_addr; 
   }
 };
 
+/* IPv6 attributes */
+struct ipv6_vtc_flow {
+  typedef uint32_t value_type;
+
+  static inline value_type get(void* pkt, uint16_t) {
+    struct ether_hdr *eth = (struct ether_hdr *) pkt;
+    struct ipv6_hdr *ip6 = (struct ipv6_hdr *) (eth + 1);
+    return ip6->vtc_flow;
+  }
+};
+
+struct ipv6_payload_len {
+  typedef uint16_t value_type;
+
+  static inline value_type get(void* pkt, uint16_t) {
+    struct ether_hdr *eth = (struct ether_hdr *) pkt;
+    struct ipv6_hdr *ip6 = (struct ipv6_hdr *) (eth + 1);
+    return ip6->payload_len;
+  }
+};
+
+struct ipv6_proto {
+  typedef uint8_t value_type;
+
+  static inline value_type get(void* pkt, uint16_t) {
+    struct ether_hdr *eth = (struct ether_hdr *) pkt;
+    struct ipv6_hdr *ip6 = (struct ipv6_hdr *) (eth + 1);
+    return ip6->proto;
+  }
+};
+
+struct ipv6_hop_limits {
+  typedef uint8_t value_type;
+
+  static inline value_type get(void* pkt, uint16_t) {
+    struct ether_hdr *eth = (struct ether_hdr *) pkt;
+    struct ipv6_hdr *ip6 = (struct ipv6_hdr *) (eth + 1);
+    return ip6->hop_limits;
+  }
+};
+
+struct ipv6_addr {
+  uint8_t bytes[16];
+};
+
+struct ipv6_src_addr {
+  typedef ipv6_addr value_type;
+
+  static inline value_type get(void* pkt, uint16_t) {
+    struct ether_hdr *eth = (struct ether_hdr *) pkt;
+    struct ipv6_hdr *ip6 = (struct ipv6_hdr *) (eth + 1);
+    value_type addr;
+    memcpy(addr.bytes, ip6->src_addr, sizeof(addr.bytes));
+    return addr;
+  }
+};
+
+struct ipv6_dst_addr {
+  typedef ipv6_addr value_type;
+
+  static inline value_type get(void* pkt, uint16_t) {
+    struct ether_hdr *eth = (struct ether_hdr *) pkt;
+    struct ipv6_hdr *ip6 = (struct ipv6_hdr *) (eth + 1);
+    value_type addr;
+    memcpy(addr.bytes, ip6->dst_addr, sizeof(addr.bytes));
+    return addr;
+  }
+};
+
 /* TCP attributes */
 struct tcp_src_port {
   typedef uint16_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     struct tcp_hdr *tcp = (struct tcp_hdr *) (ip + 1);
@@ -166,7 +279,7 @@ struct tcp_src_port {
 struct tcp_dst_port {
   typedef uint16_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     struct tcp_hdr *tcp = (struct tcp_hdr *) (ip + 1);
@@ -177,7 +290,7 @@ struct tcp_dst_port {
 struct tcp_sent_seq {
   typedef uint32_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     struct tcp_hdr *tcp = (struct tcp_hdr *) (ip + 1);
@@ -188,7 +301,7 @@ struct tcp_sent_seq {
 struct tcp_recv_ack {
   typedef uint32_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     struct tcp_hdr *tcp = (struct tcp_hdr *) (ip + 1);
@@ -199,7 +312,7 @@ struct tcp_recv_ack {
 struct tcp_data_off {
   typedef uint8_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     struct tcp_hdr *tcp = (struct tcp_hdr *) (ip + 1);
@@ -210,7 +323,7 @@ struct tcp_data_off {
 struct tcp_flags {
   typedef uint8_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     struct tcp_hdr *tcp = (struct tcp_hdr *) (ip + 1);
@@ -221,7 +334,7 @@ struct tcp_flags {
 struct tcp_rx_win {
   typedef uint16_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     struct tcp_hdr *tcp = (struct tcp_hdr *) (ip + 1);
@@ -232,7 +345,7 @@ struct tcp_rx_win {
 struct tcp_checksum {
   typedef uint16_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     struct tcp_hdr *tcp = (struct tcp_hdr *) (ip + 1);
@@ -243,7 +356,7 @@ struct tcp_checksum {
 struct tcp_urp {
   typedef uint16_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     struct tcp_hdr *tcp = (struct tcp_hdr *) (ip + 1);
@@ -255,7 +368,7 @@ struct tcp_urp {
 struct udp_src_port {
   typedef uint16_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     struct udp_hdr *udp = (struct udp_hdr *) (ip + 1);
@@ -266,7 +379,7 @@ struct udp_src_port {
 struct udp_dst_port {
   typedef uint16_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     struct udp_hdr *udp = (struct udp_hdr *) (ip + 1);
@@ -277,7 +390,7 @@ struct udp_dst_port {
 struct udp_dgram_len {
   typedef uint16_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     struct udp_hdr *udp = (struct udp_hdr *) (ip + 1);
@@ -288,7 +401,7 @@ struct udp_dgram_len {
 struct udp_dgram_checksum {
   typedef uint16_t value_type;
 
-  static inline value_type get(void* pkt) {
+  static inline value_type get(void* pkt, uint16_t) {
     struct ether_hdr *eth = (struct ether_hdr *) pkt;
     struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
     struct udp_hdr *udp = (struct udp_hdr *) (ip + 1);
@@ -296,6 +409,29 @@ struct udp_dgram_checksum {
   }
 };
 
+/* Host byte order view of a (network byte order) header field, e.g.,
+ * host_order<ipv4_total_length> for byte counts. */
+template<typename T>
+struct host_order {
+  typedef typename T::value_type value_type;
+  static_assert(std::is_integral<value_type>::value,
+                "Only integral fields can be byte-swapped");
+
+  static inline value_type get(void* pkt, uint16_t len) {
+    value_type v = T::get(pkt, len);
+    switch (sizeof(value_type)) {
+    case 2:
+      return (value_type) __builtin_bswap16((uint16_t) v);
+    case 4:
+      return (value_type) __builtin_bswap32((uint32_t) v);
+    case 8:
+      return (value_type) __builtin_bswap64((uint64_t) v);
+    default:
+      return v;
+    }
+  }
+};
+
 }
 }
 
@@ -19,6 +19,7 @@
 #include <rte_lpm.h>
 #include <rte_mbuf.h>
 
+#include "packet_metadata.h"
 #include "filterresult.h"
 #include "offsetlog.h"
 #include "datalog.h"
@@ -27,54 +28,67 @@
 
 namespace netplay {
 
+/**
+ * A (big-endian) IPv6 address prefix; a prefix of length 0 matches all
+ * addresses.
+ */
+struct ip6_prefix {
+  uint8_t addr[16];
+  uint32_t len;
+
+  inline bool matches(const uint8_t* a) const {
+    uint32_t nbytes = len / 8;
+    if (memcmp(addr, a, nbytes) != 0)
+      return false;
+    uint32_t nbits = len % 8;
+    if (nbits == 0)
+      return true;
+    uint8_t mask = (uint8_t) (0xFF << (8 - nbits));
+    return (addr[nbytes] & mask) == (a[nbytes] & mask);
+  }
+};
+
 struct index_filter {
   typedef std::pair<uint64_t, uint64_t> range;
   uint32_t index_id;
   range tok_range;
+  ip6_prefix prefix;  // Only used for radix (IPv6 address) indexes
 };
 
 struct packet_filter {
-  inline bool apply(void *pkt, uint32_t ts) const {
-    struct ether_hdr *eth = (struct ether_hdr *) pkt;
-    struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
-    if (ip->next_proto_id == IPPROTO_TCP) {
-      struct tcp_hdr *tcp = (struct tcp_hdr *) (ip + 1);
-      return (ip->src_addr >= src_addr.first && ip->src_addr <= src_addr.second)
-             && (ip->dst_addr >= dst_addr.first && ip->dst_addr <= dst_addr.second)
-             && (tcp->src_port >= src_port.first && tcp->src_port <= src_port.second)
-             && (tcp->dst_port >= dst_port.first && tcp->dst_port <= dst_port.second)
-             && (ts >= timestamp.first && ts <= timestamp.second);
-    } else if (ip->next_proto_id == IPPROTO_UDP) {
-      struct udp_hdr *udp = (struct udp_hdr *) (ip + 1);
-      return (ip->src_addr >= src_addr.first && ip->src_addr <= src_addr.second)
-             && (ip->dst_addr >= dst_addr.first && ip->dst_addr <= dst_addr.second)
-             && (udp->src_port >= src_port.first && udp->src_port <= src_port.second)
-             && (udp->dst_port >= dst_port.first && udp->dst_port <= dst_port.second)
-             && (ts >= timestamp.first && ts <= timestamp.second);
-    }
-    return (ip->src_addr >= src_addr.first && ip->src_addr <= src_addr.second)
-           && (ip->dst_addr >= dst_addr.first && ip->dst_addr <= dst_addr.second)
-           && (ts >= timestamp.first && ts <= timestamp.second);
+  inline bool apply(const unsigned char* pkt, uint16_t len, uint64_t ts) const {
+    return (ts >= timestamp.first && ts <= timestamp.second) && apply(pkt, len);
   }
 
-  inline bool apply(void *pkt) const {
-    struct ether_hdr *eth = (struct ether_hdr *) pkt;
-    struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
-    if (ip->next_proto_id == IPPROTO_TCP) {
-      struct tcp_hdr *tcp = (struct tcp_hdr *) (ip + 1);
-      return (ip->src_addr >= src_addr.first && ip->src_addr <= src_addr.second)
-             && (ip->dst_addr >= dst_addr.first && ip->dst_addr <= dst_addr.second)
-             && (tcp->src_port >= src_port.first && tcp->src_port <= src_port.second)
-             && (tcp->dst_port >= dst_port.first && tcp->dst_port <= dst_port.second);
-    } else if (ip->next_proto_id == IPPROTO_UDP) {
-      struct udp_hdr *udp = (struct udp_hdr *) (ip + 1);
-      return (ip->src_addr >= src_addr.first && ip->src_addr <= src_addr.second)
-             && (ip->dst_addr >= dst_addr.first && ip->dst_addr <= dst_addr.second)
-             && (udp->src_port >= src_port.first && udp->src_port <= src_port.second)
-             && (udp->dst_port >= dst_port.first && udp->dst_port <= dst_port.second);
+  inline bool apply(const unsigned char* pkt, uint16_t len) const {
+    packet_metadata md;
+    parse_packet(pkt, len, md);
+    return apply(md);
+  }
+
+  inline bool apply(const packet_metadata& md) const {
+    if (md.is_ipv6) {
+      if (restricts_ipv4())
+        return false;
+      if (!src_addr6.matches(md.src_addr6) || !dst_addr6.matches(md.dst_addr6))
+        return false;
+    } else {
+      if (src_addr6.len > 0 || dst_addr6.len > 0)
+        return false;
+      if (!(md.src_addr >= src_addr.first && md.src_addr <= src_addr.second)
+          || !(md.dst_addr >= dst_addr.first && md.dst_addr <= dst_addr.second))
+        return false;
     }
-    return (ip->src_addr >= src_addr.first && ip->src_addr <= src_addr.second)
-           && (ip->dst_addr >= dst_addr.first && ip->dst_addr <= dst_addr.second);
+    return (md.vlan_id >= vlan.first && md.vlan_id <= vlan.second)
+           && (md.vni >= vni.first && md.vni <= vni.second)
+           && (!md.has_ports
+               || ((md.src_port >= src_port.first && md.src_port <= src_port.second)
+                   && (md.dst_port >= dst_port.first && md.dst_port <= dst_port.second)));
+  }
+
+  inline bool restricts_ipv4() const {
+    return src_addr.first != 0 || src_addr.second != UINT64_MAX
+           || dst_addr.first != 0 || dst_addr.second != UINT64_MAX;
   }
 
   typedef int32_t node_t;
@@ -109,6 +123,10 @@ struct packet_filter {
   range src_port;
   range dst_port;
   range timestamp;
+  range vlan;
+  range vni;
+  ip6_prefix src_addr6;
+  ip6_prefix dst_addr6;
 
   bool check_path_contains_node;
   bool check_path_contains_link;
@@ -152,19 +170,8 @@ class packet_filter_result {
     }
 
     packet_filter_iterator& operator++() {
-      void *pkt = NULL;
-      uint64_t ts = 0;
-      do {
-        it_++;
-        if (!it_.finished()) {
-          uint64_t offset;
-          uint16_t length;          
-          olog_->lookup(*it_, offset, length);
-          unsigned char* pkt_data = (unsigned char*) dlog_->ptr(offset);
-          ts = *((uint64_t*) pkt_data);
-          pkt = pkt_data + sizeof(uint64_t);
-        }
-      } while (!it_.finished() && !filter_.apply(pkt, ts));
+      it_++;
+      seek();
       return *this;
     }
 
@@ -182,7 +189,22 @@ class packet_filter_result {
       return !(*this == other);
     }
 
+    /* Skip to the first matching entry, starting at the current one */
+    void seek() {
+      while (!it_.finished() && !matches())
+        it_++;
+    }
+
    private:
+    bool matches() const {
+      uint64_t offset;
+      uint16_t length;
+      olog_->lookup(*it_, offset, length);
+      unsigned char* pkt_data = (unsigned char*) dlog_->ptr(offset);
+      uint64_t ts = *((uint64_t*) pkt_data);
+      return filter_.apply(pkt_data + sizeof(uint64_t), length, ts);
+    }
+
     const packet_filter& filter_;
     filter_iterator it_;
     slog::datalog* dlog_;
@@ -199,7 +221,9 @@ class packet_filter_result {
   }
 
   packet_filter_iterator begin() {
-    return packet_filter_iterator(filter_, res_.begin(), dlog_, olog_);
+    packet_filter_iterator it(filter_, res_.begin(), dlog_, olog_);
+    it.seek();
+    return it;
   }
 
   packet_filter_iterator end() {
@@ -0,0 +1,424 @@
+#ifndef PACKET_METADATA_H_
+#define PACKET_METADATA_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include <rte_byteorder.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
+
+#define MAX_IPV6_EXT_HDRS 8
+#define MAX_VLAN_TAGS     2      // 802.1Q, or 802.1ad (QinQ) S-tag + C-tag
+#define VXLAN_UDP_PORT    4789
+
+#define GRE_FLAG_CSUM     0x8000
+#define GRE_FLAG_KEY      0x2000
+#define GRE_FLAG_SEQ      0x1000
+
+namespace netplay {
+
+enum encap_type {
+  ENCAP_NONE = 0,
+  ENCAP_VXLAN = 1,
+  ENCAP_GRE = 2
+};
+
+/**
+ * The 5-tuple of a packet, in network byte order. Addresses are IPv6
+ * addresses; IPv4 addresses are kept IPv4-mapped (::ffff:a.b.c.d), so that
+ * the 5-tuples of IPv4 and IPv6 packets never collide.
+ */
+struct five_tuple {
+  uint8_t src_addr[16];
+  uint8_t dst_addr[16];
+  uint16_t src_port;
+  uint16_t dst_port;
+  uint8_t proto;
+};
+
+/**
+ * Header fields of a packet that are relevant for indexing and filtering,
+ * extracted once per packet on ingest. Addresses and ports are kept in network
+ * byte order, exactly as they appear in the packet (and in the indexes).
+ * IPv4 addresses are zero for IPv6 packets, and IPv6 addresses are only valid
+ * for IPv6 packets.
+ *
+ * For tunneled (VXLAN or GRE) packets, the address, port and protocol fields
+ * describe the inner (tenant) packet, and the outer 5-tuple of the tunnel is
+ * kept separately; the outer 5-tuple is only valid if encap != ENCAP_NONE.
+ * VLAN ids are those of the outermost Ethernet header (host byte order, 0 if
+ * untagged); the VNI is the VXLAN VNI or GRE key (0 if not tunneled).
+ *
+ * Headers are only read if they lie entirely within the packet; a packet
+ * that is too short for the headers it announces is described like a non-IP
+ * packet (see set_non_ip).
+ */
+struct packet_metadata {
+  uint32_t src_addr;
+  uint32_t dst_addr;
+  uint16_t src_port;
+  uint16_t dst_port;
+  uint16_t pkt_len;
+  uint8_t proto;
+  uint8_t tcp_flags;
+  bool has_ports;
+  bool is_ipv6;
+  uint8_t src_addr6[16];
+  uint8_t dst_addr6[16];
+
+  uint16_t vlan_id;
+  uint16_t inner_vlan_id;
+  uint32_t vni;
+  uint8_t encap;
+  five_tuple outer;
+};
+
+inline bool parse_l2(const unsigned char* pkt, const unsigned char* end,
+                     packet_metadata& md, bool outermost);
+inline bool parse_ipv4(const unsigned char* l3, const unsigned char* end,
+                       packet_metadata& md, bool outermost);
+inline bool parse_ipv6(const unsigned char* l3, const unsigned char* end,
+                       packet_metadata& md, bool outermost);
+
+/**
+ * Check that a header lies entirely within the packet.
+ *
+ * @param hdr The start of the header.
+ * @param len The length of the header.
+ * @param end The end of the packet.
+ * @return True if the header fits, false otherwise.
+ */
+inline bool fits(const unsigned char* hdr, size_t len,
+                 const unsigned char* end) {
+  return hdr <= end && (size_t) (end - hdr) >= len;
+}
+
+/**
+ * Describe a packet as a non-IP packet: no addresses, protocol or ports.
+ *
+ * @param md The metadata to populate.
+ */
+inline void set_non_ip(packet_metadata& md) {
+  md.is_ipv6 = false;
+  md.src_addr = 0;
+  md.dst_addr = 0;
+  md.proto = 0;
+  md.src_port = 0;
+  md.dst_port = 0;
+  md.tcp_flags = 0;
+  md.has_ports = false;
+}
+
+/**
+ * Get an IPv4 address as an IPv4-mapped IPv6 address.
+ *
+ * @param addr The IPv4 address (network byte order).
+ * @param addr6 Set to the IPv6 address.
+ */
+inline void map_ipv4(const uint32_t addr, uint8_t* addr6) {
+  memset(addr6, 0, 10);
+  addr6[10] = 0xFF;
+  addr6[11] = 0xFF;
+  memcpy(addr6 + 12, &addr, 4);
+}
+
+/**
+ * Get the 5-tuple of a packet (of the inner packet, if tunneled).
+ *
+ * @param md The packet metadata.
+ * @param t Set to the 5-tuple.
+ */
+inline void five_tuple_of(const packet_metadata& md, five_tuple& t) {
+  if (md.is_ipv6) {
+    memcpy(t.src_addr, md.src_addr6, 16);
+    memcpy(t.dst_addr, md.dst_addr6, 16);
+  } else {
+    map_ipv4(md.src_addr, t.src_addr);
+    map_ipv4(md.dst_addr, t.dst_addr);
+  }
+  t.src_port = md.src_port;
+  t.dst_port = md.dst_port;
+  t.proto = md.proto;
+}
+
+/**
+ * Save the (outer) 5-tuple parsed so far as the tunnel's 5-tuple.
+ *
+ * @param md The metadata.
+ * @param encap The encapsulation type of the tunnel.
+ */
+inline void enter_tunnel(packet_metadata& md, uint8_t encap) {
+  md.encap = encap;
+  five_tuple_of(md, md.outer);
+}
+
+/**
+ * Parse a VXLAN header and the encapsulated (inner) Ethernet frame.
+ *
+ * @param vxlan The VXLAN header.
+ * @param end The end of the packet.
+ * @param md The metadata to populate.
+ * @return False if the packet is truncated, true otherwise.
+ */
+inline bool parse_vxlan(const unsigned char* vxlan, const unsigned char* end,
+                        packet_metadata& md) {
+  if (!fits(vxlan, sizeof(struct vxlan_hdr), end))
+    return false;
+  const struct vxlan_hdr *vx = (const struct vxlan_hdr *) vxlan;
+  enter_tunnel(md, ENCAP_VXLAN);
+  md.vni = rte_be_to_cpu_32(vx->vx_vni) >> 8;
+  return parse_l2((const unsigned char*) (vx + 1), end, md, false);
+}
+
+/**
+ * Parse a GRE header and the encapsulated (inner) packet; supports Ethernet
+ * (transparent Ethernet bridging, e.g., NVGRE), IPv4 and IPv6 payloads.
+ *
+ * @param gre The GRE header.
+ * @param end The end of the packet.
+ * @param md The metadata to populate.
+ * @return False if the packet is truncated, true otherwise.
+ */
+inline bool parse_gre(const unsigned char* gre, const unsigned char* end,
+                      packet_metadata& md) {
+  if (!fits(gre, 4, end))
+    return false;
+  uint16_t flags = rte_be_to_cpu_16(*((const uint16_t*) gre));
+  uint16_t gre_proto = rte_be_to_cpu_16(*((const uint16_t*) (gre + 2)));
+  const unsigned char* opt = gre + 4;
+  if (flags & GRE_FLAG_CSUM)
+    opt += 4;
+
+  md.src_port = 0;
+  md.dst_port = 0;
+  md.tcp_flags = 0;
+  md.has_ports = false;
+  enter_tunnel(md, ENCAP_GRE);
+  if (flags & GRE_FLAG_KEY) {
+    if (!fits(opt, 4, end))
+      return false;
+    uint32_t key = rte_be_to_cpu_32(*((const uint32_t*) opt));
+    md.vni = (gre_proto == ETHER_TYPE_TEB) ? (key >> 8) : key;
+    opt += 4;
+  }
+  if (flags & GRE_FLAG_SEQ)
+    opt += 4;
+
+  if (gre_proto == ETHER_TYPE_TEB)
+    return parse_l2(opt, end, md, false);
+  else if (gre_proto == ETHER_TYPE_IPv4)
+    return parse_ipv4(opt, end, md, false);
+  else if (gre_proto == ETHER_TYPE_IPv6)
+    return parse_ipv6(opt, end, md, false);
+  return true;
+}
+
+/**
+ * Parse the transport header of a packet into its metadata.
+ *
+ * @param proto The transport protocol.
+ * @param l4 The transport header.
+ * @param end The end of the packet.
+ * @param md The metadata to populate.
+ * @param outermost Whether the header may be the start of a tunnel.
+ * @return False if the packet is truncated, true otherwise.
+ */
+inline bool parse_transport(uint8_t proto, const unsigned char* l4,
+                            const unsigned char* end, packet_metadata& md,
+                            bool outermost) {
+  md.proto = proto;
+  if (proto == IPPROTO_TCP) {
+    if (!fits(l4, sizeof(struct tcp_hdr), end))
+      return false;
+    const struct tcp_hdr *tcp = (const struct tcp_hdr *) l4;
+    md.src_port = tcp->src_port;
+    md.dst_port = tcp->dst_port;
+    md.tcp_flags = tcp->tcp_flags;
+    md.has_ports = true;
+  } else if (proto == IPPROTO_UDP) {
+    if (!fits(l4, sizeof(struct udp_hdr), end))
+      return false;
+    const struct udp_hdr *udp = (const struct udp_hdr *) l4;
+    md.src_port = udp->src_port;
+    md.dst_port = udp->dst_port;
+    md.tcp_flags = 0;
+    md.has_ports = true;
+    if (__builtin_expect(outermost && udp->dst_port
+                         == rte_cpu_to_be_16(VXLAN_UDP_PORT), 0))
+      return parse_vxlan((const unsigned char*) (udp + 1), end, md);
+  } else if (__builtin_expect(outermost && proto == IPPROTO_GRE, 0)) {
+    return parse_gre(l4, end, md);
+  } else {
+    md.src_port = 0;
+    md.dst_port = 0;
+    md.tcp_flags = 0;
+    md.has_ports = false;
+  }
+  return true;
+}
+
+/**
+ * Describe a fragment other than the first of its packet: only the first
+ * fragment carries the transport header, so the protocol is known but the
+ * ports are not.
+ *
+ * @param proto The transport protocol.
+ * @param md The metadata to populate.
+ * @return True.
+ */
+inline bool parse_fragment(uint8_t proto, packet_metadata& md) {
+  md.proto = proto;
+  md.src_port = 0;
+  md.dst_port = 0;
+  md.tcp_flags = 0;
+  md.has_ports = false;
+  return true;
+}
+
+/**
+ * Parse an IPv6 header (skipping any extension headers) into the metadata.
+ *
+ * @param l3 The IPv6 header.
+ * @param end The end of the packet.
+ * @param md The metadata to populate.
+ * @param outermost Whether the packet may be the outer packet of a tunnel.
+ * @return False if the packet is truncated, true otherwise.
+ */
+inline bool parse_ipv6(const unsigned char* l3, const unsigned char* end,
+                       packet_metadata& md, bool outermost) {
+  if (!fits(l3, sizeof(struct ipv6_hdr), end))
+    return false;
+  const struct ipv6_hdr *ip6 = (const struct ipv6_hdr *) l3;
+  md.is_ipv6 = true;
+  md.src_addr = 0;
+  md.dst_addr = 0;
+  memcpy(md.src_addr6, ip6->src_addr, sizeof(md.src_addr6));
+  memcpy(md.dst_addr6, ip6->dst_addr, sizeof(md.dst_addr6));
+
+  uint8_t proto = ip6->proto;
+  const unsigned char* hdr = (const unsigned char*) (ip6 + 1);
+  bool first_fragment = true;
+  for (int i = 0; i < MAX_IPV6_EXT_HDRS; i++) {
+    size_t len;
+    if (proto == IPPROTO_HOPOPTS || proto == IPPROTO_ROUTING
+        || proto == IPPROTO_DSTOPTS)
+      len = fits(hdr, 2, end) ? (hdr[1] + 1) * 8 : SIZE_MAX;
+    else if (proto == IPPROTO_FRAGMENT)
+      len = 8;
+    else if (proto == IPPROTO_AH)
+      len = fits(hdr, 2, end) ? (hdr[1] + 2) * 4 : SIZE_MAX;
+    else
+      break;
+    if (!fits(hdr, len, end))
+      return false;
+    if (proto == IPPROTO_FRAGMENT)
+      first_fragment = (rte_be_to_cpu_16(*((const uint16_t*) (hdr + 2)))
+          & 0xFFF8) == 0;
+    proto = hdr[0];
+    hdr += len;
+  }
+  if (__builtin_expect(!first_fragment, 0))
+    return parse_fragment(proto, md);
+  return parse_transport(proto, hdr, end, md, outermost);
+}
+
+/**
+ * Parse an IPv4 header into the metadata.
+ *
+ * @param l3 The IPv4 header.
+ * @param end The end of the packet.
+ * @param md The metadata to populate.
+ * @param outermost Whether the packet may be the outer packet of a tunnel.
+ * @return False if the packet is truncated, true otherwise.
+ */
+inline bool parse_ipv4(const unsigned char* l3, const unsigned char* end,
+                       packet_metadata& md, bool outermost) {
+  if (!fits(l3, sizeof(struct ipv4_hdr), end))
+    return false;
+  const struct ipv4_hdr *ip = (const struct ipv4_hdr *) l3;
+  size_t ihl = (ip->version_ihl & IPV4_HDR_IHL_MASK) * IPV4_IHL_MULTIPLIER;
+  if (ihl < sizeof(struct ipv4_hdr) || !fits(l3, ihl, end))
+    return false;
+  md.is_ipv6 = false;
+  md.src_addr = ip->src_addr;
+  md.dst_addr = ip->dst_addr;
+  if (__builtin_expect(rte_be_to_cpu_16(ip->fragment_offset)
+                       & IPV4_HDR_OFFSET_MASK, 0))
+    return parse_fragment(ip->next_proto_id, md);
+  return parse_transport(ip->next_proto_id, l3 + ihl, end, md, outermost);
+}
+
+/**
+ * Parse an Ethernet header (skipping any VLAN tags) and its payload into the
+ * metadata.
+ *
+ * @param pkt The Ethernet header.
+ * @param end The end of the packet.
+ * @param md The metadata to populate.
+ * @param outermost Whether this is the outermost Ethernet header.
+ * @return False if the packet is truncated, true otherwise.
+ */
+inline bool parse_l2(const unsigned char* pkt, const unsigned char* end,
+                     packet_metadata& md, bool outermost) {
+  if (!fits(pkt, sizeof(struct ether_hdr), end))
+    return false;
+  const struct ether_hdr *eth = (const struct ether_hdr *) pkt;
+  uint16_t ether_type = eth->ether_type;
+  const unsigned char* l3 = (const unsigned char*) (eth + 1);
+
+  if (__builtin_expect(ether_type == rte_cpu_to_be_16(ETHER_TYPE_VLAN)
+                       || ether_type == rte_cpu_to_be_16(ETHER_TYPE_QINQ), 0)) {
+    uint16_t tags[MAX_VLAN_TAGS] = { 0, 0 };
+    for (int i = 0; i < MAX_VLAN_TAGS
+         && (ether_type == rte_cpu_to_be_16(ETHER_TYPE_VLAN)
+             || ether_type == rte_cpu_to_be_16(ETHER_TYPE_QINQ)); i++) {
+      if (!fits(l3, sizeof(struct vlan_hdr), end))
+        return false;
+      const struct vlan_hdr *vlan = (const struct vlan_hdr *) l3;
+      tags[i] = rte_be_to_cpu_16(vlan->vlan_tci) & 0x0FFF;
+      ether_type = vlan->eth_proto;
+      l3 = (const unsigned char*) (vlan + 1);
+    }
+    if (outermost) {
+      md.vlan_id = tags[0];
+      md.inner_vlan_id = tags[1];
+    }
+  }
+
+  if (__builtin_expect(ether_type == rte_cpu_to_be_16(ETHER_TYPE_IPv4), 1))
+    return parse_ipv4(l3, end, md, outermost);
+  else if (ether_type == rte_cpu_to_be_16(ETHER_TYPE_IPv6))
+    return parse_ipv6(l3, end, md, outermost);
+  set_non_ip(md);
+  return true;
+}
+
+/**
+ * Parse the headers of a packet into its metadata. Truncated packets are
+ * described as non-IP packets, outside of any tunnel.
+ *
+ * @param pkt The packet data.
+ * @param pkt_len The length of the packet data.
+ * @param md The metadata to populate.
+ */
+inline void parse_packet(const unsigned char* pkt, uint16_t pkt_len,
+                         packet_metadata& md) {
+  md.pkt_len = pkt_len;
+  md.vlan_id = 0;
+  md.inner_vlan_id = 0;
+  md.vni = 0;
+  md.encap = ENCAP_NONE;
+  if (__builtin_expect(!parse_l2(pkt, pkt + pkt_len, md, true), 0)) {
+    set_non_ip(md);
+    md.vni = 0;
+    md.encap = ENCAP_NONE;
+  }
+}
+
+}
+
+#endif  // PACKET_METADATA_H_
@@ -1,7 +1,14 @@
 #ifndef PACKETSTORE_H_
 #define PACKETSTORE_H_
 
+#include <chrono>
 #include <ctime>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
 
 #include <rte_config.h>
 #include <rte_malloc.h>
@@ -18,15 +25,21 @@
 #include <rte_udp.h>
 #include <rte_lpm.h>
 #include <rte_mbuf.h>
+#include <rte_prefetch.h>
 
 #include "logstore.h"
-#include "complex_character_index.h"
+#include "character_store.h"
 #include "packet_filter.h"
 #include "query_plan.h"
 #include "aggregates.h"
+#include "group_by.h"
+#include "result_cache.h"
+#include "rollup.h"
 #include "packet_attributes.h"
+#include "pcap_writer.h"
 
-#define MAX_FILTERS 65536
+#define INGEST_PREFETCH_OFFSET 3
+#define SCAN_BATCH_SIZE 4096  // Record ids handed to multi-get at a time
 
 #ifndef INDEX_SRC_IP
 #define INDEX_SRC_IP 1
@@ -48,98 +61,157 @@
 #define INDEX_TS 1
 #endif
 
+#ifndef INDEX_SRC_IP6
+#define INDEX_SRC_IP6 1
+#endif
+
+#ifndef INDEX_DST_IP6
+#define INDEX_DST_IP6 1
+#endif
+
+#ifndef INDEX_VLAN
+#define INDEX_VLAN 1
+#endif
+
+#ifndef INDEX_VNI
+#define INDEX_VNI 1
+#endif
+
 #ifndef NUM_INDEXES
-#define NUM_INDEXES (INDEX_SRC_IP + INDEX_DST_IP + INDEX_SRC_PORT + INDEX_DST_PORT + INDEX_TS)
+#define NUM_INDEXES (INDEX_SRC_IP + INDEX_DST_IP + INDEX_SRC_PORT + INDEX_DST_PORT + INDEX_TS \
+                     + INDEX_SRC_IP6 + INDEX_DST_IP6 + INDEX_VLAN + INDEX_VNI)
 #endif
 
 namespace netplay {
 
+/**
+ * Read-only view of a stored packet: its capture timestamp, and its header
+ * bytes in the data log.
+ */
+struct packet_view {
+  uint64_t ts;
+  const unsigned char* data;
+  uint16_t length;
+};
+
 /**
  * A data store for packet headers.
  *
  * Stores entire packet headers, along with 'casts' and 'characters' to enable
  * efficient rich semantics. See https://cs.berkeley.edu/~anuragk/netplay.pdf
  * for details.
+ *
+ * The packet store owns the logs and indexes; complex characters, their
+ * counters and sketches, and standing queries are kept in a character_store
+ * that writers update with the metadata of each packet they insert.
  */
 class packet_store: public slog::log_store {
  public:
   typedef std::unordered_set<uint64_t> result_type;
-  typedef complex_character_index::result filter_result;
+  typedef std::vector<uint64_t> batch_result_type;  // Results of batched queries
+  typedef character_store::filter_result filter_result;
   typedef aggregate::count<attribute::packet_header> packet_counter;
+  typedef aggregate::bytes<attribute::packet_header> byte_counter;
 
-  class handle : public slog::log_store::handle {
-   public:
-    handle(packet_store& store)
-      : slog::log_store::handle(store),
-        store_(store) {
+  /* Packet and byte counters of all packets, per rollup bucket */
+  struct total_counter {
+    total_counter() {
+      pkts.store(0, std::memory_order_relaxed);
+      bytes.store(0, std::memory_order_relaxed);
     }
 
-    void insert_pktburst(struct rte_mbuf** pkts, uint16_t cnt) {
-      std::time_t now = std::time(nullptr);
-      uint64_t id = store_.olog_->request_id_block(cnt);
-      uint64_t start_id = id;
-      uint64_t nbytes = cnt * sizeof(uint64_t);
-      for (int i = 0; i < cnt; i++)
-        nbytes += rte_pktmbuf_pkt_len(pkts[i]);
-      uint64_t off = store_.request_bytes(nbytes);
+    std::atomic<uint64_t> pkts;
+    std::atomic<uint64_t> bytes;
+  };
 
-      size_t num_chars = store_.num_filters_.load(std::memory_order_acquire);
-      auto char_index = store_.char_idx_->get(now);
+  typedef time_rollup<total_counter> total_counter_rollup;
 
-#if INDEX_TS == 1
-      auto time_list = store_.timestamp_idx_->get(now);
-      time_list->push_back_range(id, id + cnt - 1);
-#endif
+  /* Span of stored seconds */
+  struct time_span {
+    time_span() {
+      first.store(UINT32_MAX, std::memory_order_relaxed);
+      last.store(0, std::memory_order_relaxed);
+    }
 
-      for (int i = 0; i < cnt; i++) {
-        unsigned char* pkt = rte_pktmbuf_mtod(pkts[i], unsigned char*);
-        uint16_t pkt_size = rte_pktmbuf_pkt_len(pkts[i]);
+    std::atomic<uint32_t> first;
+    std::atomic<uint32_t> last;
+  };
 
-#if INDEX_SRC_IP == 1 || INDEX_DST_IP == 1 || INDEX_SRC_PORT == 1 || INDEX_DST_PORT == 1
-        struct ether_hdr *eth = (struct ether_hdr *) pkt;
-        struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
+  /**
+   * Everything casts read: the logs and indexes, the index ids, the span of
+   * stored seconds and the counters of all packets (used to estimate time
+   * filters). All of it is allocated through slog::allocator, so a packet
+   * store whose allocator draws from a shared memory region can be queried by
+   * other processes (see the attaching constructor, and shm_store.h).
+   */
+  struct store_layout {
+    slog::logstore_layout logs;
+    id_t srcip_idx_id;
+    id_t dstip_idx_id;
+    id_t srcport_idx_id;
+    id_t dstport_idx_id;
+    id_t timestamp_idx_id;
+    id_t srcip6_idx_id;
+    id_t dstip6_idx_id;
+    id_t vlan_idx_id;
+    id_t vni_idx_id;
+    time_span* span;
+    total_counter_rollup* total_rollup;
+  };
 
-#if INDEX_SRC_IP == 1
-        store_.srcip_idx_->add_entry(ip->src_addr, id);
-#endif // INDEX_SRC_IP == 1
-#if INDEX_DST_IP == 1
-        store_.dstip_idx_->add_entry(ip->dst_addr, id);
-#endif // INDEX_DST_IP == 1
+  /**
+   * Per-stage cycle counts for packet ingest; only maintained if the packet
+   * store is compiled with MEASURE_INGEST_STAGES.
+   */
+  struct ingest_stats {
+    ingest_stats() {
+      num_pkts = 0;
+      prefetch_cycles = 0;
+      parse_cycles = 0;
+      insert_cycles = 0;
+    }
 
-#if INDEX_SRC_PORT == 1 || INDEX_DST_PORT == 1
-        if (ip->next_proto_id == IPPROTO_TCP) {
-          struct tcp_hdr *tcp = (struct tcp_hdr *) (ip + 1);
-#if INDEX_SRC_PORT == 1
-          store_.srcport_idx_->add_entry(tcp->src_port, id);
-#endif // INDEX_SRC_PORT == 1
-#if INDEX_DST_PORT == 1
-          store_.dstport_idx_->add_entry(tcp->dst_port, id);
-#endif // INDEX_DST_PORT == 1
-        } else if (ip->next_proto_id == IPPROTO_UDP) {
-          struct udp_hdr *udp = (struct udp_hdr *) (ip + 1);
-#if INDEX_SRC_PORT == 1
-          store_.srcport_idx_->add_entry(udp->src_port, id);
-#endif // INDEX_SRC_PORT == 1
-#if INDEX_DST_PORT == 1
-          store_.dstport_idx_->add_entry(udp->dst_port, id);
-#endif // INDEX_DST_PORT == 1
-        }
-#endif // INDEX_SRC_PORT == 1 || INDEX_DST_PORT == 1
-#endif // INDEX_SRC_IP == 1 || INDEX_DST_IP == 1 || INDEX_SRC_PORT == 1 || INDEX_DST_PORT == 1
-
-        store_.olog_->set_without_alloc(id, off, pkt_size);
-        off += store_.append_pkt(off, now, pkt, pkt_size);
-        for (size_t i = 0; i < num_chars; i++) {
-          for (auto& filter : store_.filters_[i]) {
-            if (filter.apply(pkt)) {
-              char_index->get(i)->push_back(id);
-              break;
-            }
-          }
-        }
-        id++;
-      }
-      store_.olog_->end(start_id, cnt);
+    uint64_t num_pkts;
+    uint64_t prefetch_cycles;  // Stage 1: Prefetch packet descriptors
+    uint64_t parse_cycles;     // Stage 2: Parse packets into metadata
+    uint64_t insert_cycles;    // Stage 3: Update indexes, characters and logs
+  };
+
+  class handle : public slog::log_store::handle {
+   public:
+    handle(packet_store& store)
+      : slog::log_store::handle(store),
+        chars_(store.chars_),
+        store_(store) {
+    }
+
+    /**
+     * Insert a burst of DPDK packets into the packet store.
+     *
+     * @param pkts The packet buffers.
+     * @param cnt The number of packets.
+     * @param arrival_ns The arrival times of the packets, in ns, or NULL to
+     * time the whole burst once, on insertion (used for flow inter-arrival
+     * times).
+     */
+    void insert_pktburst(struct rte_mbuf** pkts, uint16_t cnt,
+                         const uint64_t* arrival_ns = NULL) {
+      insert_burst(mbuf_burst(pkts), cnt, arrival_ns);
+    }
+
+    /**
+     * Insert a burst of raw packets into the packet store; used by capture
+     * backends that do not receive packets in DPDK mbufs.
+     *
+     * @param pkts Pointers to the packet data.
+     * @param lens The packet lengths.
+     * @param cnt The number of packets.
+     * @param arrival_ns The arrival times of the packets, in ns (e.g., capture
+     * timestamps), or NULL to time the whole burst once, on insertion.
+     */
+    void insert_pktburst(unsigned char** pkts, uint16_t* lens, uint16_t cnt,
+                         const uint64_t* arrival_ns = NULL) {
+      insert_burst(raw_burst(pkts, lens), cnt, arrival_ns);
     }
 
     uint64_t approx_pkt_count(const id_t index_id, const uint64_t tok_beg,
@@ -147,6 +219,10 @@ class packet_store: public slog::log_store {
       return store_.approx_pkt_count(index_id, tok_beg, tok_end);
     }
 
+    uint64_t approx_pkt_count(const index_filter& f) const {
+      return store_.approx_pkt_count(f);
+    }
+
     void filter_pkts(result_type& results, query_plan& plan) const {
       store_.filter_pkts(results, plan);
     }
@@ -156,6 +232,17 @@ class packet_store: public slog::log_store {
       return store_.execute_cast<aggregate_type>(plan);
     }
 
+    template<typename aggregate_type>
+    typename aggregate_type::result_type execute_cast_cached(query_plan& plan) {
+      return store_.execute_cast_cached<aggregate_type>(plan);
+    }
+
+    template<typename aggregate_type>
+    std::vector<typename aggregate_type::result_type> execute_casts(
+        std::vector<query_plan>& plans) {
+      return store_.execute_casts<aggregate_type>(plans);
+    }
+
     filter_result complex_character_lookup(const id_t char_id,
                                            const uint32_t ts_beg, const uint32_t ts_end) {
       return store_.complex_character_lookup(char_id, ts_beg, ts_end);
@@ -168,6 +255,15 @@ class packet_store: public slog::log_store {
       return store_.query_character<aggregate_type>(char_id, ts_beg, ts_end);
     }
 
+    uint64_t export_cast(pcap_writer& writer, query_plan& plan) const {
+      return store_.export_cast(writer, plan);
+    }
+
+    uint64_t export_character(pcap_writer& writer, const uint32_t char_id,
+                              const uint32_t ts_beg, const uint32_t ts_end) {
+      return store_.export_character(writer, char_id, ts_beg, ts_end);
+    }
+
     id_t srcip_idx() const {
       return store_.srcip_idx_id_;
     }
@@ -188,19 +284,210 @@ class packet_store: public slog::log_store {
       return store_.timestamp_idx_id_;
     }
 
+    uint32_t first_timestamp() const {
+      return store_.first_timestamp();
+    }
+
+    id_t srcip6_idx() const {
+      return store_.srcip6_idx_id_;
+    }
+
+    id_t dstip6_idx() const {
+      return store_.dstip6_idx_id_;
+    }
+
+    id_t vlan_idx() const {
+      return store_.vlan_idx_id_;
+    }
+
+    id_t vni_idx() const {
+      return store_.vni_idx_id_;
+    }
+
     uint64_t num_pkts() const {
       return store_.num_pkts();
     }
 
+    const ingest_stats& stage_stats() const {
+      return stage_stats_;
+    }
+
    private:
+    /* Accessors for packet data and lengths within a burst */
+    struct mbuf_burst {
+      mbuf_burst(struct rte_mbuf** pkts) : pkts_(pkts) {}
+
+      inline unsigned char* data(int i) const {
+        return rte_pktmbuf_mtod(pkts_[i], unsigned char*);
+      }
+
+      inline uint16_t len(int i) const {
+        return rte_pktmbuf_pkt_len(pkts_[i]);
+      }
+
+      inline void prefetch_desc(int i) const {
+        rte_prefetch0(pkts_[i]);
+      }
+
+      inline void prefetch_data(int i) const {
+        rte_prefetch0(data(i));
+      }
+
+      struct rte_mbuf** pkts_;
+    };
+
+    struct raw_burst {
+      raw_burst(unsigned char** pkts, uint16_t* lens) : pkts_(pkts), lens_(lens) {}
+
+      inline unsigned char* data(int i) const {
+        return pkts_[i];
+      }
+
+      inline uint16_t len(int i) const {
+        return lens_[i];
+      }
+
+      inline void prefetch_desc(int i) const {
+        (void) i;
+      }
+
+      inline void prefetch_data(int i) const {
+        rte_prefetch0(pkts_[i]);
+      }
+
+      unsigned char** pkts_;
+      uint16_t* lens_;
+    };
+
+    /**
+     * Insert a burst of packets in three stages over the burst, so that each
+     * packet is parsed exactly once:
+     *  1. Prefetch packet descriptors.
+     *  2. Parse each packet into its metadata, prefetching the data of packets
+     *     INGEST_PREFETCH_OFFSET positions ahead.
+     *  3. Update indexes, characters, standing queries and logs using only
+     *     the metadata.
+     */
+    template<typename burst_type>
+    void insert_burst(const burst_type& burst, uint16_t cnt,
+                      const uint64_t* arrival_ns) {
+      if (md_.size() < cnt)
+        md_.resize(cnt);
+
+#ifdef MEASURE_INGEST_STAGES
+      uint64_t t0 = rte_rdtsc();
+#endif
+
+      /* Stage 1: Prefetch packet descriptors */
+      for (int i = 0; i < cnt; i++)
+        burst.prefetch_desc(i);
+
+#ifdef MEASURE_INGEST_STAGES
+      uint64_t t1 = rte_rdtsc();
+#endif
+
+      /* Stage 2: Parse packets */
+      uint64_t nbytes = cnt * sizeof(uint64_t);
+      for (int i = 0; i < cnt && i < INGEST_PREFETCH_OFFSET; i++)
+        burst.prefetch_data(i);
+      for (int i = 0; i < cnt; i++) {
+        if (i + INGEST_PREFETCH_OFFSET < cnt)
+          burst.prefetch_data(i + INGEST_PREFETCH_OFFSET);
+        parse_packet(burst.data(i), burst.len(i), md_[i]);
+        nbytes += md_[i].pkt_len;
+      }
+
+#ifdef MEASURE_INGEST_STAGES
+      uint64_t t2 = rte_rdtsc();
+#endif
+
+      /* Stage 3: Update indexes, characters and logs */
+      std::time_t now = std::time(nullptr);
+      store_.extend_time_span(now);
+      uint64_t id = store_.olog_->request_id_block(cnt);
+      uint64_t start_id = id;
+      uint64_t off = store_.request_bytes(nbytes);
+
+      chars_.begin_burst(now, arrival_ns);
+
+#if INDEX_TS == 1
+      auto time_list = store_.timestamp_idx_->get(now);
+      time_list->push_back_range(id, id + cnt - 1);
+#endif
+
+      for (int i = 0; i < cnt; i++) {
+        const packet_metadata& md = md_[i];
+
+        if (md.is_ipv6) {
+#if INDEX_SRC_IP6 == 1
+          store_.srcip6_idx_->add_entry(md.src_addr6, id);
+#endif // INDEX_SRC_IP6 == 1
+#if INDEX_DST_IP6 == 1
+          store_.dstip6_idx_->add_entry(md.dst_addr6, id);
+#endif // INDEX_DST_IP6 == 1
+        } else {
+#if INDEX_SRC_IP == 1
+          store_.srcip_idx_->add_entry(md.src_addr, id);
+#endif // INDEX_SRC_IP == 1
+#if INDEX_DST_IP == 1
+          store_.dstip_idx_->add_entry(md.dst_addr, id);
+#endif // INDEX_DST_IP == 1
+        }
+
+#if INDEX_SRC_PORT == 1 || INDEX_DST_PORT == 1
+        if (md.has_ports) {
+#if INDEX_SRC_PORT == 1
+          store_.srcport_idx_->add_entry(md.src_port, id);
+#endif // INDEX_SRC_PORT == 1
+#if INDEX_DST_PORT == 1
+          store_.dstport_idx_->add_entry(md.dst_port, id);
+#endif // INDEX_DST_PORT == 1
+        }
+#endif // INDEX_SRC_PORT == 1 || INDEX_DST_PORT == 1
+
+#if INDEX_VLAN == 1
+        if (md.vlan_id != 0)
+          store_.vlan_idx_->add_entry(md.vlan_id, id);
+#endif // INDEX_VLAN == 1
+#if INDEX_VNI == 1
+        if (md.encap != ENCAP_NONE)
+          store_.vni_idx_->add_entry(md.vni, id);
+#endif // INDEX_VNI == 1
+
+        store_.olog_->set_without_alloc(id, off, md.pkt_len);
+        off += store_.append_pkt(off, now, burst.data(i), md.pkt_len);
+        chars_.add(md, id, i);
+        id++;
+      }
+      store_.olog_->end(start_id, cnt);
+
+      /* Counters are updated once per burst, at every rollup level */
+      store_.count_burst(now, cnt, nbytes - cnt * sizeof(uint64_t));
+      chars_.end_burst(now);
+
+#ifdef MEASURE_INGEST_STAGES
+      uint64_t t3 = rte_rdtsc();
+      stage_stats_.num_pkts += cnt;
+      stage_stats_.prefetch_cycles += t1 - t0;
+      stage_stats_.parse_cycles += t2 - t1;
+      stage_stats_.insert_cycles += t3 - t2;
+#endif
+    }
+
+    std::vector<packet_metadata> md_;
+    character_store::writer chars_;
+    ingest_stats stage_stats_;
     packet_store& store_;
   };
 
   /**
    * Constructor to initialize the packet store.
    *
-   * By default, the packet store creates indexes on 5 fields:
-   * Source IP, Destination IP, Source Port, Destination Port and Timestamp.
+   * By default, the packet store creates indexes on 9 fields:
+   * Source IP, Destination IP, Source Port, Destination Port, Timestamp,
+   * Source and Destination IPv6 address (radix indexes), VLAN id and tunnel
+   * VNI. For tunneled packets, the address and port indexes cover the inner
+   * packet.
    */
   packet_store() {
     srcip_idx_id_ = add_index(4);
@@ -208,15 +495,97 @@ class packet_store: public slog::log_store {
     srcport_idx_id_ = add_index(2);
     dstport_idx_id_ = add_index(2);
     timestamp_idx_id_ = add_index(4);
+    srcip6_idx_id_ = add_index(16);
+    dstip6_idx_id_ = add_index(16);
+    vlan_idx_id_ = add_index(2);
+    vni_idx_id_ = add_index(4);
 
     srcip_idx_ = idx4_->at(0);
     dstip_idx_ = idx4_->at(1);
     srcport_idx_ = idx2_->at(0);
     dstport_idx_ = idx2_->at(1);
     timestamp_idx_ = idx4_->at(2);
+    srcip6_idx_ = idx16_->at(0);
+    dstip6_idx_ = idx16_->at(1);
+    vlan_idx_ = idx2_->at(2);
+    vni_idx_ = idx4_->at(3);
 
-    char_idx_ = new complex_character_index();
-    num_filters_.store(0U, std::memory_order_release);
+    span_ = slog::allocator::new_object<time_span>();
+    total_rollup_ = slog::allocator::new_object<total_counter_rollup>();
+    attached_ = false;
+    follower_running_.store(false, std::memory_order_release);
+  }
+
+  /**
+   * Constructor to query the casts of another packet store, typically one in
+   * another process whose logs and indexes live in a shared memory region
+   * mapped (read-only) into this one; see shm_store.h.
+   *
+   * Casts, packet views and time counts read the other store's structures in
+   * place, bounded by its offset log read tail, and are planned against its
+   * index cardinalities; results are cached in this store's own result cache.
+   * Complex characters, standing queries and sketches are kept per process,
+   * so this store starts without any, and nothing may be inserted into it.
+   *
+   * @param layout The layout of the other packet store.
+   */
+  explicit packet_store(const store_layout& layout)
+    : slog::log_store(layout.logs) {
+    srcip_idx_id_ = layout.srcip_idx_id;
+    dstip_idx_id_ = layout.dstip_idx_id;
+    srcport_idx_id_ = layout.srcport_idx_id;
+    dstport_idx_id_ = layout.dstport_idx_id;
+    timestamp_idx_id_ = layout.timestamp_idx_id;
+    srcip6_idx_id_ = layout.srcip6_idx_id;
+    dstip6_idx_id_ = layout.dstip6_idx_id;
+    vlan_idx_id_ = layout.vlan_idx_id;
+    vni_idx_id_ = layout.vni_idx_id;
+
+    srcip_idx_ = idx4_->at(0);
+    dstip_idx_ = idx4_->at(1);
+    srcport_idx_ = idx2_->at(0);
+    dstport_idx_ = idx2_->at(1);
+    timestamp_idx_ = idx4_->at(2);
+    srcip6_idx_ = idx16_->at(0);
+    dstip6_idx_ = idx16_->at(1);
+    vlan_idx_ = idx2_->at(2);
+    vni_idx_ = idx4_->at(3);
+
+    span_ = layout.span;
+    total_rollup_ = layout.total_rollup;
+    attached_ = true;
+    follower_running_.store(false, std::memory_order_release);
+  }
+
+  /**
+   * Get the layout of the packet store, from which other processes can
+   * attach to it.
+   *
+   * @return The layout.
+   */
+  store_layout layout() const {
+    store_layout l;
+    l.logs = slog::log_store::layout();
+    l.srcip_idx_id = srcip_idx_id_;
+    l.dstip_idx_id = dstip_idx_id_;
+    l.srcport_idx_id = srcport_idx_id_;
+    l.dstport_idx_id = dstport_idx_id_;
+    l.timestamp_idx_id = timestamp_idx_id_;
+    l.srcip6_idx_id = srcip6_idx_id_;
+    l.dstip6_idx_id = dstip6_idx_id_;
+    l.vlan_idx_id = vlan_idx_id_;
+    l.vni_idx_id = vni_idx_id_;
+    l.span = span_;
+    l.total_rollup = total_rollup_;
+    return l;
+  }
+
+  ~packet_store() {
+    stop_cast_follower();
+    if (!attached_) {
+      slog::allocator::delete_object(total_rollup_);
+      slog::allocator::delete_object(span_);
+    }
   }
 
   /**
@@ -236,16 +605,166 @@ class packet_store: public slog::log_store {
    * @return The id of the newly created complex character.
    */
   uint32_t add_complex_character(const filter_list& filter) {
-    size_t idx = num_filters_.fetch_add(1UL, std::memory_order_release);
-    filters_[idx] = filter;
-    return idx;
+    return chars_.add_complex_character(filter);
+  }
+
+  uint32_t num_complex_characters() const {
+    return chars_.num_complex_characters();
+  }
+
+  /* Standing top-K queries (see character_store::add_standing_top_k) */
+  uint32_t add_standing_top_k(const filter_list& filter, uint32_t fields,
+                              size_t capacity = TOP_K_CAPACITY) {
+    return chars_.add_standing_top_k(filter, fields, capacity);
+  }
+
+  standing_top_k* get_standing_top_k(const uint32_t id) const {
+    return chars_.get_standing_top_k(id);
+  }
+
+  /**
+   * Add a continuous cast, whose aggregate is kept up to date by
+   * update_standing_casts() (or the follower thread, see
+   * start_cast_follower()). The aggregate covers all stored packets,
+   * including those stored before the cast was added.
+   *
+   * @param filter The packet filter; an empty filter matches all packets.
+   * @return The cast, owned by the packet store.
+   */
+  template<typename aggregate_type>
+  standing_cast<aggregate_type>* add_standing_cast(const filter_list& filter) {
+    return chars_.add_standing_cast<aggregate_type>(filter);
   }
 
+  /**
+   * Bring all continuous casts up to date: the records that are readable but
+   * not yet reflected in a cast's result are matched against its filter
+   * (each record is read and parsed once for all casts), and folded into
+   * the result STANDING_CAST_BATCH records at a time.
+   *
+   * @return The number of records processed.
+   */
+  uint64_t update_standing_casts() {
+    std::lock_guard<std::mutex> lock(follower_mutex_);
+    uint32_t num_casts = chars_.num_standing_casts();
+    if (num_casts == 0)
+      return 0;
+    std::vector<standing_cast_base*> casts(num_casts);
+    for (uint32_t c = 0; c < num_casts; c++)
+      casts[c] = chars_.get_standing_cast(c);
+
+    uint64_t max_rid = olog_->num_ids();
+    uint64_t from = max_rid;
+    for (uint32_t c = 0; c < num_casts; c++)
+      from = std::min(from, casts[c]->last_rid());
+
+    std::vector<result_type> matched(num_casts);
+    packet_metadata md;
+    for (uint64_t batch = from; batch < max_rid; batch += STANDING_CAST_BATCH) {
+      uint64_t end = std::min(batch + STANDING_CAST_BATCH, max_rid);
+      for (uint64_t rid = batch; rid < end; rid++) {
+        packet_view pkt;
+        if (!view_pkt(pkt, rid))
+          continue;
+        parse_packet(pkt.data, pkt.length, md);
+        for (uint32_t c = 0; c < num_casts; c++) {
+          if (rid >= casts[c]->last_rid() && casts[c]->match(md, pkt.ts))
+            matched[c].insert(rid);
+        }
+      }
+      for (uint32_t c = 0; c < num_casts; c++) {
+        if (end > casts[c]->last_rid())
+          casts[c]->fold(matched[c], end, dlog_, olog_);
+        matched[c].clear();
+      }
+    }
+    return max_rid - from;
+  }
+
+  /**
+   * Start a follower thread that brings continuous casts up to date
+   * periodically.
+   *
+   * @param interval_us The polling interval, in microseconds.
+   */
+  void start_cast_follower(const uint64_t interval_us = CAST_FOLLOWER_INTERVAL_US) {
+    if (follower_running_.exchange(true))
+      return;
+    follower_ = std::thread([this, interval_us] {
+      while (follower_running_.load(std::memory_order_acquire)) {
+        if (update_standing_casts() < STANDING_CAST_BATCH)
+          std::this_thread::sleep_for(std::chrono::microseconds(interval_us));
+      }
+    });
+  }
+
+  /**
+   * Stop the follower thread, if it is running.
+   */
+  void stop_cast_follower() {
+    if (follower_running_.exchange(false))
+      follower_.join();
+  }
+
+  /* Distinct counts and quantiles of complex characters, from per-second
+   * sketches (see character_store) */
+  void add_distinct_count(const uint32_t char_id, uint32_t fields) {
+    chars_.add_distinct_count(char_id, fields);
+  }
+
+  character_store::char_sketch distinct_character(const uint32_t char_id,
+                                                  uint32_t ts_beg,
+                                                  uint32_t ts_end) const {
+    if (!clamp_time_range(ts_beg, ts_end))
+      return chars_.distinct(char_id, 1, 0);  // Empty
+    return chars_.distinct(char_id, ts_beg, ts_end);
+  }
+
+  void add_quantiles(const uint32_t char_id, const quantile_metric metric) {
+    chars_.add_quantiles(char_id, metric);
+  }
+
+  character_store::quantile_sketch quantiles_character(
+      const uint32_t char_id, const quantile_metric metric, uint32_t ts_beg,
+      uint32_t ts_end) const {
+    if (!clamp_time_range(ts_beg, ts_end))
+      return chars_.quantiles(char_id, metric, 1, 0);  // Empty
+    return chars_.quantiles(char_id, metric, ts_beg, ts_end);
+  }
+
+  /* Time ranges are counted from the rollups, rather than per second */
   uint64_t approx_pkt_count(const uint32_t index_id, const uint64_t tok_beg,
                             const uint64_t tok_end) const {
+    if (index_id == timestamp_idx_id_)
+      return count_time(std::min(tok_beg, (uint64_t) UINT32_MAX),
+                        std::min(tok_end, (uint64_t) UINT32_MAX)).pkts;
     return filter_count(index_id, tok_beg, tok_end);
   }
 
+  uint64_t approx_pkt_count(const index_filter& f) const {
+    if (is_radix_index(f.index_id))
+      return filter_prefix_count(f.index_id, f.prefix.addr, f.prefix.len);
+    return approx_pkt_count(f.index_id, f.tok_range.first, f.tok_range.second);
+  }
+
+  /**
+   * Filter index entries based on a single index filter; radix (IPv6
+   * address) indexes are queried by prefix, all others by token range.
+   *
+   * @param f The index filter.
+   * @param max_rid Largest record-id to consider.
+   * @param min_rid Smallest record-id to consider.
+   * @return The filter results.
+   */
+  slog::filter_result filter_index(const index_filter& f, const uint64_t max_rid,
+                                   const uint64_t min_rid = 0) const {
+    if (is_radix_index(f.index_id))
+      return filter_prefix(f.index_id, f.prefix.addr, f.prefix.len, max_rid,
+                           min_rid);
+    index_filter::range r = scan_range(f);
+    return filter(f.index_id, r.first, r.second, max_rid, min_rid);
+  }
+
   /**
    * Filter index entries based on query.
    *
@@ -253,16 +772,14 @@ class packet_store: public slog::log_store {
    * @param query The filter query.
    */
   void filter_pkts(result_type& results, query_plan& plan) const {
-    uint64_t max_rid = olog_->num_ids();
+    filter_pkts(results, plan, olog_->num_ids());
+  }
 
+  void filter_pkts(result_type& results, query_plan& plan,
+                   const uint64_t max_rid, const uint64_t min_rid = 0) const {
     for (clause_plan& cplan : plan) {
       /* Evaluate the min cardinality filter */
-      uint32_t idx_id = cplan.idx_filter.index_id;
-      uint64_t tok_beg = cplan.idx_filter.tok_range.first;
-      uint64_t tok_end = cplan.idx_filter.tok_range.second;
-
-      std::unordered_set<uint64_t> filter_res;
-      auto res = filter(idx_id, tok_beg, tok_end, max_rid);
+      auto res = filter_index(cplan.idx_filter, max_rid, min_rid);
       if (cplan.perform_pkt_filter) {
         auto pf_res = packet_filter_result(res, cplan.pkt_filter, dlog_, olog_);
         results.insert(pf_res.begin(), pf_res.end());
@@ -272,19 +789,268 @@ class packet_store: public slog::log_store {
     }
   }
 
+  /**
+   * Stream the record ids matching a query plan to a visitor, in batches.
+   *
+   * Single clause plans are streamed directly off the index (and packet
+   * filter) iterators; plans with multiple clauses need their results
+   * de-duplicated first.
+   *
+   * @param plan The query plan.
+   * @param fn The visitor, invoked as fn(record_ids, num_records) with at
+   *  most SCAN_BATCH_SIZE record ids at a time.
+   * @return The number of record ids visited.
+   */
+  template<typename visitor_type>
+  uint64_t scan_cast(query_plan& plan, visitor_type fn) const {
+    if (plan.size() != 1) {
+      result_type result;
+      filter_pkts(result, plan);
+      return scan_ids(result, fn);
+    }
+
+    clause_plan& cplan = plan.front();
+    uint64_t max_rid = olog_->num_ids();
+    auto res = filter_index(cplan.idx_filter, max_rid);
+    if (cplan.perform_pkt_filter) {
+      auto pf_res = packet_filter_result(res, cplan.pkt_filter, dlog_, olog_);
+      return scan_ids(pf_res, fn);
+    }
+    return scan_ids(res, fn);
+  }
+
   template<typename aggregate_type>
   typename aggregate_type::result_type execute_cast(query_plan& plan) {
     result_type result;
     filter_pkts(result, plan);
-    return aggregate_type::aggregate(result);
+    return aggregate_type::aggregate(result, dlog_, olog_);
   }
 
-  filter_result complex_character_lookup(const uint32_t char_id,
-                                         const uint32_t ts_beg,
-                                         const uint32_t ts_end) {
-    std::pair<uint64_t, uint64_t> time_range(ts_beg, ts_end);
+  /**
+   * Execute a cast through the result cache.
+   *
+   * Results are cached per normalized plan and aggregate, along with the
+   * max_rid they cover. A hit is extended by filtering only the records
+   * stored since, through the same index and packet filters as a miss, and
+   * merging their aggregate into the cached result.
+   *
+   * @param plan The query plan.
+   * @return The aggregate over the packets matching the plan.
+   */
+  template<typename aggregate_type>
+  typename aggregate_type::result_type execute_cast_cached(query_plan& plan) {
+    typedef typename aggregate_type::result_type agg_result_type;
+    std::string key = typeid(aggregate_type).name() + normalize_plan(plan);
     uint64_t max_rid = olog_->num_ids();
-    return char_idx_->filter(max_rid, char_id, time_range);
+
+    agg_result_type res;
+    uint64_t from;
+    if (cache_.lookup(key, res, from)) {
+      if (from >= max_rid)
+        return res;
+      result_type tail;
+      filter_pkts(tail, plan, max_rid, from);
+      aggregate_type::merge(res, aggregate_type::aggregate(tail, dlog_, olog_), 0);
+      cache_.record_extension(max_rid - from);
+      cache_.insert(key, res, max_rid);
+      return res;
+    }
+
+    result_type ids;
+    filter_pkts(ids, plan, max_rid);
+    res = aggregate_type::aggregate(ids, dlog_, olog_);
+    cache_.insert(key, res, max_rid);
+    return res;
+  }
+
+  /**
+   * Filter index entries for a batch of queries, sharing index scans among
+   * them.
+   *
+   * The clauses of all plans are grouped by the index they filter on, and
+   * the token ranges of each index are merged into disjoint segments, each
+   * of which is scanned once. Every record id is routed to the clauses
+   * whose range holds its token; a packet is fetched and parsed at most once
+   * for the packet filters of all of those clauses. Clauses on radix (IPv6
+   * address) indexes are filtered one at a time, as in filter_pkts.
+   *
+   * Results are collected in vectors rather than sets, since a batch keeps
+   * the results of all of its queries at once; only queries with several
+   * clauses need to be de-duplicated, which is done once all are scanned.
+   *
+   * @param results The results of each query; must hold one vector per plan.
+   * @param plans The query plans.
+   * @param max_rid Largest record-id to consider.
+   */
+  void filter_pkts(std::vector<batch_result_type>& results,
+                   std::vector<query_plan>& plans,
+                   const uint64_t max_rid) const {
+    std::unordered_map<uint32_t, std::vector<scan_clause>> by_index;
+    for (size_t q = 0; q < plans.size(); q++) {
+      for (clause_plan& cplan : plans[q]) {
+        if (is_radix_index(cplan.idx_filter.index_id)) {
+          auto res = filter_index(cplan.idx_filter, max_rid);
+          if (cplan.perform_pkt_filter) {
+            auto pf_res = packet_filter_result(res, cplan.pkt_filter, dlog_, olog_);
+            results[q].insert(results[q].end(), pf_res.begin(), pf_res.end());
+          } else {
+            results[q].insert(results[q].end(), res.begin(), res.end());
+          }
+          continue;
+        }
+        scan_clause c = { scan_range(cplan.idx_filter), q, &cplan };
+        if (c.range.first <= c.range.second)
+          by_index[cplan.idx_filter.index_id].push_back(c);
+      }
+    }
+
+    for (auto& entry : by_index) {
+      std::vector<scan_clause>& clauses = entry.second;
+      std::sort(clauses.begin(), clauses.end(),
+                [](const scan_clause& a, const scan_clause& b) {
+                  return a.range.first < b.range.first;
+                });
+      size_t beg = 0;
+      while (beg < clauses.size()) {
+        index_filter::range seg = clauses[beg].range;
+        size_t end = beg + 1;
+        while (end < clauses.size() && clauses[end].range.first <= seg.second) {
+          seg.second = std::max(seg.second, clauses[end].range.second);
+          end++;
+        }
+        scan_segment(results, entry.first, seg, clauses, beg, end, max_rid);
+        beg = end;
+      }
+    }
+
+    for (size_t q = 0; q < plans.size(); q++) {
+      if (plans[q].size() > 1) {
+        std::sort(results[q].begin(), results[q].end());
+        results[q].erase(std::unique(results[q].begin(), results[q].end()),
+                         results[q].end());
+      }
+    }
+  }
+
+  /**
+   * Execute a batch of casts with shared index scans (see the batch
+   * filter_pkts); cheaper than executing them one at a time when their
+   * index filters overlap.
+   *
+   * @param plans The query plans.
+   * @return The aggregate over the packets matching each plan, in order.
+   */
+  template<typename aggregate_type>
+  std::vector<typename aggregate_type::result_type> execute_casts(
+      std::vector<query_plan>& plans) {
+    std::vector<batch_result_type> ids(plans.size());
+    filter_pkts(ids, plans, olog_->num_ids());
+
+    std::vector<typename aggregate_type::result_type> results;
+    results.reserve(plans.size());
+    for (batch_result_type& res : ids)
+      results.push_back(aggregate_type::aggregate(res, dlog_, olog_));
+    return results;
+  }
+
+  /**
+   * Normalize a query plan into a cache key: clauses are serialized in a
+   * canonical form (unused filter fields are omitted, IPv6 prefixes are
+   * masked), sorted, and de-duplicated, so that equivalent plans with
+   * reordered or repeated clauses share cache entries.
+   *
+   * @param plan The query plan.
+   * @return The normalized plan.
+   */
+  std::string normalize_plan(const query_plan& plan) const {
+    std::vector<std::string> clauses;
+    for (const clause_plan& cplan : plan) {
+      std::string c;
+      append_filter(c, cplan.idx_filter);
+      if (cplan.perform_pkt_filter) {
+        const packet_filter& pf = cplan.pkt_filter;
+        append_range(c, pf.src_addr);
+        append_range(c, pf.dst_addr);
+        append_range(c, pf.src_port);
+        append_range(c, pf.dst_port);
+        append_range(c, pf.timestamp);
+        append_range(c, pf.vlan);
+        append_range(c, pf.vni);
+        append_prefix(c, pf.src_addr6);
+        append_prefix(c, pf.dst_addr6);
+      }
+      clauses.push_back(c);
+    }
+    std::sort(clauses.begin(), clauses.end());
+    clauses.erase(std::unique(clauses.begin(), clauses.end()), clauses.end());
+
+    std::string key;
+    for (const std::string& c : clauses) {
+      uint32_t len = c.size();
+      key.append((const char*) &len, sizeof(len));
+      key.append(c);
+    }
+    return key;
+  }
+
+  result_cache& get_result_cache() {
+    return cache_;
+  }
+
+  /**
+   * Execute a group-by aggregation (see group_by) over the packets matching
+   * a cast.
+   *
+   * Record ids are streamed off the filter iterators (see scan_cast). With
+   * multiple threads, the calling thread hands batches of record ids to
+   * worker threads, each of which aggregates into its own partial table;
+   * the partials are merged at the end.
+   *
+   * @param plan The query plan for the cast.
+   * @param num_threads The number of worker threads.
+   * @return The per-group aggregates.
+   */
+  template<typename group_type>
+  typename group_type::result_type execute_group_by(query_plan& plan,
+                                                    size_t num_threads = 1) const {
+    typedef typename group_type::result_type result_type;
+    if (num_threads <= 1) {
+      result_type groups;
+      scan_cast(plan, [this, &groups](const uint64_t* ids, size_t n) {
+        group_pkts<group_type>(groups, ids, n);
+      });
+      return groups;
+    }
+
+    std::vector<result_type> partials(num_threads);
+    group_by_queue queue(num_threads * GROUP_QUEUE_DEPTH);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < num_threads; i++) {
+      workers.push_back(std::thread([this, &queue, &partials, i] {
+        std::vector<uint64_t> batch;
+        while (queue.pop(batch))
+          group_pkts<group_type>(partials[i], batch.data(), batch.size());
+      }));
+    }
+    scan_cast(plan, [&queue](const uint64_t* ids, size_t n) {
+      queue.push(std::vector<uint64_t>(ids, ids + n));
+    });
+    queue.close();
+    for (std::thread& worker : workers)
+      worker.join();
+
+    for (size_t i = 1; i < num_threads; i++)
+      group_type::merge(partials[0], partials[i], 0);
+    return partials[0];
+  }
+
+  filter_result complex_character_lookup(const uint32_t char_id,
+                                         uint32_t ts_beg, uint32_t ts_end) {
+    /* Seconds without packets need not be visited */
+    if (!clamp_time_range(ts_beg, ts_end))
+      return chars_.lookup(char_id, 0, std::make_pair(1UL, 0UL));  // Empty
+    return chars_.lookup(char_id, olog_->num_ids(),
+                         std::make_pair((uint64_t) ts_beg, (uint64_t) ts_end));
   }
 
   template<typename aggregate_type>
@@ -292,7 +1058,143 @@ class packet_store: public slog::log_store {
       const uint32_t ts_beg,
       const uint32_t ts_end) {
     filter_result result = complex_character_lookup(char_id, ts_beg, ts_end);
-    return aggregate_type::aggregate(result);
+    return aggregate_type::aggregate(result, dlog_, olog_);
+  }
+
+  /**
+   * Count the packets and bytes of a complex character within a time range,
+   * from its hour, minute and second counters; neither reads the
+   * character's entry lists nor allocates.
+   *
+   * @param char_id The id of the complex character.
+   * @param ts_beg The beginning of the time range.
+   * @param ts_end The end of the time range.
+   * @return The packet and byte counts.
+   */
+  traffic_counts count_character(const uint32_t char_id, uint32_t ts_beg,
+                                 uint32_t ts_end) const {
+    if (!clamp_time_range(ts_beg, ts_end)) {
+      traffic_counts res = { 0, 0 };
+      return res;
+    }
+    return chars_.count(char_id, ts_beg, ts_end);
+  }
+
+  /**
+   * Count all packets and bytes within a time range, from the hour, minute
+   * and second counters.
+   *
+   * @param ts_beg The beginning of the time range.
+   * @param ts_end The end of the time range.
+   * @return The packet and byte counts.
+   */
+  traffic_counts count_time(uint32_t ts_beg, uint32_t ts_end) const {
+    traffic_counts res = { 0, 0 };
+    if (!clamp_time_range(ts_beg, ts_end))
+      return res;
+    total_rollup_->cover(ts_beg, ts_end, [&res](total_counter* counter) {
+      res.pkts += counter->pkts.load(std::memory_order_relaxed);
+      res.bytes += counter->bytes.load(std::memory_order_relaxed);
+    });
+    return res;
+  }
+
+  /**
+   * Get the first second with stored packets.
+   *
+   * @return The first second, or UINT32_MAX if the store is empty.
+   */
+  uint32_t first_timestamp() const {
+    return span_->first.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Get a view of a packet given its record id, without copying it.
+   *
+   * @param view The view to populate.
+   * @param record_id The record id of the packet.
+   * @return true if the packet exists, false otherwise.
+   */
+  bool view_pkt(packet_view& view, const uint64_t record_id) const {
+    slog::record_view rec;
+    if (!log_store::view(rec, record_id))
+      return false;
+    view = to_packet_view(rec);
+    return true;
+  }
+
+  /**
+   * Visit a batch of packets without copying them. Packets are visited in
+   * data log order, with upcoming packets prefetched (see
+   * slog::log_store::multi_get).
+   *
+   * @param record_ids The record ids of the packets.
+   * @param num_records The number of record ids.
+   * @param fn The visitor, invoked as fn(record_id, packet_view).
+   * @return The number of packets visited.
+   */
+  template<typename visitor_type>
+  size_t multi_get_pkts(const uint64_t* record_ids, size_t num_records,
+                        visitor_type fn) const {
+    return multi_get(record_ids, num_records,
+                     [&fn](uint64_t record_id, const slog::record_view& rec) {
+                       fn(record_id, to_packet_view(rec));
+                     });
+  }
+
+  /**
+   * Export packets with the given record ids in pcap format. Packet data is
+   * handed to the writer directly from the data log, without copying, one
+   * batch of SCAN_BATCH_SIZE record ids at a time (see multi_get_pkts).
+   *
+   * @param writer The pcap writer to export packets to.
+   * @param container The container of record ids to export.
+   * @return The number of packets exported.
+   */
+  template<typename container_type>
+  uint64_t export_pkts(pcap_writer& writer, container_type& container) const {
+    uint64_t cnt = scan_ids(container, [this, &writer](const uint64_t* ids,
+                                                       size_t n) {
+      multi_get_pkts(ids, n, [&writer](uint64_t, const packet_view& pkt) {
+        writer.append(pkt.ts, pkt.data, pkt.length);
+      });
+    });
+    writer.flush();
+    return cnt;
+  }
+
+  /**
+   * Export all packets matching a cast in pcap format.
+   *
+   * @param writer The pcap writer to export packets to.
+   * @param plan The query plan for the cast.
+   * @return The number of packets exported.
+   */
+  uint64_t export_cast(pcap_writer& writer, query_plan& plan) const {
+    uint64_t cnt = scan_cast(plan, [this, &writer](const uint64_t* ids,
+                                                   size_t n) {
+      multi_get_pkts(ids, n, [&writer](uint64_t, const packet_view& pkt) {
+        writer.append(pkt.ts, pkt.data, pkt.length);
+      });
+    });
+    writer.flush();
+    return cnt;
+  }
+
+  /**
+   * Export all packets matching a complex character within a time range in
+   * pcap format.
+   *
+   * @param writer The pcap writer to export packets to.
+   * @param char_id The id of the complex character.
+   * @param ts_beg The beginning of the time range.
+   * @param ts_end The end of the time range.
+   * @return The number of packets exported.
+   */
+  uint64_t export_character(pcap_writer& writer, const uint32_t char_id,
+                            const uint32_t ts_beg, const uint32_t ts_end) {
+    filter_result result = complex_character_lookup(char_id, ts_beg, ts_end);
+    return export_pkts(writer, result);
   }
 
   /**
@@ -323,33 +1225,215 @@ class packet_store: public slog::log_store {
     return pkt_len + sizeof(uint64_t);
   }
 
+  static inline packet_view to_packet_view(const slog::record_view& rec) {
+    packet_view view;
+    view.ts = *((const uint64_t*) rec.data);
+    view.data = rec.data + sizeof(uint64_t);
+    view.length = rec.length;
+    return view;
+  }
+
+  template<typename group_type>
+  void group_pkts(typename group_type::result_type& groups,
+                  const uint64_t* ids, size_t n) const {
+    multi_get_pkts(ids, n, [&groups](uint64_t, const packet_view& pkt) {
+      group_type::update(groups, (void*) pkt.data, pkt.length);
+    });
+  }
+
+  /* A clause of a batch of queries, on a token range of an index */
+  struct scan_clause {
+    index_filter::range range;
+    size_t query;
+    const clause_plan* cplan;
+  };
+
+  /*
+   * Scan a segment of an index once for a batch of clauses, sorted by the
+   * beginning of their ranges; tokens are visited in increasing order, so
+   * the clauses whose range holds the current token only change when the
+   * scan moves on to the next token.
+   */
+  void scan_segment(std::vector<batch_result_type>& results, const uint32_t index_id,
+                    const index_filter::range& seg,
+                    const std::vector<scan_clause>& clauses, const size_t beg,
+                    const size_t end, const uint64_t max_rid) const {
+    std::vector<const scan_clause*> active;
+    size_t next = beg;
+    uint64_t tok = seg.first;
+    bool first = true;
+    packet_metadata md;
+    packet_view pkt;
+
+    auto res = filter(index_id, seg.first, seg.second, max_rid);
+    for (auto it = res.begin(); it != res.end(); ++it) {
+      uint64_t record_id = *it;
+      if (record_id >= max_rid)
+        continue;
+      if (first || it.token() != tok) {
+        tok = it.token();
+        first = false;
+        active.erase(std::remove_if(active.begin(), active.end(),
+                                    [tok](const scan_clause* c) {
+                                      return c->range.second < tok;
+                                    }), active.end());
+        for (; next < end && clauses[next].range.first <= tok; next++) {
+          if (clauses[next].range.second >= tok)
+            active.push_back(&clauses[next]);
+        }
+      }
+
+      int parsed = -1;  // Unknown; 1 if parsed, 0 if the record is invalid
+      for (const scan_clause* c : active) {
+        if (!c->cplan->perform_pkt_filter) {
+          results[c->query].push_back(record_id);
+          continue;
+        }
+        if (parsed == -1) {
+          parsed = view_pkt(pkt, record_id);
+          if (parsed)
+            parse_packet(pkt.data, pkt.length, md);
+        }
+        const packet_filter& pf = c->cplan->pkt_filter;
+        if (parsed && pkt.ts >= pf.timestamp.first
+            && pkt.ts <= pf.timestamp.second && pf.apply(md))
+          results[c->query].push_back(record_id);
+      }
+    }
+  }
+
+  /* The token range scanned for a (non-radix) index filter */
+  index_filter::range scan_range(const index_filter& f) const {
+    if (f.index_id != timestamp_idx_id_)
+      return f.tok_range;
+    /* Open-ended time ranges start at the first stored second, not at 0 */
+    uint64_t first = std::min((uint64_t) span_->first.load(std::memory_order_acquire),
+                              f.tok_range.second);
+    return index_filter::range(std::max(f.tok_range.first, first),
+                               f.tok_range.second);
+  }
+
+  static void append_range(std::string& key, const index_filter::range& r) {
+    key.append((const char*) &r.first, sizeof(r.first));
+    key.append((const char*) &r.second, sizeof(r.second));
+  }
+
+  static void append_prefix(std::string& key, const ip6_prefix& p) {
+    ip6_prefix masked;
+    memset(&masked, 0, sizeof(masked));
+    masked.len = p.len;
+    memcpy(masked.addr, p.addr, (p.len + 7) / 8);
+    if (p.len % 8 != 0)
+      masked.addr[p.len / 8] &= (uint8_t) (0xFF << (8 - p.len % 8));
+    key.append((const char*) &masked, sizeof(masked));
+  }
+
+  void append_filter(std::string& key, const index_filter& f) const {
+    key.append((const char*) &f.index_id, sizeof(f.index_id));
+    if (is_radix_index(f.index_id))
+      append_prefix(key, f.prefix);
+    else
+      append_range(key, f.tok_range);
+  }
+
+  /* Extend the span of stored seconds; done before a burst becomes visible */
+  void extend_time_span(const uint32_t now) {
+    uint32_t first = span_->first.load(std::memory_order_relaxed);
+    while (now < first && !span_->first.compare_exchange_weak(first, now,
+        std::memory_order_release, std::memory_order_relaxed)) {
+    }
+    uint32_t last = span_->last.load(std::memory_order_relaxed);
+    while (now > last && !span_->last.compare_exchange_weak(last, now,
+        std::memory_order_release, std::memory_order_relaxed)) {
+    }
+  }
+
+  /* Count a burst in the global counters */
+  void count_burst(const uint32_t now, const uint64_t num_pkts,
+                   const uint64_t num_bytes) {
+    total_counter* counters[NUM_ROLLUP_LEVELS];
+    total_rollup_->get(now, counters);
+    for (size_t l = 0; l < NUM_ROLLUP_LEVELS; l++) {
+      counters[l]->pkts.fetch_add(num_pkts, std::memory_order_relaxed);
+      counters[l]->bytes.fetch_add(num_bytes, std::memory_order_relaxed);
+    }
+  }
+
+  /* Clamp a time range to the span of stored seconds; false if they do not overlap */
+  bool clamp_time_range(uint32_t& ts_beg, uint32_t& ts_end) const {
+    ts_beg = std::max(ts_beg, span_->first.load(std::memory_order_acquire));
+    ts_end = std::min(ts_end, span_->last.load(std::memory_order_acquire));
+    return ts_beg <= ts_end;
+  }
+
+  /* Hand the ids in a container to a visitor, SCAN_BATCH_SIZE at a time. */
+  template<typename container_type, typename visitor_type>
+  static uint64_t scan_ids(container_type& container, visitor_type fn) {
+    uint64_t batch[SCAN_BATCH_SIZE];
+    uint64_t cnt = 0;
+    size_t n = 0;
+    for (uint64_t record_id : container) {
+      batch[n++] = record_id;
+      if (n == SCAN_BATCH_SIZE) {
+        fn(batch, n);
+        cnt += n;
+        n = 0;
+      }
+    }
+    if (n > 0) {
+      fn(batch, n);
+      cnt += n;
+    }
+    return cnt;
+  }
+
   id_t srcip_idx_id_;
   id_t dstip_idx_id_;
   id_t srcport_idx_id_;
   id_t dstport_idx_id_;
   id_t timestamp_idx_id_;
+  id_t srcip6_idx_id_;
+  id_t dstip6_idx_id_;
+  id_t vlan_idx_id_;
+  id_t vni_idx_id_;
 
   slog::__index4* srcip_idx_;
   slog::__index4* dstip_idx_;
   slog::__index2* srcport_idx_;
   slog::__index2* dstport_idx_;
   slog::__index4* timestamp_idx_;
+  slog::__index16* srcip6_idx_;
+  slog::__index16* dstip6_idx_;
+  slog::__index2* vlan_idx_;
+  slog::__index4* vni_idx_;
+
+  /* Complex characters, standing queries and sketches */
+  character_store chars_;
+
+  /* The thread that follows the log for continuous casts */
+  std::mutex follower_mutex_;
+  std::thread follower_;
+  std::atomic<bool> follower_running_;
 
-  /* Complex characters */
-  /* Packet filters */
-  std::array<filter_list, MAX_FILTERS> filters_;
-  std::atomic<uint32_t> num_filters_;
-  complex_character_index* char_idx_;
+  total_counter_rollup* total_rollup_;  // Counters of all packets
+  time_span* span_;                     // Span of stored seconds
+  bool attached_;                       // Logs belong to another store
+
+  result_cache cache_;
 };
 
-template<> packet_store::packet_counter::result_type packet_store::query_character<packet_store::packet_counter>(
+template<> inline packet_store::packet_counter::result_type packet_store::query_character<packet_store::packet_counter>(
+  const uint32_t char_id,
+  const uint32_t ts_beg,
+  const uint32_t ts_end) {
+  return count_character(char_id, ts_beg, ts_end).pkts;
+}
+
+template<> inline packet_store::byte_counter::result_type packet_store::query_character<packet_store::byte_counter>(
   const uint32_t char_id,
   const uint32_t ts_beg,
   const uint32_t ts_end) {
-  packet_counter::result_type res = 0;
-  for (uint32_t ts = ts_beg; ts <= ts_end; ts++)
-    res += char_idx_->get(ts)->get(char_id)->size();
-  return res;
+  return count_character(char_id, ts_beg, ts_end).bytes;
 }
 
 }
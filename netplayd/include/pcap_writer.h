@@ -0,0 +1,189 @@
+#ifndef PCAP_WRITER_H_
+#define PCAP_WRITER_H_
+
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <string>
+
+namespace netplay {
+
+class pcap_exception : public std::exception {
+ public:
+  pcap_exception(const std::string& msg)
+    : msg_(msg) {
+  }
+
+  const char* what() const noexcept {
+    return msg_.c_str();
+  }
+
+ private:
+  const std::string msg_;
+};
+
+/**
+ * Streams packets to a file descriptor in the (libpcap) pcap format.
+ *
+ * Packet data is never copied: each packet contributes two iovecs, one for
+ * its (locally constructed) pcap record header and one pointing directly at
+ * the packet bytes. Records are batched and handed to the kernel with a single
+ * writev() call per batch. The caller must therefore ensure that packet data
+ * passed to append() remains valid until the next flush().
+ */
+class pcap_writer {
+ public:
+  static const uint32_t PCAP_MAGIC = 0xa1b2c3d4;
+  static const uint16_t PCAP_VERSION_MAJOR = 2;
+  static const uint16_t PCAP_VERSION_MINOR = 4;
+  static const uint32_t PCAP_LINKTYPE_ETHERNET = 1;
+  static const uint32_t PCAP_SNAPLEN = 65535;
+
+#ifdef IOV_MAX
+  static const size_t MAX_BATCH = IOV_MAX / 2;
+#else
+  static const size_t MAX_BATCH = 512;
+#endif
+
+  struct file_header {
+    uint32_t magic_number;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+  };
+
+  struct record_header {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+  };
+
+  /**
+   * Constructor to initialize the pcap writer; writes the pcap file header.
+   *
+   * @param fd The (open, writable) file descriptor to stream packets to.
+   */
+  pcap_writer(int fd)
+    : fd_(fd), num_pending_(0), num_pkts_(0), num_bytes_(0) {
+    file_header hdr;
+    hdr.magic_number = PCAP_MAGIC;
+    hdr.version_major = PCAP_VERSION_MAJOR;
+    hdr.version_minor = PCAP_VERSION_MINOR;
+    hdr.thiszone = 0;
+    hdr.sigfigs = 0;
+    hdr.snaplen = PCAP_SNAPLEN;
+    hdr.network = PCAP_LINKTYPE_ETHERNET;
+
+    struct iovec iov;
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(file_header);
+    write_fully(&iov, 1);
+  }
+
+  ~pcap_writer() {
+    try {
+      flush();
+    } catch (pcap_exception& e) {
+      fprintf(stderr, "pcap_writer: %s\n", e.what());
+    }
+  }
+
+  /**
+   * Add a packet to the current batch; flushes the batch if it is full.
+   *
+   * @param ts The timestamp (in seconds) for the packet.
+   * @param pkt The packet data; must remain valid until the next flush().
+   * @param pkt_len The length of the packet data.
+   */
+  void append(uint64_t ts, const unsigned char* pkt, uint16_t pkt_len) {
+    record_header& hdr = hdrs_[num_pending_];
+    hdr.ts_sec = (uint32_t) ts;
+    hdr.ts_usec = 0;
+    hdr.incl_len = pkt_len;
+    hdr.orig_len = pkt_len;
+
+    iovs_[2 * num_pending_].iov_base = &hdr;
+    iovs_[2 * num_pending_].iov_len = sizeof(record_header);
+    iovs_[2 * num_pending_ + 1].iov_base = (void*) pkt;
+    iovs_[2 * num_pending_ + 1].iov_len = pkt_len;
+
+    num_bytes_ += sizeof(record_header) + pkt_len;
+    num_pkts_++;
+    if (++num_pending_ == MAX_BATCH)
+      flush();
+  }
+
+  /**
+   * Write out all pending packets.
+   */
+  void flush() {
+    if (num_pending_ == 0)
+      return;
+    write_fully(iovs_, 2 * num_pending_);
+    num_pending_ = 0;
+  }
+
+  /**
+   * Get the number of packets exported so far.
+   *
+   * @return The number of packets exported so far.
+   */
+  uint64_t num_pkts() const {
+    return num_pkts_;
+  }
+
+  /**
+   * Get the number of bytes exported so far (excluding the file header).
+   *
+   * @return The number of bytes exported so far.
+   */
+  uint64_t num_bytes() const {
+    return num_bytes_;
+  }
+
+ private:
+  void write_fully(struct iovec* iov, size_t iovcnt) {
+    while (iovcnt > 0) {
+      ssize_t ret = writev(fd_, iov, iovcnt);
+      if (ret < 0) {
+        if (errno == EINTR)
+          continue;
+        throw pcap_exception("writev failed: " + std::string(strerror(errno)));
+      }
+
+      /* Skip past fully written iovecs, and adjust a partially written one */
+      size_t written = ret;
+      while (iovcnt > 0 && written >= iov->iov_len) {
+        written -= iov->iov_len;
+        iov++;
+        iovcnt--;
+      }
+      if (iovcnt > 0) {
+        iov->iov_base = (char*) iov->iov_base + written;
+        iov->iov_len -= written;
+      }
+    }
+  }
+
+  int fd_;
+  size_t num_pending_;
+  uint64_t num_pkts_;
+  uint64_t num_bytes_;
+
+  record_header hdrs_[MAX_BATCH];
+  struct iovec iovs_[2 * MAX_BATCH];
+};
+
+}
+
+#endif  // PCAP_WRITER_H_
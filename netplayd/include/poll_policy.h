@@ -0,0 +1,146 @@
+#ifndef POLL_POLICY_H_
+#define POLL_POLICY_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <rte_cycles.h>
+
+#define BACKOFF_SPIN_STEPS    10       // Spin 1, 2, 4, ..., 512 pauses first
+#define BACKOFF_MIN_SLEEP_NS  1000     // Then sleep 1us, 2us, 4us, ...
+#define BACKOFF_MAX_SLEEP_NS  1000000  // ... up to at most 1ms
+#define INTR_WAIT_TIMEOUT_MS  10       // Maximum time to block on interrupts
+
+namespace netplay {
+
+/**
+ * Decides what a writer does when a poll of its port returns no packets.
+ *
+ *  - busy: poll again immediately; lowest latency, always 100% CPU.
+ *  - backoff: spin with exponentially increasing numbers of pauses, then
+ *    sleep for exponentially increasing durations (up to a maximum); resets
+ *    as soon as packets arrive.
+ *  - interrupt: block until the port signals that packets are available (or
+ *    a timeout expires); falls back to backoff for ports that do not support
+ *    receive interrupts.
+ *
+ * The policy also tracks how long the writer was idle right before it found
+ * packets again, i.e., the last wait which packets may have been delayed by.
+ */
+class poll_policy {
+ public:
+  enum mode {
+    BUSY = 0,
+    BACKOFF = 1,
+    INTERRUPT = 2
+  };
+
+  poll_policy(mode m = BUSY, uint64_t max_sleep_ns = BACKOFF_MAX_SLEEP_NS) {
+    mode_ = m;
+    max_sleep_ns_ = max_sleep_ns;
+    steps_ = 0;
+    last_wait_cycles_ = 0;
+    idle_ = false;
+  }
+
+  /**
+   * Invoked when a poll returned no packets.
+   *
+   * @param intr_wait Function that blocks on the port's receive interrupt for
+   * at most the given number of milliseconds, and returns false if the port
+   * does not support interrupts.
+   */
+  template<typename intr_wait_fn>
+  inline void idle(intr_wait_fn intr_wait) {
+    if (mode_ == BUSY) {
+      idle_ = true;
+      last_wait_cycles_ = 0;
+      return;
+    }
+
+    uint64_t start = rte_rdtsc();
+    if (mode_ == BACKOFF || !intr_wait(INTR_WAIT_TIMEOUT_MS))
+      backoff();
+    last_wait_cycles_ = rte_rdtsc() - start;
+    idle_ = true;
+  }
+
+  /**
+   * Invoked when a poll returned packets.
+   *
+   * @param wait_cycles Set to the length of the last wait (in cycles), if
+   * the writer was idle before this poll.
+   * @return True if the writer was idle before this poll, false otherwise.
+   */
+  inline bool active(uint64_t& wait_cycles) {
+    if (!idle_)
+      return false;
+    wait_cycles = last_wait_cycles_;
+    idle_ = false;
+    steps_ = 0;
+    return true;
+  }
+
+  static const char* name(mode m) {
+    switch (m) {
+    case BUSY:
+      return "busy";
+    case BACKOFF:
+      return "backoff";
+    case INTERRUPT:
+      return "interrupt";
+    }
+    return "unknown";
+  }
+
+  /**
+   * Parse a poll policy name.
+   *
+   * @param str The policy name (busy, backoff or interrupt).
+   * @param m Set to the parsed policy.
+   * @return True if the name is valid, false otherwise.
+   */
+  static bool parse(const char* str, mode& m) {
+    if (!strcmp(str, "busy")) {
+      m = BUSY;
+    } else if (!strcmp(str, "backoff")) {
+      m = BACKOFF;
+    } else if (!strcmp(str, "interrupt")) {
+      m = INTERRUPT;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  inline void backoff() {
+    if (steps_ < BACKOFF_SPIN_STEPS) {
+      for (uint32_t i = 0; i < (1U << steps_); i++)
+        rte_pause();
+    } else {
+      uint64_t sleep_ns = (uint64_t) BACKOFF_MIN_SLEEP_NS << (steps_ - BACKOFF_SPIN_STEPS);
+      if (sleep_ns >= max_sleep_ns_)
+        sleep_ns = max_sleep_ns_;
+      else
+        steps_++;
+      struct timespec ts;
+      ts.tv_sec = sleep_ns / 1000000000ULL;
+      ts.tv_nsec = sleep_ns % 1000000000ULL;
+      nanosleep(&ts, NULL);
+      return;
+    }
+    steps_++;
+  }
+
+  mode mode_;
+  uint64_t max_sleep_ns_;
+  uint32_t steps_;
+  uint64_t last_wait_cycles_;
+  bool idle_;
+};
+
+}
+
+#endif  // POLL_POLICY_H_
@@ -134,7 +134,7 @@ class lexer {
       }
       default: {
         if (!opvalid(c))
-          throw parse_exception("All operands must conform to [a-zA-Z0-9_.]+");
+          throw parse_exception("All operands must conform to [a-zA-Z0-9_.:/-]+");
 
         if (c == 'i') {
           if (stream_.get() == 'n' && iswspace(stream_.peek()))
@@ -167,7 +167,7 @@ class lexer {
 
  private:
   bool opvalid(int c) {
-    return isalnum(c) || c == '.' || c == '_' || c == '/' || c == '-';
+    return isalnum(c) || c == '.' || c == '_' || c == '/' || c == '-' || c == ':';
   }
 
   std::stringstream stream_;
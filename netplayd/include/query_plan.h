@@ -14,7 +14,7 @@ struct clause_plan {
 
 typedef std::vector<clause_plan> query_plan;
 
-void print_query_plan(const query_plan& plan) {
+inline void print_query_plan(const query_plan& plan) {
   for (const auto& p : plan) {
     index_filter f = p.idx_filter;
     fprintf(stderr, "idx-filter: (%" PRIu32 ", %" PRIu64 ", %" PRIu64 ")\t",
@@ -19,45 +19,12 @@ class query_planner {
   typedef clause::iterator clause_iterator;
 
   static query_plan plan(packet_store::handle* h, expression* e) {
-    uint32_t now = std::time(NULL);
-
     query_plan _plan;
-
-    if (e->type == expression_type::PREDICATE) {
-      clause_plan _cplan;
-      _cplan.valid = true;
-      _cplan.perform_pkt_filter = false;
-      _cplan.idx_filter = netplay_utils::build_index_filter(h, (predicate*) e, now);
-      _plan.push_back(_cplan);
-    } else if (e->type == expression_type::AND) {
-      conjunction* c = (conjunction*) e;
-      clause _clause;
-      for (expression* child : c->children) {
-        if (child->type != expression_type::PREDICATE)
-          throw parse_exception("Filter expression not in DNF");
-        _clause.push_back(netplay_utils::build_index_filter(h, (predicate*) child, now));
-      }
+    for (clause& _clause : netplay_utils::build_clauses(h, e)) {
       clause_plan _cplan = build_clause_plan(h, _clause);
       if (_cplan.valid)
         _plan.push_back(_cplan);
-    } else if (e->type == expression_type::OR) {
-      disjunction *d = (disjunction*) e;
-      for (expression* dchild : d->children) {
-        if (dchild->type != expression_type::AND)
-          throw parse_exception("Filter expression not in DNF");
-        conjunction* c = (conjunction*) dchild;
-        clause _clause;
-        for (expression* cchild : c->children) {
-          if (cchild->type != expression_type::PREDICATE)
-            throw parse_exception("Filter expression not in DNF");
-          _clause.push_back(netplay_utils::build_index_filter(h, (predicate*) cchild, now));
-        }
-        clause_plan _cplan = build_clause_plan(h, _clause);
-        if (_cplan.valid)
-          _plan.push_back(_cplan);
-      }
     }
-
     return _plan;
   }
 
@@ -69,7 +36,7 @@ class query_planner {
 
     for (clause_iterator i = clause.begin(); i != clause.end(); i++) {
       uint64_t cnt;
-      if ((cnt = h->approx_pkt_count(i->index_id, i->tok_range.first, i->tok_range.second)) < min_count) {
+      if ((cnt = h->approx_pkt_count(*i)) < min_count) {
         min_count = cnt;
         min_f = i;
       }
@@ -0,0 +1,157 @@
+#ifndef QUERY_PROTOCOL_H_
+#define QUERY_PROTOCOL_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#define QUERY_MAX_REQUEST_BYTES  65536  // Largest request payload accepted
+#define QUERY_STREAM_FRAME_BYTES 65536  // Payload of each frame of a streamed result
+
+namespace netplay {
+
+/**
+ * Binary protocol of the query server (see query_server.h).
+ *
+ * Clients send requests, and the server answers each one with one or more
+ * response frames. Every frame is a fixed-size header followed by a payload
+ * of header.length bytes; all integers are in host byte order (the server
+ * only listens for clients on the same or identical hosts).
+ *
+ * Requests may be pipelined: a client can send any number of requests
+ * without waiting, and responses come back in request order, tagged with the
+ * id of their request. Results that may be large (record ids and packets)
+ * are streamed as a sequence of frames, all but the last of which carry
+ * RESPONSE_MORE; the server only produces the next frame once the previous
+ * ones have been written to the socket, so a slow client does not make the
+ * server buffer a whole result.
+ */
+namespace query_protocol {
+
+enum request_type : uint8_t {
+  REQUEST_PING = 0,           // Empty payload; empty response
+  REQUEST_CAST = 1,           // Payload: filter expression
+  REQUEST_CHARACTER = 2,      // Payload: character_request
+  REQUEST_ADD_CHARACTER = 3,  // Payload: filter expression; responds with its id
+};
+
+/* What a cast or character request computes */
+enum aggregate_type : uint8_t {
+  AGGREGATE_COUNT = 0,    // Response: uint64_t packet count
+  AGGREGATE_BYTES = 1,    // Response: uint64_t byte count
+  AGGREGATE_IDS = 2,      // Streamed response: uint64_t record ids
+  AGGREGATE_PACKETS = 3,  // Streamed response: packet_record, packet data, ...
+};
+
+/* Request flags */
+enum request_flags : uint16_t {
+  REQUEST_CACHED = 0x1,  // Execute casts through the result cache
+};
+
+enum response_status : uint8_t {
+  STATUS_OK = 0,
+  STATUS_ERROR = 1,  // Payload: error message
+};
+
+/* Response flags */
+enum response_flags : uint8_t {
+  RESPONSE_MORE = 0x1,  // More frames of the same result follow
+};
+
+struct request_header {
+  uint32_t length;    // Payload bytes
+  uint32_t id;        // Echoed in the response frames
+  uint8_t type;       // request_type
+  uint8_t aggregate;  // aggregate_type, for casts and characters
+  uint16_t flags;     // request_flags
+} __attribute__((packed));
+
+struct response_header {
+  uint32_t length;  // Payload bytes
+  uint32_t id;      // Id of the request
+  uint8_t status;   // response_status
+  uint8_t flags;    // response_flags
+  uint16_t reserved;
+} __attribute__((packed));
+
+struct character_request {
+  uint32_t char_id;
+  uint32_t ts_beg;
+  uint32_t ts_end;
+} __attribute__((packed));
+
+/* Precedes the data of each packet in a streamed AGGREGATE_PACKETS result */
+struct packet_record {
+  uint64_t ts;
+  uint16_t length;
+} __attribute__((packed));
+
+/**
+ * Append a request to a buffer.
+ *
+ * @param buf The buffer.
+ * @param id The request id.
+ * @param type The request type.
+ * @param aggregate The aggregate, for casts and characters.
+ * @param flags The request flags.
+ * @param payload The payload.
+ * @param len The payload length.
+ */
+inline void append_request(std::string& buf, uint32_t id, uint8_t type,
+                           uint8_t aggregate, uint16_t flags,
+                           const void* payload, uint32_t len) {
+  request_header hdr;
+  hdr.length = len;
+  hdr.id = id;
+  hdr.type = type;
+  hdr.aggregate = aggregate;
+  hdr.flags = flags;
+  buf.append((const char*) &hdr, sizeof(hdr));
+  buf.append((const char*) payload, len);
+}
+
+/**
+ * Append a response frame to a buffer.
+ *
+ * @param buf The buffer.
+ * @param id The id of the request.
+ * @param status The response status.
+ * @param flags The response flags.
+ * @param payload The payload.
+ * @param len The payload length.
+ */
+inline void append_response(std::string& buf, uint32_t id, uint8_t status,
+                            uint8_t flags, const void* payload, uint32_t len) {
+  response_header hdr;
+  hdr.length = len;
+  hdr.id = id;
+  hdr.status = status;
+  hdr.flags = flags;
+  hdr.reserved = 0;
+  buf.append((const char*) &hdr, sizeof(hdr));
+  buf.append((const char*) payload, len);
+}
+
+/**
+ * Check if a buffer holds a complete frame at an offset.
+ *
+ * @param buf The buffer.
+ * @param len The number of bytes in the buffer.
+ * @param pos The offset of the frame.
+ * @return The size of the frame, including its header; 0 if incomplete.
+ */
+template<typename header_type>
+inline size_t frame_size(const char* buf, size_t len, size_t pos) {
+  if (len - pos < sizeof(header_type))
+    return 0;
+  header_type hdr;
+  memcpy(&hdr, buf + pos, sizeof(hdr));
+  size_t size = sizeof(hdr) + hdr.length;
+  return len - pos < size ? 0 : size;
+}
+
+}
+
+}
+
+#endif /* QUERY_PROTOCOL_H_ */
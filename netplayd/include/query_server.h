@@ -0,0 +1,573 @@
+#ifndef QUERY_SERVER_H_
+#define QUERY_SERVER_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "packetstore.h"
+#include "sharded_packet_store.h"
+#include "cast_builder.h"
+#include "character_builder.h"
+#include "query_protocol.h"
+
+#define QUERY_SERVER_ADDR        "127.0.0.1"  // Default listening address
+#define QUERY_SERVER_BACKLOG     1024
+#define QUERY_SERVER_MAX_EVENTS  256
+#define QUERY_SERVER_POLL_MS     100          // How often threads check for shutdown
+#define QUERY_OUTPUT_HIGH_WATER  (1 << 20)    // Pending response bytes that pause a connection
+
+namespace netplay {
+
+struct query_server_config {
+  query_server_config() {
+    port = 11001;
+    addr = QUERY_SERVER_ADDR;
+  }
+
+  int port;                // Port to listen on; 0 disables the server
+  std::string addr;        // Address to listen on
+  std::vector<int> cores;  // Cores to run server threads on, one per core
+};
+
+/**
+ * Asynchronous query server; see query_protocol.h for the protocol.
+ *
+ * Every query core runs one server thread, with its own epoll instance and
+ * its own listening socket on the server port (SO_REUSEPORT), so the kernel
+ * spreads connections across the threads and each connection is served by a
+ * single thread for its lifetime; threads share nothing but the store.
+ * Sockets are non-blocking: a thread reads whatever requests have arrived on
+ * a connection, executes them in order, and writes the responses as fast as
+ * the socket accepts them.
+ *
+ * Requests execute on the server threads themselves, which is why query
+ * cores must not be writer cores: a long cast would stall ingest on its core.
+ * A connection stops taking requests while QUERY_OUTPUT_HIGH_WATER bytes of
+ * responses are pending, and streamed results are encoded one frame at a
+ * time as the socket drains, so memory per connection stays bounded by the
+ * result being streamed.
+ */
+class query_server {
+ public:
+  struct server_stats {
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> connections;  // Currently open
+    std::atomic<uint64_t> bytes_sent;
+
+    server_stats() : requests(0), errors(0), connections(0), bytes_sent(0) {
+    }
+  };
+
+  /**
+   * Constructor to initialize a query server for a packet store.
+   *
+   * @param store The packet store.
+   * @param conf The configuration of the server.
+   */
+  query_server(packet_store* store, const query_server_config& conf)
+    : store_(store), sharded_(NULL), conf_(conf), running_(false) {
+  }
+
+  query_server(sharded_packet_store* store, const query_server_config& conf)
+    : store_(NULL), sharded_(store), conf_(conf), running_(false) {
+  }
+
+  ~query_server() {
+    stop();
+  }
+
+  /**
+   * Start the server threads; all listening sockets are opened first, so
+   * that the server either starts on every core or not at all.
+   */
+  void start() {
+    if (conf_.cores.empty())
+      throw std::invalid_argument("Query server needs at least one core");
+
+    for (size_t i = 0; i < conf_.cores.size(); i++) {
+      int lfd = open_listener();
+      int efd = epoll_create1(EPOLL_CLOEXEC);
+      if (efd < 0) {
+        close(lfd);
+        throw std::runtime_error(error_message("epoll_create1"));
+      }
+      struct epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.ptr = NULL;  // The listening socket
+      epoll_ctl(efd, EPOLL_CTL_ADD, lfd, &ev);
+      listen_fds_.push_back(lfd);
+      epoll_fds_.push_back(efd);
+    }
+
+    running_.store(true, std::memory_order_release);
+    for (size_t i = 0; i < conf_.cores.size(); i++)
+      threads_.push_back(std::thread(&query_server::run, this, i));
+  }
+
+  void stop() {
+    running_.store(false, std::memory_order_release);
+    for (std::thread& t : threads_)
+      t.join();
+    threads_.clear();
+    for (int fd : listen_fds_)
+      close(fd);
+    for (int fd : epoll_fds_)
+      close(fd);
+    listen_fds_.clear();
+    epoll_fds_.clear();
+  }
+
+  const server_stats& stats() const {
+    return stats_;
+  }
+
+ private:
+  /* A streamed result, encoded one frame at a time */
+  struct result_stream {
+    bool active;
+    uint32_t id;
+    uint8_t aggregate;
+    std::vector<uint64_t> ids;
+    size_t pos;
+  };
+
+  struct connection {
+    connection(int sock) : fd(sock), in_pos(0), out_pos(0), events(EPOLLIN),
+      closing(false) {
+      stream.active = false;
+    }
+
+    int fd;
+    std::string in;      // Received bytes; requests before in_pos are done
+    size_t in_pos;
+    std::string out;     // Response bytes; bytes before out_pos are sent
+    size_t out_pos;
+    result_stream stream;
+    uint32_t events;     // Registered epoll events
+    bool closing;        // Close once the pending responses are sent
+  };
+
+  static const size_t INPUT_LIMIT = sizeof(query_protocol::request_header)
+      + QUERY_MAX_REQUEST_BYTES;
+
+  void run(size_t i) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(conf_.cores[i], &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+
+    std::unordered_set<connection*> conns;
+    struct epoll_event events[QUERY_SERVER_MAX_EVENTS];
+    while (running_.load(std::memory_order_acquire)) {
+      int n = epoll_wait(epoll_fds_[i], events, QUERY_SERVER_MAX_EVENTS,
+                         QUERY_SERVER_POLL_MS);
+      for (int e = 0; e < n; e++) {
+        connection* c = (connection*) events[e].data.ptr;
+        if (c == NULL) {
+          accept_all(i, conns);
+        } else if (!service(epoll_fds_[i], c)) {
+          conns.erase(c);
+          close_connection(epoll_fds_[i], c);
+        }
+      }
+    }
+
+    for (connection* c : conns)
+      close_connection(epoll_fds_[i], c);
+  }
+
+  void accept_all(size_t i, std::unordered_set<connection*>& conns) {
+    while (true) {
+      int fd = accept4(listen_fds_[i], NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        if (errno == EINTR)
+          continue;
+        return;
+      }
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+      connection* c = new connection(fd);
+      struct epoll_event ev;
+      ev.events = c->events;
+      ev.data.ptr = c;
+      if (epoll_ctl(epoll_fds_[i], EPOLL_CTL_ADD, fd, &ev) != 0) {
+        close(fd);
+        delete c;
+        continue;
+      }
+      conns.insert(c);
+      stats_.connections.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void close_connection(int efd, connection* c) {
+    epoll_ctl(efd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    delete c;
+    stats_.connections.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  /*
+   * Read, execute and respond to requests on a connection, until it runs out
+   * of requests or its responses back up.
+   *
+   * Returns false if the connection should be closed.
+   */
+  bool service(int efd, connection* c) {
+    if (!c->closing && !receive(c))
+      return false;
+
+    while (true) {
+      while (pending(c) < QUERY_OUTPUT_HIGH_WATER) {
+        if (c->stream.active)
+          next_frame(c);
+        else if (c->closing || !next_request(c))
+          break;
+      }
+      if (!send(c))
+        return false;
+      if (pending(c) >= QUERY_OUTPUT_HIGH_WATER)
+        break;
+      if (!c->stream.active && (c->closing || !has_request(c)))
+        break;
+    }
+
+    if (c->closing && pending(c) == 0)
+      return false;
+    uint32_t events = 0;
+    if (!c->closing && c->in.size() - c->in_pos < INPUT_LIMIT)
+      events |= EPOLLIN;
+    if (pending(c) > 0)
+      events |= EPOLLOUT;
+    if (events != c->events) {
+      struct epoll_event ev;
+      ev.events = events;
+      ev.data.ptr = c;
+      epoll_ctl(efd, EPOLL_CTL_MOD, c->fd, &ev);
+      c->events = events;
+    }
+    return true;
+  }
+
+  bool receive(connection* c) {
+    if (c->in_pos > 0 && c->in_pos >= c->in.size() / 2) {
+      c->in.erase(0, c->in_pos);
+      c->in_pos = 0;
+    }
+    char buf[16384];
+    while (c->in.size() - c->in_pos < INPUT_LIMIT) {
+      ssize_t n = read(c->fd, buf, sizeof(buf));
+      if (n > 0) {
+        c->in.append(buf, n);
+      } else if (n == 0) {
+        return false;
+      } else if (errno == EINTR) {
+        continue;
+      } else {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+      }
+    }
+    return true;
+  }
+
+  bool send(connection* c) {
+    while (c->out_pos < c->out.size()) {
+      ssize_t n = ::send(c->fd, c->out.data() + c->out_pos,
+                         c->out.size() - c->out_pos, MSG_NOSIGNAL);
+      if (n > 0) {
+        c->out_pos += n;
+        stats_.bytes_sent.fetch_add(n, std::memory_order_relaxed);
+      } else if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        break;
+      } else {
+        return false;
+      }
+    }
+    if (c->out_pos == c->out.size()) {
+      c->out.clear();
+      c->out_pos = 0;
+    } else if (c->out_pos >= QUERY_OUTPUT_HIGH_WATER) {
+      c->out.erase(0, c->out_pos);
+      c->out_pos = 0;
+    }
+    return true;
+  }
+
+  static size_t pending(const connection* c) {
+    return c->out.size() - c->out_pos;
+  }
+
+  static bool has_request(const connection* c) {
+    return query_protocol::frame_size<query_protocol::request_header>(
+        c->in.data(), c->in.size(), c->in_pos) != 0;
+  }
+
+  /* Execute the next complete request, if any */
+  bool next_request(connection* c) {
+    using namespace query_protocol;
+    request_header hdr;
+    if (c->in.size() - c->in_pos < sizeof(hdr))
+      return false;
+    memcpy(&hdr, c->in.data() + c->in_pos, sizeof(hdr));
+    if (hdr.length > QUERY_MAX_REQUEST_BYTES) {
+      /* The stream of requests cannot be resynchronized */
+      stats_.errors.fetch_add(1, std::memory_order_relaxed);
+      respond_error(c, hdr.id, "Request too large");
+      c->closing = true;
+      return false;
+    }
+    if (!has_request(c))
+      return false;
+
+    std::string payload(c->in.data() + c->in_pos + sizeof(hdr), hdr.length);
+    c->in_pos += sizeof(hdr) + hdr.length;
+    stats_.requests.fetch_add(1, std::memory_order_relaxed);
+    try {
+      execute(c, hdr, payload);
+    } catch (std::exception& e) {
+      stats_.errors.fetch_add(1, std::memory_order_relaxed);
+      respond_error(c, hdr.id, e.what());
+    }
+    return true;
+  }
+
+  void execute(connection* c, const query_protocol::request_header& hdr,
+               const std::string& payload) {
+    using namespace query_protocol;
+    switch (hdr.type) {
+    case REQUEST_PING:
+      append_response(c->out, hdr.id, STATUS_OK, 0, NULL, 0);
+      break;
+    case REQUEST_CAST:
+      execute_cast(c, hdr, payload);
+      break;
+    case REQUEST_CHARACTER: {
+      character_request req;
+      if (payload.size() != sizeof(req))
+        throw std::invalid_argument("Malformed character request");
+      memcpy(&req, payload.data(), sizeof(req));
+      if (req.char_id >= num_complex_characters())
+        throw std::out_of_range("No such character");
+      execute_character(c, hdr, req);
+      break;
+    }
+    case REQUEST_ADD_CHARACTER: {
+      uint32_t id = add_character(payload);
+      append_response(c->out, hdr.id, STATUS_OK, 0, &id, sizeof(id));
+      break;
+    }
+    default:
+      throw std::invalid_argument("Unknown request type");
+    }
+  }
+
+  void execute_cast(connection* c, const query_protocol::request_header& hdr,
+                    const std::string& exp) {
+    using namespace query_protocol;
+    bool cached = hdr.flags & REQUEST_CACHED;
+    switch (hdr.aggregate) {
+    case AGGREGATE_COUNT:
+      respond_count(c, hdr.id, cast_result<packet_store::packet_counter>(exp, cached));
+      break;
+    case AGGREGATE_BYTES:
+      respond_count(c, hdr.id, cast_result<packet_store::byte_counter>(exp, cached));
+      break;
+    case AGGREGATE_IDS:
+    case AGGREGATE_PACKETS:
+      start_stream(c, hdr, cast_result<id_list>(exp, false));
+      break;
+    default:
+      throw std::invalid_argument("Unknown aggregate");
+    }
+  }
+
+  void execute_character(connection* c, const query_protocol::request_header& hdr,
+                         const query_protocol::character_request& req) {
+    using namespace query_protocol;
+    switch (hdr.aggregate) {
+    case AGGREGATE_COUNT:
+      respond_count(c, hdr.id, character_result<packet_store::packet_counter>(req));
+      break;
+    case AGGREGATE_BYTES:
+      respond_count(c, hdr.id, character_result<packet_store::byte_counter>(req));
+      break;
+    case AGGREGATE_IDS:
+    case AGGREGATE_PACKETS:
+      start_stream(c, hdr, character_result<id_list>(req));
+      break;
+    default:
+      throw std::invalid_argument("Unknown aggregate");
+    }
+  }
+
+  typedef aggregate::record_ids<attribute::packet_header> id_list;
+
+  /* Results cached by the store are only worth it for fixed-size aggregates */
+  template<typename aggregate_type>
+  typename aggregate_type::result_type cast_result(const std::string& exp,
+                                                   bool cached) {
+    if (sharded_ != NULL) {
+      sharded_cast c = sharded_cast_builder(sharded_, exp).build();
+      return cached ? c.execute_cached<aggregate_type>()
+                    : c.execute<aggregate_type>();
+    }
+    cast c = cast_builder(store_, exp).build();
+    return cached ? c.execute_cached<aggregate_type>()
+                  : c.execute<aggregate_type>();
+  }
+
+  template<typename aggregate_type>
+  typename aggregate_type::result_type character_result(
+      const query_protocol::character_request& req) {
+    if (sharded_ != NULL)
+      return sharded_->query_character<aggregate_type>(req.char_id, req.ts_beg,
+                                                       req.ts_end);
+    return store_->query_character<aggregate_type>(req.char_id, req.ts_beg,
+                                                   req.ts_end);
+  }
+
+  uint32_t num_complex_characters() const {
+    return sharded_ != NULL ? sharded_->num_complex_characters()
+                            : store_->num_complex_characters();
+  }
+
+  uint32_t add_character(const std::string& exp) {
+    std::lock_guard<std::mutex> lock(char_mutex_);
+    if (num_complex_characters() >= MAX_FILTERS)
+      throw std::length_error("Too many characters");
+    if (sharded_ != NULL)
+      return sharded_character_builder(sharded_, exp).build().id();
+    return character_builder(store_, exp).build().id();
+  }
+
+  void start_stream(connection* c, const query_protocol::request_header& hdr,
+                    std::vector<uint64_t>&& ids) {
+    result_stream& s = c->stream;
+    s.active = true;
+    s.id = hdr.id;
+    s.aggregate = hdr.aggregate;
+    s.ids = std::move(ids);
+    s.pos = 0;
+  }
+
+  /* Encode the next frame of the active stream */
+  void next_frame(connection* c) {
+    using namespace query_protocol;
+    result_stream& s = c->stream;
+    size_t hdr_pos = c->out.size();
+    c->out.append(sizeof(response_header), '\0');
+    size_t payload_pos = c->out.size();
+
+    if (s.aggregate == AGGREGATE_IDS) {
+      size_t n = std::min(s.ids.size() - s.pos,
+                          QUERY_STREAM_FRAME_BYTES / sizeof(uint64_t));
+      c->out.append((const char*) (s.ids.data() + s.pos), n * sizeof(uint64_t));
+      s.pos += n;
+    } else {
+      while (s.pos < s.ids.size()
+             && c->out.size() - payload_pos < QUERY_STREAM_FRAME_BYTES) {
+        packet_view pkt;
+        if (!view_pkt(pkt, s.ids[s.pos++]))
+          continue;
+        packet_record rec;
+        rec.ts = pkt.ts;
+        rec.length = pkt.length;
+        c->out.append((const char*) &rec, sizeof(rec));
+        c->out.append((const char*) pkt.data, pkt.length);
+      }
+    }
+
+    s.active = s.pos < s.ids.size();
+    response_header hdr;
+    hdr.length = c->out.size() - payload_pos;
+    hdr.id = s.id;
+    hdr.status = STATUS_OK;
+    hdr.flags = s.active ? RESPONSE_MORE : 0;
+    hdr.reserved = 0;
+    memcpy(&c->out[hdr_pos], &hdr, sizeof(hdr));
+    if (!s.active)
+      std::vector<uint64_t>().swap(s.ids);
+  }
+
+  bool view_pkt(packet_view& pkt, const uint64_t record_id) const {
+    if (sharded_ == NULL)
+      return store_->view_pkt(pkt, record_id);
+    size_t shard = record_id >> SHARD_ID_SHIFT;
+    if (shard >= sharded_->num_shards())
+      return false;
+    return sharded_->shard(shard)->view_pkt(
+        pkt, record_id & ((1ULL << SHARD_ID_SHIFT) - 1));
+  }
+
+  static void respond_count(connection* c, uint32_t id, uint64_t count) {
+    query_protocol::append_response(c->out, id, query_protocol::STATUS_OK, 0,
+                                    &count, sizeof(count));
+  }
+
+  static void respond_error(connection* c, uint32_t id, const char* msg) {
+    query_protocol::append_response(c->out, id, query_protocol::STATUS_ERROR, 0,
+                                    msg, strlen(msg));
+  }
+
+  int open_listener() {
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(conf_.port);
+    if (inet_pton(AF_INET, conf_.addr.c_str(), &sa.sin_addr) != 1)
+      throw std::invalid_argument("Invalid query server address: " + conf_.addr);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+      throw std::runtime_error(error_message("socket"));
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr*) &sa, sizeof(sa)) != 0
+        || listen(fd, QUERY_SERVER_BACKLOG) != 0) {
+      std::string msg = error_message("bind");
+      close(fd);
+      throw std::runtime_error(msg);
+    }
+    return fd;
+  }
+
+  static std::string error_message(const char* what) {
+    return std::string("Query server: ") + what + ": " + strerror(errno);
+  }
+
+  packet_store* store_;
+  sharded_packet_store* sharded_;
+  query_server_config conf_;
+  std::vector<int> listen_fds_;
+  std::vector<int> epoll_fds_;
+  std::vector<std::thread> threads_;
+  std::atomic<bool> running_;
+  std::mutex char_mutex_;
+  server_stats stats_;
+};
+
+}
+
+#endif /* QUERY_SERVER_H_ */
@@ -0,0 +1,185 @@
+#ifndef RESULT_CACHE_H_
+#define RESULT_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#define RESULT_CACHE_BYTES (64UL << 20)  // Default memory budget of a result cache
+
+namespace netplay {
+
+/* Approximate memory footprint of a cached result */
+template<typename T>
+inline size_t cached_bytes(const T&) {
+  return sizeof(T);
+}
+
+template<typename T>
+inline size_t cached_bytes(const std::unordered_set<T>& s) {
+  return sizeof(s) + s.bucket_count() * sizeof(void*)
+      + s.size() * (sizeof(T) + 2 * sizeof(void*));
+}
+
+/**
+ * Cache of query results, keyed by a normalized query (see
+ * packet_store::normalize_plan) and the aggregate computed over it.
+ *
+ * Each entry holds an aggregate result along with the max_rid it covers:
+ * since the store is append-only, the result stays valid for records before
+ * max_rid, and a hit only needs to be extended with later records. Entries
+ * are evicted in least-recently-used order once the estimated size of all
+ * results exceeds the memory budget.
+ */
+class result_cache {
+ public:
+  struct cache_stats {
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> extended_records;  // Records added by extending hits
+    std::atomic<uint64_t> evictions;
+  };
+
+  result_cache(size_t capacity_bytes = RESULT_CACHE_BYTES)
+    : capacity_(capacity_bytes), size_(0) {
+    stats_.hits.store(0, std::memory_order_relaxed);
+    stats_.misses.store(0, std::memory_order_relaxed);
+    stats_.extended_records.store(0, std::memory_order_relaxed);
+    stats_.evictions.store(0, std::memory_order_relaxed);
+  }
+
+  /**
+   * Look up a result.
+   *
+   * @param key The cache key.
+   * @param result Set to a copy of the cached result, on a hit.
+   * @param max_rid Set to the max_rid the result covers, on a hit.
+   * @return True on a hit, false otherwise.
+   */
+  template<typename result_type>
+  bool lookup(const std::string& key, result_type& result, uint64_t& max_rid) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+      stats_.misses.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    entry<result_type>* e = static_cast<entry<result_type>*>(it->second.get());
+    lru_.splice(lru_.begin(), lru_, e->lru);
+    result = e->result;
+    max_rid = e->max_rid;
+    stats_.hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /**
+   * Insert or update a result; an entry that already covers more records is
+   * kept. Results larger than the whole budget are not cached.
+   *
+   * @param key The cache key.
+   * @param result The result.
+   * @param max_rid The max_rid the result covers.
+   */
+  template<typename result_type>
+  void insert(const std::string& key, const result_type& result,
+              const uint64_t max_rid) {
+    size_t bytes = key.size() + cached_bytes(result);
+    if (bytes > capacity_)
+      return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      if (it->second->max_rid >= max_rid)
+        return;
+      remove(it);
+    }
+
+    entry<result_type>* e = new entry<result_type>(result);
+    e->max_rid = max_rid;
+    e->bytes = bytes;
+    lru_.push_front(key);
+    e->lru = lru_.begin();
+    entries_[key].reset(e);
+    size_ += bytes;
+
+    while (size_ > capacity_) {
+      remove(entries_.find(lru_.back()));
+      stats_.evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Record the records that extending a hit added to a cached result, i.e.,
+   * those stored since it was cached.
+   *
+   * @param num_records The number of records.
+   */
+  void record_extension(const uint64_t num_records) {
+    stats_.extended_records.fetch_add(num_records, std::memory_order_relaxed);
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    lru_.clear();
+    size_ = 0;
+  }
+
+  size_t size_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return size_;
+  }
+
+  size_t num_entries() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+
+  const cache_stats& stats() const {
+    return stats_;
+  }
+
+ private:
+  struct entry_base {
+    virtual ~entry_base() {
+    }
+
+    uint64_t max_rid;
+    size_t bytes;
+    std::list<std::string>::iterator lru;
+  };
+
+  template<typename result_type>
+  struct entry : public entry_base {
+    entry(const result_type& res)
+      : result(res) {
+    }
+
+    result_type result;
+  };
+
+  typedef std::unordered_map<std::string, std::unique_ptr<entry_base>> entry_map;
+
+  void remove(entry_map::iterator it) {
+    size_ -= it->second->bytes;
+    lru_.erase(it->second->lru);
+    entries_.erase(it);
+  }
+
+  size_t capacity_;
+  size_t size_;
+  entry_map entries_;
+  std::list<std::string> lru_;  // Most recently used first
+  mutable std::mutex mutex_;
+  cache_stats stats_;
+};
+
+}
+
+#endif /* RESULT_CACHE_H_ */
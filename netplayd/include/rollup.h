@@ -0,0 +1,91 @@
+#ifndef ROLLUP_H_
+#define ROLLUP_H_
+
+#include <cstdint>
+
+#include "allocator.h"
+#include "tieredindex.h"
+
+namespace netplay {
+
+/* Granularities of time rollups */
+enum rollup_level {
+  ROLLUP_SECONDS = 0,
+  ROLLUP_MINUTES = 1,
+  ROLLUP_HOURS = 2,
+  NUM_ROLLUP_LEVELS = 3
+};
+
+/**
+ * Time-keyed buckets (e.g., counters) kept at second, minute and hour
+ * granularity.
+ *
+ * Writers update the bucket of the current second at every level; readers
+ * cover a time range with whole hours, then whole minutes, and single seconds
+ * only at the edges, so a range costs at most 2 * 59 second and 2 * 59 minute
+ * probes plus one probe per hour, rather than one probe per second. Each
+ * level is a tiered index keyed by bucket number; buckets are created on
+ * write, and reads never allocate. Levels are allocated through
+ * slog::allocator, like the indexes of the logs.
+ */
+template<typename bucket_type>
+class time_rollup {
+ public:
+  typedef slog::__index_depth2<65536, 65536, bucket_type> level_index;
+
+  time_rollup() {
+    for (size_t l = 0; l < NUM_ROLLUP_LEVELS; l++)
+      levels_[l] = slog::allocator::new_object<level_index>();
+  }
+
+  ~time_rollup() {
+    for (size_t l = 0; l < NUM_ROLLUP_LEVELS; l++)
+      slog::allocator::delete_object(levels_[l]);
+  }
+
+  /**
+   * Get the buckets that contain a second, at every level, creating them if
+   * necessary.
+   *
+   * @param ts The second.
+   * @param buckets Populated with the bucket of each level.
+   */
+  void get(const uint64_t ts, bucket_type* buckets[NUM_ROLLUP_LEVELS]) {
+    for (size_t l = 0; l < NUM_ROLLUP_LEVELS; l++)
+      buckets[l] = levels_[l]->get(ts / width(l));
+  }
+
+  /**
+   * Visit the buckets that exactly cover a time range, coarsest first
+   * wherever a whole bucket fits in the range.
+   *
+   * @param ts_beg The beginning of the time range.
+   * @param ts_end The end of the time range (inclusive).
+   * @param fn The visitor, invoked as fn(bucket) for every existing bucket.
+   */
+  template<typename visitor_type>
+  void cover(const uint64_t ts_beg, const uint64_t ts_end,
+             visitor_type fn) const {
+    uint64_t ts = ts_beg;
+    while (ts <= ts_end) {
+      size_t l = NUM_ROLLUP_LEVELS - 1;
+      while (l > 0 && (ts % width(l) != 0 || ts + width(l) - 1 > ts_end))
+        l--;
+      bucket_type* bucket = levels_[l]->at(ts / width(l));
+      if (bucket != NULL)
+        fn(bucket);
+      ts += width(l);
+    }
+  }
+
+  static inline uint64_t width(const size_t level) {
+    return level == ROLLUP_HOURS ? 3600 : (level == ROLLUP_MINUTES ? 60 : 1);
+  }
+
+ private:
+  level_index* levels_[NUM_ROLLUP_LEVELS];
+};
+
+}
+
+#endif /* ROLLUP_H_ */
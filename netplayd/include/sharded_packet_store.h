@@ -0,0 +1,499 @@
+#ifndef SHARDED_PACKET_STORE_H_
+#define SHARDED_PACKET_STORE_H_
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <rte_cycles.h>
+
+#include "packetstore.h"
+#include "expression.h"
+#include "query_plan.h"
+#include "query_planner.h"
+#include "netplay_utils.h"
+
+#define SHARD_ID_SHIFT 48  // Global record ids are (shard << 48) | local id
+
+namespace netplay {
+
+/**
+ * A shared-nothing packet store with one packet_store shard per writer core.
+ *
+ * Each shard has its own logs, indexes, characters and record id space, so
+ * writers on different shards never contend on the same log tails, entry lists
+ * or character time buckets. In the huge page modes, the memory of each shard
+ * is bound to the NUMA node of its writer's core, both when the shard is
+ * constructed (see slog::allocator::set_thread_node) and as its writer grows
+ * it. On the heap, and in shared memory, pages are placed on the node of the
+ * thread that first touches them, i.e., mostly the writer's.
+ *
+ * Casts and characters are fanned out to every shard, and the per-shard
+ * aggregates are merged. Casts are planned separately for each shard, since
+ * cardinality estimates differ across shards. Record ids returned across
+ * shards are global: (shard << SHARD_ID_SHIFT) | local record id.
+ */
+class sharded_packet_store {
+ public:
+  typedef std::vector<query_plan> sharded_plan;
+
+  /**
+   * Query-side costs: cycles spent executing queries on the shards, and
+   * cycles spent merging their results.
+   */
+  struct query_stats {
+    std::atomic<uint64_t> num_queries;
+    std::atomic<uint64_t> shard_cycles;
+    std::atomic<uint64_t> merge_cycles;
+
+    query_stats() : num_queries(0), shard_cycles(0), merge_cycles(0) {
+    }
+  };
+
+  /**
+   * Constructor to initialize the sharded packet store.
+   *
+   * @param cores The writer core for each shard.
+   */
+  sharded_packet_store(const std::vector<int>& cores) {
+    for (int core : cores)
+      shards_.push_back(create_shard(core));
+  }
+
+  /**
+   * Constructor to fan queries out to existing shards (e.g., packet stores
+   * attached to the shards of another process; see shm_store.h).
+   *
+   * @param shards The shards, in shard id order; the sharded packet store
+   *  takes ownership of them.
+   */
+  explicit sharded_packet_store(const std::vector<packet_store*>& shards)
+    : shards_(shards) {
+  }
+
+  ~sharded_packet_store() {
+    for (packet_store* shard : shards_)
+      delete shard;
+  }
+
+  /**
+   * Get a handle to a shard; each writer should only insert into its own
+   * shard.
+   *
+   * @param i The shard index.
+   * @return A handle to the shard.
+   */
+  packet_store::handle* get_handle(size_t i) {
+    return shards_[i]->get_handle();
+  }
+
+  packet_store* shard(size_t i) {
+    return shards_[i];
+  }
+
+  size_t num_shards() const {
+    return shards_.size();
+  }
+
+  /**
+   * Plan a cast on every shard.
+   *
+   * @param exp The filter expression.
+   * @return The per-shard query plans.
+   */
+  sharded_plan plan(expression* exp) {
+    sharded_plan plans;
+    for (packet_store* shard : shards_) {
+      packet_store::handle* handle = shard->get_handle();
+      plans.push_back(query_planner::plan(handle, exp));
+      delete handle;
+    }
+    return plans;
+  }
+
+  /**
+   * Add a new complex character to every shard; the character has the same
+   * id on all shards.
+   *
+   * @param exp The filter expression.
+   * @return The id of the newly created complex character.
+   */
+  uint32_t add_complex_character(expression* exp) {
+    std::lock_guard<std::mutex> lock(char_mutex_);
+    uint32_t id = 0;
+    for (packet_store* shard : shards_) {
+      packet_store::handle* handle = shard->get_handle();
+      auto f = netplay_utils::build_filter_list(handle, exp);
+      delete handle;
+      id = shard->add_complex_character(f);
+    }
+    return id;
+  }
+
+  uint32_t num_complex_characters() const {
+    return shards_.front()->num_complex_characters();
+  }
+
+  /**
+   * Maintain per-second distinct-count sketches for a complex character on
+   * every shard.
+   *
+   * @param char_id The id of the complex character.
+   * @param fields The 5-tuple fields whose distinct values are counted.
+   */
+  void add_distinct_count(const uint32_t char_id, uint32_t fields) {
+    for (packet_store* shard : shards_)
+      shard->add_distinct_count(char_id, fields);
+  }
+
+  /**
+   * Estimate the number of distinct keys among the packets of a complex
+   * character within a time range, across shards.
+   *
+   * @param char_id The id of the complex character.
+   * @param ts_beg The beginning of the time range.
+   * @param ts_end The end of the time range.
+   * @return The merged sketch.
+   */
+  character_store::char_sketch distinct_character(const uint32_t char_id,
+                                                  const uint32_t ts_beg,
+                                                  const uint32_t ts_end) {
+    character_store::char_sketch res;
+    for (packet_store* shard : shards_)
+      res.merge(shard->distinct_character(char_id, ts_beg, ts_end));
+    return res;
+  }
+
+  /**
+   * Count the packets and bytes of a complex character within a time range,
+   * across shards, from the rollup counters.
+   *
+   * @param char_id The id of the complex character.
+   * @param ts_beg The beginning of the time range.
+   * @param ts_end The end of the time range.
+   * @return The packet and byte counts.
+   */
+  traffic_counts count_character(const uint32_t char_id,
+                                 const uint32_t ts_beg,
+                                 const uint32_t ts_end) const {
+    traffic_counts res = { 0, 0 };
+    for (packet_store* shard : shards_) {
+      traffic_counts c = shard->count_character(char_id, ts_beg, ts_end);
+      res.pkts += c.pkts;
+      res.bytes += c.bytes;
+    }
+    return res;
+  }
+
+  /**
+   * Count all packets and bytes within a time range, across shards.
+   *
+   * @param ts_beg The beginning of the time range.
+   * @param ts_end The end of the time range.
+   * @return The packet and byte counts.
+   */
+  traffic_counts count_time(const uint32_t ts_beg,
+                            const uint32_t ts_end) const {
+    traffic_counts res = { 0, 0 };
+    for (packet_store* shard : shards_) {
+      traffic_counts c = shard->count_time(ts_beg, ts_end);
+      res.pkts += c.pkts;
+      res.bytes += c.bytes;
+    }
+    return res;
+  }
+
+  /**
+   * Maintain per-second quantile sketches of a distribution for a complex
+   * character on every shard.
+   *
+   * @param char_id The id of the complex character.
+   * @param metric The distribution (see quantile_metric).
+   */
+  void add_quantiles(const uint32_t char_id, const quantile_metric metric) {
+    for (packet_store* shard : shards_)
+      shard->add_quantiles(char_id, metric);
+  }
+
+  /**
+   * Get the distribution of a metric among the packets of a complex
+   * character within a time range, across shards.
+   *
+   * @param char_id The id of the complex character.
+   * @param metric The distribution (see quantile_metric).
+   * @param ts_beg The beginning of the time range.
+   * @param ts_end The end of the time range.
+   * @return The merged sketch.
+   */
+  character_store::quantile_sketch quantiles_character(
+      const uint32_t char_id, const quantile_metric metric,
+      const uint32_t ts_beg, const uint32_t ts_end) {
+    character_store::quantile_sketch res;
+    for (packet_store* shard : shards_)
+      res.merge(shard->quantiles_character(char_id, metric, ts_beg, ts_end));
+    return res;
+  }
+
+  /**
+   * Add a standing top-K query to every shard; the query has the same id on
+   * all shards.
+   *
+   * @param exp The filter expression, or NULL to match all packets.
+   * @param fields The 5-tuple fields that form the key (see flow_key).
+   * @param capacity The number of counters in each shard's sketch.
+   * @return The id of the newly created query.
+   */
+  uint32_t add_standing_top_k(expression* exp, uint32_t fields,
+                              size_t capacity = TOP_K_CAPACITY) {
+    std::lock_guard<std::mutex> lock(char_mutex_);
+    uint32_t id = 0;
+    for (packet_store* shard : shards_) {
+      filter_list f;
+      if (exp != NULL) {
+        packet_store::handle* handle = shard->get_handle();
+        f = netplay_utils::build_filter_list(handle, exp);
+        delete handle;
+      }
+      id = shard->add_standing_top_k(f, fields, capacity);
+    }
+    return id;
+  }
+
+  /**
+   * Get the sketch of a standing top-K query, merged across shards.
+   *
+   * @param id The id of the query.
+   * @return The merged sketch.
+   */
+  standing_top_k::sketch_type standing_top_k_snapshot(const uint32_t id) {
+    standing_top_k::sketch_type res = shards_[0]->get_standing_top_k(id)->snapshot();
+    for (size_t i = 1; i < shards_.size(); i++)
+      res.merge(shards_[i]->get_standing_top_k(id)->snapshot());
+    return res;
+  }
+
+  /**
+   * Add a continuous cast to every shard.
+   *
+   * @param exp The filter expression, or NULL to match all packets.
+   * @return The per-shard casts, owned by the shards.
+   */
+  template<typename aggregate_type>
+  std::vector<standing_cast<aggregate_type>*> add_standing_cast(expression* exp) {
+    std::lock_guard<std::mutex> lock(char_mutex_);
+    std::vector<standing_cast<aggregate_type>*> casts;
+    for (packet_store* shard : shards_) {
+      filter_list f;
+      if (exp != NULL) {
+        packet_store::handle* handle = shard->get_handle();
+        f = netplay_utils::build_filter_list(handle, exp);
+        delete handle;
+      }
+      casts.push_back(shard->add_standing_cast<aggregate_type>(f));
+    }
+    return casts;
+  }
+
+  /**
+   * Get the result of a continuous cast, merged across shards from the
+   * latest snapshot of each shard.
+   *
+   * @param casts The per-shard casts.
+   * @return The merged result.
+   */
+  template<typename aggregate_type>
+  typename aggregate_type::result_type standing_cast_snapshot(
+      const std::vector<standing_cast<aggregate_type>*>& casts) {
+    std::vector<typename aggregate_type::result_type> partials;
+    partials.reserve(casts.size());
+    uint64_t t0 = rte_rdtsc();
+    for (standing_cast<aggregate_type>* c : casts)
+      partials.push_back(c->snapshot()->result);
+    return merge<aggregate_type>(partials, t0);
+  }
+
+  /**
+   * Start a continuous cast follower thread on every shard.
+   *
+   * @param interval_us The polling interval, in microseconds.
+   */
+  void start_cast_follower(const uint64_t interval_us = CAST_FOLLOWER_INTERVAL_US) {
+    for (packet_store* shard : shards_)
+      shard->start_cast_follower(interval_us);
+  }
+
+  void stop_cast_follower() {
+    for (packet_store* shard : shards_)
+      shard->stop_cast_follower();
+  }
+
+  template<typename aggregate_type>
+  typename aggregate_type::result_type execute_cast(sharded_plan& plans) {
+    typedef typename aggregate_type::result_type result_type;
+    std::vector<result_type> partials;
+    partials.reserve(shards_.size());
+
+    uint64_t t0 = rte_rdtsc();
+    for (size_t i = 0; i < shards_.size(); i++)
+      partials.push_back(shards_[i]->execute_cast<aggregate_type>(plans[i]));
+    return merge<aggregate_type>(partials, t0);
+  }
+
+  /* Execute a cast through the result cache of every shard */
+  template<typename aggregate_type>
+  typename aggregate_type::result_type execute_cast_cached(sharded_plan& plans) {
+    typedef typename aggregate_type::result_type result_type;
+    std::vector<result_type> partials;
+    partials.reserve(shards_.size());
+
+    uint64_t t0 = rte_rdtsc();
+    for (size_t i = 0; i < shards_.size(); i++)
+      partials.push_back(shards_[i]->execute_cast_cached<aggregate_type>(plans[i]));
+    return merge<aggregate_type>(partials, t0);
+  }
+
+  /**
+   * Execute a batch of casts with shared index scans on every shard (see
+   * packet_store::execute_casts), and merge the per-shard results of each.
+   *
+   * @param plans The per-shard query plans of each cast.
+   * @return The aggregate of each cast, in order.
+   */
+  template<typename aggregate_type>
+  std::vector<typename aggregate_type::result_type> execute_casts(
+      std::vector<sharded_plan>& plans) {
+    typedef typename aggregate_type::result_type result_type;
+    std::vector<std::vector<result_type>> partials(plans.size());
+
+    uint64_t t0 = rte_rdtsc();
+    for (size_t i = 0; i < shards_.size(); i++) {
+      std::vector<query_plan> shard_plans;
+      shard_plans.reserve(plans.size());
+      for (sharded_plan& p : plans)
+        shard_plans.push_back(p[i]);
+      std::vector<result_type> res = shards_[i]->execute_casts<aggregate_type>(shard_plans);
+      for (size_t q = 0; q < plans.size(); q++)
+        partials[q].push_back(res[q]);
+    }
+
+    std::vector<result_type> results;
+    results.reserve(plans.size());
+    for (size_t q = 0; q < plans.size(); q++)
+      results.push_back(merge<aggregate_type>(partials[q], t0));
+    return results;
+  }
+
+  /**
+   * Execute a group-by aggregation on every shard, and merge the per-shard
+   * groups.
+   *
+   * @param plans The per-shard query plans for the cast.
+   * @param num_threads The number of worker threads per shard.
+   * @return The per-group aggregates.
+   */
+  template<typename group_type>
+  typename group_type::result_type execute_group_by(sharded_plan& plans,
+                                                    size_t num_threads = 1) {
+    typedef typename group_type::result_type result_type;
+    std::vector<result_type> partials;
+    partials.reserve(shards_.size());
+
+    uint64_t t0 = rte_rdtsc();
+    for (size_t i = 0; i < shards_.size(); i++)
+      partials.push_back(shards_[i]->execute_group_by<group_type>(plans[i],
+                                                                  num_threads));
+    return merge<group_type>(partials, t0);
+  }
+
+  template<typename aggregate_type>
+  typename aggregate_type::result_type query_character(const uint32_t char_id,
+      const uint32_t ts_beg,
+      const uint32_t ts_end) {
+    typedef typename aggregate_type::result_type result_type;
+    std::vector<result_type> partials;
+    partials.reserve(shards_.size());
+
+    uint64_t t0 = rte_rdtsc();
+    for (packet_store* shard : shards_)
+      partials.push_back(shard->query_character<aggregate_type>(char_id, ts_beg,
+                                                                ts_end));
+    return merge<aggregate_type>(partials, t0);
+  }
+
+  /**
+   * Export all packets matching a cast in pcap format; packets are exported
+   * shard by shard.
+   *
+   * @param writer The pcap writer to export packets to.
+   * @param plans The per-shard query plans for the cast.
+   * @return The number of packets exported.
+   */
+  uint64_t export_cast(pcap_writer& writer, sharded_plan& plans) const {
+    uint64_t cnt = 0;
+    for (size_t i = 0; i < shards_.size(); i++)
+      cnt += shards_[i]->export_cast(writer, plans[i]);
+    return cnt;
+  }
+
+  uint64_t export_character(pcap_writer& writer, const uint32_t char_id,
+                            const uint32_t ts_beg, const uint32_t ts_end) {
+    uint64_t cnt = 0;
+    for (packet_store* shard : shards_)
+      cnt += shard->export_character(writer, char_id, ts_beg, ts_end);
+    return cnt;
+  }
+
+  /**
+   * Get the number of packets across all shards.
+   *
+   * @return Number of packets across all shards.
+   */
+  uint64_t num_pkts() const {
+    uint64_t cnt = 0;
+    for (packet_store* shard : shards_)
+      cnt += shard->num_pkts();
+    return cnt;
+  }
+
+  const query_stats& stats() const {
+    return stats_;
+  }
+
+ private:
+  template<typename aggregate_type>
+  typename aggregate_type::result_type merge(
+      std::vector<typename aggregate_type::result_type>& partials, uint64_t t0) {
+    uint64_t t1 = rte_rdtsc();
+    typename aggregate_type::result_type res = partials[0];
+    for (size_t i = 1; i < partials.size(); i++)
+      aggregate_type::merge(res, partials[i], (uint64_t) i << SHARD_ID_SHIFT);
+    uint64_t t2 = rte_rdtsc();
+
+    stats_.num_queries.fetch_add(1, std::memory_order_relaxed);
+    stats_.shard_cycles.fetch_add(t1 - t0, std::memory_order_relaxed);
+    stats_.merge_cycles.fetch_add(t2 - t1, std::memory_order_relaxed);
+    return res;
+  }
+
+  static packet_store* create_shard(int core) {
+    int node = slog::allocator::get_thread_node();
+    slog::allocator::set_thread_node(slog::allocator::cpu_node(core));
+    packet_store* store;
+    try {
+      store = new packet_store();
+    } catch (...) {
+      slog::allocator::set_thread_node(node);
+      throw;
+    }
+    slog::allocator::set_thread_node(node);
+    return store;
+  }
+
+  std::vector<packet_store*> shards_;
+  std::mutex char_mutex_;
+  query_stats stats_;
+};
+
+}
+
+#endif  // SHARDED_PACKET_STORE_H_
@@ -0,0 +1,182 @@
+#ifndef SHM_STORE_H_
+#define SHM_STORE_H_
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "shmregion.h"
+#include "packetstore.h"
+#include "sharded_packet_store.h"
+
+#define MAX_SHM_SHARDS 64
+#define SHM_STORE_VERSION 1
+
+namespace netplay {
+
+/**
+ * Packet stores in shared memory, for analytics tools in other processes.
+ *
+ * The daemon draws the logs and indexes of its packet store(s) from a named
+ * shared memory region (see slog::allocator::share), and publishes the
+ * layout of every shard in the region. Other processes attach to the region
+ * read-only (see shm_store_reader) and run casts over the structures in
+ * place: the same lock-free read path the daemon's own queries use, bounded
+ * by the offset log read tail of each shard, with record data viewed
+ * directly in the mapping rather than copied over a socket.
+ */
+class shm_store {
+ public:
+  /* The root object of the region: the layout of every shard */
+  struct directory {
+    uint32_t num_shards;
+    packet_store::store_layout shards[MAX_SHM_SHARDS];
+  };
+
+  /**
+   * Fingerprint of the structures a reader must agree on with the daemon;
+   * it changes with the definitions of the logs and indexes, and with the
+   * compile-time options that select them.
+   *
+   * @return The fingerprint.
+   */
+  static uint64_t fingerprint() {
+    const uint64_t sizes[] = {
+      SHM_STORE_VERSION, SHARD_ID_SHIFT, MAX_SHM_SHARDS,
+      sizeof(directory), sizeof(slog::datalog), sizeof(slog::offsetlog),
+      sizeof(slog::entry_list), sizeof(slog::entry_log),
+      sizeof(slog::__index2), sizeof(slog::__index4), sizeof(slog::__index16),
+      sizeof(slog::monolog_linearizable<slog::__index4*>),
+      sizeof(packet_store::total_counter_rollup),
+      sizeof(packet_store::total_counter)
+    };
+    uint64_t h = 14695981039346656037ULL;  // FNV-1a
+    for (uint64_t size : sizes) {
+      h ^= size;
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+
+  /**
+   * Publish a packet store in the shared memory region its logs are
+   * allocated from.
+   *
+   * @param region The region.
+   * @param store The packet store.
+   */
+  static void publish(slog::shm_region* region, packet_store* store) {
+    directory* dir = new_directory(region);
+    dir->num_shards = 1;
+    dir->shards[0] = store->layout();
+    region->publish(dir);
+  }
+
+  /**
+   * Publish the shards of a sharded packet store in the shared memory region
+   * their logs are allocated from.
+   *
+   * @param region The region.
+   * @param store The sharded packet store.
+   */
+  static void publish(slog::shm_region* region, sharded_packet_store* store) {
+    if (store->num_shards() > MAX_SHM_SHARDS)
+      throw std::length_error("Too many shards for a shared memory store");
+    directory* dir = new_directory(region);
+    dir->num_shards = store->num_shards();
+    for (size_t i = 0; i < store->num_shards(); i++)
+      dir->shards[i] = store->shard(i)->layout();
+    region->publish(dir);
+  }
+
+ private:
+  static directory* new_directory(slog::shm_region* region) {
+    return new (region->allocate(sizeof(directory), alignof(directory))) directory();
+  }
+};
+
+/**
+ * A read-only attachment to a packet store that another process (the daemon)
+ * shares through a shared memory region.
+ *
+ * Every shard is attached as a packet store of this process (see the
+ * attaching packet_store constructor), and the shards are queried through a
+ * sharded packet store, so casts are built, planned, executed and merged
+ * exactly as in the daemon, e.g.:
+ *
+ *   shm_store_reader reader("/netplay");
+ *   sharded_cast_builder builder(reader.store(), "dst_port == 80");
+ *   uint64_t cnt = builder.build().execute<packet_store::packet_counter>();
+ *
+ * An unsharded store is attached as a single shard, so its record ids are
+ * unchanged. Only casts, packet views and time counts read the daemon's
+ * data; complex characters and standing queries are not shared. The region
+ * is mapped read-only, so inserting into the attached store faults.
+ */
+class shm_store_reader {
+ public:
+  /**
+   * Attach to a shared packet store.
+   *
+   * @param name The name of the store's shared memory region.
+   */
+  explicit shm_store_reader(const std::string& name) {
+    region_ = slog::shm_region::attach(name, shm_store::fingerprint());
+    const shm_store::directory* dir =
+        (const shm_store::directory*) region_->root();
+    if (dir == NULL || dir->num_shards == 0 || dir->num_shards > MAX_SHM_SHARDS) {
+      delete region_;
+      throw std::runtime_error("No packet store published in " + name);
+    }
+    std::vector<packet_store*> shards;
+    for (uint32_t i = 0; i < dir->num_shards; i++)
+      shards.push_back(new packet_store(dir->shards[i]));
+    store_ = new sharded_packet_store(shards);
+  }
+
+  ~shm_store_reader() {
+    delete store_;
+    delete region_;
+  }
+
+  /**
+   * Get the attached store, to build casts on.
+   *
+   * @return The attached store.
+   */
+  sharded_packet_store* store() {
+    return store_;
+  }
+
+  /**
+   * Get a view of a packet in the daemon's data log, without copying it.
+   *
+   * @param view The view to populate.
+   * @param record_id The (global) record id of the packet.
+   * @return true if the packet exists, false otherwise.
+   */
+  bool view_pkt(packet_view& view, const uint64_t record_id) const {
+    size_t shard = record_id >> SHARD_ID_SHIFT;
+    if (shard >= store_->num_shards())
+      return false;
+    uint64_t local_id = record_id & ((1ULL << SHARD_ID_SHIFT) - 1);
+    return store_->shard(shard)->view_pkt(view, local_id);
+  }
+
+  uint64_t num_pkts() const {
+    return store_->num_pkts();
+  }
+
+  const slog::shm_region& region() const {
+    return *region_;
+  }
+
+ private:
+  slog::shm_region* region_;
+  sharded_packet_store* store_;
+};
+
+}
+
+#endif /* SHM_STORE_H_ */
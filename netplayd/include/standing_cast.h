@@ -0,0 +1,161 @@
+#ifndef STANDING_CAST_H_
+#define STANDING_CAST_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_set>
+
+#include "aggregates.h"
+#include "packet_filter.h"
+#include "packet_metadata.h"
+
+#define STANDING_CAST_BATCH 4096          // Records folded into results at a time
+#define CAST_FOLLOWER_INTERVAL_US 100000  // Follower thread polling interval
+
+namespace netplay {
+
+/**
+ * A continuous cast: a filter whose aggregate is kept up to date as packets
+ * arrive, instead of being recomputed from history on every execution.
+ *
+ * The store is append-only, so the aggregate over records [0, last_rid) never
+ * changes; a follower (see packet_store::update_standing_casts) matches only
+ * the records in [last_rid, max_rid) against the filter, and folds them into
+ * the result. The base class holds what the follower needs independently of
+ * the aggregate type.
+ */
+class standing_cast_base {
+ public:
+  standing_cast_base(const filter_list& filters)
+    : filters_(filters), last_rid_(0) {
+  }
+
+  virtual ~standing_cast_base() {
+  }
+
+  /**
+   * Check if a packet matches the filter.
+   *
+   * @param md The packet metadata.
+   * @param ts The packet timestamp.
+   * @return True if the packet matches, false otherwise.
+   */
+  bool match(const packet_metadata& md, const uint64_t ts) const {
+    for (const packet_filter& filter : filters_) {
+      if (ts >= filter.timestamp.first && ts <= filter.timestamp.second
+          && filter.apply(md))
+        return true;
+    }
+    return filters_.empty();
+  }
+
+  /**
+   * Fold the matching records of [last_rid(), end_rid) into the result.
+   *
+   * @param ids The matching record ids.
+   * @param end_rid The end of the range of records that was matched.
+   * @param dlog The data log.
+   * @param olog The offset log.
+   */
+  virtual void fold(std::unordered_set<uint64_t>& ids, const uint64_t end_rid,
+                    slog::datalog* dlog, slog::offsetlog* olog) = 0;
+
+  /* Records before last_rid() have been folded (for the follower; readers
+   * get the records a result covers with the result, see snapshot()) */
+  uint64_t last_rid() const {
+    return last_rid_.load(std::memory_order_acquire);
+  }
+
+ protected:
+  filter_list filters_;
+  std::atomic<uint64_t> last_rid_;
+};
+
+/* Whether the results of an aggregate have a fixed size; result sets and
+ * record ids grow with the number of matching records */
+template<typename aggregate_type>
+struct fixed_size_result : std::true_type {
+};
+
+template<typename T>
+struct fixed_size_result<aggregate::result_set<T>> : std::false_type {
+};
+
+template<typename T>
+struct fixed_size_result<aggregate::record_ids<T>> : std::false_type {
+};
+
+/**
+ * Continuous cast maintaining a fixed-size aggregate (counts, sums, extrema,
+ * averages and sketches; see aggregates.h): new records are aggregated on
+ * their own, and merged into a copy of the latest result with the
+ * aggregate's merge. After every fold, the follower publishes the new result
+ * together with the records it covers, so readers take O(1) snapshots and
+ * never wait for the follower.
+ */
+template<typename aggregate_type>
+class standing_cast : public standing_cast_base {
+ public:
+  typedef typename aggregate_type::result_type result_type;
+
+  static_assert(fixed_size_result<aggregate_type>::value,
+                "Standing casts copy their result on every fold, and only "
+                "maintain fixed-size aggregates");
+
+  /* A published result, and the records it covers */
+  struct snapshot_type {
+    result_type result;
+    uint64_t last_rid;   // Records before last_rid are reflected in result
+  };
+
+  standing_cast(const filter_list& filters)
+    : standing_cast_base(filters),
+      snapshot_(std::make_shared<const snapshot_type>(
+          snapshot_type { empty_result(), 0 })) {
+  }
+
+  void fold(std::unordered_set<uint64_t>& ids, const uint64_t end_rid,
+            slog::datalog* dlog, slog::offsetlog* olog) override {
+    /* Only the follower publishes, so it reads snapshot_ without the lock */
+    std::shared_ptr<snapshot_type> next =
+        std::make_shared<snapshot_type>(*snapshot_);
+    if (!ids.empty()) {
+      result_type partial = aggregate_type::aggregate(ids, dlog, olog);
+      aggregate_type::merge(next->result, partial, 0);
+    }
+    next->last_rid = end_rid;
+    std::shared_ptr<const snapshot_type> published(std::move(next));
+    {
+      std::lock_guard<std::mutex> lock(snapshot_mutex_);
+      snapshot_.swap(published);
+    }
+    last_rid_.store(end_rid, std::memory_order_release);
+  }
+
+  /**
+   * Get the latest published result.
+   *
+   * @return The result, with the end of the range of records it covers.
+   */
+  std::shared_ptr<const snapshot_type> snapshot() const {
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    return snapshot_;
+  }
+
+ private:
+  /* The aggregate of no records, e.g., the lowest value for maximum */
+  static result_type empty_result() {
+    std::unordered_set<uint64_t> none;
+    return aggregate_type::aggregate(none, NULL, NULL);
+  }
+
+  mutable std::mutex snapshot_mutex_;
+  std::shared_ptr<const snapshot_type> snapshot_;
+};
+
+}
+
+#endif /* STANDING_CAST_H_ */
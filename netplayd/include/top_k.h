@@ -0,0 +1,457 @@
+#ifndef TOP_K_H_
+#define TOP_K_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "packet_filter.h"
+#include "packet_metadata.h"
+
+#define TOP_K_CAPACITY    1024   // Default number of counters per sketch
+#define TOP_K_MAX_PENDING 65536  // Keys a writer holds back while its sketch is read
+
+namespace netplay {
+
+/* Hashing and equality for sketch keys: integral attributes, 5-tuples, and
+ * other attribute values that have no padding bytes (e.g., addresses). */
+template<typename T, bool integral = std::is_integral<T>::value>
+struct sketch_key {
+  static inline size_t hash(const T& key) {
+    const unsigned char* p = (const unsigned char*) &key;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < sizeof(T); i++)
+      h = (h ^ p[i]) * 0x100000001b3ULL;
+    return h;
+  }
+
+  static inline bool equal(const T& a, const T& b) {
+    return memcmp(&a, &b, sizeof(T)) == 0;
+  }
+};
+
+template<typename T>
+struct sketch_key<T, true> {
+  static inline size_t hash(const T& key) {
+    return ((uint64_t) key * 0x9E3779B97F4A7C15ULL) >> 16;
+  }
+
+  static inline bool equal(const T& a, const T& b) {
+    return a == b;
+  }
+};
+
+template<>
+struct sketch_key<five_tuple, false> {
+  static inline size_t hash(const five_tuple& key) {
+    uint64_t w[4];
+    memcpy(w, key.src_addr, 16);
+    memcpy(w + 2, key.dst_addr, 16);
+    uint64_t h = ((uint64_t) key.src_port << 24) | ((uint64_t) key.dst_port << 8)
+                 | key.proto;
+    for (size_t i = 0; i < 4; i++)
+      h = ((h ^ w[i]) * 0xff51afd7ed558ccdULL) ^ (h >> 29);
+    return (h * 0x9E3779B97F4A7C15ULL) >> 16;
+  }
+
+  static inline bool equal(const five_tuple& a, const five_tuple& b) {
+    return memcmp(a.src_addr, b.src_addr, 16) == 0
+        && memcmp(a.dst_addr, b.dst_addr, 16) == 0
+        && a.src_port == b.src_port && a.dst_port == b.dst_port
+        && a.proto == b.proto;
+  }
+};
+
+/**
+ * Space-Saving sketch for the most frequent keys of a stream, in bounded
+ * memory (Metwally et al., "Efficient Computation of Frequent and Top-k
+ * Elements in Data Streams").
+ *
+ * The sketch keeps a fixed number of counters in a min-heap. A key without a
+ * counter takes over the smallest counter, inheriting its count as the
+ * error. Every count is therefore an overestimate, by at most its error, and
+ * at most total() / capacity(); every key that occurs more than
+ * total() / capacity() times has a counter.
+ *
+ * Sketches are mergeable (Agarwal et al., "Mergeable Summaries"), so partial
+ * sketches of threads or shards can be combined with the same guarantees.
+ */
+template<typename key_type>
+class space_saving {
+ public:
+  struct counter {
+    key_type key;
+    uint64_t count;  // Upper bound on the key's frequency
+    uint64_t error;  // count - error is a lower bound
+  };
+
+  space_saving(size_t capacity = TOP_K_CAPACITY)
+    : capacity_(capacity), total_(0) {
+    heap_.reserve(capacity);
+    pos_.reserve(capacity);
+  }
+
+  /**
+   * Count an occurrence of a key.
+   *
+   * @param key The key.
+   * @param weight The number of occurrences.
+   */
+  void offer(const key_type& key, uint64_t weight = 1) {
+    total_ += weight;
+    auto it = pos_.find(key);
+    if (it != pos_.end()) {
+      heap_[it->second].count += weight;
+      sift_down(it->second);
+      return;
+    }
+
+    if (heap_.size() < capacity_) {
+      heap_.push_back(counter { key, weight, 0 });
+      pos_[key] = heap_.size() - 1;
+      sift_up(heap_.size() - 1);
+      return;
+    }
+
+    /* Take over the smallest counter */
+    counter& min = heap_[0];
+    pos_.erase(min.key);
+    min.key = key;
+    min.error = min.count;
+    min.count += weight;
+    pos_[key] = 0;
+    sift_down(0);
+  }
+
+  /**
+   * Merge another sketch into this one. A key missing from a full sketch
+   * may have occurred up to that sketch's smallest count times, which is
+   * added to its count and error.
+   *
+   * @param other The other sketch.
+   */
+  void merge(const space_saving& other) {
+    uint64_t min_this = full() ? heap_[0].count : 0;
+    uint64_t min_other = other.full() ? other.heap_[0].count : 0;
+
+    std::vector<counter> all;
+    all.reserve(heap_.size() + other.heap_.size());
+    for (const counter& c : heap_) {
+      auto it = other.pos_.find(c.key);
+      if (it != other.pos_.end()) {
+        const counter& o = other.heap_[it->second];
+        all.push_back(counter { c.key, c.count + o.count, c.error + o.error });
+      } else {
+        all.push_back(counter { c.key, c.count + min_other,
+                                c.error + min_other });
+      }
+    }
+    for (const counter& o : other.heap_) {
+      if (pos_.find(o.key) == pos_.end())
+        all.push_back(counter { o.key, o.count + min_this, o.error + min_this });
+    }
+
+    if (all.size() > capacity_) {
+      std::nth_element(all.begin(), all.begin() + capacity_, all.end(),
+                       [](const counter& a, const counter& b) {
+                         return a.count > b.count;
+                       });
+      all.resize(capacity_);
+    }
+
+    heap_.swap(all);
+    total_ += other.total_;
+    pos_.clear();
+    for (size_t i = 0; i < heap_.size(); i++)
+      pos_[heap_[i].key] = i;
+    for (size_t i = heap_.size() / 2; i-- > 0;)
+      sift_down(i);
+  }
+
+  /**
+   * Get the most frequent keys.
+   *
+   * @param k The number of keys.
+   * @return Up to k counters, by decreasing count.
+   */
+  std::vector<counter> top(size_t k) const {
+    std::vector<counter> res(heap_);
+    k = std::min(k, res.size());
+    std::partial_sort(res.begin(), res.begin() + k, res.end(),
+                      [](const counter& a, const counter& b) {
+                        return a.count > b.count;
+                      });
+    res.resize(k);
+    return res;
+  }
+
+  /**
+   * Get the maximum overestimate of any count, i.e., the smallest count if
+   * the sketch is full (which is at most total() / capacity()).
+   *
+   * @return The error bound.
+   */
+  uint64_t error_bound() const {
+    return full() ? heap_[0].count : 0;
+  }
+
+  uint64_t total() const {
+    return total_;
+  }
+
+  size_t size() const {
+    return heap_.size();
+  }
+
+  size_t capacity() const {
+    return capacity_;
+  }
+
+  void clear() {
+    heap_.clear();
+    pos_.clear();
+    total_ = 0;
+  }
+
+ private:
+  struct key_hash {
+    size_t operator()(const key_type& key) const {
+      return sketch_key<key_type>::hash(key);
+    }
+  };
+
+  struct key_equal {
+    bool operator()(const key_type& a, const key_type& b) const {
+      return sketch_key<key_type>::equal(a, b);
+    }
+  };
+
+  bool full() const {
+    return heap_.size() >= capacity_;
+  }
+
+  void swap_counters(size_t i, size_t j) {
+    std::swap(heap_[i], heap_[j]);
+    pos_[heap_[i].key] = i;
+    pos_[heap_[j].key] = j;
+  }
+
+  void sift_up(size_t i) {
+    while (i > 0) {
+      size_t parent = (i - 1) / 2;
+      if (heap_[parent].count <= heap_[i].count)
+        break;
+      swap_counters(i, parent);
+      i = parent;
+    }
+  }
+
+  void sift_down(size_t i) {
+    size_t n = heap_.size();
+    while (true) {
+      size_t min = i;
+      size_t l = 2 * i + 1, r = 2 * i + 2;
+      if (l < n && heap_[l].count < heap_[min].count)
+        min = l;
+      if (r < n && heap_[r].count < heap_[min].count)
+        min = r;
+      if (min == i)
+        break;
+      swap_counters(i, min);
+      i = min;
+    }
+  }
+
+  size_t capacity_;
+  uint64_t total_;
+  std::vector<counter> heap_;
+  std::unordered_map<key_type, size_t, key_hash, key_equal> pos_;
+};
+
+/* Fields of the 5-tuple that key standing queries */
+enum flow_key {
+  KEY_SRC_ADDR = 1,
+  KEY_DST_ADDR = 2,
+  KEY_SRC_PORT = 4,
+  KEY_DST_PORT = 8,
+  KEY_PROTO = 16,
+  KEY_FIVE_TUPLE = 31
+};
+
+/**
+ * Get the key of a packet for a standing query: the selected fields of its
+ * 5-tuple (see five_tuple_of), with all other fields zero.
+ *
+ * @param md The packet metadata.
+ * @param fields The fields of the key (see flow_key).
+ * @param key Set to the key.
+ */
+inline void flow_key_of(const packet_metadata& md, const uint32_t fields,
+                        five_tuple& key) {
+  memset(&key, 0, sizeof(key));
+  if (fields & KEY_SRC_ADDR) {
+    if (md.is_ipv6)
+      memcpy(key.src_addr, md.src_addr6, 16);
+    else
+      map_ipv4(md.src_addr, key.src_addr);
+  }
+  if (fields & KEY_DST_ADDR) {
+    if (md.is_ipv6)
+      memcpy(key.dst_addr, md.dst_addr6, 16);
+    else
+      map_ipv4(md.dst_addr, key.dst_addr);
+  }
+  if (fields & KEY_SRC_PORT)
+    key.src_port = md.src_port;
+  if (fields & KEY_DST_PORT)
+    key.dst_port = md.dst_port;
+  if (fields & KEY_PROTO)
+    key.proto = md.proto;
+}
+
+/**
+ * Standing top-K query: a Space-Saving sketch over (a subset of the fields
+ * of) the 5-tuple of the packets that match a filter, maintained on ingest,
+ * like a complex character.
+ *
+ * Keys are taken from the parsed packet metadata (i.e., the inner packet of
+ * tunneled packets); fields outside the key are zero, and addresses are
+ * those of either family (see five_tuple).
+ *
+ * Each writer (packet store handle) counts the keys it inserts in a sketch
+ * of its own (a partial, see add_writer()), once per burst, so writers never
+ * share a sketch or wait for one another. Readers merge the partials when
+ * they take a snapshot; Space-Saving sketches merge with the same
+ * guarantees.
+ */
+class standing_top_k {
+ public:
+  typedef space_saving<five_tuple> sketch_type;
+
+  /**
+   * The sketch of the keys counted by a single writer.
+   */
+  class partial {
+   public:
+    partial(size_t capacity)
+      : sketch_(capacity) {
+    }
+
+    /**
+     * Count the matching keys of a burst; only called by the writer that
+     * owns the partial. The writer never waits for readers: if a reader is
+     * merging the sketch, the keys are kept and counted with the next burst
+     * (unless TOP_K_MAX_PENDING keys are already waiting).
+     *
+     * @param keys The keys; cleared once they are counted.
+     */
+    void update(std::vector<five_tuple>& keys) {
+      if (!mutex_.try_lock()) {
+        if (keys.size() < TOP_K_MAX_PENDING)
+          return;
+        mutex_.lock();
+      }
+      for (const five_tuple& key : keys)
+        sketch_.offer(key);
+      mutex_.unlock();
+      keys.clear();
+    }
+
+   private:
+    friend class standing_top_k;
+
+    std::mutex mutex_;  // Taken by the writer, and by readers merging
+    sketch_type sketch_;
+  };
+
+  standing_top_k(const filter_list& filters, uint32_t fields,
+                 size_t capacity = TOP_K_CAPACITY)
+    : filters_(filters), fields_(fields), capacity_(capacity) {
+  }
+
+  ~standing_top_k() {
+    for (partial* p : partials_)
+      delete p;
+  }
+
+  /**
+   * Get the key of a packet, if it matches the filter.
+   *
+   * @param md The packet metadata.
+   * @param key Set to the key of the packet.
+   * @return True if the packet matches the filter, false otherwise.
+   */
+  bool match(const packet_metadata& md, five_tuple& key) const {
+    bool matched = filters_.empty();
+    for (const packet_filter& filter : filters_) {
+      if (filter.apply(md)) {
+        matched = true;
+        break;
+      }
+    }
+    if (!matched)
+      return false;
+
+    flow_key_of(md, fields_, key);
+    return true;
+  }
+
+  /**
+   * Create the partial sketch of a writer; called once per writer, and
+   * owned by the query (counts outlive the writer).
+   *
+   * @return The partial.
+   */
+  partial* add_writer() {
+    std::lock_guard<std::mutex> lock(partials_mutex_);
+    partials_.push_back(new partial(capacity_));
+    return partials_.back();
+  }
+
+  /**
+   * Get the sketch of all writers' keys, merged.
+   *
+   * @return The sketch.
+   */
+  sketch_type snapshot() {
+    std::lock_guard<std::mutex> lock(partials_mutex_);
+    sketch_type res(capacity_);
+    for (partial* p : partials_) {
+      std::lock_guard<std::mutex> plock(p->mutex_);
+      res.merge(p->sketch_);
+    }
+    return res;
+  }
+
+  /**
+   * Get the sketch of all writers' keys, merged, and start new ones (e.g.,
+   * at the end of a reporting interval).
+   *
+   * @return The sketch.
+   */
+  sketch_type reset() {
+    std::lock_guard<std::mutex> lock(partials_mutex_);
+    sketch_type res(capacity_);
+    for (partial* p : partials_) {
+      std::lock_guard<std::mutex> plock(p->mutex_);
+      res.merge(p->sketch_);
+      p->sketch_.clear();
+    }
+    return res;
+  }
+
+ private:
+  filter_list filters_;
+  uint32_t fields_;
+  size_t capacity_;
+  std::mutex partials_mutex_;
+  std::vector<partial*> partials_;
+};
+
+}
+
+#endif /* TOP_K_H_ */
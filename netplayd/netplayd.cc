@@ -9,6 +9,8 @@
 #include <exception>
 #include <new>
 #include <map>
+#include <string>
+#include <vector>
 
 #include <rte_config.h>
 #include <rte_malloc.h>
@@ -29,17 +31,21 @@
 #include "dpdk_utils.h"
 #include "ovs_init.h"
 #include "bess_init.h"
+#include "ring_port.h"
+#include "afpacket_port.h"
 #include "netplayd.h"
 
 #define DEFAULT_RUN_DIR  "/var/run"
 #define DEFAULT_LOG_DIR  "/var/log"
+#define DEFAULT_SHM_GB   64
 
 const char* exec = "netplayd";
 const char* desc = "%s: Open NetPlay daemon\n";
 const char* usage =
   "usage: %s [OPTIONS] [VIRTUAL-SWITCH]\n"
   "where VIRTUAL-SWITCH is the virtual switch which NetPlay should connect to.\n"
-  "Examples: ovs, bess, etc.\n";
+  "Examples: ovs, bess, etc. Use afpacket to capture from Linux interfaces\n"
+  "(e.g., one end of a veth pair) via AF_PACKET, without DPDK.\n";
 const char* daemon_opts =
   "\nDaemon options:\n"
   "  --detach                       run in background as daemon\n"
@@ -53,7 +59,50 @@ const char* netplay_opts =
   "                                 core and DPDK ring buffer interface it should\n"
   "                                 poll; each mapping is of the form:\n"
   "                                 <core>:<interface> (default: empty)\n"
-  "  -q, --query-server-port=PORT   PORT mask for NetPlay writers (default: 11001)\n"
+  "  -q, --query-server-port=PORT   PORT the query server listens on; 0 disables\n"
+  "                                 the query server (default: 11001)\n"
+  "  --query-server-addr=ADDR       IPv4 address the query server listens on\n"
+  "                                 (default: 127.0.0.1)\n"
+  "  --query-cores=CORES            comma separated CORES that run query server\n"
+  "                                 threads, one per core; these must not be\n"
+  "                                 writer cores (default: the lowest core that\n"
+  "                                 runs neither a writer, the master nor the\n"
+  "                                 preallocator)\n"
+  "  -b, --burst-size=SIZE          maximum number of packets each writer receives\n"
+  "                                 and inserts at once (default: 32, 512 with\n"
+  "                                 --direct-ring, 1024 for afpacket)\n"
+  "  --direct-ring                  dequeue directly from the virtual switch rings\n"
+  "                                 instead of going through the ring PMD\n"
+  "  --coalesce-pkts=N              coalesce up to N received packets before\n"
+  "                                 inserting them; 0 for no packet budget, and\n"
+  "                                 at most the burst size to insert every burst\n"
+  "                                 (default: 256)\n"
+  "  --coalesce-usecs=USECS         insert coalesced packets at most USECS after\n"
+  "                                 the first one arrived; 0 for no time budget\n"
+  "                                 (default: 20); --coalesce-pkts and\n"
+  "                                 --coalesce-usecs may not both be 0\n"
+  "  --poll-policy=POLICY           what writers do when their port is empty:\n"
+  "                                 busy (poll continuously), backoff (pause,\n"
+  "                                 then sleep for increasing durations) or\n"
+  "                                 interrupt (block on rx interrupts where the\n"
+  "                                 port supports them, backoff otherwise)\n"
+  "                                 (default: busy, interrupt for afpacket)\n"
+  "  --sharded                      give each writer core its own packet store\n"
+  "                                 shard (logs, indexes and record ids), allocated\n"
+  "                                 on the core's NUMA node\n"
+  "  --hugepages=MODE               back logs and indexes with MODE pages: heap\n"
+  "                                 (regular heap), 2M or 1G (huge pages bound\n"
+  "                                 to the writer's NUMA node) (default: heap)\n"
+  "  --shm=NAME                     allocate logs and indexes from the shared\n"
+  "                                 memory region NAME (e.g., /netplay), which\n"
+  "                                 other processes can map read-only to query\n"
+  "                                 the store in place\n"
+  "  --shm-size=GB                  size of the shared memory region; only pages\n"
+  "                                 in use take memory, but they must fit in\n"
+  "                                 /dev/shm (default: %d)\n"
+  "  --prealloc-core=CORE           pin the thread that allocates log buckets\n"
+  "                                 ahead of the writers to CORE\n"
+  "  --no-prealloc                  allocate log buckets on the writers' hot path\n"
   "  --bench                        Run benchmark (Measures throughput and dies)\n";
 const char* other_opts =
   "\nOther options:\n"
@@ -62,7 +111,7 @@ const char* other_opts =
 void print_usage() {
   fprintf(stderr, usage, exec);
   fprintf(stderr, daemon_opts, DEFAULT_RUN_DIR, exec, DEFAULT_LOG_DIR);
-  fputs(netplay_opts, stderr);
+  fprintf(stderr, netplay_opts, DEFAULT_SHM_GB);
   fputs(other_opts, stderr);
 }
 
@@ -177,6 +226,21 @@ void redirect_output(char* logprefix) {
   }
 }
 
+template<typename vport_type>
+void run_daemon(const std::map<int, std::string>& writer_mapping,
+                struct rte_mempool* mempool,
+                const netplay::query_server_config& query_conf,
+                const netplay::writer_config& conf, int sharded, int bench) {
+  typedef netplay::netplay_daemon<vport_type> daemon_t;
+  daemon_t netplayd(writer_mapping, mempool, query_conf, conf, sharded);
+  netplayd.start();
+  if (bench) {
+    netplayd.bench();
+  } else {
+    netplayd.monitor();
+  }
+}
+
 void parse_writer_mapping(std::map<int, std::string>& writer_mapping,
                           char* mapping_str) {
 
@@ -205,10 +269,31 @@ void parse_writer_mapping(std::map<int, std::string>& writer_mapping,
   }
 }
 
+void parse_cores(std::vector<int>& cores, char* cores_str) {
+  char* core_str = strsep(&cores_str, ",");
+  while (core_str != NULL) {
+    cores.push_back(atoi(core_str));
+    core_str = strsep(&cores_str, ",");
+  }
+}
+
+/* The lowest core that runs neither a writer, the master nor the preallocator */
+int default_query_core(const std::map<int, std::string>& writer_mapping,
+                       int master_core, int prealloc_core) {
+  int core = 0;
+  while (writer_mapping.find(core) != writer_mapping.end()
+         || core == master_core || core == prealloc_core)
+    core++;
+  return core;
+}
+
 int main(int argc, char** argv) {
   int detach = 0;
   int nochdir = 0;
   int bench = 0;
+  int direct_ring = 0;
+  int sharded = 0;
+  int no_prealloc = 0;
 
   static struct option long_options[] = {
     {"detach", no_argument, &detach, 1},
@@ -218,6 +303,19 @@ int main(int argc, char** argv) {
     {"master-core", required_argument, NULL, 'm'},
     {"writer-mappings", required_argument, NULL, 'w'},
     {"query-server-port", required_argument, NULL, 'q'},
+    {"query-server-addr", required_argument, NULL, 'S'},
+    {"query-cores", required_argument, NULL, 'Q'},
+    {"burst-size", required_argument, NULL, 'b'},
+    {"direct-ring", no_argument, &direct_ring, 1},
+    {"coalesce-pkts", required_argument, NULL, 'C'},
+    {"coalesce-usecs", required_argument, NULL, 'U'},
+    {"poll-policy", required_argument, NULL, 'P'},
+    {"sharded", no_argument, &sharded, 1},
+    {"hugepages", required_argument, NULL, 'H'},
+    {"prealloc-core", required_argument, NULL, 'A'},
+    {"no-prealloc", no_argument, &no_prealloc, 1},
+    {"shm", required_argument, NULL, 'X'},
+    {"shm-size", required_argument, NULL, 'Z'},
     {"bench", no_argument, &bench, 1},
     {"help", no_argument, NULL, 'h'},
     {NULL, 0, NULL, 0}
@@ -226,11 +324,20 @@ int main(int argc, char** argv) {
   int c;
   int option_index = 0;
   int master_core = 0;
-  int query_server_port = 11001;
+  netplay::query_server_config query_conf;
+  int burst_size = 0;
+  int coalesce_pkts = 256;
+  int coalesce_usecs = 20;
+  int policy_set = 0;
+  netplay::poll_policy::mode policy = netplay::poll_policy::BUSY;
+  slog::allocator::mode alloc_mode = slog::allocator::HEAP;
+  int prealloc_core = -1;
+  std::string shm_name;
+  uint64_t shm_gb = DEFAULT_SHM_GB;
   std::map<int, std::string> writer_mapping;
   char* pidfile = NULL;
   char* logprefix = NULL;
-  while ((c = getopt_long(argc, argv, "m:w:q:hp::l::", long_options, &option_index)) != -1) {
+  while ((c = getopt_long(argc, argv, "m:w:q:b:hp::l::", long_options, &option_index)) != -1) {
     switch (c) {
     case 0:
       break;
@@ -254,7 +361,64 @@ int main(int argc, char** argv) {
       parse_writer_mapping(writer_mapping, optarg);
       break;
     case 'q':
-      query_server_port = atoi(optarg);
+      query_conf.port = atoi(optarg);
+      if (query_conf.port < 0 || query_conf.port > UINT16_MAX) {
+        fprintf(stderr, "Invalid query server port: %s\n", optarg);
+        return -1;
+      }
+      break;
+    case 'S':
+      query_conf.addr = std::string(optarg);
+      break;
+    case 'Q':
+      parse_cores(query_conf.cores, optarg);
+      break;
+    case 'b':
+      burst_size = atoi(optarg);
+      if (burst_size <= 0 || burst_size > UINT16_MAX) {
+        fprintf(stderr, "Invalid burst size: %s\n", optarg);
+        return -1;
+      }
+      break;
+    case 'C':
+      coalesce_pkts = atoi(optarg);
+      if (coalesce_pkts < 0 || coalesce_pkts > UINT16_MAX) {
+        fprintf(stderr, "Invalid coalesce packet count: %s\n", optarg);
+        return -1;
+      }
+      break;
+    case 'U':
+      coalesce_usecs = atoi(optarg);
+      if (coalesce_usecs < 0) {
+        fprintf(stderr, "Invalid coalesce time: %s\n", optarg);
+        return -1;
+      }
+      break;
+    case 'P':
+      if (!netplay::poll_policy::parse(optarg, policy)) {
+        fprintf(stderr, "Invalid poll policy: %s\n", optarg);
+        return -1;
+      }
+      policy_set = 1;
+      break;
+    case 'H':
+      if (!slog::allocator::parse(optarg, alloc_mode)) {
+        fprintf(stderr, "Invalid huge page mode: %s\n", optarg);
+        return -1;
+      }
+      break;
+    case 'A':
+      prealloc_core = atoi(optarg);
+      break;
+    case 'X':
+      shm_name = std::string(optarg);
+      break;
+    case 'Z':
+      shm_gb = strtoull(optarg, NULL, 10);
+      if (shm_gb == 0) {
+        fprintf(stderr, "Invalid shared memory size: %s\n", optarg);
+        return -1;
+      }
       break;
     case 'h':
       print_help();
@@ -270,6 +434,11 @@ int main(int argc, char** argv) {
     }
   }
 
+  if (coalesce_pkts == 0 && coalesce_usecs == 0) {
+    fprintf(stderr, "--coalesce-pkts and --coalesce-usecs may not both be 0\n");
+    return -1;
+  }
+
   if (optind != argc - 1) {
     fprintf(stderr, "%s expects a single INTERFACE argument\n", exec);
     prompt_help();
@@ -278,6 +447,16 @@ int main(int argc, char** argv) {
 
   char *vswitch = argv[optind];
 
+  if (query_conf.cores.empty())
+    query_conf.cores.push_back(default_query_core(writer_mapping, master_core,
+                                                  prealloc_core));
+  for (int core : query_conf.cores) {
+    if (writer_mapping.find(core) != writer_mapping.end()) {
+      fprintf(stderr, "Query core %d is also a writer core\n", core);
+      return -1;
+    }
+  }
+
   check_user();
 
   if (detach) {
@@ -295,28 +474,55 @@ int main(int argc, char** argv) {
     redirect_output(logprefix);
   }
 
-  struct rte_mempool* mempool = netplay::dpdk::init_dpdk(vswitch, master_core, 1);
-  if (!strcmp("ovs", vswitch)) {
-    typedef netplay::netplay_daemon<netplay::dpdk::ovs_ring_init> daemon_t;
-    daemon_t netplayd(writer_mapping, mempool, query_server_port);
-    netplayd.start();
-    if (bench) {
-      netplayd.bench();
-    } else {
-      netplayd.monitor();
+  slog::allocator::configure(alloc_mode);
+  if (!shm_name.empty()) {
+    /* Replaces a region left behind by a daemon that did not exit cleanly */
+    try {
+      slog::allocator::share(slog::shm_region::create(shm_name, shm_gb << 30,
+          netplay::shm_store::fingerprint()));
+    } catch (std::exception& e) {
+      fprintf(stderr, "%s\n", e.what());
+      return -1;
     }
+  }
+  if (!no_prealloc)
+    slog::preallocator::start(prealloc_core);
+
+  netplay::writer_config conf;
+  conf.coalesce_pkts = coalesce_pkts;
+  conf.coalesce_usecs = coalesce_usecs;
+  conf.policy = policy;
+
+  if (!strcmp("afpacket", vswitch)) {
+    typedef netplay::dpdk::afpacket_port vport_t;
+    conf.burst_size = burst_size ? burst_size : AFPACKET_BATCH;
+    if (!policy_set)
+      conf.policy = netplay::poll_policy::INTERRUPT;
+    run_daemon<vport_t>(writer_mapping, NULL, query_conf, conf, sharded, bench);
+    return 0;
+  }
+
+  if (burst_size == 0)
+    burst_size = direct_ring ? RING_BURST_SIZE : BATCH_SIZE;
+  conf.burst_size = burst_size;
+
+  struct rte_mempool* mempool = netplay::dpdk::init_dpdk(vswitch, master_core, 1);
+  if (!strcmp("ovs", vswitch) && direct_ring) {
+    typedef netplay::dpdk::ring_port<netplay::dpdk::ovs_ring_lookup> vport_t;
+    run_daemon<vport_t>(writer_mapping, mempool, query_conf, conf, sharded, bench);
+  } else if (!strcmp("ovs", vswitch)) {
+    typedef netplay::dpdk::virtual_port<netplay::dpdk::ovs_ring_init> vport_t;
+    run_daemon<vport_t>(writer_mapping, mempool, query_conf, conf, sharded, bench);
+  } else if (!strcmp("bess", vswitch) && direct_ring) {
+    typedef netplay::dpdk::ring_port<netplay::dpdk::bess_ring_lookup> vport_t;
+    run_daemon<vport_t>(writer_mapping, mempool, query_conf, conf, sharded, bench);
   } else if (!strcmp("bess", vswitch)) {
-    typedef netplay::netplay_daemon<netplay::dpdk::bess_ring_init> daemon_t;
-    daemon_t netplayd(writer_mapping, mempool, query_server_port);
-    netplayd.start();
-    if (bench) {
-      netplayd.bench();
-    } else {
-      netplayd.monitor();
-    }
+    typedef netplay::dpdk::virtual_port<netplay::dpdk::bess_ring_init> vport_t;
+    run_daemon<vport_t>(writer_mapping, mempool, query_conf, conf, sharded, bench);
   } else {
     fprintf(stderr, "Virtual Switch interface %s is not yet supported.\n", vswitch);
     return -1;
   }
 
-}
\ No newline at end of file
+  return 0;
+}
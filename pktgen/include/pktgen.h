@@ -51,6 +51,8 @@ class rand_generator {
       eth->ether_type = rte_cpu_to_be_16(0x0800);
 
       struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
+      ip->version_ihl = 0x45;
+      ip->fragment_offset = 0;
       ip->src_addr = 0;
       ip->dst_addr = 0;
       ip->next_proto_id = IPPROTO_TCP;
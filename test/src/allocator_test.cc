@@ -0,0 +1,74 @@
+#include "gtest/gtest.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+
+#include <thread>
+#include <vector>
+
+#include "allocator.h"
+
+using namespace ::slog;
+
+class AllocatorTest : public testing::Test {
+ public:
+  void SetUp() {
+    allocator::configure(allocator::HUGE_2MB, false);
+  }
+
+  void TearDown() {
+    allocator::configure(allocator::HEAP);
+  }
+
+  static bool mapped(void* ptr) {
+    char* page = (char*) ((uintptr_t) ptr & ~(uintptr_t) 4095);
+    return msync(page, 4096, MS_ASYNC) == 0 || errno != ENOMEM;
+  }
+
+ protected:
+  const size_t block_size = 4096;
+};
+
+TEST_F(AllocatorTest, ArenaReusesMostRecentBlock) {
+  void* a = allocator::allocate(block_size);
+  allocator::deallocate(a, block_size);
+  void* b = allocator::allocate(block_size);
+  ASSERT_EQ(a, b);
+  allocator::deallocate(b, block_size);
+}
+
+TEST_F(AllocatorTest, ArenaChunkUnmappedOnceFreed) {
+  // Fill most of a thread's first chunk, and free its blocks from here
+  std::vector<void*> blocks;
+  size_t num_blocks = SLOG_ARENA_CHUNK_SIZE / block_size / 2;
+  std::thread writer([&] {
+    for (size_t i = 0; i < num_blocks; i++)
+      blocks.push_back(allocator::allocate(block_size));
+  });
+  writer.join();
+
+  ASSERT_TRUE(mapped(blocks[0]));
+  for (size_t i = 0; i < num_blocks - 1; i++)
+    allocator::deallocate(blocks[i], block_size);
+  ASSERT_TRUE(mapped(blocks[0]));
+  allocator::deallocate(blocks[num_blocks - 1], block_size);
+  ASSERT_FALSE(mapped(blocks[0]));
+}
+
+TEST_F(AllocatorTest, ArenaChunkKeptWhileInUse) {
+  void* block = allocator::allocate(block_size);
+  void* other = NULL;
+  std::thread t([&] {
+    other = allocator::allocate(block_size);
+  });
+  t.join();
+  allocator::deallocate(other, block_size);
+  ASSERT_FALSE(mapped(other));
+
+  // This thread still allocates from its chunk
+  void* next = allocator::allocate(block_size);
+  allocator::deallocate(block, block_size);
+  ASSERT_TRUE(mapped(block));
+  memset(next, 0, block_size);
+  allocator::deallocate(next, block_size);
+}
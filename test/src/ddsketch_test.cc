@@ -0,0 +1,81 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "ddsketch.h"
+
+using namespace ::netplay;
+
+class DDSketchTest : public testing::Test {
+ public:
+  /* Check every quantile against the sorted values, within DDSKETCH_ALPHA */
+  template<typename sketch_type>
+  static void check_quantiles(const sketch_type& sketch,
+                              std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    ASSERT_EQ(values.size(), sketch.count());
+    const double qs[] = { 0.0, 0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999,
+                          1.0 };
+    for (double q : qs) {
+      double expected = values[(size_t) (q * (values.size() - 1))];
+      double estimate = sketch.quantile(q);
+      if (expected < 1.0)
+        ASSERT_EQ(0.0, estimate) << q;
+      else
+        ASSERT_LE(std::fabs(estimate - expected), DDSKETCH_ALPHA * expected)
+            << q;
+    }
+  }
+};
+
+TEST_F(DDSketchTest, RelativeErrorBounds) {
+  // Exponential (e.g., inter-arrival times) and uniform (e.g., packet sizes)
+  std::mt19937 gen(7);
+  std::exponential_distribution<double> gaps(1e-5);
+  std::uniform_real_distribution<double> sizes(64, 1514);
+  ddsketch<> gap_sketch, size_sketch;
+  std::vector<double> gap_values, size_values;
+  for (int i = 0; i < 100000; i++) {
+    double g = gaps(gen), s = sizes(gen);
+    gap_sketch.add(g);
+    gap_values.push_back(g);
+    size_sketch.add(s);
+    size_values.push_back(s);
+  }
+  check_quantiles(gap_sketch, gap_values);
+  check_quantiles(size_sketch, size_values);
+}
+
+TEST_F(DDSketchTest, ValuesBelowOne) {
+  ddsketch<> sketch;
+  std::vector<double> values;
+  for (int i = 0; i < 1000; i++) {
+    double v = (i % 4 == 0) ? 0.0 : i;
+    sketch.add(v);
+    values.push_back(v);
+  }
+  check_quantiles(sketch, values);
+  ASSERT_EQ(250U, sketch.zeros());
+  ASSERT_EQ(0.0, ddsketch<>().quantile(0.5));
+}
+
+TEST_F(DDSketchTest, MergedRelativeErrorBounds) {
+  // Narrow per-second sketches merge into a wide one
+  std::mt19937 gen(11);
+  std::lognormal_distribution<double> dist(8.0, 2.0);
+  ddsketch<> merged;
+  std::vector<double> values;
+  for (int s = 0; s < 10; s++) {
+    ddsketch<uint32_t> second;
+    for (int i = 0; i < 10000; i++) {
+      double v = dist(gen);
+      second.add_atomic(v);
+      values.push_back(v);
+    }
+    merged.merge(second);
+  }
+  check_quantiles(merged, values);
+}
@@ -0,0 +1,87 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "entrylist.h"
+
+using namespace ::slog;
+
+class EntryListTest : public testing::Test {
+ public:
+  const size_t NUM_THREADS = 8;
+  const uint64_t PER_THREAD = 10000;
+  const uint64_t RANGE = 32;
+  const uint64_t INLINE = entry_list::INLINE_ENTRIES;
+
+  /* All entries below size() are valid, and each value appears once */
+  static void expect_values(const entry_list& list, uint64_t num_values) {
+    ASSERT_EQ(num_values, list.size());
+    std::vector<uint64_t> values;
+    for (size_t i = 0; i < list.size(); i++)
+      values.push_back(list.get(i));
+    std::sort(values.begin(), values.end());
+    for (uint64_t i = 0; i < num_values; i++)
+      ASSERT_EQ(i, values[i]);
+  }
+};
+
+TEST_F(EntryListTest, InlineToOverflow) {
+  entry_list list;
+  for (uint64_t i = 0; i < INLINE; i++) {
+    ASSERT_EQ(i, list.push_back(i));
+    ASSERT_TRUE(list.is_inline());
+    ASSERT_EQ(i + 1, list.size());
+  }
+  ASSERT_EQ(INLINE, list.push_back(INLINE));
+  ASSERT_FALSE(list.is_inline());
+  for (uint64_t i = 0; i <= INLINE; i++)
+    ASSERT_EQ(i, list.get(i));
+}
+
+TEST_F(EntryListTest, ConcurrentPromotion) {
+  for (int round = 0; round < 20; round++) {
+    entry_list list;
+    uint64_t allocs = slab::stats().num_allocs.load();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < NUM_THREADS; t++) {
+      threads.push_back(std::thread([&list, t, this] {
+        for (uint64_t i = 0; i < PER_THREAD; i++)
+          list.push_back(i * NUM_THREADS + t);
+      }));
+    }
+    for (auto& th : threads)
+      th.join();
+    expect_values(list, NUM_THREADS * PER_THREAD);
+    // Writers that lose the promotion race do not create overflow logs
+    ASSERT_EQ(allocs + 1, slab::stats().num_allocs.load());
+  }
+}
+
+TEST_F(EntryListTest, ConcurrentRanges) {
+  for (int round = 0; round < 20; round++) {
+    entry_list list;
+    std::vector<std::thread> threads;
+    std::vector<int> contiguous(NUM_THREADS, 1);
+    for (size_t t = 0; t < NUM_THREADS; t++) {
+      threads.push_back(std::thread([&list, &contiguous, t, this] {
+        for (uint64_t i = t; i < PER_THREAD / RANGE * NUM_THREADS;
+             i += NUM_THREADS) {
+          uint64_t start = i * RANGE;
+          size_t idx = list.push_back_range(start, start + RANGE - 1);
+          // Past the inline entries, a range occupies consecutive positions
+          if (idx >= INLINE)
+            for (uint64_t k = 0; k < RANGE; k++)
+              if (list.get(idx + k) != start + k)
+                contiguous[t] = 0;
+        }
+      }));
+    }
+    for (auto& th : threads)
+      th.join();
+    for (size_t t = 0; t < NUM_THREADS; t++)
+      EXPECT_TRUE(contiguous[t]);
+    expect_values(list, PER_THREAD / RANGE * NUM_THREADS * RANGE);
+  }
+}
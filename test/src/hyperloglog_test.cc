@@ -0,0 +1,59 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "hyperloglog.h"
+
+using namespace ::netplay;
+
+class HyperLogLogTest : public testing::Test {
+ public:
+  /* Three standard errors; estimates are deterministic for fixed keys */
+  const double MAX_ERROR = 3 * 1.04 / std::sqrt(4096.0);
+
+  static double relative_error(uint64_t estimate, uint64_t n) {
+    return std::fabs((double) estimate - (double) n) / (double) n;
+  }
+};
+
+TEST_F(HyperLogLogTest, ErrorBounds) {
+  const uint64_t sizes[] = { 10, 100, 1000, 10000, 100000, 1000000 };
+  for (uint64_t n : sizes) {
+    hyperloglog<> hll;
+    for (uint64_t k = 0; k < n; k++) {
+      hll.add(hll_hash(k));
+      hll.add(hll_hash(k));  // Duplicates are not counted
+    }
+    ASSERT_LE(relative_error(hll.estimate(), n), MAX_ERROR) << n;
+  }
+  ASSERT_EQ(0U, hyperloglog<>().estimate());
+}
+
+TEST_F(HyperLogLogTest, MergeCountsTheUnion) {
+  // Overlapping halves, as of different shards or seconds
+  hyperloglog<> a, b;
+  for (uint64_t k = 0; k < 60000; k++)
+    a.add(hll_hash(k));
+  for (uint64_t k = 40000; k < 100000; k++)
+    b.add(hll_hash(k));
+  a.merge(b);
+  ASSERT_LE(relative_error(a.estimate(), 100000), MAX_ERROR);
+}
+
+TEST_F(HyperLogLogTest, ConcurrentWriters) {
+  hyperloglog<> shared, serial;
+  std::vector<std::thread> writers;
+  for (uint64_t w = 0; w < 4; w++) {
+    writers.push_back(std::thread([&shared, w] {
+      for (uint64_t k = w; k < 200000; k += 4)
+        shared.add_atomic(hll_hash(k));
+    }));
+  }
+  for (std::thread& t : writers)
+    t.join();
+  for (uint64_t k = 0; k < 200000; k++)
+    serial.add(hll_hash(k));
+  ASSERT_EQ(serial.estimate(), shared.estimate());
+}
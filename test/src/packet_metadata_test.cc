@@ -0,0 +1,316 @@
+#include "gtest/gtest.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "packet_metadata.h"
+#include "top_k.h"
+
+using namespace ::netplay;
+
+/**
+ * Parses frames that end right before a guard page, so that any read past the
+ * end of a frame faults.
+ */
+class PacketMetadataTest : public testing::Test {
+ public:
+  void SetUp() {
+    page_ = sysconf(_SC_PAGESIZE);
+    mem_ = (unsigned char*) mmap(NULL, 2 * page_, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(MAP_FAILED, (void*) mem_);
+    ASSERT_EQ(0, mprotect(mem_ + page_, page_, PROT_NONE));
+  }
+
+  void TearDown() {
+    munmap(mem_, 2 * page_);
+  }
+
+  packet_metadata parse(const std::vector<unsigned char>& frame, size_t len) {
+    unsigned char* pkt = mem_ + page_ - len;
+    memcpy(pkt, frame.data(), len);
+    packet_metadata md;
+    parse_packet(pkt, len, md);
+    return md;
+  }
+
+  /* Every strict prefix of the frame longer than min_len is non-IP */
+  void expect_truncations_non_ip(const std::vector<unsigned char>& frame,
+                                 size_t min_len = 0) {
+    for (size_t len = min_len; len < frame.size(); len++) {
+      packet_metadata md = parse(frame, len);
+      EXPECT_FALSE(md.is_ipv6) << "length " << len;
+      EXPECT_EQ(0U, md.src_addr) << "length " << len;
+      EXPECT_EQ(0U, md.proto) << "length " << len;
+      EXPECT_FALSE(md.has_ports) << "length " << len;
+      EXPECT_EQ(ENCAP_NONE, md.encap) << "length " << len;
+      EXPECT_EQ(0U, md.vni) << "length " << len;
+    }
+  }
+
+  static void put16(std::vector<unsigned char>& f, uint16_t v) {
+    f.push_back(v >> 8);
+    f.push_back(v & 0xFF);
+  }
+
+  static void put32(std::vector<unsigned char>& f, uint32_t v) {
+    put16(f, v >> 16);
+    put16(f, v & 0xFFFF);
+  }
+
+  static void ether(std::vector<unsigned char>& f, uint16_t type) {
+    f.insert(f.end(), 12, 0);
+    put16(f, type);
+  }
+
+  static void ipv4(std::vector<unsigned char>& f, uint8_t proto, uint32_t src) {
+    f.push_back(0x45);
+    f.insert(f.end(), 8, 0);
+    f.push_back(proto);
+    put16(f, 0);
+    put32(f, src);
+    put32(f, 0x0A000002);
+  }
+
+  static void ipv6(std::vector<unsigned char>& f, uint8_t proto) {
+    put32(f, 0x60000000);
+    put16(f, 0);
+    f.push_back(proto);
+    f.push_back(64);
+    f.push_back(0x20);
+    f.insert(f.end(), 31, 0);
+  }
+
+  static void tcp(std::vector<unsigned char>& f, uint16_t sport) {
+    put16(f, sport);
+    put16(f, 80);
+    f.insert(f.end(), 9, 0);
+    f.push_back(0x02);  // SYN
+    f.insert(f.end(), 6, 0);
+  }
+
+  static void udp(std::vector<unsigned char>& f, uint16_t dport) {
+    put16(f, 1234);
+    put16(f, dport);
+    put32(f, 0);
+  }
+
+ protected:
+  size_t page_;
+  unsigned char* mem_;
+};
+
+TEST_F(PacketMetadataTest, TruncatedIPv4) {
+  std::vector<unsigned char> f;
+  ether(f, ETHER_TYPE_IPv4);
+  ipv4(f, IPPROTO_TCP, 0x0A000001);
+  tcp(f, 4321);
+
+  packet_metadata md = parse(f, f.size());
+  EXPECT_EQ(rte_cpu_to_be_32(0x0A000001), md.src_addr);
+  EXPECT_EQ(rte_cpu_to_be_16(4321), md.src_port);
+  EXPECT_EQ(0x02, md.tcp_flags);
+  EXPECT_TRUE(md.has_ports);
+
+  expect_truncations_non_ip(f);
+}
+
+TEST_F(PacketMetadataTest, IPv4Options) {
+  std::vector<unsigned char> f;
+  ether(f, ETHER_TYPE_IPv4);
+  ipv4(f, IPPROTO_TCP, 0x0A000001);
+  f[14] = 0x47;                // 8 bytes of options
+  f.insert(f.end(), 8, 0x01);  // NOP
+  tcp(f, 4321);
+
+  packet_metadata md = parse(f, f.size());
+  EXPECT_EQ(rte_cpu_to_be_16(4321), md.src_port);
+  EXPECT_EQ(0x02, md.tcp_flags);
+
+  expect_truncations_non_ip(f);
+
+  // A header length shorter than the fixed header is malformed
+  f[14] = 0x44;
+  md = parse(f, f.size());
+  EXPECT_EQ(0U, md.src_addr);
+  EXPECT_FALSE(md.has_ports);
+}
+
+TEST_F(PacketMetadataTest, NonFirstFragments) {
+  std::vector<unsigned char> f;
+  ether(f, ETHER_TYPE_IPv4);
+  ipv4(f, IPPROTO_UDP, 0x0A000001);
+  udp(f, 53);
+  f[20] = 0x00;  // Fragment offset 1 (8 bytes)
+  f[21] = 0x01;
+
+  // The payload of a later fragment does not start with the ports
+  packet_metadata md = parse(f, f.size());
+  EXPECT_EQ(rte_cpu_to_be_32(0x0A000001), md.src_addr);
+  EXPECT_EQ(IPPROTO_UDP, md.proto);
+  EXPECT_FALSE(md.has_ports);
+  EXPECT_EQ(0U, md.src_port);
+
+  // The first fragment (more fragments set, offset 0) has the ports
+  f[20] = 0x20;
+  f[21] = 0x00;
+  md = parse(f, f.size());
+  EXPECT_TRUE(md.has_ports);
+  EXPECT_EQ(rte_cpu_to_be_16(1234), md.src_port);
+
+  std::vector<unsigned char> f6;
+  ether(f6, ETHER_TYPE_IPv6);
+  ipv6(f6, IPPROTO_FRAGMENT);
+  f6.push_back(IPPROTO_TCP);
+  f6.push_back(0);
+  put16(f6, 0x00B9);             // Offset 23 (184 bytes), more fragments
+  put32(f6, 1);
+  tcp(f6, 4321);
+
+  md = parse(f6, f6.size());
+  EXPECT_TRUE(md.is_ipv6);
+  EXPECT_EQ(IPPROTO_TCP, md.proto);
+  EXPECT_FALSE(md.has_ports);
+  EXPECT_EQ(0, md.tcp_flags);
+
+  f6[56] = 0x00;
+  f6[57] = 0x01;                 // Offset 0, more fragments
+  md = parse(f6, f6.size());
+  EXPECT_TRUE(md.has_ports);
+  EXPECT_EQ(rte_cpu_to_be_16(4321), md.src_port);
+}
+
+TEST_F(PacketMetadataTest, TruncatedIPv6ExtensionHeaders) {
+  std::vector<unsigned char> f;
+  ether(f, ETHER_TYPE_IPv6);
+  ipv6(f, IPPROTO_HOPOPTS);
+  f.push_back(IPPROTO_DSTOPTS);  // Hop-by-hop options, 8 bytes
+  f.insert(f.end(), 7, 0);
+  f.push_back(IPPROTO_TCP);      // Destination options, 16 bytes
+  f.push_back(1);
+  f.insert(f.end(), 14, 0);
+  tcp(f, 4321);
+
+  packet_metadata md = parse(f, f.size());
+  EXPECT_TRUE(md.is_ipv6);
+  EXPECT_EQ(0x20, md.src_addr6[0]);
+  EXPECT_EQ(IPPROTO_TCP, md.proto);
+  EXPECT_EQ(rte_cpu_to_be_16(4321), md.src_port);
+
+  expect_truncations_non_ip(f);
+}
+
+TEST_F(PacketMetadataTest, IPv6ExtensionHeaderPastEnd) {
+  std::vector<unsigned char> f;
+  ether(f, ETHER_TYPE_IPv6);
+  ipv6(f, IPPROTO_ROUTING);
+  f.push_back(IPPROTO_TCP);
+  f.push_back(255);  // Claims 2KB
+  f.insert(f.end(), 30, 0);
+
+  packet_metadata md = parse(f, f.size());
+  EXPECT_FALSE(md.is_ipv6);
+  EXPECT_EQ(0U, md.proto);
+}
+
+TEST_F(PacketMetadataTest, TruncatedVXLAN) {
+  std::vector<unsigned char> f;
+  ether(f, ETHER_TYPE_IPv4);
+  ipv4(f, IPPROTO_UDP, 0xC0A80001);
+  udp(f, VXLAN_UDP_PORT);
+  put32(f, 0x08000000);
+  put32(f, 42 << 8);
+  ether(f, ETHER_TYPE_IPv4);
+  ipv4(f, IPPROTO_TCP, 0x0A000001);
+  tcp(f, 4321);
+
+  packet_metadata md = parse(f, f.size());
+  EXPECT_EQ(ENCAP_VXLAN, md.encap);
+  EXPECT_EQ(42U, md.vni);
+  uint8_t outer_src[16];
+  map_ipv4(rte_cpu_to_be_32(0xC0A80001), outer_src);
+  EXPECT_EQ(0, memcmp(outer_src, md.outer.src_addr, 16));
+  EXPECT_EQ(rte_cpu_to_be_32(0x0A000001), md.src_addr);
+  EXPECT_EQ(rte_cpu_to_be_16(4321), md.src_port);
+
+  expect_truncations_non_ip(f);
+}
+
+TEST_F(PacketMetadataTest, TruncatedGRE) {
+  std::vector<unsigned char> f;
+  ether(f, ETHER_TYPE_IPv4);
+  ipv4(f, IPPROTO_GRE, 0xC0A80001);
+  put16(f, GRE_FLAG_CSUM | GRE_FLAG_KEY | GRE_FLAG_SEQ);
+  put16(f, ETHER_TYPE_IPv4);
+  put32(f, 0);   // Checksum
+  put32(f, 7);   // Key
+  put32(f, 0);   // Sequence number
+  ipv4(f, IPPROTO_UDP, 0x0A000001);
+  udp(f, 53);
+
+  packet_metadata md = parse(f, f.size());
+  EXPECT_EQ(ENCAP_GRE, md.encap);
+  EXPECT_EQ(7U, md.vni);
+  EXPECT_EQ(rte_cpu_to_be_32(0x0A000001), md.src_addr);
+  EXPECT_EQ(rte_cpu_to_be_16(53), md.dst_port);
+
+  expect_truncations_non_ip(f);
+}
+
+TEST_F(PacketMetadataTest, TruncatedQinQ) {
+  std::vector<unsigned char> f;
+  ether(f, ETHER_TYPE_QINQ);
+  put16(f, 100);
+  put16(f, ETHER_TYPE_VLAN);
+  put16(f, 200);
+  put16(f, ETHER_TYPE_IPv4);
+  ipv4(f, IPPROTO_TCP, 0x0A000001);
+  tcp(f, 4321);
+
+  packet_metadata md = parse(f, f.size());
+  EXPECT_EQ(100, md.vlan_id);
+  EXPECT_EQ(200, md.inner_vlan_id);
+  EXPECT_EQ(rte_cpu_to_be_16(4321), md.src_port);
+
+  expect_truncations_non_ip(f);
+
+  // Tags that fit are kept, even if the IP header does not
+  md = parse(f, 14 + 8 + 10);
+  EXPECT_EQ(100, md.vlan_id);
+  EXPECT_EQ(200, md.inner_vlan_id);
+}
+
+TEST_F(PacketMetadataTest, FlowKeysOfBothFamilies) {
+  std::vector<unsigned char> a;
+  ether(a, ETHER_TYPE_IPv6);
+  ipv6(a, IPPROTO_TCP);
+  tcp(a, 4321);
+  std::vector<unsigned char> b = a;
+  b[14 + 8 + 15] = 1;  // Another IPv6 source address
+
+  std::vector<unsigned char> c;
+  ether(c, ETHER_TYPE_IPv4);
+  ipv4(c, IPPROTO_TCP, 0x0A000001);
+  tcp(c, 4321);
+
+  five_tuple ka, kb, kc;
+  flow_key_of(parse(a, a.size()), KEY_FIVE_TUPLE, ka);
+  flow_key_of(parse(b, b.size()), KEY_FIVE_TUPLE, kb);
+  flow_key_of(parse(c, c.size()), KEY_FIVE_TUPLE, kc);
+  EXPECT_FALSE(sketch_key<five_tuple>::equal(ka, kb));
+  EXPECT_FALSE(sketch_key<five_tuple>::equal(ka, kc));
+  EXPECT_EQ(0x20, ka.src_addr[0]);
+
+  uint8_t mapped[16];
+  map_ipv4(rte_cpu_to_be_32(0x0A000001), mapped);
+  EXPECT_EQ(0, memcmp(mapped, kc.src_addr, 16));
+
+  // Fields outside the key are zero
+  five_tuple ks;
+  flow_key_of(parse(b, b.size()), KEY_SRC_PORT, ks);
+  uint8_t zero[16] = { 0 };
+  EXPECT_EQ(0, memcmp(zero, ks.src_addr, 16));
+  EXPECT_EQ(rte_cpu_to_be_16(4321), ks.src_port);
+}
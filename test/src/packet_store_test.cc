@@ -0,0 +1,283 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+#include "cast_builder.h"
+#include "character_builder.h"
+
+using namespace ::netplay;
+
+typedef aggregate::record_ids<attribute::packet_header> id_list;
+
+class PacketStoreTest : public testing::Test {
+ public:
+  const uint16_t NUM_PORTS = 10;
+
+  void SetUp() {
+    store_ = new packet_store();
+    handle_ = store_->get_handle();
+  }
+
+  void TearDown() {
+    delete handle_;
+    delete store_;
+  }
+
+  /*
+   * Insert num_pkts TCP packets, with source ports cycling over NUM_PORTS,
+   * and destination ports over 80-82
+   */
+  void insert_pkts(const size_t num_pkts) {
+    std::vector<std::vector<unsigned char>> frames(num_pkts);
+    std::vector<unsigned char*> pkts(num_pkts);
+    std::vector<uint16_t> lens(num_pkts);
+    for (size_t i = 0; i < num_pkts; i++) {
+      frames[i] = tcp_frame(i % NUM_PORTS, 80 + i % 3, i);
+      pkts[i] = frames[i].data();
+      lens[i] = frames[i].size();
+    }
+    for (size_t i = 0; i < num_pkts; i += 32) {
+      uint16_t cnt = std::min(num_pkts - i, (size_t) 32);
+      handle_->insert_pktburst(&pkts[i], &lens[i], cnt);
+    }
+  }
+
+  static std::vector<unsigned char> tcp_frame(uint16_t sport, uint16_t dport,
+                                              uint32_t seq) {
+    std::vector<unsigned char> f(14 + 20 + 20, 0);
+    f[12] = 0x08;                      // IPv4
+    f[14] = 0x45;
+    f[14 + 9] = IPPROTO_TCP;
+    f[14 + 12] = 10;                   // 10.0.0.1 -> 10.0.0.2
+    f[14 + 15] = 1;
+    f[14 + 16] = 10;
+    f[14 + 19] = 2;
+    memcpy(&f[34], &sport, 2);         // Ports are indexed as loaded
+    memcpy(&f[36], &dport, 2);
+    for (int b = 0; b < 4; b++)
+      f[38 + b] = seq >> (24 - 8 * b);
+    f[47] = 0x10;                      // ACK
+    return f;
+  }
+
+ protected:
+  packet_store* store_;
+  packet_store::handle* handle_;
+};
+
+TEST_F(PacketStoreTest, CharacterLookupOutsideStoredSeconds) {
+  complex_character c = character_builder(store_, "src_port == 3").build();
+  uint32_t before = std::time(NULL);
+  insert_pkts(1000);
+  uint32_t after = std::time(NULL);
+
+  ASSERT_EQ(100U, c.execute<id_list>(before, after).size());
+  ASSERT_EQ(100U, c.execute<id_list>(0, UINT32_MAX).size());
+
+  // Ranges that end before the first, or begin after the last, stored second
+  // do not overlap the stored seconds, and have no packets
+  ASSERT_EQ(0U, c.execute<id_list>(after + 1, after + 100).size());
+  ASSERT_EQ(0U, c.execute<id_list>(after + 1, UINT32_MAX).size());
+  ASSERT_EQ(0U, c.execute<id_list>(0, before - 1).size());
+  ASSERT_EQ(0U, c.execute<id_list>(after, before - 1).size());
+}
+
+TEST_F(PacketStoreTest, CachedCastExtensionMatchesFreshExecution) {
+  const char* exprs[] = {
+    "src_port == 3",
+    "src_port == 3 && dst_port == 80",
+    "src_port >= 7 && dst_port == 81",
+    "(src_port == 3 && dst_port == 80) || (src_port <= 5 && dst_port == 80)"
+  };
+  std::vector<cast> casts;
+  for (const char* expr : exprs)
+    casts.push_back(cast_builder(store_, expr).build());
+
+  insert_pkts(1000);
+  for (cast& c : casts) {
+    ASSERT_LT(0U, c.execute<packet_store::packet_counter>());
+    ASSERT_EQ(c.execute<packet_store::packet_counter>(),
+              c.execute_cached<packet_store::packet_counter>());
+    c.execute_cached<id_list>();
+  }
+
+  // Each round extends the cached results with the packets stored since
+  for (int round = 0; round < 3; round++) {
+    insert_pkts(777);
+    for (size_t i = 0; i < casts.size(); i++) {
+      cast& c = casts[i];
+      ASSERT_EQ(c.execute<packet_store::packet_counter>(),
+                c.execute_cached<packet_store::packet_counter>()) << exprs[i];
+
+      id_list::result_type fresh = c.execute<id_list>();
+      id_list::result_type cached = c.execute_cached<id_list>();
+      std::sort(fresh.begin(), fresh.end());
+      std::sort(cached.begin(), cached.end());
+      ASSERT_TRUE(fresh == cached) << exprs[i];
+    }
+  }
+
+  const result_cache::cache_stats& st = store_->get_result_cache().stats();
+  ASSERT_EQ(3 * 777U * 2 * casts.size(), st.extended_records.load());
+}
+
+TEST_F(PacketStoreTest, CachedCastAfterEviction) {
+  cast c = cast_builder(store_, "src_port == 3").build();
+  insert_pkts(1000);
+  ASSERT_EQ(100U, c.execute_cached<packet_store::packet_counter>());
+
+  // A hit with no new records is not extended
+  const result_cache::cache_stats& st = store_->get_result_cache().stats();
+  ASSERT_EQ(100U, c.execute_cached<packet_store::packet_counter>());
+  ASSERT_EQ(1U, st.hits.load());
+  ASSERT_EQ(0U, st.extended_records.load());
+
+  // An evicted result is computed afresh, over all records
+  store_->get_result_cache().clear();
+  insert_pkts(500);
+  ASSERT_EQ(150U, c.execute_cached<packet_store::packet_counter>());
+  ASSERT_EQ(2U, st.misses.load());
+  ASSERT_EQ(0U, st.extended_records.load());
+}
+
+TEST_F(PacketStoreTest, InterArrivalQuantilesUseArrivalTimes) {
+  complex_character c = character_builder(store_, "src_port == 3").build();
+  store_->add_quantiles(c.id(), QUANTILE_INTERARRIVAL);
+
+  // One flow, 5us apart, inserted in bursts of 16
+  const uint16_t num_pkts = 256, burst = 16;
+  std::vector<std::vector<unsigned char>> frames(num_pkts);
+  std::vector<unsigned char*> pkts(num_pkts);
+  std::vector<uint16_t> lens(num_pkts);
+  std::vector<uint64_t> arrival_ns(num_pkts);
+  for (uint16_t i = 0; i < num_pkts; i++) {
+    frames[i] = tcp_frame(3, 80, i);
+    pkts[i] = frames[i].data();
+    lens[i] = frames[i].size();
+    arrival_ns[i] = 1000000000ULL + i * 5000ULL;
+  }
+  for (uint16_t i = 0; i < num_pkts; i += burst)
+    handle_->insert_pktburst(&pkts[i], &lens[i], burst, &arrival_ns[i]);
+
+  // Every gap is sampled, including those within a burst
+  character_store::quantile_sketch q = store_->quantiles_character(c.id(),
+      QUANTILE_INTERARRIVAL, 0, UINT32_MAX);
+  ASSERT_EQ(num_pkts - 1U, q.count());
+  ASSERT_NEAR(5000.0, q.quantile(0.01), 5000.0 * DDSKETCH_ALPHA);
+  ASSERT_NEAR(5000.0, q.quantile(0.99), 5000.0 * DDSKETCH_ALPHA);
+}
+
+TEST_F(PacketStoreTest, StandingTopKMergesWriters) {
+  uint32_t id = store_->add_standing_top_k(filter_list(), KEY_SRC_PORT, 64);
+  std::vector<std::thread> writers;
+  for (int t = 0; t < 4; t++) {
+    writers.push_back(std::thread([this] {
+      packet_store::handle* handle = store_->get_handle();
+      for (int round = 0; round < 50; round++) {
+        std::vector<std::vector<unsigned char>> frames;
+        for (uint16_t i = 0; i < 32; i++)
+          frames.push_back(tcp_frame(i < 16 ? 7 : i, 80, i));
+        unsigned char* pkts[32];
+        uint16_t lens[32];
+        for (size_t i = 0; i < 32; i++) {
+          pkts[i] = frames[i].data();
+          lens[i] = frames[i].size();
+        }
+        handle->insert_pktburst(pkts, lens, 32);
+      }
+      delete handle;
+    }));
+  }
+  for (auto& th : writers)
+    th.join();
+
+  // Counts of writers that have exited are kept
+  standing_top_k::sketch_type sketch = store_->get_standing_top_k(id)->snapshot();
+  ASSERT_EQ(4U * 50 * 32, sketch.total());
+  std::vector<standing_top_k::sketch_type::counter> top = sketch.top(1);
+  ASSERT_EQ(1U, top.size());
+  uint16_t port = 7;
+  ASSERT_EQ(port, top[0].key.src_port);
+  ASSERT_EQ(4U * 50 * 16, top[0].count);
+
+  standing_top_k::sketch_type prev = store_->get_standing_top_k(id)->reset();
+  ASSERT_EQ(sketch.total(), prev.total());
+  ASSERT_EQ(0U, store_->get_standing_top_k(id)->snapshot().total());
+}
+
+TEST_F(PacketStoreTest, VlanComparisons) {
+  // Untagged packets have no VLAN id, and match no VLAN predicate
+  const char* exprs[] = { "vlan == 10", "vlan != 10", "vlan != 0",
+                          "vlan != 4095", "vlan < 10", "vlan < 0",
+                          "vlan > 4095", "vlan >= 4095",
+                          "vlan != 10 && dst_port == 80" };
+  const uint64_t expected[] = { 10, 30, 40, 30, 10, 0, 0, 10, 30 };
+  const size_t num_exprs = sizeof(exprs) / sizeof(exprs[0]);
+  std::vector<complex_character> chars;
+  for (size_t i = 0; i < num_exprs; i++)
+    chars.push_back(character_builder(store_, exprs[i]).build());
+
+  // 10 packets on each of VLANs 0 (untagged), 9, 10, 11 and 4095
+  const uint16_t vlans[] = { 0, 9, 10, 11, 4095 };
+  std::vector<std::vector<unsigned char>> frames;
+  for (uint16_t vlan : vlans) {
+    for (int i = 0; i < 10; i++) {
+      std::vector<unsigned char> f = tcp_frame(1, 80, i);
+      if (vlan != 0) {
+        unsigned char tag[] = { 0x81, 0x00, (unsigned char) (vlan >> 8),
+                                (unsigned char) (vlan & 0xFF) };
+        f.insert(f.begin() + 12, tag, tag + 4);
+      }
+      frames.push_back(f);
+    }
+  }
+  std::vector<unsigned char*> pkts;
+  std::vector<uint16_t> lens;
+  for (auto& f : frames) {
+    pkts.push_back(f.data());
+    lens.push_back(f.size());
+  }
+  handle_->insert_pktburst(pkts.data(), lens.data(), pkts.size());
+
+  for (size_t i = 0; i < num_exprs; i++) {
+    cast c = cast_builder(store_, exprs[i]).build();
+    ASSERT_EQ(expected[i], c.execute<packet_store::packet_counter>())
+        << exprs[i];
+    ASSERT_EQ(expected[i], chars[i].execute<id_list>(0, UINT32_MAX).size())
+        << exprs[i];
+  }
+}
+
+TEST_F(PacketStoreTest, StandingCastsPublishResultWithCoveredRecords) {
+  typedef standing_cast<packet_store::packet_counter> count_cast;
+  count_cast* c = cast_builder(store_, "src_port == 3")
+      .build_standing<packet_store::packet_counter>();
+  std::shared_ptr<const count_cast::snapshot_type> empty = c->snapshot();
+  ASSERT_EQ(0U, empty->result);
+  ASSERT_EQ(0U, empty->last_rid);
+
+  // More records than are folded at a time
+  insert_pkts(10000);
+  ASSERT_EQ(10000U, store_->update_standing_casts());
+  std::shared_ptr<const count_cast::snapshot_type> snap = c->snapshot();
+  ASSERT_EQ(1000U, snap->result);
+  ASSERT_EQ(10000U, snap->last_rid);
+  ASSERT_EQ(0U, empty->result);
+
+  // A cast added later covers the records stored before it
+  count_cast* later = cast_builder(store_, "dst_port == 80")
+      .build_standing<packet_store::packet_counter>();
+  ASSERT_EQ(10000U, store_->update_standing_casts());
+  ASSERT_EQ(3334U, later->snapshot()->result);
+  ASSERT_EQ(1000U, c->snapshot()->result);
+
+  insert_pkts(100);
+  ASSERT_EQ(100U, store_->update_standing_casts());
+  ASSERT_EQ(1010U, c->snapshot()->result);
+  ASSERT_EQ(10100U, c->snapshot()->last_rid);
+  ASSERT_EQ(3368U, later->snapshot()->result);
+}
@@ -0,0 +1,146 @@
+#include "gtest/gtest.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "character_builder.h"
+#include "pcap_writer.h"
+
+using namespace ::netplay;
+
+class PcapWriterTest : public testing::Test {
+ public:
+  void SetUp() {
+    char path[] = "/tmp/np_pcap_test_XXXXXX";
+    fd_ = mkstemp(path);
+    ASSERT_NE(-1, fd_);
+    unlink(path);
+  }
+
+  void TearDown() {
+    close(fd_);
+  }
+
+  /* The contents written to the file so far */
+  std::vector<unsigned char> contents() {
+    std::vector<unsigned char> buf(lseek(fd_, 0, SEEK_END));
+    EXPECT_EQ((ssize_t) buf.size(), pread(fd_, buf.data(), buf.size(), 0));
+    return buf;
+  }
+
+  static std::vector<unsigned char> frame(uint16_t len, unsigned char fill) {
+    std::vector<unsigned char> f(len, fill);
+    memset(f.data(), 0, std::min<size_t>(len, 34));
+    f[12] = 0x08;  // IPv4
+    f[14] = 0x45;
+    return f;
+  }
+
+ protected:
+  int fd_;
+};
+
+TEST_F(PcapWriterTest, HeaderAndRecords) {
+  std::vector<unsigned char> pkts[] = { frame(60, 0xAA), frame(1514, 0xBB) };
+  {
+    pcap_writer writer(fd_);
+    writer.append(1000, pkts[0].data(), pkts[0].size());
+    writer.append(1001, pkts[1].data(), pkts[1].size());
+    ASSERT_EQ(2U, writer.num_pkts());
+    ASSERT_EQ(2 * sizeof(pcap_writer::record_header) + 60 + 1514,
+              writer.num_bytes());
+  }
+
+  std::vector<unsigned char> buf = contents();
+  ASSERT_EQ(sizeof(pcap_writer::file_header) + 2
+            * sizeof(pcap_writer::record_header) + 60 + 1514, buf.size());
+  pcap_writer::file_header fh;
+  memcpy(&fh, buf.data(), sizeof(fh));
+  ASSERT_EQ(0xa1b2c3d4U, fh.magic_number);
+  ASSERT_EQ(2, fh.version_major);
+  ASSERT_EQ(4, fh.version_minor);
+  ASSERT_EQ(1U, fh.network);          // Ethernet
+
+  size_t off = sizeof(fh);
+  for (int i = 0; i < 2; i++) {
+    pcap_writer::record_header rh;
+    memcpy(&rh, buf.data() + off, sizeof(rh));
+    off += sizeof(rh);
+    ASSERT_EQ(1000U + i, rh.ts_sec);
+    ASSERT_EQ(pkts[i].size(), rh.incl_len);
+    ASSERT_EQ(pkts[i].size(), rh.orig_len);
+    ASSERT_EQ(0, memcmp(pkts[i].data(), buf.data() + off, pkts[i].size()));
+    off += pkts[i].size();
+  }
+}
+
+TEST_F(PcapWriterTest, FlushesFullBatches) {
+  std::vector<unsigned char> pkt = frame(64, 0xCC);
+  size_t num_pkts = 2 * pcap_writer::MAX_BATCH + 3;
+  pcap_writer writer(fd_);
+  for (size_t i = 0; i < num_pkts; i++)
+    writer.append(i, pkt.data(), pkt.size());
+
+  // Only the last, partial batch is pending
+  size_t record_size = sizeof(pcap_writer::record_header) + pkt.size();
+  ASSERT_EQ(sizeof(pcap_writer::file_header)
+            + 2 * pcap_writer::MAX_BATCH * record_size, contents().size());
+  writer.flush();
+  ASSERT_EQ(sizeof(pcap_writer::file_header) + num_pkts * record_size,
+            contents().size());
+  ASSERT_EQ(num_pkts, writer.num_pkts());
+}
+
+TEST_F(PcapWriterTest, WriteErrorsThrow) {
+  ASSERT_THROW(pcap_writer writer(-1), pcap_exception);
+}
+
+TEST_F(PcapWriterTest, ExportCharacter) {
+  packet_store* store = new packet_store();
+  packet_store::handle* handle = store->get_handle();
+  complex_character c = character_builder(store, "dst_port == 80").build();
+
+  std::vector<std::vector<unsigned char>> frames;
+  for (int i = 0; i < 100; i++) {
+    std::vector<unsigned char> f = frame(64 + i, i);
+    f[23] = IPPROTO_TCP;
+    uint16_t dport = i % 2 ? 80 : 443;  // As the indexes read it
+    memcpy(&f[36], &dport, 2);
+    frames.push_back(f);
+  }
+  std::vector<unsigned char*> pkts;
+  std::vector<uint16_t> lens;
+  for (auto& f : frames) {
+    pkts.push_back(f.data());
+    lens.push_back(f.size());
+  }
+  handle->insert_pktburst(pkts.data(), lens.data(), pkts.size());
+
+  pcap_writer writer(fd_);
+  ASSERT_EQ(50U, c.export_pcap(writer, 0, UINT32_MAX));
+
+  // Every exported packet is one of the odd (port 80) packets, intact
+  std::vector<unsigned char> buf = contents();
+  size_t off = sizeof(pcap_writer::file_header);
+  std::vector<bool> seen(frames.size(), false);
+  for (int i = 0; i < 50; i++) {
+    pcap_writer::record_header rh;
+    ASSERT_LE(off + sizeof(rh), buf.size());
+    memcpy(&rh, buf.data() + off, sizeof(rh));
+    off += sizeof(rh);
+    size_t idx = rh.incl_len - 64;
+    ASSERT_EQ(1U, idx % 2);
+    ASSERT_FALSE(seen[idx]);
+    seen[idx] = true;
+    ASSERT_EQ(0, memcmp(frames[idx].data(), buf.data() + off, rh.incl_len));
+    off += rh.incl_len;
+  }
+  ASSERT_EQ(buf.size(), off);
+
+  delete handle;
+  delete store;
+}
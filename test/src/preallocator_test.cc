@@ -0,0 +1,23 @@
+#include "gtest/gtest.h"
+
+#include "monolog.h"
+#include "preallocator.h"
+
+using namespace ::slog;
+
+TEST(PreallocatorTest, StallsOnlyCountedWhileRunning) {
+  // Both entries fall in buckets larger than SLOG_PREALLOC_MIN_BYTES
+  monolog_relaxed<uint64_t> log;
+  const size_t idx1 = 1UL << 20, idx2 = 1UL << 23;
+
+  preallocator::stop();
+  uint64_t stalls = preallocator::stats().stalls;
+  log.set(idx1, 1);
+  ASSERT_EQ(stalls, preallocator::stats().stalls);
+
+  // A bucket the preallocator was never asked for is a stall
+  preallocator::start();
+  log.set(idx2, 1);
+  preallocator::stop();
+  ASSERT_EQ(stalls + 1, preallocator::stats().stalls);
+}
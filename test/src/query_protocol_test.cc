@@ -0,0 +1,207 @@
+#include "gtest/gtest.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "query_server.h"
+
+using namespace ::netplay;
+using namespace ::netplay::query_protocol;
+
+class QueryProtocolTest : public testing::Test {
+ public:
+  const int BASE_PORT = 31001;
+  const int NUM_PORTS = 64;
+
+  void SetUp() {
+    store_ = NULL;
+    server_ = NULL;
+    port_ = 0;
+  }
+
+  void TearDown() {
+    delete server_;
+    delete store_;
+  }
+
+  /* Starts a single-threaded server on the first free port */
+  void start_server() {
+    store_ = new packet_store();
+    for (port_ = BASE_PORT; port_ < BASE_PORT + NUM_PORTS; port_++) {
+      query_server_config conf;
+      conf.port = port_;
+      conf.cores.push_back(0);
+      server_ = new query_server(store_, conf);
+      try {
+        server_->start();
+        return;
+      } catch (std::runtime_error& e) {
+        delete server_;
+        server_ = NULL;
+      }
+    }
+    FAIL() << "No free port for the query server";
+  }
+
+  int connect_client() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port_);
+    inet_pton(AF_INET, "127.0.0.1", &sa.sin_addr);
+    EXPECT_EQ(0, connect(fd, (struct sockaddr*) &sa, sizeof(sa)));
+    struct timeval tv = { 5, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+  }
+
+  static void send_all(int fd, const std::string& buf) {
+    size_t off = 0;
+    while (off < buf.size()) {
+      ssize_t n = ::send(fd, buf.data() + off, buf.size() - off, MSG_NOSIGNAL);
+      if (n <= 0)
+        return;
+      off += n;
+    }
+  }
+
+  static bool read_all(int fd, char* buf, size_t len) {
+    size_t off = 0;
+    while (off < len) {
+      ssize_t n = read(fd, buf + off, len - off);
+      if (n <= 0)
+        return false;
+      off += n;
+    }
+    return true;
+  }
+
+  /* Reads one response frame; false if the server closed the connection */
+  static bool read_response(int fd, response_header& hdr, std::string& payload) {
+    if (!read_all(fd, (char*) &hdr, sizeof(hdr)))
+      return false;
+    payload.resize(hdr.length);
+    return read_all(fd, &payload[0], hdr.length);
+  }
+
+ protected:
+  packet_store* store_;
+  query_server* server_;
+  int port_;
+};
+
+TEST_F(QueryProtocolTest, FrameSize) {
+  std::string buf;
+  ASSERT_EQ(0U, frame_size<request_header>(buf.data(), buf.size(), 0));
+
+  append_request(buf, 1, REQUEST_PING, 0, 0, NULL, 0);
+  size_t ping = sizeof(request_header);
+  for (size_t len = 0; len < ping; len++)
+    ASSERT_EQ(0U, frame_size<request_header>(buf.data(), len, 0));
+  ASSERT_EQ(ping, frame_size<request_header>(buf.data(), buf.size(), 0));
+
+  // A header is not a frame until its payload has arrived
+  std::string exp = "src_port == 80";
+  append_request(buf, 2, REQUEST_CAST, AGGREGATE_COUNT, 0, exp.data(),
+                 exp.size());
+  size_t cast = sizeof(request_header) + exp.size();
+  for (size_t len = ping; len < ping + cast; len++)
+    ASSERT_EQ(0U, frame_size<request_header>(buf.data(), len, ping));
+  ASSERT_EQ(cast, frame_size<request_header>(buf.data(), buf.size(), ping));
+
+  // Trailing bytes of the next frame do not count
+  append_request(buf, 3, REQUEST_PING, 0, 0, NULL, 0);
+  ASSERT_EQ(cast, frame_size<request_header>(buf.data(), buf.size() - 1, ping));
+  ASSERT_EQ(0U, frame_size<request_header>(buf.data(), buf.size(), buf.size()));
+
+  // Lengths near the limits of the length field do not wrap
+  request_header hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.length = UINT32_MAX;
+  std::string huge((const char*) &hdr, sizeof(hdr));
+  huge.append(4096, 'x');
+  ASSERT_EQ(0U, frame_size<request_header>(huge.data(), huge.size(), 0));
+
+  std::string resp;
+  append_response(resp, 7, STATUS_OK, RESPONSE_MORE, "abc", 3);
+  ASSERT_EQ(sizeof(response_header) + 3,
+            frame_size<response_header>(resp.data(), resp.size(), 0));
+}
+
+TEST_F(QueryProtocolTest, PipelinedRequests) {
+  start_server();
+  int fd = connect_client();
+
+  std::string exp = "src_port == 80";
+  std::string buf;
+  append_request(buf, 1, REQUEST_PING, 0, 0, NULL, 0);
+  append_request(buf, 2, REQUEST_CAST, AGGREGATE_COUNT, 0, exp.data(),
+                 exp.size());
+  append_request(buf, 3, REQUEST_CAST, AGGREGATE_COUNT, 0, "((", 2);
+  append_request(buf, 4, REQUEST_PING, 0, 0, NULL, 0);
+  send_all(fd, buf);
+
+  response_header hdr;
+  std::string payload;
+  const uint32_t ids[] = { 1, 2, 3, 4 };
+  const uint8_t status[] = { STATUS_OK, STATUS_OK, STATUS_ERROR, STATUS_OK };
+  for (size_t i = 0; i < 4; i++) {
+    ASSERT_TRUE(read_response(fd, hdr, payload));
+    ASSERT_EQ(ids[i], hdr.id);
+    ASSERT_EQ(status[i], hdr.status);
+  }
+  close(fd);
+}
+
+TEST_F(QueryProtocolTest, OversizedRequest) {
+  start_server();
+  int fd = connect_client();
+
+  // A request of exactly the maximum size is executed
+  std::string buf;
+  std::string exp(QUERY_MAX_REQUEST_BYTES, ' ');
+  append_request(buf, 1, REQUEST_CAST, AGGREGATE_COUNT, 0, exp.data(),
+                 exp.size());
+  append_request(buf, 2, REQUEST_PING, 0, 0, NULL, 0);
+  send_all(fd, buf);
+
+  response_header hdr;
+  std::string payload;
+  ASSERT_TRUE(read_response(fd, hdr, payload));
+  ASSERT_EQ(1U, hdr.id);
+  ASSERT_TRUE(read_response(fd, hdr, payload));
+  ASSERT_EQ(2U, hdr.id);
+  ASSERT_EQ(STATUS_OK, hdr.status);
+
+  // A larger one is rejected from its header alone, and the connection is
+  // closed, since the requests that follow cannot be found
+  request_header big;
+  memset(&big, 0, sizeof(big));
+  big.length = QUERY_MAX_REQUEST_BYTES + 1;
+  big.id = 3;
+  big.type = REQUEST_CAST;
+  send_all(fd, std::string((const char*) &big, sizeof(big)));
+
+  ASSERT_TRUE(read_response(fd, hdr, payload));
+  ASSERT_EQ(3U, hdr.id);
+  ASSERT_EQ(STATUS_ERROR, hdr.status);
+  ASSERT_EQ("Request too large", payload);
+  ASSERT_FALSE(read_response(fd, hdr, payload));
+  close(fd);
+
+  // Other connections are unaffected
+  fd = connect_client();
+  buf.clear();
+  append_request(buf, 4, REQUEST_PING, 0, 0, NULL, 0);
+  send_all(fd, buf);
+  ASSERT_TRUE(read_response(fd, hdr, payload));
+  ASSERT_EQ(4U, hdr.id);
+  ASSERT_EQ(STATUS_OK, hdr.status);
+  close(fd);
+}
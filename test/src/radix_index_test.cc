@@ -0,0 +1,148 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <array>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "radixindex.h"
+
+using namespace ::slog;
+
+class RadixIndexTest : public testing::Test {
+ public:
+  typedef std::array<uint8_t, 16> key_type;
+
+  const size_t NUM_KEYS = 20000;
+  const size_t NUM_THREADS = 8;
+
+  /*
+   * Keys clustered in a few /64 networks, and in a few /56 and /48 networks
+   * around them, so that prefixes that end mid-byte, mid-word and on word
+   * boundaries all split the keys.
+   */
+  std::vector<key_type> make_keys() {
+    std::mt19937_64 rng(42);
+    std::vector<key_type> keys;
+    for (size_t i = 0; i < NUM_KEYS; i++) {
+      key_type key;
+      uint64_t r = rng();
+      key.fill(0);
+      key[0] = 0x20;
+      key[1] = 0x01;
+      key[5] = r % 3;           // /48 networks
+      key[6] = (r >> 8) % 5;    // /56 networks
+      key[7] = (r >> 16) % 7;   // /64 networks
+      for (size_t j = 8; j < 16; j++)
+        key[j] = (i % 4 == 0) ? (rng() & 0xFF) : (j == 15 ? i % 251 : 0);
+      keys.push_back(key);
+    }
+    return keys;
+  }
+
+  static bool matches(const key_type& key, const uint8_t* prefix,
+                      size_t prefix_bits) {
+    for (size_t b = 0; b < prefix_bits; b++) {
+      uint8_t bit = 0x80 >> (b % 8);
+      if ((key[b / 8] & bit) != (prefix[b / 8] & bit))
+        return false;
+    }
+    return true;
+  }
+
+  /* Scans a prefix and compares the values visited against a linear scan */
+  void expect_scan(__index16& idx, const std::vector<key_type>& keys,
+                   const key_type& prefix, size_t prefix_bits) {
+    std::vector<entry_list*> expected, actual;
+    for (const key_type& key : keys)
+      if (matches(key, prefix.data(), prefix_bits))
+        expected.push_back(idx.at(key.data()));
+    std::sort(expected.begin(), expected.end());
+    expected.erase(std::unique(expected.begin(), expected.end()),
+                   expected.end());
+
+    idx.prefix_scan(prefix.data(), prefix_bits, [&actual](entry_list* list) {
+      actual.push_back(list);
+    });
+    std::sort(actual.begin(), actual.end());
+    ASSERT_EQ(expected.size(), actual.size()) << "prefix length "
+                                              << prefix_bits;
+    ASSERT_TRUE(expected == actual) << "prefix length " << prefix_bits;
+  }
+};
+
+TEST_F(RadixIndexTest, AddAndLookup) {
+  __index16 idx;
+  std::vector<key_type> keys = make_keys();
+  for (size_t i = 0; i < keys.size(); i++)
+    idx.add_entry(keys[i].data(), i);
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    entry_list* list = idx.at(keys[i].data());
+    ASSERT_TRUE(list != NULL);
+    bool found = false;
+    for (size_t j = 0; j < list->size(); j++)
+      found = found || list->get(j) == i;
+    ASSERT_TRUE(found);
+  }
+
+  key_type missing = keys[0];
+  missing[15] ^= 0xFF;
+  missing[8] ^= 0x5A;
+  ASSERT_TRUE(idx.at(missing.data()) == NULL);
+  missing = keys[0];
+  missing[0] = 0xFE;
+  ASSERT_TRUE(idx.at(missing.data()) == NULL);
+}
+
+TEST_F(RadixIndexTest, PartialBytePrefixScan) {
+  __index16 idx;
+  std::vector<key_type> keys = make_keys();
+  for (size_t i = 0; i < keys.size(); i++)
+    idx.add_entry(keys[i].data(), i);
+
+  const size_t lengths[] = { 0, 1, 3, 15, 16, 45, 46, 47, 48, 53, 55, 56, 61,
+                             63, 64, 65, 67, 71, 72, 100, 127, 128 };
+  for (size_t k = 0; k < keys.size(); k += keys.size() / 7) {
+    for (size_t prefix_bits : lengths)
+      expect_scan(idx, keys, keys[k], prefix_bits);
+  }
+
+  // Bits past the prefix length are ignored
+  key_type prefix = keys[3];
+  prefix[5] |= 0x0F;
+  expect_scan(idx, keys, prefix, 44);
+  prefix = keys[3];
+  prefix[9] ^= 0x3F;
+  expect_scan(idx, keys, prefix, 66);
+}
+
+TEST_F(RadixIndexTest, ConcurrentInsert) {
+  __index16 idx;
+  std::vector<key_type> keys = make_keys();
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < NUM_THREADS; t++) {
+    threads.push_back(std::thread([&idx, &keys, t, this] {
+      for (size_t i = 0; i < keys.size(); i++)
+        idx.add_entry(keys[(i + t * 997) % keys.size()].data(),
+                      t * keys.size() + i);
+    }));
+  }
+  for (auto& th : threads)
+    th.join();
+
+  // Each key has a single list, with one entry per thread and occurrence
+  std::vector<key_type> distinct = keys;
+  std::sort(distinct.begin(), distinct.end());
+  uint64_t total = 0;
+  idx.prefix_scan(keys[0].data(), 0, [&total](entry_list* list) {
+    total += list->size();
+  });
+  ASSERT_EQ(NUM_THREADS * keys.size(), total);
+  for (const key_type& key : keys) {
+    size_t occurrences = std::upper_bound(distinct.begin(), distinct.end(), key)
+        - std::lower_bound(distinct.begin(), distinct.end(), key);
+    ASSERT_EQ(NUM_THREADS * occurrences, idx.at(key.data())->size());
+  }
+}
@@ -0,0 +1,74 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <unordered_set>
+
+#include "result_cache.h"
+
+using namespace ::netplay;
+
+class ResultCacheTest : public testing::Test {
+ public:
+  /* Size of a uint64_t result with a single character key */
+  const size_t ENTRY_BYTES = 1 + sizeof(uint64_t);
+};
+
+TEST_F(ResultCacheTest, HitsReturnTheCoveredRecords) {
+  result_cache cache;
+  uint64_t result, max_rid;
+  ASSERT_FALSE(cache.lookup("a", result, max_rid));
+
+  cache.insert("a", (uint64_t) 10, 100);
+  ASSERT_TRUE(cache.lookup("a", result, max_rid));
+  ASSERT_EQ(10U, result);
+  ASSERT_EQ(100U, max_rid);
+
+  // A result covering more records replaces the entry, but not one covering
+  // fewer
+  cache.insert("a", (uint64_t) 15, 150);
+  cache.insert("a", (uint64_t) 12, 120);
+  ASSERT_TRUE(cache.lookup("a", result, max_rid));
+  ASSERT_EQ(15U, result);
+  ASSERT_EQ(150U, max_rid);
+  ASSERT_EQ(1U, cache.num_entries());
+  ASSERT_EQ(ENTRY_BYTES, cache.size_bytes());
+
+  ASSERT_EQ(2U, cache.stats().hits.load());
+  ASSERT_EQ(1U, cache.stats().misses.load());
+}
+
+TEST_F(ResultCacheTest, EvictsLeastRecentlyUsed) {
+  result_cache cache(3 * ENTRY_BYTES);
+  uint64_t result, max_rid;
+  cache.insert("a", (uint64_t) 1, 10);
+  cache.insert("b", (uint64_t) 2, 10);
+  cache.insert("c", (uint64_t) 3, 10);
+  ASSERT_TRUE(cache.lookup("a", result, max_rid));
+
+  // "b" is now the least recently used
+  cache.insert("d", (uint64_t) 4, 10);
+  ASSERT_EQ(3U, cache.num_entries());
+  ASSERT_EQ(3 * ENTRY_BYTES, cache.size_bytes());
+  ASSERT_FALSE(cache.lookup("b", result, max_rid));
+  ASSERT_TRUE(cache.lookup("a", result, max_rid));
+  ASSERT_TRUE(cache.lookup("c", result, max_rid));
+  ASSERT_TRUE(cache.lookup("d", result, max_rid));
+  ASSERT_EQ(1U, cache.stats().evictions.load());
+}
+
+TEST_F(ResultCacheTest, LargeResultsAreNotCached) {
+  result_cache cache(3 * ENTRY_BYTES);
+  std::unordered_set<uint64_t> ids = { 1, 2, 3, 4, 5 };
+  cache.insert("ids", ids, 10);
+  ASSERT_EQ(0U, cache.num_entries());
+
+  // Nor do they evict anything
+  cache.insert("a", (uint64_t) 1, 10);
+  cache.insert("ids", ids, 20);
+  ASSERT_EQ(1U, cache.num_entries());
+  ASSERT_EQ(0U, cache.stats().evictions.load());
+
+  cache.clear();
+  ASSERT_EQ(0U, cache.num_entries());
+  ASSERT_EQ(0U, cache.size_bytes());
+}
@@ -0,0 +1,96 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "rollup.h"
+
+using namespace ::netplay;
+
+class RollupTest : public testing::Test {
+ public:
+  struct counter {
+    std::atomic<uint64_t> n;
+
+    counter() {
+      n.store(0);
+    }
+  };
+
+  typedef time_rollup<counter> rollup_type;
+
+  /* Seconds [FIRST, LAST] each have one event */
+  const uint64_t FIRST = 3 * 3600 - 61;
+  const uint64_t LAST = 5 * 3600 + 61;
+
+  void SetUp() {
+    for (uint64_t ts = FIRST; ts <= LAST; ts++) {
+      counter* buckets[NUM_ROLLUP_LEVELS];
+      rollup_.get(ts, buckets);
+      for (size_t l = 0; l < NUM_ROLLUP_LEVELS; l++)
+        buckets[l]->n++;
+    }
+  }
+
+  /* Covers a range; returns the number of events, and the buckets visited */
+  uint64_t cover(uint64_t ts_beg, uint64_t ts_end, size_t& visited) {
+    uint64_t events = 0;
+    visited = 0;
+    rollup_.cover(ts_beg, ts_end, [&events, &visited](counter* c) {
+      events += c->n.load();
+      visited++;
+    });
+    return events;
+  }
+
+  uint64_t expected(uint64_t ts_beg, uint64_t ts_end) {
+    uint64_t beg = std::max(ts_beg, FIRST), end = std::min(ts_end, LAST);
+    return beg <= end ? end - beg + 1 : 0;
+  }
+
+ protected:
+  rollup_type rollup_;
+};
+
+TEST_F(RollupTest, AlignedRanges) {
+  size_t visited;
+  ASSERT_EQ(3600U, cover(3 * 3600, 4 * 3600 - 1, visited));
+  ASSERT_EQ(1U, visited);
+  ASSERT_EQ(60U, cover(4 * 3600 + 60, 4 * 3600 + 119, visited));
+  ASSERT_EQ(1U, visited);
+  ASSERT_EQ(1U, cover(4 * 3600, 4 * 3600, visited));
+  ASSERT_EQ(1U, visited);
+}
+
+TEST_F(RollupTest, UnalignedEdges) {
+  size_t visited;
+  // One second on either side of two whole hours
+  ASSERT_EQ(7202U, cover(3 * 3600 - 1, 5 * 3600, visited));
+  ASSERT_EQ(4U, visited);
+  // 59 seconds, 59 minutes, 59 seconds: the most probes a partial hour takes
+  ASSERT_EQ(3599U + 59U, cover(3 * 3600 + 1, 4 * 3600 + 58, visited));
+  ASSERT_EQ(59U + 59U + 59U, visited);
+  // Crossing a minute boundary without covering a whole minute
+  ASSERT_EQ(60U, cover(4 * 3600 + 30, 4 * 3600 + 89, visited));
+  ASSERT_EQ(60U, visited);
+}
+
+TEST_F(RollupTest, EmptyAndOutsideRanges) {
+  size_t visited;
+  ASSERT_EQ(0U, cover(4 * 3600 + 1, 4 * 3600, visited));
+  ASSERT_EQ(0U, visited);
+  ASSERT_EQ(0U, cover(LAST + 1, LAST + 7200, visited));
+  ASSERT_EQ(0U, visited);
+  ASSERT_EQ(0U, cover(0, FIRST - 1, visited));
+  ASSERT_EQ(0U, visited);
+  ASSERT_EQ(1U, cover(LAST, LAST + 3600, visited));
+  ASSERT_EQ(1U, cover(FIRST - 3600, FIRST, visited));
+}
+
+TEST_F(RollupTest, AllRanges) {
+  size_t visited;
+  for (uint64_t beg = FIRST - 2; beg <= LAST + 2; beg += 37)
+    for (uint64_t end = beg; end <= LAST + 2; end += 53)
+      ASSERT_EQ(expected(beg, end), cover(beg, end, visited))
+          << "range " << beg << "-" << end;
+}
@@ -0,0 +1,119 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "cast_builder.h"
+#include "character_builder.h"
+#include "sharded_packet_store.h"
+
+using namespace ::netplay;
+
+typedef aggregate::record_ids<attribute::packet_header> shard_id_list;
+
+class ShardedPacketStoreTest : public testing::Test {
+ public:
+  const size_t NUM_SHARDS = 3;
+
+  void SetUp() {
+    store_ = new sharded_packet_store(std::vector<int>(NUM_SHARDS, 0));
+  }
+
+  void TearDown() {
+    delete store_;
+  }
+
+  /*
+   * Insert num_pkts TCP packets into a shard, with destination port 80 + the
+   * shard id, and source ports cycling over 0-9
+   */
+  void insert_pkts(size_t shard, size_t num_pkts) {
+    std::vector<std::vector<unsigned char>> frames(num_pkts);
+    std::vector<unsigned char*> pkts(num_pkts);
+    std::vector<uint16_t> lens(num_pkts);
+    for (size_t i = 0; i < num_pkts; i++) {
+      std::vector<unsigned char>& f = frames[i];
+      f.assign(14 + 20 + 20, 0);
+      f[12] = 0x08;                    // IPv4
+      f[14] = 0x45;
+      f[14 + 9] = IPPROTO_TCP;
+      uint16_t sport = i % 10, dport = 80 + shard;  // As the indexes read them
+      memcpy(&f[34], &sport, 2);
+      memcpy(&f[36], &dport, 2);
+      pkts[i] = f.data();
+      lens[i] = f.size();
+    }
+    packet_store::handle* handle = store_->get_handle(shard);
+    for (size_t i = 0; i < num_pkts; i += 32) {
+      uint16_t cnt = std::min(num_pkts - i, (size_t) 32);
+      handle->insert_pktburst(&pkts[i], &lens[i], cnt);
+    }
+    delete handle;
+  }
+
+ protected:
+  sharded_packet_store* store_;
+};
+
+TEST_F(ShardedPacketStoreTest, CastsFanOutToEveryShard) {
+  // Writers insert into their own shards concurrently
+  std::vector<std::thread> writers;
+  for (size_t s = 0; s < NUM_SHARDS; s++)
+    writers.push_back(std::thread([this, s] { insert_pkts(s, 1000 * (s + 1)); }));
+  for (std::thread& t : writers)
+    t.join();
+  ASSERT_EQ(6000U, store_->num_pkts());
+
+  sharded_cast all = sharded_cast_builder(store_, "src_port == 3").build();
+  ASSERT_EQ(600U, all.execute<packet_store::packet_counter>());
+  sharded_cast one = sharded_cast_builder(store_, "dst_port == 81").build();
+  ASSERT_EQ(2000U, one.execute<packet_store::packet_counter>());
+  ASSERT_EQ(2000U, one.execute_cached<packet_store::packet_counter>());
+
+  std::vector<sharded_cast> batch = { all, one };
+  std::vector<size_t> counts =
+      sharded_cast::execute_batch<packet_store::packet_counter>(batch);
+  ASSERT_EQ(600U, counts[0]);
+  ASSERT_EQ(2000U, counts[1]);
+  ASSERT_EQ(5U, store_->stats().num_queries.load());  // One per merged result
+}
+
+TEST_F(ShardedPacketStoreTest, RecordIdsAreGlobal) {
+  for (size_t s = 0; s < NUM_SHARDS; s++)
+    insert_pkts(s, 100);
+
+  // Each record id names its shard, and the record within the shard
+  sharded_cast c = sharded_cast_builder(store_, "src_port == 3").build();
+  std::vector<uint64_t> ids = c.execute<shard_id_list>();
+  ASSERT_EQ(30U, ids.size());
+  std::vector<size_t> per_shard(NUM_SHARDS, 0);
+  for (uint64_t id : ids) {
+    size_t shard = id >> SHARD_ID_SHIFT;
+    uint64_t local = id & ((1ULL << SHARD_ID_SHIFT) - 1);
+    ASSERT_LT(shard, NUM_SHARDS);
+    ASSERT_EQ(3U, local % 10);
+    ASSERT_LT(local, 100U);
+    per_shard[shard]++;
+  }
+  ASSERT_EQ(std::vector<size_t>(NUM_SHARDS, 10), per_shard);
+}
+
+TEST_F(ShardedPacketStoreTest, CharactersAcrossShards) {
+  sharded_complex_character c =
+      sharded_character_builder(store_, "src_port == 3").build();
+  sharded_complex_character d =
+      sharded_character_builder(store_, "dst_port == 82").build();
+  ASSERT_EQ(c.id() + 1, d.id());
+  ASSERT_EQ(2U, store_->num_complex_characters());
+
+  for (size_t s = 0; s < NUM_SHARDS; s++)
+    insert_pkts(s, 100);
+  ASSERT_EQ(30U, c.execute<shard_id_list>(0, UINT32_MAX).size());
+  std::vector<uint64_t> ids = d.execute<shard_id_list>(0, UINT32_MAX);
+  ASSERT_EQ(100U, ids.size());
+  for (uint64_t id : ids)
+    ASSERT_EQ(2U, id >> SHARD_ID_SHIFT);
+  ASSERT_EQ(30U, store_->count_character(c.id(), 0, UINT32_MAX).pkts);
+}
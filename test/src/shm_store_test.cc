@@ -0,0 +1,165 @@
+#include "gtest/gtest.h"
+
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "cast_builder.h"
+#include "shm_store.h"
+
+extern char** environ;
+
+using namespace ::netplay;
+
+class ShmStoreTest : public testing::Test {
+ public:
+  static const uint64_t LAYOUT = 42;
+  static const size_t CAPACITY = 1UL << 20;
+
+  void SetUp() {
+    name_ = "/np_shm_test_" + std::to_string(getpid());
+    slog::shm_region::remove_stale(name_);
+  }
+
+  void TearDown() {
+    slog::shm_region::remove_stale(name_);
+  }
+
+  /*
+   * Run a step of the DISABLED_OtherProcess test in a new process, as another
+   * process would attach to the region: it maps nothing this one does. The
+   * process is spawned rather than forked, so that it does not have to
+   * account for the memory of this one.
+   *
+   * @return The exit status (0 if the step passed), or 128 + the signal that
+   * killed the process.
+   */
+  int in_other_process(const std::string& step) {
+    std::string filter = "--gtest_filter=ShmStoreTest.DISABLED_OtherProcess";
+    char* argv[] = { (char*) "np_test", (char*) filter.c_str(),
+        (char*) "--gtest_also_run_disabled_tests", NULL };
+    setenv("NP_SHM_TEST_REGION", name_.c_str(), 1);
+    setenv("NP_SHM_TEST_STEP", step.c_str(), 1);
+    pid_t pid;
+    int status;
+    if (posix_spawn(&pid, "/proc/self/exe", NULL, NULL, argv, environ) != 0
+        || waitpid(pid, &status, 0) != pid)
+      return -1;
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+  }
+
+  /* Frame i of those inserted into the shared store */
+  static std::vector<unsigned char> frame(size_t i) {
+    std::vector<unsigned char> f(14 + 20 + 20, 0);
+    f[12] = 0x08;                      // IPv4
+    f[14] = 0x45;
+    f[14 + 9] = IPPROTO_TCP;
+    f[14 + 19] = i;
+    uint16_t dport = i % 4 ? 443 : 80;  // As the indexes read it
+    memcpy(&f[36], &dport, 2);
+    return f;
+  }
+
+ protected:
+  std::string name_;
+};
+
+TEST_F(ShmStoreTest, AttachReadsPublishedRoot) {
+  slog::shm_region* region = slog::shm_region::create(name_, CAPACITY, LAYOUT);
+  uint64_t* root = (uint64_t*) region->allocate(sizeof(uint64_t), 8);
+  *root = 1234;
+  ASSERT_THROW(region->publish(&name_), std::invalid_argument);
+  region->publish(root);
+
+  ASSERT_EQ(0, in_other_process("root"));
+  // Readers need the same layout, and cannot write
+  ASSERT_EQ(0, in_other_process("layout"));
+  ASSERT_EQ(128 + SIGSEGV, in_other_process("write"));
+
+  delete region;
+  ASSERT_THROW(slog::shm_region::attach(name_, LAYOUT), std::runtime_error);
+}
+
+TEST_F(ShmStoreTest, LiveRegionsAreNotReplaced) {
+  slog::shm_region* region = slog::shm_region::create(name_, CAPACITY, LAYOUT);
+  ASSERT_FALSE(slog::shm_region::remove_stale(name_));
+  ASSERT_THROW(slog::shm_region::create(name_, CAPACITY, LAYOUT,
+                                        SLOG_SHM_DEFAULT_BASE + CAPACITY),
+               std::runtime_error);
+  delete region;
+}
+
+TEST_F(ShmStoreTest, StaleRegionsAreReplaced) {
+  ASSERT_EQ(0, in_other_process("create"));
+
+  slog::shm_region* region = slog::shm_region::create(name_, CAPACITY, LAYOUT);
+  ASSERT_EQ(NULL, region->root());
+  ASSERT_EQ((size_t) SLOG_SHM_HEADER_SIZE, region->used());
+  delete region;
+}
+
+TEST_F(ShmStoreTest, ReaderQueriesSharedStore) {
+  slog::shm_region* region = slog::shm_region::create(name_, 64UL << 30,
+                                                      shm_store::fingerprint());
+  slog::allocator::share(region);
+  packet_store* store = new packet_store();
+  packet_store::handle* handle = store->get_handle();
+  std::vector<std::vector<unsigned char>> frames;
+  std::vector<unsigned char*> pkts;
+  std::vector<uint16_t> lens;
+  for (size_t i = 0; i < 100; i++)
+    frames.push_back(frame(i));
+  for (auto& f : frames) {
+    pkts.push_back(f.data());
+    lens.push_back(f.size());
+  }
+  handle->insert_pktburst(pkts.data(), lens.data(), pkts.size());
+  shm_store::publish(region, store);
+
+  ASSERT_EQ(0, in_other_process("store"));
+
+  delete handle;
+  delete store;
+  slog::allocator::share(NULL);
+  delete region;
+}
+
+/* The steps that in_other_process runs */
+TEST_F(ShmStoreTest, DISABLED_OtherProcess) {
+  const char* name = getenv("NP_SHM_TEST_REGION");
+  std::string step = getenv("NP_SHM_TEST_STEP");
+
+  if (step == "root") {
+    slog::shm_region* r = slog::shm_region::attach(name, LAYOUT);
+    ASSERT_NE(nullptr, r->root());
+    ASSERT_EQ(1234U, *(const uint64_t*) r->root());
+    delete r;
+  } else if (step == "layout") {
+    ASSERT_THROW(slog::shm_region::attach(name, LAYOUT + 1), std::runtime_error);
+  } else if (step == "write") {
+    slog::shm_region* r = slog::shm_region::attach(name, LAYOUT);
+    *(uint64_t*) r->root() = 0;
+    delete r;
+  } else if (step == "create") {
+    // Exits without removing the region
+    slog::shm_region::create(name, CAPACITY, LAYOUT);
+  } else if (step == "store") {
+    shm_store_reader reader(name);
+    ASSERT_EQ(100U, reader.num_pkts());
+    sharded_cast c = sharded_cast_builder(reader.store(), "dst_port == 80").build();
+    ASSERT_EQ(25U, c.execute<packet_store::packet_counter>());
+    packet_view view;
+    std::vector<unsigned char> f = frame(4);
+    ASSERT_TRUE(reader.view_pkt(view, 4));
+    ASSERT_EQ(f.size(), view.length);
+    ASSERT_EQ(0, memcmp(f.data(), view.data, view.length));
+  } else {
+    FAIL() << step;
+  }
+}
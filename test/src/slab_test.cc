@@ -0,0 +1,66 @@
+#include "gtest/gtest.h"
+
+#include <unistd.h>
+
+#include <string>
+
+#include "entrylist.h"
+
+using namespace ::slog;
+
+class SlabTest : public testing::Test {
+ public:
+  void SetUp() {
+    name_ = "/np_slab_test_" + std::to_string(getpid());
+    shm_region::remove_stale(name_);
+    region_ = shm_region::create(name_, 64UL << 20, 0);
+  }
+
+  void TearDown() {
+    allocator::share(NULL);
+    delete region_;
+  }
+
+ protected:
+  std::string name_;
+  shm_region* region_;
+};
+
+TEST_F(SlabTest, FreeListsPerSource) {
+  // A heap object on the free list is not reused once allocations are shared
+  slab::delete_object(slab::new_object<entry_list>());
+  allocator::share(region_);
+  entry_list* shared = slab::new_object<entry_list>();
+  ASSERT_TRUE(region_->contains(shared));
+
+  // Nor is a shared object reused for private allocations
+  slab::delete_object(shared);
+  allocator::share(NULL);
+  entry_list* priv = slab::new_object<entry_list>();
+  ASSERT_FALSE(region_->contains(priv));
+  slab::delete_object(priv);
+
+  // Objects are reused within their source
+  allocator::share(region_);
+  entry_list* reused = slab::new_object<entry_list>();
+  ASSERT_EQ(shared, reused);
+  slab::delete_object(reused);
+}
+
+TEST_F(SlabTest, SharedSlabDroppedWithRegion) {
+  allocator::share(region_);
+  entry_list* old = slab::new_object<entry_list>();
+  slab::delete_object(old);
+  allocator::share(NULL);
+  delete region_;
+
+  // A new region, at the same address, hands out its own memory
+  region_ = shm_region::create(name_, 64UL << 20, 0);
+  allocator::share(region_);
+  size_t used = region_->used();
+  entry_list* obj = slab::new_object<entry_list>();
+  ASSERT_TRUE(region_->contains(obj));
+  ASSERT_LT(used, region_->used());
+  ASSERT_LE((char*) region_->base() + used, (char*) obj);
+  slab::delete_object(obj);
+}
@@ -0,0 +1,94 @@
+#include "gtest/gtest.h"
+
+#include <map>
+#include <random>
+
+#include "top_k.h"
+
+using namespace ::netplay;
+
+class TopKTest : public testing::Test {
+ public:
+  const size_t CAPACITY = 100;
+
+  /* A skewed stream: key k occurs about 1 / (k + 1) as often as key 0 */
+  static std::vector<uint32_t> stream(size_t n, uint32_t num_keys,
+                                      unsigned seed) {
+    std::vector<double> weights;
+    for (uint32_t k = 0; k < num_keys; k++)
+      weights.push_back(1.0 / (k + 1));
+    std::mt19937 gen(seed);
+    std::discrete_distribution<uint32_t> dist(weights.begin(), weights.end());
+    std::vector<uint32_t> keys;
+    for (size_t i = 0; i < n; i++)
+      keys.push_back(dist(gen));
+    return keys;
+  }
+
+  /* Check the Space-Saving guarantees against the true frequencies */
+  static void check_bounds(const space_saving<uint32_t>& sketch,
+                           const std::map<uint32_t, uint64_t>& truth) {
+    uint64_t bound = sketch.total() / sketch.capacity();
+    ASSERT_LE(sketch.error_bound(), bound);
+    std::vector<space_saving<uint32_t>::counter> top = sketch.top(sketch.size());
+    std::map<uint32_t, uint64_t> counted;
+    for (auto& c : top) {
+      uint64_t freq = truth.count(c.key) ? truth.at(c.key) : 0;
+      ASSERT_GE(c.count, freq) << c.key;
+      ASSERT_LE(c.count - c.error, freq) << c.key;
+      ASSERT_LE(c.count - freq, bound) << c.key;
+      counted[c.key] = c.count;
+    }
+    for (auto& t : truth) {
+      if (t.second > bound)
+        ASSERT_EQ(1U, counted.count(t.first)) << t.first;
+    }
+  }
+};
+
+TEST_F(TopKTest, ErrorBounds) {
+  std::vector<uint32_t> keys = stream(200000, 10000, 1);
+  space_saving<uint32_t> sketch(CAPACITY);
+  std::map<uint32_t, uint64_t> truth;
+  for (uint32_t k : keys) {
+    sketch.offer(k);
+    truth[k]++;
+  }
+  ASSERT_EQ(keys.size(), sketch.total());
+  ASSERT_EQ(CAPACITY, sketch.size());
+  check_bounds(sketch, truth);
+
+  // The heaviest keys come out on top, in order
+  std::vector<space_saving<uint32_t>::counter> top = sketch.top(3);
+  ASSERT_EQ(3U, top.size());
+  ASSERT_EQ(0U, top[0].key);
+  ASSERT_EQ(1U, top[1].key);
+  ASSERT_EQ(2U, top[2].key);
+}
+
+TEST_F(TopKTest, MergedErrorBounds) {
+  // Partial sketches over different streams, as of different writers
+  std::map<uint32_t, uint64_t> truth;
+  space_saving<uint32_t> merged(CAPACITY);
+  for (unsigned s = 0; s < 4; s++) {
+    space_saving<uint32_t> partial(CAPACITY);
+    for (uint32_t k : stream(50000, 10000 / (s + 1), s)) {
+      partial.offer(k + s);
+      truth[k + s]++;
+    }
+    merged.merge(partial);
+  }
+  ASSERT_EQ(200000U, merged.total());
+  check_bounds(merged, truth);
+}
+
+TEST_F(TopKTest, ExactBelowCapacity) {
+  space_saving<uint32_t> sketch(CAPACITY);
+  for (uint32_t k = 0; k < CAPACITY - 1; k++)
+    sketch.offer(k, k + 1);
+  ASSERT_EQ(0U, sketch.error_bound());
+  for (auto& c : sketch.top(CAPACITY)) {
+    ASSERT_EQ(c.key + 1, c.count);
+    ASSERT_EQ(0U, c.error);
+  }
+}